@@ -590,48 +590,6 @@ hnd_put_example_data(coap_context_t *ctx COAP_UNUSED,
 }
 
 #if SERVER_CAN_PROXY
-static int
-resolve_address(const coap_str_const_t *server, struct sockaddr *dst) {
-
-  struct addrinfo *res, *ainfo;
-  struct addrinfo hints;
-  static char addrstr[256];
-  int error, len=-1;
-
-  memset(addrstr, 0, sizeof(addrstr));
-  if (server->length)
-    memcpy(addrstr, server->s, server->length);
-  else
-    memcpy(addrstr, "localhost", 9);
-
-  memset ((char *)&hints, 0, sizeof(hints));
-  hints.ai_socktype = SOCK_DGRAM;
-  hints.ai_family = AF_UNSPEC;
-
-  error = getaddrinfo(addrstr, NULL, &hints, &res);
-
-  if (error != 0) {
-    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(error));
-    return error;
-  }
-
-  for (ainfo = res; ainfo != NULL; ainfo = ainfo->ai_next) {
-    switch (ainfo->ai_family) {
-    case AF_INET6:
-    case AF_INET:
-      len = (int)ainfo->ai_addrlen;
-      memcpy(dst, ainfo->ai_addr, len);
-      goto finish;
-    default:
-      ;
-    }
-  }
-
- finish:
-  freeaddrinfo(res);
-  return len;
-}
-
 #define MAX_USER 128 /* Maximum length of a user name (i.e., PSK
                       * identity) in bytes. */
 static unsigned char *user = NULL;
@@ -641,123 +599,6 @@ static coap_uri_t proxy = { {0, NULL}, 0, {0, NULL}, {0, NULL}, 0 };
 static size_t proxy_host_name_count = 0;
 static const char **proxy_host_name_list = NULL;
 
-typedef struct proxy_list_t {
-  coap_session_t *ongoing;  /* Ongoing session */
-  coap_session_t *incoming; /* Incoming session */
-  coap_binary_t *token;     /* Incoming token */
-  coap_string_t *query;     /* Incoming query */
-  coap_binary_t *body_data; /* Partial data received */
-} proxy_list_t;
-
-static proxy_list_t *proxy_list = NULL;
-static size_t proxy_list_count = 0;
-static coap_resource_t *proxy_resource = NULL;
-
-static int
-get_uri_proxy_scheme_info(coap_pdu_t *request,
-                          coap_opt_t *opt,
-                          coap_uri_t *uri,
-                          coap_string_t **uri_path,
-                          coap_string_t **uri_query) {
-
-  const char *opt_val = (const char*)coap_opt_value(opt);
-  int opt_len = coap_opt_length(opt);
-  coap_opt_iterator_t opt_iter;
-
-  if (opt_len == 9 &&
-      strncasecmp(opt_val, "coaps+tcp", 9) == 0) {
-    uri->scheme = COAP_URI_SCHEME_COAPS_TCP;
-    uri->port = COAPS_DEFAULT_PORT;
-  }
-  else if (opt_len == 8 &&
-      strncasecmp(opt_val, "coap+tcp", 8) == 0) {
-    uri->scheme = COAP_URI_SCHEME_COAP_TCP;
-    uri->port = COAP_DEFAULT_PORT;
-  }
-  else if (opt_len == 5 &&
-      strncasecmp(opt_val, "coaps", 5) == 0) {
-    uri->scheme = COAP_URI_SCHEME_COAPS;
-    uri->port = COAPS_DEFAULT_PORT;
-  }
-  else if (opt_len == 4 &&
-      strncasecmp(opt_val, "coap", 4) == 0) {
-    uri->scheme = COAP_URI_SCHEME_COAP;
-    uri->port = COAP_DEFAULT_PORT;
-  }
-  else {
-    coap_log(LOG_WARNING, "Unsupported Proxy Scheme '%*.*s'\n",
-             opt_len, opt_len, opt_val);
-    return 0;
-  }
-
-  opt = coap_check_option(request, COAP_OPTION_URI_HOST, &opt_iter);
-  if (opt) {
-    uri->host.length = coap_opt_length(opt);
-    uri->host.s = coap_opt_value(opt);
-  }
-  else {
-    coap_log(LOG_WARNING, "Proxy Scheme requires Uri-Host\n");
-    return 0;
-  }
-  opt = coap_check_option(request, COAP_OPTION_URI_PORT, &opt_iter);
-  if (opt) {
-    uri->port =
-          coap_decode_var_bytes (coap_opt_value (opt),
-                                 coap_opt_length (opt));
-  }
-  *uri_path = coap_get_uri_path(request);
-  if (*uri_path) {
-    uri->path.s = (*uri_path)->s;
-    uri->path.length = (*uri_path)->length;
-  }
-  *uri_query = coap_get_query(request);
-  if (*uri_query) {
-    uri->query.s = (*uri_query)->s;
-    uri->query.length = (*uri_query)->length;
-  }
-  return 1;
-}
-
-static int
-verify_proxy_scheme_supported(coap_uri_scheme_t scheme) {
-
-  /* Sanity check that the connection can be forwarded on */
-  switch (scheme) {
-  case COAP_URI_SCHEME_HTTP:
-  case COAP_URI_SCHEME_HTTPS:
-  coap_log(LOG_WARNING, "Proxy URI http or https not supported\n");
-    return 0;
-  case COAP_URI_SCHEME_COAP:
-    break;
-  case COAP_URI_SCHEME_COAPS:
-    if (!coap_dtls_is_supported()) {
-      coap_log(LOG_WARNING,
-        "coaps URI scheme not supported for proxy\n");
-      return 0;
-    }
-    break;
-  case COAP_URI_SCHEME_COAP_TCP:
-    if (!coap_tcp_is_supported()) {
-      coap_log(LOG_WARNING,
-        "coap+tcp URI scheme not supported for proxy\n");
-      return 0;
-    }
-    break;
-  case COAP_URI_SCHEME_COAPS_TCP:
-    if (!coap_tls_is_supported()) {
-      coap_log(LOG_WARNING,
-        "coaps+tcp URI scheme not supported for proxy\n");
-      return 0;
-    }
-    break;
-  default:
-      coap_log(LOG_WARNING,
-        "%d URI scheme not supported\n", scheme);
-    break;
-  }
-  return 1;
-}
-
 static coap_dtls_cpsk_t *
 setup_cpsk(char *client_sni) {
   static coap_dtls_cpsk_t dtls_cpsk;
@@ -772,169 +613,23 @@ setup_cpsk(char *client_sni) {
   return &dtls_cpsk;
 }
 
-static proxy_list_t *
-get_proxy_session(coap_session_t *session, coap_pdu_t *response,
-                  coap_binary_t *token, coap_string_t *query) {
-
-  size_t i;
-  proxy_list_t *new_proxy_list;
-
-  /* Locate existing forwarding relationship */
-  for (i = 0; i < proxy_list_count; i++) {
-    if (proxy_list[i].incoming == session) {
-      return &proxy_list[i];
-    }
-  }
-
-  /* Need to create a new forwarding mapping */
-  new_proxy_list = realloc(proxy_list, (i+1)*sizeof(proxy_list[0]));
-
-  if (new_proxy_list == NULL) {
-    coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
-    return NULL;
-  }
-  proxy_list = new_proxy_list;
-  proxy_list[i].incoming = session;
-  if (token) {
-    proxy_list[i].token = coap_new_binary(token->length);
-    if (!proxy_list[i].token) {
-      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
-      return NULL;
-    }
-    memcpy(proxy_list[i].token->s, token->s, token->length);
-  }
-  else
-    proxy_list[i].token = NULL;
-
-  if (query) {
-    proxy_list[i].query = coap_new_string(query->length);
-    if (!proxy_list[i].query) {
-      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
-      return NULL;
-    }
-    memcpy(proxy_list[i].query->s, query->s, query->length);
-  }
-  else
-    proxy_list[i].query = NULL;
-
-  proxy_list[i].body_data = NULL;
-  proxy_list[i].ongoing = NULL;
-  proxy_list_count++;
-  return &proxy_list[i];
-}
-
-static void
-remove_proxy_association(coap_session_t *session, int send_failure) {
-
-  size_t i;
-
-  for (i = 0; i < proxy_list_count; i++) {
-    if (proxy_list[i].incoming == session) {
-      coap_session_release(proxy_list[i].ongoing);
-      break;
-    }
-    if (proxy_list[i].ongoing == session && send_failure) {
-      coap_pdu_t *response;
-
-      coap_session_release(proxy_list[i].ongoing);
-
-      /* Need to send back a gateway failure */
-      response = coap_pdu_init(COAP_MESSAGE_NON,
-                               COAP_RESPONSE_CODE_BAD_GATEWAY,
-                               coap_new_message_id(proxy_list[i].incoming),
-                          coap_session_max_pdu_size(proxy_list[i].incoming));
-      if (!response) {
-        coap_log(LOG_INFO, "PDU creation issue\n");
-        return;
-      }
-
-      if (proxy_list[i].token &&
-          !coap_add_token(response, proxy_list[i].token->length,
-                          proxy_list[i].token->s)) {
-        coap_log(LOG_DEBUG,
-                       "Cannot add token to incoming proxy response PDU\n");
-      }
-
-      if (coap_send_large(proxy_list[i].incoming, response) ==
-                                                          COAP_INVALID_MID) {
-        coap_log(LOG_INFO, "Failed to send PDU with 5.02 gateway issue\n");
-      }
-      break;
-    }
-  }
-  if (i != proxy_list_count) {
-    coap_delete_binary(proxy_list[i].token);
-    coap_delete_string(proxy_list[i].query);
-    coap_delete_binary(proxy_list[i].body_data);
-    if (proxy_list_count-i > 1) {
-       memmove (&proxy_list[i],
-                &proxy_list[i+1],
-               (proxy_list_count-i-1) * sizeof (proxy_list[0]));
-    }
-    proxy_list_count--;
-  }
-}
-
-
 static coap_session_t *
-get_ongoing_proxy_session(coap_context_t *ctx, coap_session_t *session,
-                          coap_pdu_t *response, coap_binary_t *token,
-                          coap_string_t *query, coap_uri_t *uri) {
-
-  coap_address_t dst;
-  coap_uri_scheme_t scheme;
+proxy_session_handler(coap_context_t *ctx,
+                      const coap_address_t *server,
+                      coap_proto_t proto,
+                      const coap_str_const_t *host) {
   static char client_sni[256];
-  coap_str_const_t server;
-  uint16_t port = COAP_DEFAULT_PORT;
-  proxy_list_t *new_proxy_list;
-
-  new_proxy_list = get_proxy_session(session, response, token, query);
-  if (!new_proxy_list)
-    return NULL;
 
-  if (new_proxy_list->ongoing)
-    return new_proxy_list->ongoing;
-
-  coap_address_init(&dst);
-
-  if (proxy.host.length) {
-    server = proxy.host;
-    port = proxy.port;
-    scheme = proxy.scheme;
-  } else {
-    server = uri->host;
-    port = uri->port;
-    scheme = uri->scheme;
-  }
-  if (resolve_address(&server, &dst.addr.sa) < 0) {
-    coap_pdu_set_code(response, COAP_RESPONSE_CODE_BAD_GATEWAY);
-    remove_proxy_association(session, 0);
-    return NULL;
-  }
-  switch (dst.addr.sa.sa_family) {
-  case AF_INET:
-    dst.addr.sin.sin_port = ntohs(port);
-    break;
-  case AF_INET6:
-    dst.addr.sin6.sin6_port = ntohs(port);
-    break;
-  default:
-    break;
-  }
-  switch (scheme) {
-  case COAP_URI_SCHEME_COAP:
-  case COAP_URI_SCHEME_COAP_TCP:
-    new_proxy_list->ongoing =
-       coap_new_client_session(ctx, NULL, &dst,
-                               scheme == COAP_URI_SCHEME_COAP ?
-                                COAP_PROTO_UDP : COAP_PROTO_TCP);
-    break;
-  case COAP_URI_SCHEME_COAPS:
-  case COAP_URI_SCHEME_COAPS_TCP:
+  switch (proto) {
+  case COAP_PROTO_UDP:
+  case COAP_PROTO_TCP:
+    return coap_new_client_session(ctx, NULL, server, proto);
+  case COAP_PROTO_DTLS:
+  case COAP_PROTO_TLS:
     memset(client_sni, 0, sizeof(client_sni));
-    if ((server.length == 3 && memcmp(server.s, "::1", 3) != 0) ||
-        (server.length == 9 && memcmp(server.s, "127.0.0.1", 9) != 0))
-      memcpy(client_sni, server.s, min(server.length, sizeof(client_sni)-1));
+    if ((host->length == 3 && memcmp(host->s, "::1", 3) != 0) ||
+        (host->length == 9 && memcmp(host->s, "127.0.0.1", 9) != 0))
+      memcpy(client_sni, host->s, min(host->length, sizeof(client_sni)-1));
     else
       memcpy(client_sni, "localhost", 9);
 
@@ -942,277 +637,34 @@ get_ongoing_proxy_session(coap_context_t *ctx, coap_session_t *session,
       /* Use our defined PKI certs (or NULL)  */
       coap_dtls_pki_t *dtls_pki = setup_pki(ctx, COAP_DTLS_ROLE_CLIENT,
                                             client_sni);
-      new_proxy_list->ongoing =
-           coap_new_client_session_pki(ctx, NULL, &dst,
-                 scheme == COAP_URI_SCHEME_COAPS ?
-                  COAP_PROTO_DTLS : COAP_PROTO_TLS,
-                 dtls_pki);
+      return coap_new_client_session_pki(ctx, NULL, server, proto, dtls_pki);
     }
     else {
       /* Use our defined PSK */
       coap_dtls_cpsk_t *dtls_cpsk = setup_cpsk(client_sni);
 
-      new_proxy_list->ongoing =
-           coap_new_client_session_psk2(ctx, NULL, &dst,
-                 scheme == COAP_URI_SCHEME_COAPS ?
-                  COAP_PROTO_DTLS : COAP_PROTO_TLS,
-                 dtls_cpsk);
+      return coap_new_client_session_psk2(ctx, NULL, server, proto,
+                                          dtls_cpsk);
     }
-    break;
-  case COAP_URI_SCHEME_HTTP:
-  case COAP_URI_SCHEME_HTTPS:
+  case COAP_PROTO_NONE:
   default:
-    assert(0);
-    break;
-  }
-  if (new_proxy_list->ongoing == NULL) {
-    coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
-    remove_proxy_association(session, 0);
     return NULL;
   }
-  return new_proxy_list->ongoing;
-}
-
-static void
-release_proxy_body_data(coap_session_t *session COAP_UNUSED,
-                       void *app_ptr) {
-  coap_delete_binary(app_ptr);
 }
 
 static void
-hnd_proxy_uri(coap_context_t *ctx,
-                coap_resource_t *resource COAP_UNUSED,
+hnd_proxy_uri(coap_context_t *ctx COAP_UNUSED,
+                coap_resource_t *resource,
                 coap_session_t *session,
                 coap_pdu_t *request,
-                coap_binary_t *token,
-                coap_string_t *query,
+                coap_binary_t *token COAP_UNUSED,
+                coap_string_t *query COAP_UNUSED,
                 coap_pdu_t *response) {
-  coap_opt_iterator_t opt_iter;
-  coap_opt_t *opt;
-  coap_opt_t *proxy_uri;
-  int proxy_scheme_option = 0;
-  coap_uri_t uri;
-  coap_string_t *uri_path = NULL;
-  coap_string_t *uri_query = NULL;
-  coap_session_t *ongoing = NULL;
-  proxy_list_t *tmp_proxy_list;
-  size_t size;
-  size_t offset;
-  size_t total;
-  coap_binary_t *body_data = NULL;
-  const uint8_t *data;
-  coap_pdu_t *pdu;
-  coap_optlist_t *optlist = NULL;
-  coap_opt_t *option;
-  unsigned char portbuf[2];
-#define BUFSIZE 100
-  unsigned char _buf[BUFSIZE];
-  unsigned char *buf = _buf;
-  size_t buflen;
-  int res;
-
-  memset(&uri, 0, sizeof(uri));
-  /*
-   * See if Proxy-Scheme
-   */
-  opt = coap_check_option(request, COAP_OPTION_PROXY_SCHEME, &opt_iter);
-  if (opt) {
-    if (!get_uri_proxy_scheme_info(request, opt, &uri, &uri_path,
-                                   &uri_query)) {
-      coap_pdu_set_code(response,
-                             COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
-      goto cleanup;
-    }
-    proxy_scheme_option = 1;
-  }
   /*
-   * See if Proxy-Uri
+   * The library passes the response back to the client when it arrives,
+   * so there is nothing more to do here.
    */
-  proxy_uri = coap_check_option(request, COAP_OPTION_PROXY_URI, &opt_iter);
-  if (proxy_uri) {
-    coap_log(LOG_INFO, "Proxy URI '%.*s'\n",
-             coap_opt_length(proxy_uri),
-             (const char*)coap_opt_value(proxy_uri));
-    if (coap_split_proxy_uri(coap_opt_value(proxy_uri),
-                             coap_opt_length(proxy_uri),
-                             &uri) < 0) {
-      /* Need to return a 5.05 RFC7252 Section 5.7.2 */
-      coap_log(LOG_WARNING, "Proxy URI not decodable\n");
-      coap_pdu_set_code(response,
-                             COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
-      goto cleanup;
-    }
-  }
-
-  if (!(proxy_scheme_option || proxy_uri)) {
-    coap_pdu_set_code(response, COAP_RESPONSE_CODE_NOT_FOUND);
-    goto cleanup;
-  }
-
-  if (uri.host.length == 0) {
-    /* Ongoing connection not well formed */
-    coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
-    goto cleanup;
-  }
-
-  if (!verify_proxy_scheme_supported(uri.scheme)) {
-    coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
-    goto cleanup;
-  }
-
-  /* Handle the CoAP forwarding mapping */
-  if (uri.scheme == COAP_URI_SCHEME_COAP ||
-      uri.scheme == COAP_URI_SCHEME_COAPS ||
-      uri.scheme == COAP_URI_SCHEME_COAP_TCP ||
-      uri.scheme == COAP_URI_SCHEME_COAPS_TCP) {
-    coap_pdu_code_t req_code = coap_pdu_get_code(request);
-
-    tmp_proxy_list = get_proxy_session(session, response, token, query);
-    if (!tmp_proxy_list)
-      goto cleanup;
-    body_data = tmp_proxy_list->body_data;
-    /*
-     * Check if received is Block'd request - if so, re-assemble body from the
-     * payloads before passing everything on to the server
-     */
-    if (coap_get_data_large(request, &size, &data, &offset, &total) &&
-        size != total) {
-      body_data = coap_block_build_body(body_data, size, data, offset, total);
-      tmp_proxy_list->body_data = body_data;
-      if (!body_data) {
-        coap_log(LOG_DEBUG, "body build memory error\n");
-        goto cleanup;
-      }
-      if (offset + size != total) {
-        coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTINUE);
-        goto cleanup;
-      }
-      data = body_data->s;
-      size = body_data->length;
-      tmp_proxy_list->body_data = NULL;
-    }
-
-    /* Send data on (opening session if appropriate) now that it is all in */
-
-    ongoing = get_ongoing_proxy_session(ctx, session, response, token,
-                                        query, &uri);
-    /*
-     * Build up the ongoing PDU that we are going to send
-     */
-    pdu = coap_pdu_init(coap_pdu_get_type(request), req_code,
-                        coap_new_message_id(ongoing),
-                        coap_session_max_pdu_size(session));
-    if (!pdu) {
-      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
-      goto cleanup;
-    }
-
-    if (token && !coap_add_token(pdu, token->length, token->s)) {
-      coap_log(LOG_DEBUG, "cannot add token to proxy request\n");
-      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
-      coap_delete_pdu(pdu);
-      goto cleanup;
-    }
-
-    if (proxy.host.length) {   /* Use Proxy-Uri */
-      coap_insert_optlist(&optlist,
-                  coap_new_optlist(COAP_OPTION_PROXY_URI,
-                  coap_opt_length(proxy_uri),
-                  coap_opt_value(proxy_uri)));
-
-    }
-    else {      /* Use  Uri-Path and Uri-Query */
-      if (uri.port != (coap_uri_scheme_is_secure(&uri) ?
-           COAPS_DEFAULT_PORT : COAP_DEFAULT_PORT)) {
-        coap_insert_optlist(&optlist,
-                    coap_new_optlist(COAP_OPTION_URI_PORT,
-                             coap_encode_var_safe(portbuf, sizeof(portbuf),
-                                                  (uri.port & 0xffff)),
-                    portbuf));
-      }
-
-      if (uri.path.length) {
-        buflen = BUFSIZE;
-        if (uri.path.length > BUFSIZE)
-          coap_log(LOG_WARNING,
-                   "URI path will be truncated (max buffer %d)\n", BUFSIZE);
-        res = coap_split_path(uri.path.s, uri.path.length, buf, &buflen);
-
-        while (res--) {
-          coap_insert_optlist(&optlist,
-                      coap_new_optlist(COAP_OPTION_URI_PATH,
-                      coap_opt_length(buf),
-                      coap_opt_value(buf)));
-
-          buf += coap_opt_size(buf);
-        }
-      }
-
-      if (uri.query.length) {
-        buflen = BUFSIZE;
-        buf = _buf;
-        res = coap_split_query(uri.query.s, uri.query.length, buf, &buflen);
-
-        while (res--) {
-          coap_insert_optlist(&optlist,
-                      coap_new_optlist(COAP_OPTION_URI_QUERY,
-                      coap_opt_length(buf),
-                      coap_opt_value(buf)));
-
-          buf += coap_opt_size(buf);
-        }
-      }
-    }
-
-    /* Copy the remaining options across */
-    coap_option_iterator_init(request, &opt_iter, COAP_OPT_ALL);
-    while ((option = coap_option_next(&opt_iter))) {
-      switch (opt_iter.number) {
-      case COAP_OPTION_PROXY_URI:
-      case COAP_OPTION_PROXY_SCHEME:
-      case COAP_OPTION_URI_PATH:
-      case COAP_OPTION_URI_PORT:
-      case COAP_OPTION_URI_QUERY:
-        /* Skip those potentially already added */
-        break;
-      case COAP_OPTION_BLOCK1:
-      case COAP_OPTION_BLOCK2:
-        /* These are not passed on */
-        break;
-      default:
-        coap_insert_optlist(&optlist,
-                    coap_new_optlist(opt_iter.number,
-                    coap_opt_length(option),
-                    coap_opt_value(option)));
-        break;
-      }
-    }
-
-    /* Update pdu with options */
-    coap_add_optlist_pdu(pdu, &optlist);
-    coap_delete_optlist(optlist);
-
-    if (size) {
-      if (!coap_add_data_large_request(session, pdu, size, data,
-                                       release_proxy_body_data, body_data)) {
-        coap_log(LOG_DEBUG, "cannot add data to proxy request\n");
-      }
-    }
-
-    if (coap_get_log_level() < LOG_DEBUG)
-      coap_show_pdu(LOG_INFO, pdu);
-
-    coap_send_large(ongoing, pdu);
-    goto cleanup;
-  }
-  else {
-    /* TODO http & https */
-    coap_log(LOG_ERR, "Proxy-Uri scheme %d unknown\n", uri.scheme);
-  }
-cleanup:
-  coap_delete_string(uri_path);
-  coap_delete_string(uri_query);
-  coap_delete_binary(body_data);
+  coap_proxy_forward_request(session, request, response, resource);
 }
 
 #endif /* SERVER_CAN_PROXY */
@@ -1577,172 +1029,6 @@ hnd_unknown_put(coap_context_t *ctx,
   hnd_put(ctx, r, session, request, token, query, response);
 }
 
-#if SERVER_CAN_PROXY
-static int
-proxy_event_handler(coap_context_t *ctx COAP_UNUSED,
-              coap_event_t event,
-              coap_session_t *session) {
-
-  switch(event) {
-  case COAP_EVENT_DTLS_CLOSED:
-  case COAP_EVENT_TCP_CLOSED:
-  case COAP_EVENT_SESSION_CLOSED:
-    /* Need to remove any proxy associations */
-    remove_proxy_association(session, 0);
-    break;
-  default:
-    break;
-  }
-  return 0;
-}
-
-static coap_response_t
-proxy_message_handler(coap_context_t *ctx COAP_UNUSED,
-                coap_session_t *session,
-                coap_pdu_t *sent COAP_UNUSED,
-                coap_pdu_t *received,
-                const coap_mid_t id COAP_UNUSED) {
-
-  coap_pdu_t *pdu = NULL;
-  coap_session_t *incoming = NULL;
-  size_t i;
-  size_t size;
-  const uint8_t *data;
-  coap_optlist_t *optlist = NULL;
-  coap_opt_t *option;
-  coap_opt_iterator_t opt_iter;
-  size_t offset;
-  size_t total;
-  proxy_list_t *proxy_entry = NULL;
-  uint16_t media_type = COAP_MEDIATYPE_TEXT_PLAIN;
-  int maxage = -1;
-  uint64_t etag = 0;
-  coap_pdu_code_t rcv_code = coap_pdu_get_code(received);
-  coap_bin_const_t rcv_token = coap_pdu_get_token(received);
-
-  for (i = 0; i < proxy_list_count; i++) {
-    if (proxy_list[i].ongoing == session) {
-      proxy_entry = &proxy_list[i];
-      incoming = proxy_entry->incoming;
-      break;
-    }
-  }
-  if (i == proxy_list_count) {
-    coap_log(LOG_DEBUG, "Unknown proxy ongoing session response received\n");
-    return COAP_RESPONSE_OK;
-  }
-
-  coap_log(LOG_DEBUG, "** process upstream incoming %d.%02d response:\n",
-           COAP_RESPONSE_CLASS(rcv_code), rcv_code & 0x1F);
-  if (coap_get_log_level() < LOG_DEBUG)
-    coap_show_pdu(LOG_INFO, received);
-
-  /*
-   * Check if received is Block'd response - if so, re-assemble body from the
-   * payloads before passing everything back to the client
-   */
-  if (coap_get_data_large(received, &size, &data, &offset, &total) &&
-      size != total) {
-    proxy_entry->body_data = coap_block_build_body(proxy_entry->body_data,
-    size, data, offset, total);
-    if (!proxy_entry->body_data) {
-      coap_log(LOG_DEBUG, "body build memory error\n");
-      return COAP_RESPONSE_OK;
-    }
-    if (offset + size != total)
-      return COAP_RESPONSE_OK;
-    data = proxy_entry->body_data->s;
-    size = proxy_entry->body_data->length;
-  }
-
-  /*
-   * Build up the ongoing PDU that we are going to send to proxy originator
-   */
-  pdu = coap_pdu_init(coap_pdu_get_type(received), rcv_code,
-                      coap_new_message_id(incoming),
-                      coap_session_max_pdu_size(incoming));
-  if (!pdu) {
-    coap_log(LOG_DEBUG, "Failed to create ongoing proxy response PDU\n");
-    return COAP_RESPONSE_OK;
-  }
-
-  if (!coap_add_token(pdu, rcv_token.length, rcv_token.s)) {
-    coap_log(LOG_DEBUG, "cannot add token to ongoing proxy response PDU\n");
-  }
-
-  /*
-   * Copy the options across, skipping those needed for
-   * coap_add_data_response_large()
-   */
-  coap_option_iterator_init(received, &opt_iter, COAP_OPT_ALL);
-  while ((option = coap_option_next(&opt_iter))) {
-    switch (opt_iter.number) {
-    case COAP_OPTION_CONTENT_FORMAT:
-      media_type = coap_decode_var_bytes(coap_opt_value (option),
-                                         coap_opt_length (option));
-      break;
-    case COAP_OPTION_MAXAGE:
-      maxage = coap_decode_var_bytes(coap_opt_value (option),
-                                     coap_opt_length (option));
-      break;
-    case COAP_OPTION_ETAG:
-      etag = coap_decode_var_bytes8(coap_opt_value (option),
-                                    coap_opt_length (option));
-      break;
-    case COAP_OPTION_BLOCK2:
-    case COAP_OPTION_SIZE2:
-      break;
-    default:
-      coap_insert_optlist(&optlist,
-                  coap_new_optlist(opt_iter.number,
-                  coap_opt_length(option),
-                  coap_opt_value(option)));
-      break;
-    }
-  }
-  coap_add_optlist_pdu(pdu, &optlist);
-  coap_delete_optlist(optlist);
-
-  if (size > 0) {
-    coap_add_data_large_response(proxy_resource, incoming, NULL, pdu,
-                                 proxy_entry->token, proxy_entry->query,
-                                 media_type, maxage, etag, size, data,
-                                 release_proxy_body_data,
-                                 proxy_entry->body_data);
-    proxy_entry->body_data = NULL;
-  }
-
-  if (coap_get_log_level() < LOG_DEBUG)
-    coap_show_pdu(LOG_INFO, pdu);
-
-  coap_send_large(incoming, pdu);
-  return COAP_RESPONSE_OK;
-}
-
-static void
-proxy_nack_handler(coap_context_t *context COAP_UNUSED,
-             coap_session_t *session,
-             coap_pdu_t *sent COAP_UNUSED,
-             coap_nack_reason_t reason,
-             const coap_mid_t id COAP_UNUSED) {
-
-  switch(reason) {
-  case COAP_NACK_TOO_MANY_RETRIES:
-  case COAP_NACK_NOT_DELIVERABLE:
-  case COAP_NACK_RST:
-  case COAP_NACK_TLS_FAILED:
-    /* Need to remove any proxy associations */
-    remove_proxy_association(session, 1);
-    break;
-  case COAP_NACK_ICMP_ISSUE:
-  default:
-    break;
-  }
-  return;
-}
-
-#endif /* SERVER_CAN_PROXY */
-
 static void
 init_resources(coap_context_t *ctx) {
   coap_resource_t *r;
@@ -1799,10 +1085,9 @@ init_resources(coap_context_t *ctx) {
     r = coap_resource_proxy_uri_init(hnd_proxy_uri, proxy_host_name_count,
                                      proxy_host_name_list);
     coap_add_resource(ctx, r);
-    coap_register_event_handler(ctx, proxy_event_handler);
-    coap_register_response_handler(ctx, proxy_message_handler);
-    coap_register_nack_handler(ctx, proxy_nack_handler);
-    proxy_resource = r;
+    coap_register_proxy_session_handler(ctx, proxy_session_handler);
+    if (proxy.host.length)
+      coap_context_set_proxy_next_hop(ctx, &proxy);
   }
 #endif /* SERVER_CAN_PROXY */
 }
@@ -2162,7 +1447,7 @@ usage( const char *program, const char *version) {
   }
   fprintf(stderr, "\n"
      "Usage: %s [-d max] [-e] [-g group] [-G group_if] [-l loss] [-p port]\n"
-     "\t\t[-v num] [-A address] [-L value] [-N]\n"
+     "\t\t[-v num] [-A address] [-L value] [-N] [-T threads]\n"
      "\t\t[-P scheme://address[:port],name1[,name2..]]\n"
      "\t\t[[-h hint] [-i match_identity_file] [-k key]\n"
      "\t\t[-s match_psk_sni_file] [-u user]]\n"
@@ -2198,6 +1483,9 @@ usage( const char *program, const char *version) {
      "\t-N     \t\tMake \"observe\" responses NON-confirmable. Even if set\n"
      "\t       \t\tevery fifth response will still be sent as a confirmable\n"
      "\t       \t\tresponse (RFC 7641 requirement)\n"
+     "\t-T threads\tRun the DTLS handshakes on this number of worker\n"
+     "\t       \t\tthreads, so that the established sessions keep being\n"
+     "\t       \t\tserved meanwhile. Default is 0 (no worker threads)\n"
     , program);
   fprintf( stderr,
      "\t-P scheme://address[:port],name1[,name2[,name3..]]\tScheme, address,\n"
@@ -2615,6 +1903,7 @@ main(int argc, char **argv) {
   int opt;
   coap_log_t log_level = LOG_WARNING;
   unsigned wait_ms;
+  unsigned int handshake_threads = 0;
   coap_time_t t_last = 0;
   int coap_fd;
   fd_set m_readfds;
@@ -2632,7 +1921,7 @@ main(int argc, char **argv) {
 
   clock_offset = time(NULL);
 
-  while ((opt = getopt(argc, argv, "c:d:eg:G:h:i:j:J:k:l:mnp:s:u:v:A:C:L:M:NP:R:S:")) != -1) {
+  while ((opt = getopt(argc, argv, "c:d:eg:G:h:i:j:J:k:l:mnp:s:u:v:A:C:L:M:NP:R:S:T:")) != -1) {
     switch (opt) {
     case 'A' :
       strncpy(addr_str, optarg, NI_MAXHOST-1);
@@ -2741,6 +2030,9 @@ main(int argc, char **argv) {
       user_length = cmdline_read_user(optarg, &user, MAX_USER);
       break;
 #endif /* SERVER_CAN_PROXY */
+    case 'T':
+      handshake_threads = (unsigned int)strtoul(optarg, NULL, 10);
+      break;
     case 'v' :
       log_level = strtol(optarg, NULL, 10);
       break;
@@ -2760,6 +2052,8 @@ main(int argc, char **argv) {
 
   init_resources(ctx);
   coap_context_set_block_mode(ctx, block_mode);
+  if (handshake_threads)
+    coap_context_set_handshake_threads(ctx, handshake_threads);
 
   /* Define the options to ignore when setting up cache-keys */
   coap_cache_ignore_options(ctx, cache_ignore_options,
@@ -2904,14 +2198,6 @@ main(int argc, char **argv) {
   free(dynamic_entry);
   release_resource_data(NULL, example_data_value);
 #if SERVER_CAN_PROXY
-  for (i = 0; i < proxy_list_count; i++) {
-    coap_delete_binary(proxy_list[i].token);
-    coap_delete_string(proxy_list[i].query);
-    coap_delete_binary(proxy_list[i].body_data);
-  }
-  free(proxy_list);
-  proxy_list = NULL;
-  proxy_list_count = 0;
 #ifdef _WIN32
 #pragma warning( disable : 4090 )
 #endif
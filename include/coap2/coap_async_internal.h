@@ -35,8 +35,51 @@ struct coap_async_t {
   coap_session_t *session;         /**< transaction session */
   coap_pdu_t *pdu;                 /**< copy of request pdu */
   void* appdata;                   /** User definable data pointer */
+  UT_hash_handle hh;               /**< context's async_collapse */
+  coap_cache_key_t *cache_key;     /**< set if in async_collapse */
+  coap_resource_t *resource;       /**< resource, if in async_collapse */
+  struct coap_async_t *leader;     /**< async this request is collapsed
+                                        into */
+  struct coap_async_t *followers;  /**< requests collapsed into this one */
+  struct coap_async_t *f_next;     /**< leader's followers linkage */
 };
 
+/**
+ * Makes @p request, for a resource with COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS
+ * set, follow an identical request that is being handled asynchronously, if
+ * there is one.  A following request is registered as an async that does not
+ * trigger, and is sent a copy of the response to the request it follows.
+ *
+ * @param context  The current context.
+ * @param session  The session the request was received on.
+ * @param resource The resource the request is for.
+ * @param request  The received request.
+ *
+ * @return @c 1 if @p request follows another one and the handler is not to
+ *         be called, else @c 0.
+ */
+int coap_async_collapse_join(coap_context_t *context, coap_session_t *session,
+                             coap_resource_t *resource, coap_pdu_t *request);
+
+/**
+ * Called once the handler of a resource with
+ * COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS set has returned.  If the handler
+ * registered an async for @p request and left @p response empty, identical
+ * requests can now follow it.  If the handler has answered an async that
+ * has requests following it, they are sent a copy of @p response.
+ *
+ * @param context  The current context.
+ * @param session  The session the request was received on.
+ * @param resource The resource the request is for.
+ * @param request  The request passed to the handler.
+ * @param response The response generated by the handler.
+ */
+void coap_async_collapse_update(coap_context_t *context,
+                                coap_session_t *session,
+                                coap_resource_t *resource,
+                                coap_pdu_t *request,
+                                const coap_pdu_t *response);
+
 /**
  * Checks if there are any pending Async requests - if so, send them off.
  * Otherewise return the time remaining for the next Async to be triggered
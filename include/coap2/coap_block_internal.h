@@ -31,6 +31,37 @@ typedef enum {
   COAP_RECURSE_NO
 } coap_recurse_t;
 
+/**
+ * The SZX value that indicates BERT (Block-wise Extension for Reliable
+ * Transport) https://tools.ietf.org/html/rfc8323#section-6
+ */
+#define COAP_BERT_SZX 7
+
+/**
+ * The Max-Message-Size that the peer must exceed in its CSM before BERT
+ * is used for transmissions to the peer.
+ */
+#define COAP_BERT_BASE 1152
+
+/**
+ * Returns @c 1 if the peer of the reliable @p session has indicated in its
+ * CSM that it can handle BERT, else @c 0.
+ */
+#define COAP_SESSION_BERT(session) \
+  (COAP_PROTO_RELIABLE((session)->proto) && (session)->csm_bert_rem_support)
+
+/**
+ * Structure of Block options with BERT support.
+ */
+typedef struct {
+  unsigned int num;       /**< block number (in 1 << (szx + 4) units) */
+  unsigned int m:1;       /**< 1 if more blocks follow, 0 otherwise */
+  unsigned int szx:3;     /**< block size (0-6) */
+  unsigned int aszx:3;    /**< block size as in option (0-7 including BERT) */
+  unsigned int bert:1;    /**< Operating as BERT */
+  size_t chunk_size;      /**< payload size, > 1024 if BERT */
+} coap_block_b_t;
+
 struct coap_lg_range {
   uint32_t begin;
   uint32_t end;
@@ -69,12 +100,44 @@ typedef struct coap_l_block2_t {
   coap_time_t maxage_expire; /**< When this entry expires */
 } coap_l_block2_t;
 
+/**
+ * Structure to hold a large body (BLOCK2) that is shared between all the
+ * sessions in a context transmitting the same representation, as identified
+ * by resource, query, ETag and length.
+ */
+struct coap_lg_body_t {
+  struct coap_lg_body_t *next;
+  coap_resource_t *resource; /**< associated resource */
+  coap_string_t *query;  /**< Associated query for the resource */
+  uint64_t etag;         /**< ETag value */
+  coap_time_t maxage_expire; /**< When this entry can no longer be shared
+                                  or 0 if no Max-Age */
+  unsigned int ref;      /**< number of lg_xmit referencing this body */
+  uint8_t linked;        /**< Set if in context->lg_body and shareable */
+  const uint8_t *data;   /**< large data ptr */
+  size_t length;         /**< large data length */
+  coap_release_large_data_t release_func; /**< large data de-alloc function */
+  void *app_ptr;         /**< applicaton provided ptr for de-alloc function */
+};
+
+/**
+ * Hash key for the lg_xmit entries of a session.
+ */
+typedef struct coap_lg_xmit_key_t {
+  coap_resource_t *resource; /**< BLOCK2 resource or NULL for BLOCK1 */
+  uint32_t id;           /**< BLOCK1 bottom 32 bits of token or
+                              BLOCK2 hash of query */
+} coap_lg_xmit_key_t;
+
 /**
  * Structure to hold large body (many blocks) transmission information
  */
 struct coap_lg_xmit_t {
-  struct coap_lg_xmit_t *next;
-  uint8_t blk_size;      /**< large block transmission size */
+  UT_hash_handle hh;     /**< session lg_xmit hash, keyed on key */
+  coap_lg_xmit_key_t key; /**< hash key */
+  uint8_t blk_size;      /**< large block transmission size (SZX) which is
+                              COAP_BERT_SZX if BERT is in use */
+  size_t bert_size;      /**< BERT payload size per PDU (multiple of 1024) */
   uint16_t option;       /**< large block transmisson CoAP option */
   int last_block;        /**< last acknowledged block number */
   const uint8_t *data;   /**< large data ptr */
@@ -86,16 +149,17 @@ struct coap_lg_xmit_t {
   } b;
   coap_pdu_t pdu;        /**< skeletal PDU */
   coap_tick_t last_payload; /**< Last time MAX_PAYLOAD was sent or 0 */
-  coap_tick_t last_used; /**< Last time all data sent or 0 */
+  coap_tick_t last_used; /**< Last time data sent (BLOCK2) or 0 */
   coap_release_large_data_t release_func; /**< large data de-alloc function */
   void *app_ptr;         /**< applicaton provided ptr for de-alloc function */
+  coap_lg_body_t *body;  /**< shared body holding data (BLOCK2) or NULL */
 };
 
 /**
  * Structure to hold large body (many blocks) client receive information
  */
 struct coap_lg_crcv_t {
-  struct coap_lg_crcv_t *next;
+  UT_hash_handle hh;     /**< session lg_crcv hash, keyed on token */
   uint8_t observe[3];    /**< Observe data (if set) (only 24 bits) */
   uint8_t observe_length;/**< Length of observe data */
   uint8_t observe_set;   /**< Set if this is an observe receive PDU */
@@ -123,7 +187,7 @@ struct coap_lg_crcv_t {
  * Structure to hold large body (many blocks) server receive information
  */
 struct coap_lg_srcv_t {
-  struct coap_lg_srcv_t *next;
+  UT_hash_handle hh;     /**< session lg_srcv hash, keyed on uri_path */
   uint8_t observe[3];    /**< Observe data (if set) (only 24 bits) */
   uint8_t observe_length;/**< Length of observe data */
   uint8_t observe_set;   /**< Set if this is an observe receive PDU */
@@ -137,7 +201,7 @@ struct coap_lg_srcv_t {
   coap_binary_t *body_data; /**< Used for re-assembling entire body */
   size_t amount_so_far;  /**< Amount of data seen so far */
   coap_resource_t *resource; /**< associated resource */
-  coap_str_const_t *uri_path; /** set to uri_path if unknown resource */
+  coap_str_const_t *uri_path; /**< uri_path of the request */
   coap_rblock_t rec_blocks; /** < list of received blocks */
   uint8_t last_token[8]; /**< last used token */
   size_t last_token_length; /**< length of token */
@@ -146,6 +210,62 @@ struct coap_lg_srcv_t {
   uint16_t block_option; /**< Block option in use */
 };
 
+#define LG_XMIT_ADD(e, obj) \
+  HASH_ADD(hh, (e), key, sizeof((obj)->key), (obj))
+
+#define LG_XMIT_DELETE(e, obj) \
+  HASH_DELETE(hh, (e), (obj))
+
+#define LG_XMIT_ITER(e, el, rtmp) \
+  HASH_ITER(hh, (e), el, rtmp)
+
+#define LG_XMIT_FIND(e, k, res) {                      \
+    HASH_FIND(hh, (e), &(k), sizeof(k), (res));        \
+  }
+
+#define LG_CRCV_ADD(e, obj) \
+  HASH_ADD_KEYPTR(hh, (e), (obj)->token, (obj)->token_length, (obj))
+
+#define LG_CRCV_DELETE(e, obj) \
+  HASH_DELETE(hh, (e), (obj))
+
+#define LG_CRCV_ITER(e, el, rtmp) \
+  HASH_ITER(hh, (e), el, rtmp)
+
+#define LG_CRCV_FIND(e, k, klen, res) {                \
+    HASH_FIND(hh, (e), (k), (klen), (res));            \
+  }
+
+#define LG_SRCV_ADD(e, obj) \
+  HASH_ADD_KEYPTR(hh, (e), (obj)->uri_path->s, (obj)->uri_path->length, (obj))
+
+#define LG_SRCV_DELETE(e, obj) \
+  HASH_DELETE(hh, (e), (obj))
+
+#define LG_SRCV_ITER(e, el, rtmp) \
+  HASH_ITER(hh, (e), el, rtmp)
+
+#define LG_SRCV_FIND(e, k, res) {                      \
+    HASH_FIND(hh, (e), (k)->s, (k)->length, (res));    \
+  }
+
+/**
+ * Initializes @p block from @p pdu, the same as coap_get_block() but with
+ * the addition of BERT handling if @p session is a reliable session.
+ * A BERT option is reported with szx of 6 and aszx of COAP_BERT_SZX with
+ * chunk_size set to the amount of payload carried in @p pdu.
+ *
+ * @param session The session that @p pdu is associated with.
+ * @param pdu     The pdu to search for option @p number.
+ * @param number  The option number to search for (must be COAP_OPTION_BLOCK1
+ *                or COAP_OPTION_BLOCK2).
+ * @param block   The block structure to initilize.
+ *
+ * @return        @c 1 on success, @c 0 otherwise.
+ */
+int coap_get_block_b(const coap_session_t *session, coap_pdu_t *pdu,
+                     coap_option_num_t number, coap_block_b_t *block);
+
 coap_lg_crcv_t * coap_block_new_lg_crcv(coap_session_t *session,
                                         coap_pdu_t *pdu);
 
@@ -190,6 +310,35 @@ int coap_handle_response_get_block(coap_context_t *context,
 void coap_block_delete_lg_xmit(coap_session_t *session,
                                coap_lg_xmit_t *lg_xmit);
 
+coap_tick_t coap_block_check_lg_xmit_timeouts(coap_session_t *session,
+                                              coap_tick_t now);
+
+/**
+ * Expires any of the large transmits and receives of @p session that have
+ * timed out. The session's lg_expire is used so that the entries are only
+ * checked when at least one of them may have expired.
+ *
+ * @param session The session to check.
+ * @param now     The current time in ticks.
+ *
+ * @return The number of ticks until the next check is needed or
+ *         (coap_tick_t)-1 if there is nothing left to expire.
+ */
+coap_tick_t coap_block_check_lg_timeouts(coap_session_t *session,
+                                         coap_tick_t now);
+
+/**
+ * Removes all the shared large bodies associated with @p resource from
+ * @p context so that they are no longer used for new transmissions.
+ * Bodies still referenced by an active lg_xmit are released when the
+ * last lg_xmit is deleted.
+ *
+ * @param context  The context holding the shared bodies.
+ * @param resource The resource being deleted or NULL for all resources.
+ */
+void coap_block_unlink_lg_bodies(coap_context_t *context,
+                                 coap_resource_t *resource);
+
 /**
  * The function that does all the work for the coap_add_data_large*()
  * functions.
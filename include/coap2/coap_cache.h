@@ -30,6 +30,29 @@
  */
 typedef void (*coap_cache_app_data_free_callback_t)(void *data);
 
+/**
+ * Statistics of the cache-entries of a context, as returned by
+ * coap_cache_get_stats().
+ */
+typedef struct coap_cache_stats_t {
+  uint64_t hits;      /**< lookups that found a cache-entry */
+  uint64_t misses;    /**< lookups that did not */
+  uint64_t evictions; /**< cache-entries removed to keep within the size
+                           limit */
+  uint64_t expiries;  /**< cache-entries removed on their idle timeout or
+                           Max-Age expiring */
+  size_t entries;     /**< current number of cache-entries */
+  size_t bytes;       /**< current number of bytes used by the cache-entries */
+} coap_cache_stats_t;
+
+/**
+ * How cache-keys are derived, see coap_context_set_cache_key_mode().
+ */
+typedef enum coap_cache_key_mode_t {
+  COAP_CACHE_KEY_DIGEST, /**< SHA-256 digest from the (D)TLS library */
+  COAP_CACHE_KEY_FAST    /**< keyed 128-bit SipHash, verified on a match */
+} coap_cache_key_mode_t;
+
 typedef enum coap_cache_session_based_t {
   COAP_CACHE_NOT_SESSION_BASED,
   COAP_CACHE_IS_SESSION_BASED
@@ -193,6 +216,65 @@ void coap_cache_set_app_data(coap_cache_entry_t *cache_entry, void *data,
  */
 void *coap_cache_get_app_data(const coap_cache_entry_t *cache_entry);
 
+/**
+ * Sets the maximum number of bytes that the cache-entries of @p context may
+ * use, including the responses cached for resources created with
+ * COAP_RESOURCE_FLAGS_CACHE_RESPONSES.  When a new cache-entry would exceed
+ * this, the least recently used cache-entries are deleted.  A @p size of
+ * @c 0 means no limit.
+ *
+ * @param context The context to use.
+ * @param size    The maximum number of bytes to use.
+ */
+void coap_context_set_cache_size(coap_context_t *context, size_t size);
+
+/**
+ * Gets the maximum number of bytes that the cache-entries of @p context may
+ * use.
+ *
+ * @param context The context to use.
+ *
+ * @return The maximum number of bytes, or @c 0 if there is no limit.
+ */
+size_t coap_context_get_cache_size(const coap_context_t *context);
+
+/**
+ * Gets the statistics of the cache-entries of @p context.
+ *
+ * @param context The context to use.
+ * @param stats   Updated with the current statistics.
+ */
+void coap_cache_get_stats(const coap_context_t *context,
+                          coap_cache_stats_t *stats);
+
+/**
+ * Sets how the cache-keys of @p context are derived.  The default
+ * COAP_CACHE_KEY_DIGEST uses a SHA-256 digest (or coap_hash() for builds
+ * without (D)TLS support).  COAP_CACHE_KEY_FAST uses SipHash-2-4 with a
+ * 128-bit output and a random key, and keeps the hashed information with
+ * the cache-key so that a match can be checked for a collision.  It is
+ * much cheaper, which matters when every request is looked up, such as in a
+ * caching proxy.
+ *
+ * This should be set before any cache-entries are created, as any existing
+ * cache-entries are deleted when the mode is changed.
+ *
+ * @param context The context to use.
+ * @param mode    COAP_CACHE_KEY_DIGEST or COAP_CACHE_KEY_FAST.
+ */
+void coap_context_set_cache_key_mode(coap_context_t *context,
+                                     coap_cache_key_mode_t mode);
+
+/**
+ * Gets how the cache-keys of @p context are derived.
+ *
+ * @param context The context to use.
+ *
+ * @return COAP_CACHE_KEY_DIGEST or COAP_CACHE_KEY_FAST.
+ */
+coap_cache_key_mode_t
+coap_context_get_cache_key_mode(const coap_context_t *context);
+
 /** @} */
 
 #endif  /* COAP_CACHE_H */
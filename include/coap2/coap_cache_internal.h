@@ -24,13 +24,30 @@
  * @{
  */
 
+/**
+ * The maximum number of bytes that the cache-entries of a context may use
+ * once a resource with COAP_RESOURCE_FLAGS_CACHE_RESPONSES is added, unless
+ * coap_context_set_cache_size() has been called.  Otherwise there is no
+ * limit by default.  0 means no limit other than the memory pools of
+ * constrained platforms.
+ */
+#ifndef COAP_DEFAULT_CACHE_SIZE
+#if defined(WITH_CONTIKI) || defined(WITH_LWIP) || defined(RIOT_VERSION)
+#define COAP_DEFAULT_CACHE_SIZE 0
+#else /* ! WITH_CONTIKI && ! WITH_LWIP && ! RIOT_VERSION */
+#define COAP_DEFAULT_CACHE_SIZE (1024 * 1024)
+#endif /* ! WITH_CONTIKI && ! WITH_LWIP && ! RIOT_VERSION */
+#endif /* COAP_DEFAULT_CACHE_SIZE */
+
 /* Holds a digest in binary typically sha256 except for notls */
 typedef struct coap_digest_t {
   uint8_t key[32];
 } coap_digest_t;
 
 struct coap_cache_key_t {
-  uint8_t key[32];
+  uint8_t key[32];      /* Digest, or SipHash for COAP_CACHE_KEY_FAST */
+  coap_binary_t *data;  /* The hashed information for COAP_CACHE_KEY_FAST,
+                           used to verify a match, else NULL */
 };
 
 struct coap_cache_entry_t {
@@ -42,16 +59,90 @@ struct coap_cache_entry_t {
   coap_tick_t expire_ticks;
   unsigned int idle_timeout;
   coap_cache_app_data_free_callback_t callback;
+  coap_resource_t *resource;  /* Set if held in context->response_cache */
+  struct coap_cache_entry_t *lru_prev; /* context's cache_lru linkage */
+  struct coap_cache_entry_t *lru_next;
+  struct coap_cache_entry_t *exp_prev; /* context's cache_expire linkage, */
+  struct coap_cache_entry_t *exp_next; /* if expire_ticks is set */
+  size_t size;                /* Bytes accounted in context's cache_size */
 };
 
 /**
- * Expire coap_cache_entry_t entries
+ * Expire coap_cache_entry_t entries that have reached their idle timeout
+ * or Max-Age.  The entries are held in expiry order, so only those that
+ * have expired are looked at.
  *
  * Internal function.
  *
  * @param context The context holding the coap-entries to exire
+ * @param now     The current time in ticks.
+ *
+ * @return The tick time before the next entry expires, else 0 if there
+ *         are no entries with an expiry time.
+ */
+coap_tick_t coap_expire_cache_entries(coap_context_t *context, coap_tick_t now);
+
+/**
+ * Checks that a hash match of the cache-keys @p a and @p b is a real match,
+ * which with COAP_CACHE_KEY_FAST means comparing the hashed information.
+ *
+ * Internal function.
+ *
+ * @param a The first cache-key.
+ * @param b The second cache-key.
+ *
+ * @return @c 1 if the cache-keys match, else @c 0.
+ */
+int coap_cache_key_verify(const coap_cache_key_t *a,
+                          const coap_cache_key_t *b);
+
+/**
+ * Looks up the response to the GET or FETCH @p request for @p resource in
+ * the response cache of the context of @p session.  If one is found that
+ * has not reached its Max-Age, @p response (which only holds the token) is
+ * filled in from it, using 2.03 Valid if an ETag in @p request matches.
+ *
+ * Internal function.
+ *
+ * @param session  The session the request was received on.
+ * @param resource The resource with COAP_RESOURCE_FLAGS_CACHE_RESPONSES set.
+ * @param request  The received request.
+ * @param response The response to fill in.
+ *
+ * @return @c 1 if @p response has been filled in, else @c 0 and the request
+ *         handler needs to be called.
  */
-void coap_expire_cache_entries(coap_context_t *context);
+int coap_cache_response_lookup(coap_session_t *session,
+                               coap_resource_t *resource,
+                               const coap_pdu_t *request,
+                               coap_pdu_t *response);
+
+/**
+ * Adds the 2.05 @p response generated by the handler of @p resource for
+ * @p request to the response cache, to be used until its Max-Age expires.
+ * If an ETag in @p request matches the one in @p response, @p response is
+ * turned into 2.03 Valid.
+ *
+ * Internal function.
+ *
+ * @param session  The session the request was received on.
+ * @param resource The resource with COAP_RESOURCE_FLAGS_CACHE_RESPONSES set.
+ * @param request  The received request.
+ * @param response The response that is about to be sent.
+ */
+void coap_cache_response_store(coap_session_t *session,
+                               coap_resource_t *resource,
+                               const coap_pdu_t *request,
+                               coap_pdu_t *response);
+
+/**
+ * Removes all the cached responses of @p resource.
+ *
+ * Internal function.
+ *
+ * @param resource The resource that has changed or is being deleted.
+ */
+void coap_cache_invalidate_resource(coap_resource_t *resource);
 
 typedef void coap_digest_ctx_t;
 
@@ -104,6 +195,21 @@ int coap_digest_update(coap_digest_ctx_t *digest_ctx,
 int coap_digest_final(coap_digest_ctx_t *digest_ctx,
                       coap_digest_t *digest_buffer);
 
+/**
+ * Calculates the SipHash-2-4 keyed hash of @p in, with a 128-bit output.
+ * This is used for the COAP_CACHE_KEY_FAST cache-keys, and for the
+ * stateless DTLS cookies.
+ *
+ * Internal function.
+ *
+ * @param key   The 16 byte key.
+ * @param in    The data to hash.
+ * @param inlen The length of @p in.
+ * @param out   Updated with the 16 byte hash.
+ */
+void coap_siphash128(const uint8_t *key, const uint8_t *in, size_t inlen,
+                     uint8_t out[16]);
+
 /** @} */
 
 #endif /* COAP_CACHE_INTERNAL_H_ */
@@ -230,7 +230,8 @@ int coap_dtls_receive(coap_session_t *coap_session,
 
 /**
  * Handling client HELLO messages from a new candiate peer.
- * Note that session->tls is empty.
+ * Note that session->tls is empty.  If coap_dtls_hello_needs_cookie() is
+ * @c 1, the HELLO already carries a valid cookie.
  *
  * @param coap_session The CoAP session.
  * @param data      Encrypted datagram.
@@ -244,6 +245,57 @@ int coap_dtls_hello(coap_session_t *coap_session,
                     const uint8_t *data,
                     size_t data_len);
 
+/**
+ * Checks whether the library has to check the cookie of a ClientHello
+ * (see coap_dtls_cookie_verify()) before coap_dtls_hello() is called.
+ * Otherwise the DTLS library does its own stateless cookie exchange in
+ * coap_dtls_hello(), and the session is released if that returns @c 0.
+ *
+ * @return @c 1 if the library checks the cookie, else @c 0.
+ */
+int coap_dtls_hello_needs_cookie(void);
+
+/**
+ * Checks whether the library can run the DTLS handshake steps of
+ * coap_dtls_receive() on the worker threads of the context (see
+ * coap_handshake_offload()).
+ *
+ * @return @c 1 if the handshakes can be run by worker threads, else @c 0.
+ */
+int coap_dtls_can_offload_handshake(void);
+
+/** Number of seconds that a (D)TLS session can be resumed for */
+#ifndef COAP_DTLS_RESUME_LIFETIME
+#define COAP_DTLS_RESUME_LIFETIME (24 * 60 * 60)
+#endif
+/** Number of sessions a server keeps to resume by session ID */
+#ifndef COAP_DTLS_SESSION_CACHE_SIZE
+#define COAP_DTLS_SESSION_CACHE_SIZE 256
+#endif
+#define COAP_DTLS_TICKET_KEY_NAME_LENGTH 16
+
+/**
+ * A key that servers seal the session tickets (RFC 5077) they hand out
+ * with, so that clients can resume their sessions without the server
+ * keeping any state for them.
+ */
+typedef struct coap_dtls_ticket_key_t {
+  uint8_t name[COAP_DTLS_TICKET_KEY_NAME_LENGTH]; /**< named in the ticket */
+  uint8_t cipher_key[32];      /**< for AES-256-CBC */
+  uint8_t mac_key[32];         /**< for HMAC-SHA256 */
+} coap_dtls_ticket_key_t;
+
+/**
+ * Gets the state of the established (D)TLS client session, which a later
+ * session to the same server can be resumed from by the (D)TLS library.
+ *
+ * @param coap_session The CoAP session.
+ *
+ * @return The state in the format of the (D)TLS library, to be freed with
+ *         coap_delete_binary(), or @c NULL if the session cannot be resumed.
+ */
+coap_binary_t *coap_dtls_get_resume_state(coap_session_t *coap_session);
+
 /**
  * Get DTLS overhead over cleartext PDUs.
  *
@@ -253,6 +305,39 @@ int coap_dtls_hello(coap_session_t *coap_session,
  */
 unsigned int coap_dtls_get_overhead(coap_session_t *coap_session);
 
+/**
+ * Checks whether the library can serialise an established DTLS connection
+ * and restore it later (see coap_dtls_hibernate()).
+ *
+ * @return @c 1 if DTLS sessions can hibernate, else @c 0.
+ */
+int coap_dtls_can_hibernate(void);
+
+/**
+ * Serialises the state of the established DTLS connection of @p coap_session
+ * (keys, epoch, sequence numbers and replay window), and frees the library
+ * objects of the session.  On failure, the session is left unchanged.
+ *
+ * @param coap_session The CoAP session.
+ *
+ * @return The state in the format of the (D)TLS library, to be freed with
+ *         coap_delete_binary(), or @c NULL if it cannot be serialised.
+ */
+coap_binary_t *coap_dtls_hibernate(coap_session_t *coap_session);
+
+/**
+ * Restores the DTLS connection of @p coap_session from the @p state returned
+ * by coap_dtls_hibernate().
+ *
+ * @param coap_session The CoAP session.
+ * @param state        The serialised connection.
+ *
+ * @return Opaque handle to underlying TLS library object containing security
+ *         parameters for the session, or @c NULL on failure.
+ */
+void *coap_dtls_rehydrate(coap_session_t *coap_session,
+                          const coap_binary_t *state);
+
 /**
  * Create a new TLS client-side session.
  *
@@ -43,6 +43,7 @@ typedef struct coap_async_t coap_async_t;
 /*
  * Block handling information.
  */
+typedef struct coap_lg_body_t coap_lg_body_t;
 typedef struct coap_lg_xmit_t coap_lg_xmit_t;
 typedef struct coap_lg_crcv_t coap_lg_crcv_t;
 typedef struct coap_lg_srcv_t coap_lg_srcv_t;
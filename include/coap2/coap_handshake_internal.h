@@ -0,0 +1,206 @@
+/*
+ * coap_handshake_internal.h -- Worker threads for (D)TLS handshakes
+ *
+ * Copyright (C) 2021 The libcoap project
+ *
+ * This file is part of the CoAP library libcoap. Please see README for terms
+ * of use.
+ */
+
+/**
+ * @file coap_handshake_internal.h
+ * @brief CoAP (D)TLS handshake worker pool internal information
+ */
+
+#ifndef COAP_HANDSHAKE_INTERNAL_H_
+#define COAP_HANDSHAKE_INTERNAL_H_
+
+/**
+ * @defgroup handshake_internal Handshake Workers (Internal)
+ * Structures and functions for running the (D)TLS handshake steps of the
+ * sessions of a context on a pool of worker threads, so that the thread
+ * doing the network I/O keeps serving the established sessions.
+ *
+ * Only one step of a session is handed to the workers at a time.  Records
+ * that arrive for the session meanwhile are held back, and the records that
+ * the step sends are captured, so the socket and the session are only
+ * touched by the I/O thread.  The step's outcome is passed back to the I/O
+ * thread, which is woken up through a pipe that is polled along with the
+ * sockets of the context.
+ * @{
+ */
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE) && \
+    !defined(WITH_CONTIKI) && !defined(WITH_LWIP) && \
+    !defined(RIOT_VERSION) && !defined(_WIN32)
+#define COAP_HANDSHAKE_THREADS 1
+#else
+#define COAP_HANDSHAKE_THREADS 0
+#endif
+
+/**
+ * The maximum number of worker threads that a context can have (see
+ * coap_context_set_handshake_threads()).
+ */
+#ifndef COAP_HANDSHAKE_MAX_THREADS
+#define COAP_HANDSHAKE_MAX_THREADS 64
+#endif /* COAP_HANDSHAKE_MAX_THREADS */
+
+/**
+ * A (D)TLS record, as received for or sent by a handshake step.
+ */
+typedef struct coap_handshake_data_t {
+  struct coap_handshake_data_t *next;
+  size_t length;                /**< length of the record */
+  uint8_t *s;                   /**< the record (follows the structure) */
+} coap_handshake_data_t;
+
+typedef struct coap_handshake_job_t coap_handshake_job_t;
+
+/** The worker threads of a context, and their queues. */
+typedef struct coap_handshake_pool_t coap_handshake_pool_t;
+
+/**
+ * Runs the handshake step of @p job on a worker thread, feeding it the
+ * records in job->in.  The records that are consumed are removed from
+ * job->in; any that are left over (for example because the handshake has
+ * completed) are passed to coap_dtls_receive() once done has been called.
+ *
+ * @param job The handshake step to run.
+ *
+ * @return @c 1 if the handshake has completed, @c 0 if more records are
+ *         needed, or @c -1 if the handshake has failed.
+ */
+typedef int (*coap_handshake_run_t)(coap_handshake_job_t *job);
+
+/**
+ * Completes the handshake step of @p job on the I/O thread, after
+ * coap_handshake_run_t has returned job->result.  This is expected to send
+ * job->out and to update the session for job->result.
+ *
+ * @param job The handshake step that has been run.
+ */
+typedef void (*coap_handshake_done_t)(coap_handshake_job_t *job);
+
+/**
+ * The handshake steps of a session that are run by the worker threads.
+ * This is kept by the session from its first step until the session is
+ * freed or its (D)TLS is torn down.
+ */
+struct coap_handshake_job_t {
+  struct coap_handshake_job_t *next; /**< in the queues of the pool */
+  struct coap_handshake_job_t *prev; /**< in the queues of the pool */
+  coap_session_t *session;           /**< the session of the handshake */
+  void *tls;                         /**< the (D)TLS object of the session */
+  coap_handshake_run_t run;          /**< runs a step on a worker */
+  coap_handshake_done_t done;        /**< completes a step on the I/O thread */
+  coap_handshake_data_t *in;         /**< records for the step */
+  coap_handshake_data_t *pending;    /**< records received during the step */
+  coap_handshake_data_t *out;        /**< records sent by the step */
+  int result;                        /**< the result of run */
+  int state;                         /**< where the step is (internal) */
+};
+
+/**
+ * Adds a copy of the record @p data of length @p length to the end of
+ * @p list.  This is used by coap_handshake_run_t to capture the records
+ * that it sends.
+ *
+ * @param list   The list to add to.
+ * @param data   The record.
+ * @param length The length of the record.
+ *
+ * @return @c 1 if successful, else @c 0.
+ */
+int coap_handshake_data_add(coap_handshake_data_t **list,
+                            const uint8_t *data, size_t length);
+
+/**
+ * Hands the (D)TLS handshake of @p session over to the worker threads of
+ * its context, if it has any.  The received record @p data is passed to
+ * @p run on a worker thread, or held back until the current step of
+ * @p session has completed.
+ *
+ * @param session The session in (D)TLS handshake.
+ * @param tls     The (D)TLS object of the session, which may not have been
+ *                set in @p session yet.
+ * @param data    The received record, or @c NULL for the first step.
+ * @param length  The length of @p data.
+ * @param run     Runs a step on a worker thread.
+ * @param done    Completes a step on the I/O thread.
+ *
+ * @return @c 1 if the record has been taken by the workers, or @c 0 if the
+ *         context has no workers (or the job cannot be created) and the
+ *         record has to be handled inline.
+ */
+int coap_handshake_offload(coap_session_t *session, void *tls,
+                           const uint8_t *data, size_t length,
+                           coap_handshake_run_t run,
+                           coap_handshake_done_t done);
+
+/**
+ * Checks whether a handshake step of @p session is queued for or being run
+ * by the worker threads.  The (D)TLS object and its timers must then be left
+ * alone by the I/O thread.
+ *
+ * @param session The session.
+ *
+ * @return @c 1 if a step is outstanding, else @c 0.
+ */
+int coap_handshake_busy(const coap_session_t *session);
+
+/**
+ * Discards the handshake steps of @p session, waiting for a step being run
+ * by a worker thread to end.  This must be called before the (D)TLS object
+ * of @p session is freed.
+ *
+ * @param session The session.
+ */
+void coap_handshake_cancel(coap_session_t *session);
+
+/**
+ * Completes the handshake steps that the worker threads of @p context have
+ * run.  This is called by the I/O thread after the sockets have been polled.
+ *
+ * @param context The context.
+ */
+void coap_handshake_process(coap_context_t *context);
+
+/**
+ * Locks the state of @p context that the (D)TLS callbacks can update, such as
+ * the SNI entries, the ticket keys and the PSK and event state of the
+ * sessions, if the context has worker threads.  The (D)TLS callbacks, and so
+ * the application callbacks that they call, are run with the lock held.
+ *
+ * @param context The context.
+ */
+void coap_handshake_lock(coap_context_t *context);
+
+/**
+ * Unlocks the state locked by coap_handshake_lock().
+ *
+ * @param context The context.
+ */
+void coap_handshake_unlock(coap_context_t *context);
+
+/**
+ * Gets the socket that wakes up the I/O thread when handshake steps have been
+ * run, so that it can be polled along with the sockets of @p context.
+ *
+ * @param context The context.
+ *
+ * @return The socket, or @c NULL if @p context has no worker threads.
+ */
+coap_socket_t *coap_handshake_socket(coap_context_t *context);
+
+/**
+ * Stops the worker threads of @p context and frees the pool.  All the
+ * sessions must have been freed.
+ *
+ * @param context The context.
+ */
+void coap_handshake_free_pool(coap_context_t *context);
+
+/** @} */
+
+#endif /* COAP_HANDSHAKE_INTERNAL_H_ */
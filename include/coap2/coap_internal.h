@@ -35,6 +35,13 @@
 
 #include "coap2/coap.h"
 
+/*
+ * Fails the build if the constant expression cond is false.  name is used
+ * for the array type that then cannot be declared.
+ */
+#define COAP_STATIC_ASSERT(cond, name) \
+  typedef char coap_static_assert_##name[(cond) ? 1 : -1]
+
 /*
  * Include all the header files that are for internal use only.
  */
@@ -51,12 +58,16 @@
 #include "coap_block_internal.h"
 #include "coap_cache_internal.h"
 #include "coap_dtls_internal.h"
+#include "coap_handshake_internal.h"
 #include "coap_io_internal.h"
+#include "coap_mid_cache_internal.h"
 #include "coap_net_internal.h"
 #include "coap_pdu_internal.h"
+#include "coap_proxy_internal.h"
 #include "coap_session_internal.h"
 #include "coap_resource_internal.h"
 #include "coap_session_internal.h"
+#include "coap_submit_internal.h"
 #include "coap_subscribe_internal.h"
 #include "coap_tcp_internal.h"
 
@@ -79,6 +79,31 @@ coap_socket_send( coap_socket_t *sock, coap_session_t *session,
 ssize_t
 coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len);
 
+/**
+ * The most buffers that coap_socket_writev() writes in one call.
+ */
+#ifndef COAP_SOCKET_MAX_IOV
+#define COAP_SOCKET_MAX_IOV 16
+#endif /* COAP_SOCKET_MAX_IOV */
+
+/**
+ * Writes the buffers @p bufs, in order, to the connected socket @p sock with
+ * one system call (writev() or WSASend()).  As with coap_socket_write(), the
+ * socket is flagged to wait for writing if it does not take all of the data.
+ * Where gathered writes are not available, only the first buffer is written.
+ *
+ * @param sock  The connected socket.
+ * @param bufs  The buffers to write.
+ * @param count The number of buffers, of which at most COAP_SOCKET_MAX_IOV are
+ *              written.
+ *
+ * @return The number of bytes written, which can end part way through any of
+ *         the buffers, @c 0 if the socket would block, or @c -1 on error.
+ */
+ssize_t
+coap_socket_writev(coap_socket_t *sock, const coap_bin_const_t *bufs,
+                   size_t count);
+
 ssize_t
 coap_socket_read(coap_socket_t *sock, uint8_t *data, size_t data_len);
 
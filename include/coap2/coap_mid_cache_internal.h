@@ -0,0 +1,104 @@
+/*
+ * coap_mid_cache_internal.h -- Message-ID deduplication for libcoap
+ *
+ * Copyright (C) 2021 The libcoap project
+ *
+ * This file is part of the CoAP library libcoap. Please see README for terms
+ * of use.
+ */
+
+/**
+ * @file coap_mid_cache_internal.h
+ * @brief CoAP Message-ID deduplication internal information
+ */
+
+#ifndef COAP_MID_CACHE_INTERNAL_H_
+#define COAP_MID_CACHE_INTERNAL_H_
+
+/**
+ * @defgroup mid_cache_internal Message Deduplication (Internal)
+ * Structures and functions for detecting duplicate Confirmable requests and
+ * answering them with the response that was sent for the original request
+ * (RFC 7252 Section 4.5).
+ * @{
+ */
+
+/**
+ * The default maximum number of bytes that the Message-ID deduplication
+ * cache of a context may use (see coap_context_set_mid_cache_size()).
+ */
+#ifndef COAP_DEFAULT_MID_CACHE_SIZE
+#if defined(WITH_CONTIKI) || defined(WITH_LWIP) || defined(RIOT_VERSION)
+#define COAP_DEFAULT_MID_CACHE_SIZE 0
+#else /* ! WITH_CONTIKI && ! WITH_LWIP && ! RIOT_VERSION */
+#define COAP_DEFAULT_MID_CACHE_SIZE (32 * 1024)
+#endif /* ! WITH_CONTIKI && ! WITH_LWIP && ! RIOT_VERSION */
+#endif /* COAP_DEFAULT_MID_CACHE_SIZE */
+
+/**
+ * A Confirmable request that has been handled, together with the encoded
+ * ACK that was sent back for it.  Entries are held in a hash on their
+ * session, keyed on the request's Message-ID, and on a least recently used
+ * list on the context that is used to enforce the context's size limit.
+ */
+typedef struct coap_mid_cache_t {
+  UT_hash_handle hh;                /**< session's mid_cache, keyed on mid */
+  struct coap_mid_cache_t *lru_prev; /**< context's mid_cache_lru linkage */
+  struct coap_mid_cache_t *lru_next;
+  coap_session_t *session;          /**< session the request came in on */
+  coap_tick_t expire;               /**< end of EXCHANGE_LIFETIME */
+  coap_mid_t mid;                   /**< Message-ID of the request */
+  coap_binary_t *response;          /**< encoded ACK, or NULL if none has
+                                         been sent yet */
+} coap_mid_cache_t;
+
+#define MID_CACHE_ADD(e, obj) \
+  HASH_ADD(hh, (e), mid, sizeof((obj)->mid), (obj))
+
+#define MID_CACHE_DELETE(e, obj) \
+  HASH_DELETE(hh, (e), (obj))
+
+#define MID_CACHE_ITER(e, el, rtmp) \
+  HASH_ITER(hh, (e), el, rtmp)
+
+#define MID_CACHE_FIND(e, k, res) {                    \
+    HASH_FIND(hh, (e), &(k), sizeof(k), (res));        \
+  }
+
+/**
+ * Checks whether the Confirmable request @p pdu is a duplicate of one that
+ * has already been responded to on @p session.  If so, the cached response
+ * is sent again.  Otherwise, the request is recorded so that the ACK sent
+ * for it can be added by coap_mid_cache_set_response().
+ *
+ * Nothing is done if the cache size of the session's context is 0, or for
+ * reliable or transient (stateless) sessions.
+ *
+ * @param session The session the request was received on.
+ * @param pdu     The received request.
+ *
+ * @return @c 1 if @p pdu was a duplicate that has been answered, @c 0 if
+ *         it needs to be handled.
+ */
+int coap_mid_cache_check(coap_session_t *session, const coap_pdu_t *pdu);
+
+/**
+ * Stores the encoded ACK @p pdu as the response for the request with the
+ * same Message-ID that was recorded by coap_mid_cache_check(), if any.
+ *
+ * @param session The session the ACK was sent on.
+ * @param pdu     The sent ACK, with the header already encoded.
+ */
+void coap_mid_cache_set_response(coap_session_t *session,
+                                 const coap_pdu_t *pdu);
+
+/**
+ * Removes all the cached requests of @p session.
+ *
+ * @param session The session being freed.
+ */
+void coap_mid_cache_free_session(coap_session_t *session);
+
+/** @} */
+
+#endif /* COAP_MID_CACHE_INTERNAL_H_ */
@@ -32,6 +32,9 @@ struct coap_queue_t {
   unsigned char retransmit_cnt; /**< retransmission counter, will be removed
                                  *    when zero */
   unsigned int timeout;         /**< the randomized timeout value */
+  uint8_t backoff;              /**< retransmission backoff factor in
+                                 *    halves, or 0 to double the timeout */
+  coap_tick_t sent;             /**< time of the first transmission */
   coap_session_t *session;      /**< the CoAP session */
   coap_mid_t id;                /**< CoAP message id */
   coap_pdu_t *pdu;              /**< the CoAP PDU to send */
@@ -56,6 +59,8 @@ struct coap_context_t {
   /**
    * list of asynchronous message ids */
   coap_async_t *async_state;
+  coap_async_t *async_collapse;    /**< asyncs with requests collapsed into
+                                        them, by cache-key */
 #endif /* WITHOUT_ASYNC */
 
   /**
@@ -119,6 +124,42 @@ struct coap_context_t {
   unsigned int max_handshake_sessions; /**< Maximum number of simultaneous
                                             negotating sessions per endpoint. 0
                                             means use default. */
+  uint8_t dtls_cookie_secret[2][16];   /**< current and previous secret for
+                                            stateless DTLS cookies */
+  coap_tick_t dtls_cookie_drawn;       /**< when dtls_cookie_secret[0] was
+                                            drawn */
+  int dtls_cookie_init;                /**< 1 once the secrets are drawn */
+  coap_dtls_ticket_key_t dtls_ticket_key[2]; /**< current and previous key
+                                            for session tickets */
+  coap_tick_t dtls_ticket_key_drawn;   /**< when dtls_ticket_key[0] was
+                                            drawn */
+  int dtls_ticket_key_init;            /**< 1 once the keys are drawn */
+  struct coap_tls_resume_t *tls_resume; /**< client (D)TLS states to resume
+                                            from, by server */
+  coap_handshake_pool_t *handshake_pool; /**< worker threads for (D)TLS
+                                            handshakes, or NULL */
+  struct coap_submit_queue_t *submit_queue; /**< calls submitted from other
+                                            threads, or NULL */
+  unsigned int hibernate_timeout;      /**< Number of seconds of inactivity
+                                            after which a DTLS server session
+                                            hibernates. 0 means never. */
+  int stateless_udp;                   /**< 1 if requests from unknown UDP
+                                            peers are handled without
+                                            creating a session */
+  int cocoa;                           /**< 1 if new sessions use CoCoA RTO
+                                            estimation */
+  int cork;                            /**< 1 if what is sent on TCP and
+                                            TLS sessions is held back until
+                                            the I/O is next waited for */
+  coap_pdu_t *rx_pdu;                  /**< PDU that the messages received
+                                            whole on TCP and TLS sessions are
+                                            parsed into, kept for reuse */
+  struct coap_mid_cache_t *mid_cache_lru; /**< handled CON requests of all
+                                               sessions, least recently
+                                               used first */
+  size_t mid_cache_size;               /**< bytes used by mid_cache_lru */
+  size_t max_mid_cache_size;           /**< limit for mid_cache_size, 0
+                                            disables deduplication */
   unsigned int ping_timeout;           /**< Minimum inactivity time before
                                             sending a ping message. 0 means
                                             disabled. */
@@ -127,12 +168,43 @@ struct coap_context_t {
   uint8_t observe_pending;         /**< Observe response pending */
   uint8_t block_mode;              /**< Zero or more COAP_BLOCK_ or'd options */
   uint64_t etag;                   /**< Next ETag to use */
+  coap_lg_body_t *lg_body;         /**< Large bodies shared between
+                                        sessions for BLOCK2 transmissions */
 
   coap_cache_entry_t *cache;       /**< CoAP cache-entry cache */
+  coap_cache_entry_t *response_cache; /**< responses of resources with
+                                       COAP_RESOURCE_FLAGS_CACHE_RESPONSES */
+  coap_cache_entry_t *cache_lru;   /**< all cache-entries, least recently
+                                        used first */
+  coap_cache_entry_t *cache_expire; /**< cache-entries with an expiry time,
+                                        soonest first */
+  size_t cache_size;               /**< bytes used by the cache-entries */
+  size_t max_cache_size;           /**< limit for cache_size, 0 if none */
+  uint8_t cache_size_set;          /**< max_cache_size set by the
+                                        application */
+  coap_cache_stats_t cache_stats;  /**< cache hits, misses etc. */
+  coap_cache_key_mode_t cache_key_mode; /**< how cache-keys are derived */
+  uint8_t cache_hash_key[16];      /**< random key for COAP_CACHE_KEY_FAST */
   uint16_t *cache_ignore_options;  /**< CoAP options to ignore when creating a
                                         cache-key */
   size_t cache_ignore_count;       /**< The number of CoAP options to ignore
                                         when creating a cache-key */
+  struct coap_proxy_upstream_t *proxy_upstreams; /**< forward proxy upstream
+                                        sessions, by scheme, host and port */
+  struct coap_proxy_req_t *proxy_reqs; /**< forwarded requests waiting for a
+                                        response, soonest expiry first */
+  struct coap_proxy_req_t *proxy_collapse; /**< forwarded GET and FETCH
+                                        requests waiting for a response,
+                                        by cache-key */
+  coap_string_t *proxy_next_host;  /**< next hop proxy, or NULL if none */
+  uint16_t proxy_next_port;
+  coap_uri_scheme_t proxy_next_scheme;
+  unsigned int proxy_max_inflight; /**< requests in flight per upstream,
+                                        0 if no limit */
+  unsigned int proxy_max_queued;   /**< requests queued per upstream,
+                                        0 if no limit */
+  coap_proxy_session_handler_t proxy_session_handler; /**< creates upstream
+                                        sessions, NULL for the default */
   void *app;                       /**< application-specific data */
 #ifdef COAP_EPOLL_SUPPORT
   int epfd;                        /**< External FD for epoll */
@@ -219,6 +291,24 @@ coap_mid_t coap_retransmit(coap_context_t *context, coap_queue_t *node);
  */
 int coap_handle_dgram(coap_context_t *ctx, coap_session_t *session, uint8_t *data, size_t data_len);
 
+/**
+ * Parses and interprets a CoAP datagram that has been written straight into
+ * the buffer of @p pdu, starting at pdu->token -
+ * COAP_PDU_MAX_UDP_HEADER_SIZE, so that it is not copied again (for example
+ * by decrypting a DTLS record into it).  @p pdu is freed.
+ *
+ * @param ctx      The current CoAP context.
+ * @param session  The current CoAP session.
+ * @param pdu      The PDU holding the datagram, as created by coap_pdu_init()
+ *                 with room for @p data_len bytes.
+ * @param data_len The length of the datagram.
+ *
+ * @return       @c 0 if message was handled successfully, or less than zero on
+ *               error.
+ */
+int coap_handle_dgram_pdu(coap_context_t *ctx, coap_session_t *session,
+                          coap_pdu_t *pdu, size_t data_len);
+
 /**
  * This function removes the element with given @p id from the list given list.
  * If @p id was found, @p node is updated to point to the removed element. Note
@@ -270,6 +360,18 @@ coap_cancel_session_messages(coap_context_t *context,
                              coap_session_t *session,
                              coap_nack_reason_t reason);
 
+/**
+ * Reports that the Confirmable @p sent was not acknowledged, to the forward
+ * proxy and to the application's NACK handler.
+ *
+ * @param session Session @p sent was sent on.
+ * @param sent    The message that was not acknowledged.
+ * @param reason  Why it was not acknowledged.
+ * @param mid     The message id of @p sent.
+ */
+void coap_handle_nack(coap_session_t *session, coap_pdu_t *sent,
+                      coap_nack_reason_t reason, coap_mid_t mid);
+
 /**
  * Dispatches the PDUs from the receive queue in given context.
  */
@@ -333,6 +435,9 @@ coap_pdu_t *coap_wellknown_response(coap_context_t *context,
  * Qx.FRAC_BITS fixed point notation, whereas the passed parameter @p r
  * is interpreted as the fractional part of a Q0.MAX_BITS random value.
  *
+ * If CoCoA is enabled for @p session, the current RTO estimate is used
+ * instead of 'ack_timeout' and the result is in the range [RTO, 1.5 * RTO].
+ *
  * @param session session timeout is associated with
  * @param r  random value as fractional part of a Q0.MAX_BITS fixed point
  *           value
@@ -341,6 +446,19 @@ coap_pdu_t *coap_wellknown_response(coap_context_t *context,
  */
 unsigned int coap_calc_timeout(coap_session_t *session, unsigned char r);
 
+/**
+ * Feeds the round-trip time of the confirmable message @p node, which has
+ * just been acknowledged (or reset) at time @p now, into the CoCoA
+ * estimators of @p session.  Messages retransmitted more than twice, and
+ * sessions without CoCoA enabled, are ignored.
+ *
+ * @param session The session the message was sent on.
+ * @param node    The retransmission queue entry of the message.
+ * @param now     The time the ACK or RST was received.
+ */
+void coap_update_rtt_estimate(coap_session_t *session,
+                              const coap_queue_t *node, coap_tick_t now);
+
 /** @} */
 
 #endif /* COAP_NET_INTERNAL_H_ */
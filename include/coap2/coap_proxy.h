@@ -0,0 +1,134 @@
+/* coap_proxy.h -- Forward proxy for CoAP requests
+*
+* Copyright (C) 2021 The libcoap project
+*
+* This file is part of the CoAP library libcoap. Please see
+* README for terms of use.
+*/
+
+/**
+ * @file coap_proxy.h
+ * @brief Forwarding of CoAP requests to upstream servers
+ */
+
+#ifndef COAP_PROXY_H_
+#define COAP_PROXY_H_
+
+#include "coap_forward_decls.h"
+#include "address.h"
+#include "pdu.h"
+#include "uri.h"
+
+/**
+ * @defgroup proxy Forward Proxy
+ * API functions for forwarding the requests received by a proxy resource
+ * (see coap_resource_proxy_uri_init()) to the upstream servers.
+ * @{
+ */
+
+/**
+ * Callback to create the client session to an upstream server, for example
+ * to set up the PKI or PSK information for the coaps and coaps+tcp schemes.
+ *
+ * @param context The current context.
+ * @param server  The resolved address of the upstream server.
+ * @param proto   The protocol for the URI scheme of the request.
+ * @param host    The host name (or address) of the upstream server, as used
+ *                in the request.
+ *
+ * @return The new client session, or @c NULL if it cannot be created.
+ */
+typedef coap_session_t *(*coap_proxy_session_handler_t)(
+                                             coap_context_t *context,
+                                             const coap_address_t *server,
+                                             coap_proto_t proto,
+                                             const coap_str_const_t *host);
+
+/**
+ * Checks whether the forward proxy is supported.
+ *
+ * @return @c 1 if supported, else @c 0.
+ */
+int coap_proxy_is_supported(void);
+
+/**
+ * Forwards @p request, which carries a Proxy-Uri or Proxy-Scheme option, to
+ * its upstream server (or to the next hop proxy set by
+ * coap_context_set_proxy_next_hop()).  The response is passed back to the
+ * client as a separate response when it arrives.
+ *
+ * All the requests to the same scheme, host and port share one client
+ * session, which is released once it has been unused for the session
+ * timeout of the context (see coap_context_set_session_timeout()).  Host
+ * names are resolved without blocking where the system supports it.
+ *
+ * A request body sent with Block1 is reassembled before it is forwarded, and
+ * a response body received with Block2 is reassembled before it is passed
+ * back.
+ *
+ * A GET or FETCH request with the same cache-key as one that is waiting for
+ * its response is not forwarded, but is answered with a copy of that
+ * response.
+ *
+ * This is intended to be called by the handler of the proxy resource.  The
+ * response handler of the context is not called for responses received on
+ * upstream sessions.
+ *
+ * @param session  The session @p request was received on.
+ * @param request  The request to forward.
+ * @param response The response being built by the handler.  Its code is
+ *                 set if the request cannot be forwarded, and left as 0
+ *                 otherwise.
+ * @param resource The proxy resource.
+ *
+ * @return @c 1 if the request has been forwarded (or queued to be), else
+ *         @c 0.
+ */
+int coap_proxy_forward_request(coap_session_t *session,
+                               const coap_pdu_t *request,
+                               coap_pdu_t *response,
+                               coap_resource_t *resource);
+
+/**
+ * Sets the proxy that all requests are forwarded to, with their Proxy-Uri
+ * or Proxy-Scheme option, rather than to the servers they are for.
+ *
+ * @param context  The context to update.
+ * @param next_hop The scheme, host and port of the next hop proxy, or
+ *                 @c NULL to forward directly to the servers.
+ *
+ * @return @c 1 if successful, else @c 0.
+ */
+int coap_context_set_proxy_next_hop(coap_context_t *context,
+                                    const coap_uri_t *next_hop);
+
+/**
+ * Limits the number of forwarded requests that are waiting for a response
+ * from each upstream server.  Further requests are queued until one of them
+ * completes.  When @p max_queued requests are queued for an upstream server,
+ * further requests get 5.03 (Service Unavailable).
+ *
+ * @param context      The context to update.
+ * @param max_inflight The maximum number of requests in flight per upstream
+ *                     server, or @c 0 for no limit (the default).
+ * @param max_queued   The maximum number of requests queued per upstream
+ *                     server, or @c 0 for no limit (the default).
+ */
+void coap_context_set_proxy_limits(coap_context_t *context,
+                                   unsigned int max_inflight,
+                                   unsigned int max_queued);
+
+/**
+ * Registers the callback that creates the client sessions to the upstream
+ * servers.  Without one, sessions are only created for the coap and coap+tcp
+ * schemes.
+ *
+ * @param context The context to update.
+ * @param handler The callback, or @c NULL to use the default.
+ */
+void coap_register_proxy_session_handler(coap_context_t *context,
+                                         coap_proxy_session_handler_t handler);
+
+/** @} */
+
+#endif /* COAP_PROXY_H_ */
@@ -0,0 +1,174 @@
+/*
+ * coap_proxy_internal.h -- Forward proxy for libcoap
+ *
+ * Copyright (C) 2021 The libcoap project
+ *
+ * This file is part of the CoAP library libcoap. Please see README for terms
+ * of use.
+ */
+
+/**
+ * @file coap_proxy_internal.h
+ * @brief CoAP forward proxy internal information
+ */
+
+#ifndef COAP_PROXY_INTERNAL_H_
+#define COAP_PROXY_INTERNAL_H_
+
+/**
+ * @defgroup proxy_internal Forward Proxy (Internal)
+ * Structures and functions for forwarding requests to upstream servers over
+ * pooled client sessions, and for passing the responses back.
+ * @{
+ */
+
+#if !defined(WITH_CONTIKI) && !defined(WITH_LWIP) && !defined(RIOT_VERSION) \
+    && defined(HAVE_GETADDRINFO)
+#define COAP_PROXY_SUPPORT 1
+#else
+#define COAP_PROXY_SUPPORT 0
+#endif
+
+/**
+ * The number of seconds a forwarded request waits for its response before
+ * 5.04 (Gateway Timeout) is returned.  This is a little more than
+ * MAX_TRANSMIT_WAIT with the default transmission parameters, so that the
+ * NACK of a Confirmable request to the upstream server gets in first.
+ */
+#ifndef COAP_PROXY_EXCHANGE_TIMEOUT
+#define COAP_PROXY_EXCHANGE_TIMEOUT 100
+#endif /* COAP_PROXY_EXCHANGE_TIMEOUT */
+
+/**
+ * How often the outcome of an outstanding name resolution is checked, in
+ * ticks.
+ */
+#define COAP_PROXY_RESOLVE_POLL (COAP_TICKS_PER_SECOND / 100)
+
+typedef struct coap_proxy_upstream_t coap_proxy_upstream_t;
+
+typedef enum coap_proxy_req_state_t {
+  COAP_PROXY_REQ_QUEUED,    /**< waiting for the upstream session or for
+                                 the in-flight limit */
+  COAP_PROXY_REQ_SENT,      /**< sent, waiting for the response */
+  COAP_PROXY_REQ_OBSERVING, /**< notifications are being passed back */
+  COAP_PROXY_REQ_COLLAPSED  /**< waiting for the response to an identical
+                                 request */
+} coap_proxy_req_state_t;
+
+/**
+ * A request that is being forwarded to an upstream server.  Once sent, it is
+ * held in a hash on its upstream, keyed on the token that was used for the
+ * upstream request.  Until a response arrives, it is also on the context's
+ * proxy_reqs list, which is in order of expiry.
+ *
+ * A GET or FETCH request is also held in the context's proxy_collapse hash,
+ * keyed on its cache-key, until its response arrives.  Identical requests
+ * that come in meanwhile are not forwarded, but are held as its followers
+ * and get a copy of its response.
+ */
+typedef struct coap_proxy_req_t {
+  UT_hash_handle hh;              /**< upstream's reqs, keyed on token */
+  struct coap_proxy_req_t *q_prev; /**< upstream's queue linkage */
+  struct coap_proxy_req_t *q_next;
+  struct coap_proxy_req_t *exp_prev; /**< context's proxy_reqs linkage */
+  struct coap_proxy_req_t *exp_next;
+  uint64_t token;                 /**< token of the upstream request */
+  size_t token_length;
+  coap_proxy_upstream_t *upstream;
+  coap_proxy_req_state_t state;
+  coap_tick_t expire;             /**< when to give up waiting */
+  coap_session_t *incoming;       /**< session the request came in on */
+  coap_binary_t *incoming_token;  /**< token of the incoming request */
+  coap_string_t *query;           /**< Uri-Query of the incoming request */
+  coap_resource_t *resource;      /**< the proxy resource */
+  coap_pdu_type_t type;           /**< type of the incoming request */
+  coap_pdu_code_t code;           /**< method of the incoming request */
+  coap_optlist_t *optlist;        /**< options for the upstream request,
+                                       until sent */
+  coap_binary_t *body;            /**< body of the request, until sent */
+  coap_binary_t *body_data;       /**< partial Block2 response body */
+  UT_hash_handle ch;              /**< context's proxy_collapse */
+  coap_cache_key_t *cache_key;    /**< set if in proxy_collapse */
+  struct coap_proxy_req_t *leader; /**< request followed, if COLLAPSED */
+  struct coap_proxy_req_t *followers; /**< requests collapsed into this */
+  struct coap_proxy_req_t *f_next; /**< leader's followers linkage */
+} coap_proxy_req_t;
+
+/**
+ * A pooled client session to an upstream server (or to the next hop proxy),
+ * held in a hash on the context keyed on scheme, port and host.
+ */
+struct coap_proxy_upstream_t {
+  UT_hash_handle hh;              /**< context's proxy_upstreams */
+  coap_binary_t *key;             /**< scheme, port and host */
+  coap_string_t *host;
+  uint16_t port;
+  coap_uri_scheme_t scheme;
+  unsigned int numeric:1;         /**< host is an IP address literal */
+  unsigned int resolving:1;       /**< name resolution is outstanding */
+  unsigned int failed:1;          /**< session failed, to be released */
+  coap_session_t *session;        /**< NULL until resolved */
+  coap_proxy_req_t *reqs;         /**< hash of sent and observing requests */
+  coap_proxy_req_t *queue;        /**< requests waiting to be sent */
+  unsigned int inflight;          /**< requests in state SENT */
+  unsigned int queued;            /**< requests in state QUEUED */
+  coap_tick_t last_used;          /**< when inflight last dropped to 0 */
+  void *resolver;                 /**< outstanding name resolution */
+};
+
+/**
+ * Passes a response received on the upstream @p session back to the client
+ * whose request it answers.
+ *
+ * @param session  The upstream session.
+ * @param received The received response.
+ *
+ * @return @c COAP_RESPONSE_FAIL if the response does not match a forwarded
+ *         request (so that it is rejected), else @c COAP_RESPONSE_OK.
+ */
+coap_response_t coap_proxy_handle_response(coap_session_t *session,
+                                           const coap_pdu_t *received);
+
+/**
+ * Fails the forwarded request that @p sent was for, if any.
+ *
+ * @param session The upstream session.
+ * @param sent    The request that was not acknowledged.
+ * @param reason  Why it was not acknowledged.
+ */
+void coap_proxy_handle_nack(coap_session_t *session, const coap_pdu_t *sent,
+                            coap_nack_reason_t reason);
+
+/**
+ * Fails all the requests forwarded over @p session if @p event closes an
+ * upstream session, and forgets the requests that came in on @p session if
+ * it closes a client's session.
+ *
+ * @param session The session the event is for.
+ * @param event   The event.
+ */
+void coap_proxy_handle_event(coap_session_t *session, coap_event_t event);
+
+/**
+ * Completes name resolutions, times out forwarded requests and releases
+ * failed and idle upstream sessions.
+ *
+ * @param context The current context.
+ * @param now     The current time in ticks.
+ *
+ * @return The time in ticks until this needs to be called again, or @c 0 if
+ *         nothing is pending.
+ */
+coap_tick_t coap_proxy_check(coap_context_t *context, coap_tick_t now);
+
+/**
+ * Releases all the upstream sessions and forwarded requests of @p context.
+ *
+ * @param context The context being freed.
+ */
+void coap_proxy_free_all(coap_context_t *context);
+
+/** @} */
+
+#endif /* COAP_PROXY_INTERNAL_H_ */
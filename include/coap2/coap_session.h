@@ -181,6 +181,43 @@ void *coap_session_get_tls(const coap_session_t *session);
  */
 coap_context_t *coap_session_get_context(const coap_session_t *session);
 
+/**
+ * Get the (D)TLS state of an established client session, so that a later
+ * session to the same server, possibly in another process, can resume it
+ * with an abbreviated handshake (see coap_context_import_tls_state()).
+ *
+ * The state includes the session keys, so needs to be stored securely.  It
+ * is only valid for the (D)TLS library that libcoap is built with.
+ *
+ * @param session The CoAP client session.
+ *
+ * @return The (D)TLS state, to be freed with coap_delete_binary(), or @c NULL
+ *         if the session cannot be resumed.
+ */
+coap_binary_t *coap_session_export_tls_state(coap_session_t *session);
+
+/**
+ * Sets the (D)TLS state, as got by coap_session_export_tls_state(), that
+ * the next client session of @p context to @p server resumes from, if it is
+ * set up with the same PSK identity or certificate, and SNI, as the session
+ * the state was got from.  The state of the last established session to
+ * each server with each of these credentials is also kept automatically.
+ * If the server does not accept it, the session falls back to a full
+ * handshake.
+ *
+ * @param context The CoAP context.
+ * @param server  The address of the server.
+ * @param proto   The protocol (COAP_PROTO_DTLS or COAP_PROTO_TLS).
+ * @param data    The (D)TLS state.
+ * @param length  The length of @p data.
+ *
+ * @return @c 1 if the state has been set, else @c 0.
+ */
+int coap_context_import_tls_state(coap_context_t *context,
+                                  const coap_address_t *server,
+                                  coap_proto_t proto,
+                                  const uint8_t *data, size_t length);
+
 /**
  * Set the session type to client. Typically used in a call-home server.
  * The session needs to be of type COAP_SESSION_TYPE_SERVER.
@@ -419,6 +456,8 @@ coap_session_t *coap_session_get_by_peer(const coap_context_t *ctx,
    * The number of simultaneous outstanding interactions that a client
    * maintains to a given server.
    * RFC 7252, Section 4.8 Default value of NSTART is 1
+   *
+   * Configurable using coap_session_set_nstart()
    */
 #define COAP_DEFAULT_NSTART 1
 
@@ -576,6 +615,55 @@ coap_fixed_point_t coap_session_get_ack_timeout(const coap_session_t *session);
 coap_fixed_point_t coap_session_get_ack_random_factor(
                                                const coap_session_t *session);
 
+/**
+* Set the CoAP maximum number of outstanding confirmable messages
+*
+* The number of confirmable messages (requests or notifications) that can be
+* waiting for an ACK at the same time.  Further confirmable messages are
+* delayed until one of these is acknowledged or given up on.  The number
+* actually allowed is adjusted between 1 and @p value, being halved whenever
+* a message needs to be re-transmitted and growing by one for each @p value
+* messages acknowledged without re-transmission.
+*
+* @param session The CoAP session.
+* @param value The value to set to (1 - 255). The default is 1 and should
+*              only be increased if the peer is known to be able to handle
+*              the load.
+*/
+void coap_session_set_nstart(coap_session_t *session, unsigned int value);
+
+/**
+* Get the CoAP maximum number of outstanding confirmable messages
+*
+* @param session The CoAP session.
+*
+* @return Current NSTART value
+*/
+unsigned int coap_session_get_nstart(const coap_session_t *session);
+
+/**
+* Set whether the initial ack response timeout is estimated using CoCoA
+*
+* If enabled, the round-trip times of acknowledged confirmable messages are
+* used to estimate the initial retransmission timeout as per
+* draft-ietf-core-cocoa, replacing ack_timeout and ack_random_factor, and
+* re-transmissions use the CoCoA variable backoff factor.
+*
+* @param session The CoAP session.
+* @param cocoa 1 to enable CoCoA, 0 (the default unless changed by
+*              coap_context_set_cocoa()) to keep the RFC 7252 behavior.
+*/
+void coap_session_set_cocoa(coap_session_t *session, int cocoa);
+
+/**
+* Get whether the initial ack response timeout is estimated using CoCoA
+*
+* @param session The CoAP session.
+*
+* @return @c 1 if CoCoA is enabled, else @c 0.
+*/
+int coap_session_get_cocoa(const coap_session_t *session);
+
 /**
  * Send a ping message for the session.
  * @param session The CoAP session.
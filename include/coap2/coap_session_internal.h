@@ -21,6 +21,16 @@
 #define COAP_DEFAULT_SESSION_TIMEOUT 300
 #define COAP_PARTIAL_SESSION_TIMEOUT_TICKS (30 * COAP_TICKS_PER_SECOND)
 #define COAP_DEFAULT_MAX_HANDSHAKE_SESSIONS 100
+/** How often the secret for stateless DTLS cookies is replaced */
+#define COAP_DTLS_COOKIE_SECRET_TICKS (60 * COAP_TICKS_PER_SECOND)
+#define COAP_DTLS_COOKIE_LENGTH 16
+/** Length of the DTLS Connection IDs that server sessions ask peers to use */
+#define COAP_DTLS_CID_LENGTH 8
+/** How often the key that servers seal session tickets with is replaced */
+#define COAP_DTLS_TICKET_KEY_TICKS \
+  (COAP_DTLS_RESUME_LIFETIME / 2 * COAP_TICKS_PER_SECOND)
+/** Number of servers whose client (D)TLS session state is kept to resume */
+#define COAP_TLS_RESUME_MAX_SERVERS 16
 
 /**
  * @defgroup session_internal Sessions (Internal)
@@ -39,51 +49,58 @@ struct coap_addr_hash_t {
   coap_proto_t proto;          /**< CoAP protocol */
 };
 
+#define COAP_TLS_CREDENTIALS_LENGTH 16
+
 /**
- * Abstraction of virtual session that can be attached to coap_context_t
- * (client) or coap_endpoint_t (server).
+ * What a (D)TLS state is kept for: the server, and the credentials that
+ * the client authenticated itself with, so that a state is not resumed by
+ * a session set up with other credentials.
  */
-struct coap_session_t {
-  coap_proto_t proto;               /**< protocol used */
-  coap_session_type_t type;         /**< client or server side socket */
-  coap_session_state_t state;       /**< current state of relationaship with
-                                         peer */
-  unsigned ref;                     /**< reference count from queues */
-  size_t tls_overhead;              /**< overhead of TLS layer */
-  size_t mtu;                       /**< path or CSM mtu */
-  coap_addr_hash_t addr_hash;  /**< Address hash for server incoming packets */
-  UT_hash_handle hh;
-  coap_addr_tuple_t addr_info;      /**< key: remote/local address info */
-  int ifindex;                      /**< interface index */
-  coap_socket_t sock;               /**< socket object for the session, if
-                                         any */
-  coap_endpoint_t *endpoint;        /**< session's endpoint */
-  coap_context_t *context;          /**< session's context */
-  void *tls;                        /**< security parameters */
-  uint16_t tx_mid;                  /**< the last message id that was used in
-                                         this session */
-  uint8_t con_active;               /**< Active CON request sent */
-  uint8_t csm_block_supported;      /**< CSM TCP blocks supported */
-  coap_mid_t last_ping_mid;         /**< the last keepalive message id that was
-                                         used in this session */
-  coap_queue_t *delayqueue;         /**< list of delayed messages waiting to
-                                         be sent */
-  coap_lg_xmit_t *lg_xmit;          /**< list of large transmissions */
-  coap_lg_crcv_t *lg_crcv;       /**< Client list of expected large receives */
-  coap_lg_srcv_t *lg_srcv;       /**< Server list of expected large receives */
+typedef struct coap_tls_resume_key_t {
+  coap_addr_hash_t server;     /**< protocol and server address */
+  uint8_t credentials[COAP_TLS_CREDENTIALS_LENGTH]; /**< hash of the client
+                                    credentials (see coap_session_secure_t) */
+} coap_tls_resume_key_t;
+
+/**
+ * The (D)TLS state of the last client session to a server, which the next
+ * client sessions to that server with the same credentials resume from.
+ * Held in the context's tls_resume hash, oldest first.
+ */
+typedef struct coap_tls_resume_t {
+  UT_hash_handle hh;           /**< context's tls_resume */
+  coap_tls_resume_key_t key;   /**< key: server and client credentials */
+  coap_binary_t *state;        /**< in the format of the (D)TLS library */
+} coap_tls_resume_t;
+
+/**
+ * Session state that is only needed for reliable (TCP or TLS) transports.
+ * Allocated together with such a session.
+ */
+typedef struct coap_session_tcp_t {
   size_t partial_write;             /**< if > 0 indicates number of bytes
                                          already written from the pdu at the
                                          head of sendqueue */
-  uint8_t read_header[8];           /**< storage space for header of incoming
-                                         message header */
   size_t partial_read;              /**< if > 0 indicates number of bytes
                                          already read for an incoming message */
   coap_pdu_t *partial_pdu;          /**< incomplete incoming pdu */
-  coap_tick_t last_rx_tx;
-  coap_tick_t last_tx_rst;
-  coap_tick_t last_ping;
-  coap_tick_t last_pong;
-  coap_tick_t csm_tx;
+  coap_tick_t csm_tx;               /**< time the CSM was sent */
+  uint8_t *write_batch;             /**< PDUs from the head of delayqueue
+                                         gathered into one TLS record whose
+                                         write has to be retried, or NULL */
+  size_t write_batch_len;           /**< length of write_batch */
+  int write_retry;                  /**< 1 if the TLS write of the pdu at
+                                         the head of delayqueue has to be
+                                         retried on its own */
+  uint8_t read_header[8];           /**< storage space for header of incoming
+                                         message header */
+} coap_session_tcp_t;
+
+/**
+ * Session state that is only needed when a pre-shared key is in use.
+ * Allocated by coap_session_psk_block() when first needed.
+ */
+typedef struct coap_session_psk_t {
   coap_dtls_cpsk_t cpsk_setup_data; /**< client provided PSK initial setup
                                          data */
   coap_bin_const_t *psk_identity;   /**< If client, this field contains the
@@ -113,9 +130,151 @@ struct coap_session_t {
                                       contained in context->spsk_setup_data
 
                                       Value maintained internally */
-  void *app;                        /**< application-specific data */
+} coap_session_psk_t;
+
+/**
+ * The DTLS Connection ID (RFC 9146) of a server session, which the peer puts
+ * in the records that it sends so that they still reach the session after a
+ * NAT has changed the peer's address.  Allocated by coap_session_new_cid()
+ * and held in the endpoint's cid_sessions hash.
+ */
+typedef struct coap_session_cid_t {
+  UT_hash_handle hh;                /**< endpoint's cid_sessions */
+  uint8_t cid[COAP_DTLS_CID_LENGTH]; /**< key: the Connection ID */
+  coap_session_t *session;          /**< the session with this CID */
+  coap_addr_tuple_t rebound;        /**< new addresses of the peer */
+  int rebound_ifindex;
+  int rebinding;                    /**< 1 while a record from rebound is
+                                         being handled */
+} coap_session_cid_t;
+
+/**
+ * One of the CoCoA (draft-ietf-core-cocoa) round-trip time estimators.
+ * All values are in coap_tick_t units, with srtt of 0 meaning that no
+ * sample has been taken yet.
+ */
+typedef struct coap_rtt_estimator_t {
+  unsigned int srtt;                /**< smoothed round-trip time */
+  unsigned int rttvar;              /**< round-trip time variation */
+  unsigned int rto;                 /**< retransmission timeout of this
+                                         estimator */
+} coap_rtt_estimator_t;
+
+/**
+ * Session state that is only needed when the retransmission timeout is
+ * estimated using CoCoA.  Allocated by coap_session_set_cocoa().
+ */
+typedef struct coap_session_cocoa_t {
+  coap_rtt_estimator_t rtt_strong;  /**< estimator fed by exchanges without
+                                         retransmissions */
+  coap_rtt_estimator_t rtt_weak;    /**< estimator fed by exchanges with 1 or
+                                         2 retransmissions */
+  unsigned int rto;                 /**< overall RTO in ticks, or 0 to use
+                                         ack_timeout */
+  coap_tick_t rto_updated;          /**< when rto was last updated */
+} coap_session_cocoa_t;
+
+/**
+ * (D)TLS state that only some sessions need.  Allocated by
+ * coap_session_secure_block() when first needed.
+ */
+typedef struct coap_session_secure_t {
+  uint8_t credentials[COAP_TLS_CREDENTIALS_LENGTH]; /**< hash of the PSK
+                                         identity or certificate, and SNI,
+                                         of a client session */
+  coap_handshake_job_t *handshake;  /**< (D)TLS handshake being run by the
+                                         worker threads, or NULL */
+  coap_binary_t *hibernated;        /**< serialised DTLS connection while
+                                         tls is freed, or NULL */
+} coap_session_secure_t;
+
+/**
+ * Session state that is only needed by the forward proxy.  Allocated when
+ * the session becomes an upstream session or starts to receive a request
+ * body that is to be forwarded.
+ */
+typedef struct coap_session_proxy_t {
+  struct coap_proxy_upstream_t *upstream; /**< set if this is a forward
+                                         proxy upstream session */
+  coap_binary_t *body;              /**< request body being reassembled for
+                                         the forward proxy */
+} coap_session_proxy_t;
+
+/**
+ * Abstraction of virtual session that can be attached to coap_context_t
+ * (client) or coap_endpoint_t (server).
+ *
+ * The fields looked at for every packet come first so that they share as
+ * few cache lines as possible.  On a 64-bit host the hash handle takes up
+ * the first line, the hash key used to find a server session and the socket
+ * the second, and the pointers followed when handling a PDU the third.
+ * Protocol specific state that most sessions do not need hangs off the
+ * separately allocated tcp, psk, cid, cocoa, secure and proxy blocks.
+ */
+struct coap_session_t {
+  UT_hash_handle hh;
+  coap_proto_t proto;               /**< protocol used */
+  coap_session_state_t state;       /**< current state of relationaship with
+                                         peer */
+  coap_addr_hash_t addr_hash;  /**< Address hash for server incoming packets */
+  coap_socket_t sock;               /**< socket object for the session, if
+                                         any */
+  coap_context_t *context;          /**< session's context */
+  coap_endpoint_t *endpoint;        /**< session's endpoint */
+  void *tls;                        /**< security parameters */
+  coap_tick_t last_rx_tx;
+  struct coap_mid_cache_t *mid_cache; /**< hash of handled CON requests */
+  coap_lg_xmit_t *lg_xmit;          /**< hash of large transmissions */
+  coap_lg_crcv_t *lg_crcv;       /**< Client hash of expected large receives */
+  coap_lg_srcv_t *lg_srcv;       /**< Server hash of expected large receives */
+  coap_session_type_t type;         /**< client or server side socket */
+  unsigned ref;                     /**< reference count from queues */
+  uint16_t tx_mid;                  /**< the last message id that was used in
+                                         this session */
+  uint8_t con_active;               /**< Active CON request sent */
+  uint8_t cwnd;                     /**< Current limit on con_active, between
+                                         1 and nstart */
+  uint8_t block_mode;             /**< Zero or more COAP_BLOCK_ or'd options */
+  uint8_t idle_flags;             /**< Zero or more COAP_SESSION_IDLE_ or'd
+                                       endpoint lists the session is on */
+  uint8_t transient;              /**< One of COAP_SESSION_TRANSIENT_ if
+                                       this is the endpoint's stateless UDP
+                                       session, else 0 */
+  uint8_t csm_block_supported;      /**< CSM TCP blocks supported */
+  uint8_t csm_bert_rem_support;     /**< CSM TCP BERT blocks supported by
+                                         the remote peer */
+  int ifindex;                      /**< interface index */
+  coap_addr_tuple_t addr_info;      /**< key: remote/local address info */
+  size_t mtu;                       /**< path or CSM mtu */
+  size_t tls_overhead;              /**< overhead of TLS layer */
+  coap_queue_t *delayqueue;         /**< list of delayed messages waiting to
+                                         be sent */
+  coap_session_t *idle_prev;      /**< endpoint idle_sessions list linkage */
+  coap_session_t *idle_next;
+  coap_tick_t lg_expire;            /**< Earliest time an lg_xmit, lg_crcv or
+                                         lg_srcv can expire or 0 if none */
+
+  /* Less frequently used fields */
+  coap_session_tcp_t *tcp;          /**< reliable transport state, or NULL */
+  coap_session_psk_t *psk;          /**< pre-shared key state, or NULL */
+  coap_session_cid_t *cid;          /**< DTLS Connection ID, or NULL */
+  coap_session_cocoa_t *cocoa;      /**< CoCoA RTO estimation state, or NULL
+                                         if the RFC 7252 timeouts are used */
+  coap_session_secure_t *secure;    /**< (D)TLS client credentials,
+                                         handshake offload and hibernation
+                                         state, or NULL */
+  coap_session_proxy_t *proxy;      /**< forward proxy state, or NULL */
+  coap_session_t *hs_prev;        /**< endpoint hs_sessions list linkage */
+  coap_session_t *hs_next;
+  coap_mid_t last_ping_mid;         /**< the last keepalive message id that was
+                                         used in this session */
   unsigned int max_retransmit;      /**< maximum re-transmit count (default
                                          4) */
+  uint8_t nstart;                   /**< maximum number of outstanding CON
+                                         messages (default 1) */
+  uint8_t cwnd_acks;                /**< CONs acknowledged without
+                                         retransmission since cwnd last
+                                         changed */
   coap_fixed_point_t ack_timeout;   /**< timeout waiting for ack (default 2
                                          secs) */
   coap_fixed_point_t ack_random_factor; /**< ack random factor backoff (default
@@ -123,10 +282,29 @@ struct coap_session_t {
   unsigned int dtls_timeout_count;      /**< dtls setup retry counter */
   int dtls_event;                       /**< Tracking any (D)TLS events on this
                                              sesison */
-  uint8_t block_mode;             /**< Zero or more COAP_BLOCK_ or'd options */
+  coap_tick_t last_tx_rst;
+  coap_tick_t last_ping;
+  coap_tick_t last_pong;
+  void *app;                        /**< application-specific data */
   uint64_t tx_token;              /**< Next token number to use */
 };
 
+/** Session is on the endpoint's idle_sessions list */
+#define COAP_SESSION_IDLE_SERVER 0x01
+/** Session is on the endpoint's hs_sessions list */
+#define COAP_SESSION_IDLE_HS     0x02
+
+/** Transient session is dropped after the request unless it holds state */
+#define COAP_SESSION_TRANSIENT      1
+/** Transient session must be kept as something refers to it by pointer */
+#define COAP_SESSION_TRANSIENT_KEEP 2
+
+/**
+ * Returns non-zero if @p s has as many CON messages outstanding as its
+ * current congestion window allows.
+ */
+#define COAP_SESSION_CWND_FULL(s) ((s)->con_active >= (s)->cwnd)
+
 /**
  * Abstraction of virtual endpoint that can be attached to coap_context_t. The
  * keys (port, bind_addr) must uniquely identify this endpoint.
@@ -140,6 +318,18 @@ struct coap_endpoint_t {
                                        any */
   coap_address_t bind_addr;       /**< local interface address */
   coap_session_t *sessions;       /**< hash table or list of active sessions */
+  coap_session_t *idle_sessions;  /**< unreferenced server sessions with
+                                       nothing queued, least recently used
+                                       first */
+  coap_session_t *hs_sessions;    /**< unreferenced sessions still in (D)TLS
+                                       set up, least recently used first */
+  unsigned int num_idle;          /**< number of sessions on idle_sessions */
+  unsigned int num_hs;            /**< number of sessions on hs_sessions */
+  coap_session_cid_t *cid_sessions; /**< hash of the DTLS Connection IDs of
+                                       sessions */
+  coap_session_t *transient;      /**< reusable session for stateless UDP
+                                       requests from unknown peers, not in
+                                       sessions */
 };
 
 /**
@@ -156,6 +346,23 @@ void coap_session_send_csm(coap_session_t *session);
  */
 void coap_session_connected(coap_session_t *session);
 
+/**
+ * Grows the congestion window of @p session by one (up to nstart) for every
+ * window's worth of CON messages acknowledged without being retransmitted.
+ *
+ * @param session The CoAP session.
+ * @param node    The retransmission queue entry that was acknowledged.
+ */
+void coap_session_cwnd_ack(coap_session_t *session, const coap_queue_t *node);
+
+/**
+ * Halves the congestion window of @p session (down to 1) as a CON message
+ * has been lost.
+ *
+ * @param session The CoAP session.
+ */
+void coap_session_cwnd_loss(coap_session_t *session);
+
 /**
  * Refresh the session's current Identity Hint (PSK).
  * Note: A copy of @p psk_hint is maintained in the session by libcoap.
@@ -182,6 +389,19 @@ int coap_session_refresh_psk_hint(coap_session_t *session,
 int coap_session_refresh_psk_key(coap_session_t *session,
                                  const coap_bin_const_t *psk_key);
 
+/**
+ * Refresh the session's current pre-shared key (PSK) identity.
+ * Note: A copy of @p psk_identity is maintained in the session by libcoap.
+ *
+ * @param session      The current coap_session_t object.
+ * @param psk_identity If NULL, the identity will revert to the initial
+ *                     identity used as session setup.
+ *
+ * @return @c 1 if successful, else @c 0.
+ */
+int coap_session_refresh_psk_identity(coap_session_t *session,
+                                      const coap_bin_const_t *psk_identity);
+
 /**
  * Creates a new server session for the specified endpoint.
  * @param ctx The CoAP context.
@@ -239,6 +459,48 @@ ssize_t coap_session_write(coap_session_t *session,
  */
 ssize_t coap_session_send_pdu(coap_session_t *session, coap_pdu_t *pdu);
 
+/**
+ * The most bytes of queued PDUs that coap_session_write_delayed() gathers
+ * into one TLS record (the largest TLS plaintext fragment).
+ */
+#ifndef COAP_SESSION_MAX_TLS_BATCH
+#define COAP_SESSION_MAX_TLS_BATCH 16384
+#endif /* COAP_SESSION_MAX_TLS_BATCH */
+
+/**
+ * Writes as much of the delayqueue of the reliable (TCP or TLS) @p session as
+ * the connection takes.  The queued PDUs are gathered into one writev() for
+ * TCP, or copied into one TLS record of up to COAP_SESSION_MAX_TLS_BATCH
+ * bytes, rather than being written one at a time.
+ *
+ * @param session The established reliable session.
+ * @param now     The current time.
+ */
+void coap_session_write_delayed(coap_session_t *session, coap_tick_t now);
+
+/**
+ * Writes out what the established reliable @p session has queued while its
+ * context is corked (see coap_context_set_cork()), or behind an earlier
+ * write, unless its socket is waiting to become writable.  This is called
+ * before the I/O of the context is waited for.
+ *
+ * @param session The session.
+ * @param now     The current time.
+ */
+void coap_session_flush(coap_session_t *session, coap_tick_t now);
+
+/**
+ * Sets up the TLS of the new incoming TLS @p session, which is left until
+ * the first bytes (the ClientHello) have arrived so that a burst of new
+ * connections is accepted without building their TLS objects up front.
+ * The session is disconnected if this fails.
+ *
+ * @param session The server TLS session in handshake without its TLS.
+ *
+ * @return @c 1 if the TLS session has been set up, else @c 0.
+ */
+int coap_session_accept_tls(coap_session_t *session);
+
 ssize_t
 coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
                        coap_queue_t *node);
@@ -247,6 +509,10 @@ coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
  * Lookup the server session for the packet received on an endpoint, or create
  * a new one.
  *
+ * On a DTLS endpoint, a ClientHello from a peer without a session is answered
+ * with a HelloVerifyRequest, without creating a session, unless it carries a
+ * valid cookie (see coap_dtls_cookie_generate()).
+ *
  * @param endpoint Active endpoint the packet was received on.
  * @param packet Received packet.
  * @param now The current time in ticks.
@@ -269,9 +535,232 @@ coap_session_t *coap_endpoint_get_session(coap_endpoint_t *endpoint,
 coap_session_t *coap_session_new_dtls_session(coap_session_t *session,
   coap_tick_t now);
 
+/**
+ * Calculates the stateless DTLS cookie for the peer @p addr_hash, which the
+ * peer has to echo in its ClientHello to show that it owns its address.  The
+ * secret it is keyed with is replaced every COAP_DTLS_COOKIE_SECRET_TICKS.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param context   The current context.
+ * @param addr_hash The address hash of the peer.
+ * @param cookie    Updated with the cookie.
+ */
+void coap_dtls_cookie_generate(coap_context_t *context,
+                               const coap_addr_hash_t *addr_hash,
+                               uint8_t cookie[COAP_DTLS_COOKIE_LENGTH]);
+
+/**
+ * Checks a cookie echoed by the peer @p addr_hash against the current and the
+ * previous secret, replacing them first if they are due.  A cookie is thus
+ * not accepted for longer than two COAP_DTLS_COOKIE_SECRET_TICKS.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param context    The current context.
+ * @param addr_hash  The address hash of the peer.
+ * @param cookie     The cookie from the ClientHello.
+ * @param cookie_len The length of @p cookie.
+ *
+ * @return @c 1 if the cookie is valid, else @c 0.
+ */
+int coap_dtls_cookie_verify(coap_context_t *context,
+                            const coap_addr_hash_t *addr_hash,
+                            const uint8_t *cookie, size_t cookie_len);
+
+/**
+ * Gives the server @p session a new random DTLS Connection ID, which the
+ * DTLS library then asks the peer to use.  Records that carry it are passed
+ * to @p session by coap_endpoint_get_session() whatever address they come
+ * from.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The server session.
+ * @param cid     Updated with the Connection ID.
+ *
+ * @return @c 1 if successful, else @c 0.
+ */
+int coap_session_new_cid(coap_session_t *session,
+                         uint8_t cid[COAP_DTLS_CID_LENGTH]);
+
+/**
+ * Moves @p session to the address that a record with its Connection ID
+ * came from, if it did not come from the session's own address.  This is
+ * called once the record has been decrypted, so that only authentic
+ * records can move the session.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The server session.
+ */
+void coap_session_cid_rebind(coap_session_t *session);
+
+/**
+ * Ends the handling of a record that coap_endpoint_get_session() passed to
+ * @p session.  If the record came from another address and has not been
+ * decrypted by now, it does not move the session.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The session the record was passed to.
+ */
+void coap_session_cid_rebind_done(coap_session_t *session);
+
+/**
+ * Gets the key that servers seal new session tickets with.  It is replaced
+ * every COAP_DTLS_TICKET_KEY_TICKS, and the previous key is kept to open the
+ * tickets sealed before that, so that a ticket can be used for up to
+ * COAP_DTLS_RESUME_LIFETIME seconds.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param context The current context.
+ *
+ * @return The current ticket key.
+ */
+const coap_dtls_ticket_key_t *coap_dtls_ticket_key_current(
+                                                     coap_context_t *context);
+
+/**
+ * Finds the ticket key that a session ticket names.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param context    The current context.
+ * @param name       The key name from the ticket.
+ * @param is_current Updated with @c 1 if the key is the current one, so
+ *                   that the ticket does not need to be renewed.
+ *
+ * @return The ticket key, or @c NULL if it has been dropped.
+ */
+const coap_dtls_ticket_key_t *coap_dtls_ticket_key_find(
+                         coap_context_t *context,
+                         const uint8_t name[COAP_DTLS_TICKET_KEY_NAME_LENGTH],
+                         int *is_current);
+
+/**
+ * Gets the (D)TLS state that the client @p session can resume from, as
+ * stored for its server and credentials by an earlier session or by
+ * coap_context_import_tls_state().
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The client session being set up.
+ *
+ * @return The state in the format of the (D)TLS library, or @c NULL if
+ *         there is none.
+ */
+const coap_binary_t *coap_session_tls_resume_state(
+                                               const coap_session_t *session);
+
+/**
+ * Stores the (D)TLS state of the established client @p session for the next
+ * client sessions to its server with the same credentials.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The client session.
+ */
+void coap_session_save_tls_state(coap_session_t *session);
+
+/**
+ * Hibernates the established DTLS server @p session, replacing its (D)TLS
+ * library objects by the serialised state of the connection.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The idle server session.
+ *
+ * @return @c 1 if the session has hibernated, else @c 0 (the session is
+ *         left as it was).
+ */
+int coap_session_hibernate(coap_session_t *session);
+
+/**
+ * Restores the (D)TLS library objects of the hibernated @p session, so that
+ * it can send and receive again.  The session is disconnected if they cannot
+ * be restored.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The session.
+ *
+ * @return @c 1 if the session has its (D)TLS objects (or has not
+ *         hibernated), else @c 0.
+ */
+int coap_session_rehydrate(coap_session_t *session);
+
+/**
+ * Checks whether @p session has hibernated, so that its (D)TLS library
+ * objects have to be restored before it can be used.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param session The session.
+ *
+ * @return non-zero if the session has hibernated.
+ */
+#define coap_session_is_hibernated(session) \
+  ((session)->secure && (session)->secure->hibernated)
+
+/**
+ * Frees all the stored client (D)TLS states of @p context.
+ *
+ * @ingroup dtls_internal
+ *
+ * @param context The current context.
+ */
+void coap_context_free_tls_resume(coap_context_t *context);
+
 void coap_session_free(coap_session_t *session);
 void coap_session_mfree(coap_session_t *session);
 
+/**
+ * Re-evaluate whether the server @p session is idle or in (D)TLS handshake
+ * and move it on or off the endpoint's idle_sessions and hs_sessions lists
+ * accordingly, keeping the endpoint's num_idle and num_hs counts current.
+ * This must be called whenever the session's reference count, type, state
+ * or delayqueue may have changed, so that coap_endpoint_get_session() can
+ * admit and evict sessions without scanning the endpoint.
+ *
+ * @param session The CoAP session.
+ */
+void coap_session_idle_update(coap_session_t *session);
+
+/**
+ * Called once a packet has been handled on the endpoint's transient session
+ * (see coap_context_set_stateless_udp()).  If handling the request left any
+ * state behind (references, delayed or large transfers, application data
+ * or session based cache entries), the transient session is added to the
+ * endpoint's sessions as a normal server session and a new transient
+ * session will be used for the next unknown peer.  Otherwise it is left to
+ * be reused.  Does nothing if @p session is not transient.
+ *
+ * @param session The CoAP session.
+ */
+void coap_session_check_transient(coap_session_t *session);
+
+/**
+ * Returns the pre-shared key state of @p session, allocating it if the
+ * session does not have one yet.
+ *
+ * @param session The CoAP session.
+ *
+ * @return The PSK state or @c NULL if it could not be allocated.
+ */
+coap_session_psk_t *coap_session_psk_block(coap_session_t *session);
+
+/**
+ * Returns the (D)TLS state of @p session that only some sessions need,
+ * allocating it if the session does not have one yet.
+ *
+ * @param session The CoAP session.
+ *
+ * @return The state or @c NULL if it could not be allocated.
+ */
+coap_session_secure_t *coap_session_secure_block(coap_session_t *session);
+
 /** @} */
 
 #define SESSIONS_ADD(e, obj) \
@@ -0,0 +1,110 @@
+/* coap_submit.h -- Submitting work to a context from other threads
+*
+* Copyright (C) 2021 The libcoap project
+*
+* This file is part of the CoAP library libcoap. Please see
+* README for terms of use.
+*/
+
+/**
+ * @file coap_submit.h
+ * @brief Thread-safe submission of work to the I/O thread of a context
+ */
+
+#ifndef COAP_SUBMIT_H_
+#define COAP_SUBMIT_H_
+
+#include "coap_forward_decls.h"
+#include "pdu.h"
+#include "str.h"
+
+/**
+ * @defgroup submit Submitting from Other Threads
+ * API functions for handing work to a context from threads other than the
+ * one that runs its I/O.
+ *
+ * All the other functions that take a context, or a session, resource or
+ * PDU that belongs to one, must be called from the thread that calls
+ * coap_io_process() (or coap_io_prepare_io() and coap_io_do_io()) for the
+ * context, the I/O thread.  A PDU that has not yet been handed to libcoap
+ * belongs to the thread that created it, so it can be built with
+ * coap_pdu_init(), coap_add_token(), coap_add_option() and coap_add_data()
+ * on any thread.
+ *
+ * Once coap_context_set_submit_queue() has been called on the I/O thread,
+ * the functions below can be called from any thread.  They put the call on
+ * a lock-free queue of the context, and wake up the I/O thread, which makes
+ * the call as part of its next pass of coap_io_process().  The calls queued
+ * by one thread are made in the order they were queued, but there is no
+ * order between the calls of different threads.
+ * @{
+ */
+
+/**
+ * Set whether the context has a queue for the calls submitted from other
+ * threads, and so can be woken up by them.  This must be called on the I/O
+ * thread, before any other thread submits calls and after all of them have
+ * stopped doing so.  When the queue is removed, the calls still in it are
+ * made first.
+ *
+ * @param context The coap_context_t object.
+ * @param enable  1 to set up the queue, 0 to remove it.
+ *
+ * @return @c 1 if successful, else @c 0 (such as when the platform does not
+ *         support it).
+ */
+int coap_context_set_submit_queue(coap_context_t *context, int enable);
+
+/**
+ * Get whether the context has a queue for calls submitted from other threads.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return @c 1 if the context has a submit queue, else @c 0.
+ */
+int coap_context_get_submit_queue(const coap_context_t *context);
+
+/**
+ * Thread-safe version of coap_send().  @p pdu is sent on @p session by the
+ * I/O thread.  The message ID of a Confirmable or Non-confirmable @p pdu is
+ * assigned then, as another thread cannot safely take one from the session.
+ * The caller must hold a reference to @p session until the PDU has been sent,
+ * which is the case if it later calls coap_submit_session_release() for it
+ * from the same thread.
+ *
+ * @param session The CoAP session.
+ * @param pdu     The CoAP PDU to send, which is owned by libcoap from now on.
+ *
+ * @return @c 1 if @p pdu has been queued, else @c 0 (in which case @p pdu has
+ *         been deleted).
+ */
+int coap_submit_send(coap_session_t *session, coap_pdu_t *pdu);
+
+/**
+ * Thread-safe version of coap_resource_notify_observers().  The observers of
+ * @p resource are notified by the I/O thread, which must not delete
+ * @p resource before then.
+ *
+ * @param resource The resource that has changed.
+ * @param query    The query to match the observers against, or @c NULL for
+ *                 all of them.  This is copied.
+ *
+ * @return @c 1 if the notification has been queued, else @c 0.
+ */
+int coap_submit_notify_observers(coap_resource_t *resource,
+                                 const coap_string_t *query);
+
+/**
+ * Thread-safe version of coap_session_release().  The reference to
+ * @p session is given up by the I/O thread, after the calls that the calling
+ * thread has queued before for @p session.
+ *
+ * @param session The CoAP session.
+ *
+ * @return @c 1 if the release has been queued, else @c 0.
+ */
+int coap_submit_session_release(coap_session_t *session);
+
+/** @} */
+
+#endif /* COAP_SUBMIT_H_ */
@@ -0,0 +1,90 @@
+/*
+ * coap_submit_internal.h -- Submitting work to a context from other threads
+ *
+ * Copyright (C) 2021 The libcoap project
+ *
+ * This file is part of the CoAP library libcoap. Please see README for terms
+ * of use.
+ */
+
+/**
+ * @file coap_submit_internal.h
+ * @brief CoAP cross-thread submit queue internal information
+ */
+
+#ifndef COAP_SUBMIT_INTERNAL_H_
+#define COAP_SUBMIT_INTERNAL_H_
+
+/**
+ * @defgroup submit_internal Submit Queue (Internal)
+ * Structures and functions for the queue of calls submitted to a context from
+ * other threads (see coap_context_set_submit_queue()).
+ *
+ * The queue is a lock-free stack: a submitting thread pushes its call with a
+ * compare-and-swap on the head, and the I/O thread takes the whole stack in
+ * one atomic exchange and reverses it, so the calls of each thread are made
+ * in order.  Only the thread that pushes onto an empty stack wakes up the I/O
+ * thread, through an eventfd (or a pipe) that is polled along with the
+ * sockets of the context.
+ * @{
+ */
+
+#if !defined(WITH_CONTIKI) && !defined(WITH_LWIP) && \
+    !defined(RIOT_VERSION) && !defined(_WIN32) && \
+    defined(HAVE_UNISTD_H) && defined(__ATOMIC_ACQUIRE)
+#define COAP_SUBMIT_QUEUE 1
+#else
+#define COAP_SUBMIT_QUEUE 0
+#endif
+
+/** What a submitted call does (coap_submit_t type) */
+typedef enum coap_submit_type_t {
+  COAP_SUBMIT_SEND,         /**< coap_send() */
+  COAP_SUBMIT_NOTIFY,       /**< coap_resource_notify_observers() */
+  COAP_SUBMIT_RELEASE       /**< coap_session_release() */
+} coap_submit_type_t;
+
+/**
+ * A call submitted from another thread, waiting for the I/O thread.
+ */
+typedef struct coap_submit_t {
+  struct coap_submit_t *next;
+  coap_submit_type_t type;
+  coap_session_t *session;      /**< for SEND and RELEASE */
+  coap_pdu_t *pdu;              /**< for SEND */
+  coap_resource_t *resource;    /**< for NOTIFY */
+  coap_string_t *query;         /**< for NOTIFY, or NULL */
+} coap_submit_t;
+
+/** The submit queue of a context. */
+typedef struct coap_submit_queue_t coap_submit_queue_t;
+
+/**
+ * Makes the calls that have been submitted to @p context.  This is called by
+ * the I/O thread after the sockets have been polled.
+ *
+ * @param context The context.
+ */
+void coap_submit_process(coap_context_t *context);
+
+/**
+ * Gets the socket that wakes up the I/O thread when calls have been
+ * submitted, so that it can be polled along with the sockets of @p context.
+ *
+ * @param context The context.
+ *
+ * @return The socket, or @c NULL if @p context has no submit queue.
+ */
+coap_socket_t *coap_submit_socket(coap_context_t *context);
+
+/**
+ * Removes the submit queue of @p context as it is being freed.  The calls
+ * still in the queue are discarded rather than made.
+ *
+ * @param context The context.
+ */
+void coap_submit_free_queue(coap_context_t *context);
+
+/** @} */
+
+#endif /* COAP_SUBMIT_INTERNAL_H_ */
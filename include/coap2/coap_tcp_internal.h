@@ -26,6 +26,40 @@
 
 #if !COAP_DISABLE_TCP
 
+/**
+ * The maximum number of new incoming TCP sessions that are accepted on a
+ * listening socket each time it is found to be ready, so that a burst of
+ * connections empties the accept queue without starving the other sessions.
+ * RIOT only supports a small number of sockets, so it takes one at a time.
+ */
+#ifndef COAP_MAX_ACCEPT_BATCH
+#ifdef RIOT_VERSION
+#define COAP_MAX_ACCEPT_BATCH 1
+#else /* ! RIOT_VERSION */
+#define COAP_MAX_ACCEPT_BATCH 64
+#endif /* ! RIOT_VERSION */
+#endif /* COAP_MAX_ACCEPT_BATCH */
+
+/**
+ * The backlog of pending connections passed to listen() for a TCP
+ * endpoint.
+ */
+#ifndef COAP_TCP_LISTEN_BACKLOG
+#ifdef SOMAXCONN
+#define COAP_TCP_LISTEN_BACKLOG SOMAXCONN
+#else /* ! SOMAXCONN */
+#define COAP_TCP_LISTEN_BACKLOG 5
+#endif /* ! SOMAXCONN */
+#endif /* COAP_TCP_LISTEN_BACKLOG */
+
+/**
+ * How long (in seconds) the TCP layer holds back a new incoming TLS session
+ * waiting for its ClientHello (see coap_socket_defer_accept_tcp()).
+ */
+#ifndef COAP_TLS_DEFER_ACCEPT_SECS
+#define COAP_TLS_DEFER_ACCEPT_SECS 10
+#endif /* COAP_TLS_DEFER_ACCEPT_SECS */
+
 /**
  * Create a new TCP socket and initiate the connection
  *
@@ -91,10 +125,13 @@ coap_socket_bind_tcp(coap_socket_t *sock,
  * @param server The socket information to use to accept the TCP connection
  * @param new_client Filled in socket information with the new incoming
  *                   session information
- * @param local_addr Filled in with the local address
+ * @param local_addr Filled in with the local address, or @c NULL if the
+ *                   caller already knows it (the listening socket is bound
+ *                   to a single address)
  * @param remote_addr Filled in with the remote address
  *
- * @return @c 1 if succesful, @c 0 if failure of some sort
+ * @return @c 1 if succesful, @c 0 if failure of some sort (including no
+ *         more sessions waiting to be accepted)
 */
 int
 coap_socket_accept_tcp(coap_socket_t *server,
@@ -102,6 +139,20 @@ coap_socket_accept_tcp(coap_socket_t *server,
                        coap_address_t *local_addr,
                        coap_address_t *remote_addr);
 
+/**
+ * Asks the TCP layer to hold back new incoming TCP sessions on a listening
+ * socket until their first data has arrived, where the system supports it
+ * (TCP_DEFER_ACCEPT).
+ *
+ * Internal function.
+ *
+ * @param sock The listening socket
+ * @param seconds How long to wait for the first data, after which the session
+ *                is passed on anyway
+*/
+void
+coap_socket_defer_accept_tcp(coap_socket_t *sock, int seconds);
+
 #endif /* !COAP_DISABLE_TCP */
 
 /** @} */
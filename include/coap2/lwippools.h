@@ -95,6 +95,38 @@
 #define MEMP_NUM_COAPLGSRCV 2
 #endif
 
+#ifndef MEMP_NUM_COAPLGBODY
+#define MEMP_NUM_COAPLGBODY 2
+#endif
+
+#ifndef MEMP_NUM_COAPSESSIONTCP
+#define MEMP_NUM_COAPSESSIONTCP 1
+#endif
+
+#ifndef MEMP_NUM_COAPSESSIONPSK
+#define MEMP_NUM_COAPSESSIONPSK MEMP_NUM_COAPSESSION
+#endif
+
+#ifndef MEMP_NUM_COAPMIDCACHE
+#define MEMP_NUM_COAPMIDCACHE 2
+#endif
+
+#ifndef MEMP_NUM_COAPSESSIONCID
+#define MEMP_NUM_COAPSESSIONCID 1
+#endif
+
+#ifndef MEMP_NUM_COAPSESSIONCOCOA
+#define MEMP_NUM_COAPSESSIONCOCOA 1
+#endif
+
+#ifndef MEMP_NUM_COAPSESSIONSECURE
+#define MEMP_NUM_COAPSESSIONSECURE 1
+#endif
+
+#ifndef MEMP_NUM_COAPSESSIONPROXY
+#define MEMP_NUM_COAPSESSIONPROXY 1
+#endif
+
 LWIP_MEMPOOL(COAP_CONTEXT, MEMP_NUM_COAPCONTEXT, sizeof(coap_context_t), "COAP_CONTEXT")
 LWIP_MEMPOOL(COAP_ENDPOINT, MEMP_NUM_COAPENDPOINT, sizeof(coap_endpoint_t), "COAP_ENDPOINT")
 LWIP_MEMPOOL(COAP_PACKET, MEMP_NUM_COAPPACKET, sizeof(coap_packet_t), "COAP_PACKET")
@@ -112,4 +144,12 @@ LWIP_MEMPOOL(COAP_PDU_BUF, MEMP_NUM_COAPPDUBUF, MEMP_LEN_COAPPDUBUF, "COAP_PDU_B
 LWIP_MEMPOOL(COAP_LG_XMIT, MEMP_NUM_COAPLGXMIT, sizeof(coap_lg_xmit_t), "COAP_LG_XMIT")
 LWIP_MEMPOOL(COAP_LG_CRCV, MEMP_NUM_COAPLGCRCV, sizeof(coap_lg_crcv_t), "COAP_LG_CRCV")
 LWIP_MEMPOOL(COAP_LG_SRCV, MEMP_NUM_COAPLGSRCV, sizeof(coap_lg_srcv_t), "COAP_LG_SRCV")
+LWIP_MEMPOOL(COAP_LG_BODY, MEMP_NUM_COAPLGBODY, sizeof(coap_lg_body_t), "COAP_LG_BODY")
+LWIP_MEMPOOL(COAP_SESSION_TCP, MEMP_NUM_COAPSESSIONTCP, sizeof(coap_session_tcp_t), "COAP_SESSION_TCP")
+LWIP_MEMPOOL(COAP_SESSION_PSK, MEMP_NUM_COAPSESSIONPSK, sizeof(coap_session_psk_t), "COAP_SESSION_PSK")
+LWIP_MEMPOOL(COAP_MID_CACHE, MEMP_NUM_COAPMIDCACHE, sizeof(coap_mid_cache_t), "COAP_MID_CACHE")
+LWIP_MEMPOOL(COAP_SESSION_CID, MEMP_NUM_COAPSESSIONCID, sizeof(coap_session_cid_t), "COAP_SESSION_CID")
+LWIP_MEMPOOL(COAP_SESSION_COCOA, MEMP_NUM_COAPSESSIONCOCOA, sizeof(coap_session_cocoa_t), "COAP_SESSION_COCOA")
+LWIP_MEMPOOL(COAP_SESSION_SECURE, MEMP_NUM_COAPSESSIONSECURE, sizeof(coap_session_secure_t), "COAP_SESSION_SECURE")
+LWIP_MEMPOOL(COAP_SESSION_PROXY, MEMP_NUM_COAPSESSIONPROXY, sizeof(coap_session_proxy_t), "COAP_SESSION_PROXY")
 
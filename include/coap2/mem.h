@@ -48,6 +48,14 @@ typedef enum {
   COAP_LG_XMIT,
   COAP_LG_CRCV,
   COAP_LG_SRCV,
+  COAP_LG_BODY,
+  COAP_SESSION_TCP,
+  COAP_SESSION_PSK,
+  COAP_MID_CACHE,
+  COAP_SESSION_CID,
+  COAP_SESSION_COCOA,
+  COAP_SESSION_SECURE,
+  COAP_SESSION_PROXY,
 } coap_memory_tag_t;
 
 #ifndef WITH_LWIP
@@ -264,6 +264,106 @@ coap_context_set_max_idle_sessions(coap_context_t *context,
 unsigned int
 coap_context_get_max_idle_sessions(const coap_context_t *context);
 
+/**
+ * Set whether NoSec UDP requests from peers that have no session are handled
+ * statelessly. If enabled, such a request is handled using a transient
+ * session that is not added to the endpoint, and a server session is only
+ * created if handling the request needs one to be kept, e.g. for observe,
+ * block-wise transfers, delayed (separate) responses or when the session is
+ * referenced by the application.
+ * 0 (the default) means that a server session is created for every peer.
+ *
+ * @param context       The coap_context_t object.
+ * @param stateless_udp 1 to enable stateless UDP handling, 0 to disable.
+ */
+void
+coap_context_set_stateless_udp(coap_context_t *context, int stateless_udp);
+
+/**
+ * Get whether NoSec UDP requests from unknown peers are handled statelessly.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return @c 1 if stateless UDP handling is enabled, else @c 0.
+ */
+int
+coap_context_get_stateless_udp(const coap_context_t *context);
+
+/**
+ * Set whether new sessions estimate their initial retransmission timeout
+ * using CoCoA (see coap_session_set_cocoa()).
+ * 0 (the default) means that the RFC 7252 timeouts are used.
+ *
+ * @param context The coap_context_t object.
+ * @param cocoa   1 to enable CoCoA for new sessions, 0 to disable.
+ */
+void
+coap_context_set_cocoa(coap_context_t *context, int cocoa);
+
+/**
+ * Get whether new sessions estimate their initial retransmission timeout
+ * using CoCoA.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return @c 1 if CoCoA is enabled for new sessions, else @c 0.
+ */
+int
+coap_context_get_cocoa(const coap_context_t *context);
+
+/**
+ * Set whether what is sent on the TCP and TLS sessions of the context is held
+ * back (corked) and written out in as few writes as possible just before the
+ * I/O is next waited for, by coap_io_process() or coap_io_prepare_io(), or
+ * when corking is turned off.  This suits bursts, such as the notifications
+ * of a resource to many observers or the responses to pipelined requests.
+ * 0 (the default) means that each PDU is written when it is sent, with the
+ * PDUs that have to wait for the connection written together once it is
+ * writable.
+ *
+ * @param context The coap_context_t object.
+ * @param cork    1 to hold back what is sent, 0 to write it out.
+ */
+void
+coap_context_set_cork(coap_context_t *context, int cork);
+
+/**
+ * Get whether what is sent on the TCP and TLS sessions of the context is held
+ * back until the I/O is next waited for.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return @c 1 if corking is on, else @c 0.
+ */
+int
+coap_context_get_cork(const coap_context_t *context);
+
+/**
+ * Set the maximum number of bytes used to remember the Confirmable requests
+ * received over UDP or DTLS, along with the ACK sent back for each, for
+ * EXCHANGE_LIFETIME.  A retransmission of such a request is answered by
+ * sending the same ACK again without calling the request handler
+ * (RFC 7252 Section 4.5).  When the limit is reached, the least recently
+ * used requests are forgotten first.
+ * 0 disables this deduplication.  The default is 32768 (0 for Contiki,
+ * LwIP and RIOT).
+ *
+ * @param context The coap_context_t object.
+ * @param size    The maximum number of bytes to use.
+ */
+void
+coap_context_set_mid_cache_size(coap_context_t *context, size_t size);
+
+/**
+ * Get the maximum number of bytes used to deduplicate Confirmable requests.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return The maximum number of bytes.
+ */
+size_t
+coap_context_get_mid_cache_size(const coap_context_t *context);
+
 /**
  * Set the session timeout value. The number of seconds of inactivity after
  * which an unused server session will be closed.
@@ -331,6 +431,67 @@ coap_context_set_max_handshake_sessions(coap_context_t *context,
 unsigned int
 coap_context_get_max_handshake_sessions(const coap_context_t *context);
 
+/**
+ * Set the number of worker threads that run the public key operations of the
+ * DTLS handshakes of the server and client sessions, so that the thread
+ * calling coap_io_process() keeps serving the established sessions during a
+ * burst of handshakes.  The (D)TLS callbacks (such as for PSK, SNI and
+ * certificate validation) are then called from the worker threads.
+ * 0 (the default) means the handshakes are done by the thread calling
+ * coap_io_process().  The number can only be changed while no handshakes are
+ * being run.
+ *
+ * @param context The coap_context_t object.
+ * @param threads The number of worker threads.
+ *
+ * @return @c 1 if successful, else @c 0 (such as when the (D)TLS library or
+ *         platform does not support it).
+ */
+int
+coap_context_set_handshake_threads(coap_context_t *context,
+                                   unsigned int threads);
+
+/**
+ * Get the number of worker threads that run (D)TLS handshakes.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return The number of worker threads.
+ */
+unsigned int
+coap_context_get_handshake_threads(const coap_context_t *context);
+
+/**
+ * Set the number of seconds of inactivity after which an established DTLS
+ * server session hibernates.  The (D)TLS library objects of the session are
+ * then replaced by the serialised state of its connection (keys, epoch and
+ * sequence numbers), and are restored when the next record is received for
+ * or sent by the session, without a new handshake.  This cuts the memory of
+ * idle sessions that are kept until the session timeout.
+ * 0 (the default) means that sessions do not hibernate.
+ *
+ * @param context The coap_context_t object.
+ * @param hibernate_timeout The seconds of inactivity before hibernating.
+ *
+ * @return @c 1 if successful, else @c 0 if the (D)TLS library cannot
+ *         serialise its connections.
+ */
+int
+coap_context_set_hibernate_timeout(coap_context_t *context,
+                                   unsigned int hibernate_timeout);
+
+/**
+ * Get the number of seconds of inactivity after which an established DTLS
+ * server session hibernates.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return The seconds of inactivity before hibernating, or 0 if sessions do
+ *         not hibernate.
+ */
+unsigned int
+coap_context_get_hibernate_timeout(const coap_context_t *context);
+
 /**
  * Returns a new message id and updates @p session->tx_mid accordingly. The
  * message id is returned in network byte order to make it easier to read in
@@ -75,6 +75,26 @@ typedef void (*coap_method_handler_t)
  */
 #define COAP_RESOURCE_FLAGS_NOTIFY_NON_ALWAYS  0x4
 
+/**
+ * 2.05 responses to GET and FETCH requests are cached by libcoap and sent,
+ * without calling the handler, until their Max-Age expires or
+ * coap_resource_notify_observers() is called for the resource.  Requests with
+ * an ETag matching the cached response are answered with 2.03 Valid.
+ * The handler output must only depend on the request's cache-key options
+ * (and FETCH payload).  Observe and block-wise requests are not cached.
+ */
+#define COAP_RESOURCE_FLAGS_CACHE_RESPONSES  0x8
+
+/**
+ * GET and FETCH requests that are identical (have the same cache-key) to one
+ * whose handler has registered an async (see coap_register_async()) and left
+ * the response empty are not passed to the handler.  They are acknowledged,
+ * and sent a copy of the response once the handler answers the first
+ * request.  This is for resources with handlers that take a while to produce
+ * a response.  Observe and Block1 requests are not collapsed.
+ */
+#define COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS  0x10
+
 /**
  * Creates a new resource object and initializes the link field to the string
  * @p uri_path. This function returns the new coap_resource_t object.
@@ -101,6 +121,16 @@ typedef void (*coap_method_handler_t)
  *                  If this flag is set, coap-observe notifications
  *                  will be sent non-confirmable by default.@n
  *
+ *                 COAP_RESOURCE_FLAGS_CACHE_RESPONSES
+ *                  If this flag is set, GET and FETCH responses are
+ *                  cached and sent without calling the handler until
+ *                  their Max-Age expires or the resource changes.@n
+ *
+ *                 COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS
+ *                  If this flag is set, GET and FETCH requests that are
+ *                  identical to one being handled asynchronously get a
+ *                  copy of its response.@n
+ *
  *                  If flags is set to 0 then the
  *                  COAP_RESOURCE_FLAGS_NOTIFY_NON is considered.
  *
@@ -114,9 +114,32 @@ coap_find_async(coap_context_t *context, coap_session_t *session,
   return tmp;
 }
 
+/* Triggers the requests following s, so that the handler answers each of
+ * them */
+static void
+async_release_followers(coap_async_t *s) {
+  coap_async_t *follower, *ftmp;
+
+  LL_FOREACH_SAFE2(s->followers, follower, ftmp, f_next) {
+    follower->leader = NULL;
+    follower->f_next = NULL;
+    coap_async_set_delay(follower, 1);
+  }
+  s->followers = NULL;
+}
+
 void
 coap_free_async(coap_context_t *context, coap_async_t *s) {
   if (s) {
+    /* Requests following this one, which has not been answered, are now
+     * left to the handler */
+    async_release_followers(s);
+    if (s->cache_key) {
+      HASH_DELETE(hh, context->async_collapse, s);
+      coap_delete_cache_key(s->cache_key);
+    }
+    if (s->leader)
+      LL_DELETE2(s->leader->followers, s, f_next);
     LL_DELETE(context->async_state,s);
     if (s->session) {
       coap_session_release(s->session);
@@ -139,6 +162,124 @@ coap_delete_all_async(coap_context_t *context) {
   context->async_state = NULL;
 }
 
+/* Checks whether request can be collapsed with identical ones */
+static int
+async_collapse_eligible(const coap_pdu_t *request) {
+  coap_opt_iterator_t opt_iter;
+
+  if (request->code != COAP_REQUEST_CODE_GET &&
+      request->code != COAP_REQUEST_CODE_FETCH)
+    return 0;
+  if (coap_check_option(request, COAP_OPTION_OBSERVE, &opt_iter) ||
+      coap_check_option(request, COAP_OPTION_BLOCK1, &opt_iter))
+    return 0;
+  return 1;
+}
+
+int
+coap_async_collapse_join(coap_context_t *context, coap_session_t *session,
+                         coap_resource_t *resource, coap_pdu_t *request) {
+  coap_binary_t token = { request->token_length, request->token };
+  coap_cache_key_t *cache_key;
+  coap_async_t *leader;
+  coap_async_t *s;
+
+  if (!context->async_collapse || !async_collapse_eligible(request) ||
+      coap_find_async(context, session, token))
+    return 0;
+  cache_key = coap_cache_derive_key(session, request,
+                                    COAP_CACHE_NOT_SESSION_BASED);
+  if (!cache_key)
+    return 0;
+  HASH_FIND(hh, context->async_collapse, cache_key->key,
+            sizeof(cache_key->key), leader);
+  if (leader && (leader->resource != resource ||
+                 !coap_cache_key_verify(cache_key, leader->cache_key)))
+    leader = NULL;
+  coap_delete_cache_key(cache_key);
+  if (!leader)
+    return 0;
+
+  /* Wait for the leader to be answered */
+  s = coap_register_async(context, session, request, 0);
+  if (!s)
+    return 0;
+  s->leader = leader;
+  LL_APPEND2(leader->followers, s, f_next);
+  coap_log(LOG_DEBUG, "   %s: Request collapsed into one being handled\n",
+           coap_session_str(session));
+  return 1;
+}
+
+void
+coap_async_collapse_update(coap_context_t *context, coap_session_t *session,
+                           coap_resource_t *resource, coap_pdu_t *request,
+                           const coap_pdu_t *response) {
+  coap_binary_t token = { request->token_length, request->token };
+  coap_async_t *async = coap_find_async(context, session, token);
+  coap_async_t *follower, *ftmp;
+  coap_async_t *leader;
+  coap_cache_key_t *cache_key;
+  size_t len;
+  const uint8_t *data;
+
+  if (!async || async->leader)
+    return;
+
+  if (response->code == 0) {
+    /* The handler will answer later, so identical requests can follow */
+    if (async->cache_key || !async_collapse_eligible(request))
+      return;
+    cache_key = coap_cache_derive_key(session, request,
+                                      COAP_CACHE_NOT_SESSION_BASED);
+    if (!cache_key)
+      return;
+    HASH_FIND(hh, context->async_collapse, cache_key->key,
+              sizeof(cache_key->key), leader);
+    if (leader) {
+      coap_delete_cache_key(cache_key);
+      return;
+    }
+    async->cache_key = cache_key;
+    async->resource = resource;
+    HASH_ADD_KEYPTR(hh, context->async_collapse, cache_key->key,
+                    sizeof(cache_key->key), async);
+    return;
+  }
+
+  if (!async->cache_key)
+    return;
+  HASH_DELETE(hh, context->async_collapse, async);
+  coap_delete_cache_key(async->cache_key);
+  async->cache_key = NULL;
+  if (response->lg_xmit) {
+    /* A body sent with Block2 is left to the handler for each of them */
+    async_release_followers(async);
+    return;
+  }
+
+  LL_FOREACH_SAFE2(async->followers, follower, ftmp, f_next) {
+    coap_pdu_t *pdu = coap_pdu_duplicate(response, follower->session,
+                                         follower->pdu->token_length,
+                                         follower->pdu->token, NULL);
+
+    if (pdu) {
+      pdu->type = follower->pdu->type == COAP_MESSAGE_CON ?
+                    COAP_MESSAGE_CON : COAP_MESSAGE_NON;
+      if (coap_get_data(response, &len, &data) &&
+          !coap_add_data(pdu, len, data)) {
+        coap_delete_pdu(pdu);
+        pdu = NULL;
+      }
+    }
+    if (!pdu || coap_send(follower->session, pdu) == COAP_INVALID_MID) {
+      coap_log(LOG_DEBUG, "   %s: cannot send collapsed response\n",
+               coap_session_str(follower->session));
+    }
+    coap_free_async(context, follower);
+  }
+}
+
 void
 coap_async_set_app_data(coap_async_t *async, void *app_data) {
   async->appdata = app_data;
@@ -59,6 +59,44 @@ coap_get_block(coap_pdu_t *pdu, coap_option_num_t number, coap_block_t *block) {
   return 0;
 }
 
+int
+coap_get_block_b(const coap_session_t *session, coap_pdu_t *pdu,
+                 coap_option_num_t number, coap_block_b_t *block) {
+  coap_block_t block_l;
+
+  assert(block);
+  memset(block, 0, sizeof(coap_block_b_t));
+
+  if (!coap_get_block(pdu, number, &block_l))
+    return 0;
+
+  block->num = block_l.num;
+  block->m = block_l.m;
+  block->aszx = block_l.szx;
+  if (block_l.szx == COAP_BERT_SZX) {
+    /*
+     * BERT is interpreted as SZX 6, but the payload can contain
+     * multiple blocks https://tools.ietf.org/html/rfc8323#section-6
+     * For unreliable sessions SZX 7 is reserved and so is treated as SZX 6.
+     */
+    block->szx = COAP_BERT_SZX - 1;
+    block->chunk_size = (size_t)1 << (block->szx + 4);
+    if (session && COAP_PROTO_RELIABLE(session->proto)) {
+      size_t length;
+      const uint8_t *data;
+
+      block->bert = 1;
+      if (coap_get_data(pdu, &length, &data) && length > block->chunk_size)
+        block->chunk_size = length;
+    }
+  }
+  else {
+    block->szx = block_l.szx;
+    block->chunk_size = (size_t)1 << (block->szx + 4);
+  }
+  return 1;
+}
+
 int
 coap_write_block_opt(coap_block_t *block, coap_option_num_t number,
                      coap_pdu_t *pdu, size_t data_length) {
@@ -162,6 +200,10 @@ coap_add_data_blocked_response(coap_resource_t *resource,
   if (request) {
     if (coap_get_block(request, COAP_OPTION_BLOCK2, &block2)) {
       block2_requested = 1;
+      if (block2.szx == COAP_BERT_SZX) {
+        /* BERT is the same as SZX 6 with potentially multiple blocks */
+        block2.szx = COAP_BERT_SZX - 1;
+      }
       if (block2.num != 0 && length <= (block2.num << (block2.szx + 4))) {
         coap_log(LOG_DEBUG, "Illegal block requested (%d > last = %zu)\n",
                  block2.num,
@@ -268,37 +310,137 @@ coap_context_set_block_mode(coap_context_t *context,
     context->block_mode = 0;
 }
 
+COAP_STATIC_INLINE int
+full_match(const uint8_t *a, size_t alen,
+  const uint8_t *b, size_t blen) {
+  return alen == blen && (alen == 0 || memcmp(a, b, alen) == 0);
+}
+
+/*
+ * The payload size carried by each PDU of a large transmission.
+ */
+COAP_STATIC_INLINE size_t
+lg_xmit_chunk(const coap_lg_xmit_t *lg_xmit) {
+  if (lg_xmit->blk_size == COAP_BERT_SZX)
+    return lg_xmit->bert_size;
+  return (size_t)1 << (lg_xmit->blk_size + 4);
+}
+
+/*
+ * The size of the data that a block number step represents for a large
+ * transmission (BERT block numbers are in 1024 byte units).
+ */
+COAP_STATIC_INLINE size_t
+lg_xmit_unit(const coap_lg_xmit_t *lg_xmit) {
+  if (lg_xmit->blk_size == COAP_BERT_SZX)
+    return (size_t)1 << (COAP_BERT_SZX - 1 + 4);
+  return (size_t)1 << (lg_xmit->blk_size + 4);
+}
+
+/*
+ * The time in ticks that a large transfer is kept without any activity.
+ */
+COAP_STATIC_INLINE coap_tick_t
+lg_partial_timeout(const coap_session_t *session) {
+  return (coap_tick_t)COAP_EXCHANGE_LIFETIME(session) * COAP_TICKS_PER_SECOND;
+}
+
+/*
+ * Record activity on a large transfer, keeping the session's earliest
+ * large transfer expiry time up to date.
+ */
+static void
+lg_set_last_used(coap_session_t *session, coap_tick_t *last_used) {
+  coap_tick_t expire;
+
+  coap_ticks(last_used);
+  expire = *last_used + lg_partial_timeout(session);
+  if (session->lg_expire == 0 || expire < session->lg_expire)
+    session->lg_expire = expire;
+}
+
 /*
- * The block token match only matches on the bottom 32 bits
+ * BLOCK1 lg_xmit are keyed on the bottom 32 bits of the token, which stay
+ * the same for all the PDUs of the transmission.
  * [The upper 32 bits are incremented as different payloads are sent]
- *
  */
-COAP_STATIC_INLINE int
-block_token_match(const uint8_t *a, size_t alen,
-  const uint8_t *b, size_t blen) {
-  size_t bias;
-  if (blen < 4)
-    return alen == blen && memcmp(a, b, blen) == 0;
-  bias = blen - 4;
-  return alen == blen && memcmp(a+bias, b+bias, 4) == 0;
+static void
+lg_xmit_b1_key(coap_lg_xmit_key_t *key, const uint8_t *token,
+               size_t token_length) {
+  memset(key, 0, sizeof(*key));
+  key->id = (uint32_t)(coap_decode_var_bytes8(token, token_length) &
+                       0xffffffff);
 }
 
-COAP_STATIC_INLINE int
-full_match(const uint8_t *a, size_t alen,
-  const uint8_t *b, size_t blen) {
-  return alen == blen && (alen == 0 || memcmp(a, b, alen) == 0);
+/*
+ * BLOCK2 lg_xmit are keyed on resource and a hash of the query, so the
+ * query needs to be checked on a match.
+ */
+static void
+lg_xmit_b2_key(coap_lg_xmit_key_t *key, coap_resource_t *resource,
+               const coap_string_t *query) {
+  coap_key_t qhash;
+
+  memset(key, 0, sizeof(*key));
+  memset(qhash, 0, sizeof(qhash));
+  if (query)
+    coap_hash(query->s, query->length, qhash);
+  key->resource = resource;
+  memcpy(&key->id, qhash, sizeof(key->id));
+}
+
+static coap_lg_xmit_t *
+lg_xmit_find_b2(coap_session_t *session, coap_resource_t *resource,
+                const coap_string_t *query) {
+  coap_lg_xmit_key_t key;
+  coap_lg_xmit_t *lg_xmit;
+  coap_lg_xmit_t *q;
+  coap_string_t empty = { 0, NULL};
+
+  lg_xmit_b2_key(&key, resource, query);
+  LG_XMIT_FIND(session->lg_xmit, key, lg_xmit);
+  if (lg_xmit &&
+      coap_string_equal(query ? query : &empty,
+                        lg_xmit->b.b2.query ? lg_xmit->b.b2.query : &empty))
+    return lg_xmit;
+  if (!lg_xmit)
+    return NULL;
+
+  /* Query hash collision - need to check them all */
+  LG_XMIT_ITER(session->lg_xmit, lg_xmit, q) {
+    if (!COAP_PDU_IS_REQUEST(&lg_xmit->pdu) &&
+        resource == lg_xmit->b.b2.resource &&
+        coap_string_equal(query ? query : &empty,
+                        lg_xmit->b.b2.query ? lg_xmit->b.b2.query : &empty))
+      return lg_xmit;
+  }
+  return NULL;
+}
+
+/*
+ * The token of a lg_crcv is the hash key, so the entry needs to be re-hashed
+ * when the token changes.
+ */
+static void
+lg_crcv_update_token(coap_session_t *session, coap_lg_crcv_t *lg_crcv,
+                     const uint8_t *token, size_t token_length) {
+  LG_CRCV_DELETE(session->lg_crcv, lg_crcv);
+  memcpy(lg_crcv->token, token, token_length);
+  lg_crcv->token_length = token_length;
+  LG_CRCV_ADD(session->lg_crcv, lg_crcv);
 }
 
 int
 coap_cancel_observe(coap_session_t *session, coap_binary_t *token,
                     coap_pdu_type_t type) {
   coap_lg_crcv_t *cq;
+  coap_lg_crcv_t *ctmp;
 
   assert(session);
   if (!session)
     return 0;
 
-  LL_FOREACH(session->lg_crcv, cq) {
+  LG_CRCV_ITER(session->lg_crcv, cq, ctmp) {
     if (cq->observe_set) {
       if ((!token && !cq->app_token->length) || (token &&
           full_match(token->s, token->length, cq->app_token->s,
@@ -331,6 +473,105 @@ coap_cancel_observe(coap_session_t *session, coap_binary_t *token,
   return 0;
 }
 
+/*
+ * Find a shared large body in the context for the same representation,
+ * no longer sharing any whose Max-Age has lapsed.
+ */
+static coap_lg_body_t *
+find_lg_body(coap_context_t *context, coap_resource_t *resource,
+             const coap_string_t *query, uint64_t etag, size_t length) {
+  coap_lg_body_t *body;
+  coap_lg_body_t *q;
+  coap_string_t empty = { 0, NULL};
+  coap_tick_t now;
+  coap_time_t now_rt;
+
+  coap_ticks(&now);
+  now_rt = coap_ticks_to_rt(now);
+  LL_FOREACH_SAFE(context->lg_body, body, q) {
+    if (body->maxage_expire && body->maxage_expire <= now_rt) {
+      /* Still in use by an lg_xmit, so just stop sharing it */
+      LL_DELETE(context->lg_body, body);
+      body->linked = 0;
+      continue;
+    }
+    if (body->resource == resource && body->etag == etag &&
+        body->length == length &&
+        coap_string_equal(query ? query : &empty,
+                          body->query ? body->query : &empty)) {
+      return body;
+    }
+  }
+  return NULL;
+}
+
+static coap_lg_body_t *
+new_lg_body(coap_context_t *context, coap_resource_t *resource,
+            const coap_string_t *query, uint64_t etag, int maxage,
+            size_t length, const uint8_t *data,
+            coap_release_large_data_t release_func, void *app_ptr) {
+  coap_lg_body_t *body;
+
+  body = coap_malloc_type(COAP_LG_BODY, sizeof(coap_lg_body_t));
+  if (!body)
+    return NULL;
+  memset(body, 0, sizeof(coap_lg_body_t));
+  if (query) {
+    body->query = coap_new_string(query->length);
+    if (!body->query) {
+      coap_free_type(COAP_LG_BODY, body);
+      return NULL;
+    }
+    memcpy(body->query->s, query->s, query->length);
+  }
+  body->resource = resource;
+  body->etag = etag;
+  if (maxage >= 0) {
+    coap_tick_t now;
+
+    coap_ticks(&now);
+    body->maxage_expire = coap_ticks_to_rt(now) + maxage;
+  }
+  body->ref = 1;
+  body->data = data;
+  body->length = length;
+  body->release_func = release_func;
+  body->app_ptr = app_ptr;
+  body->linked = 1;
+  LL_PREPEND(context->lg_body, body);
+  return body;
+}
+
+static void
+release_lg_body(coap_session_t *session, coap_lg_body_t *body) {
+  assert(body->ref);
+  if (--body->ref)
+    return;
+
+  if (body->linked)
+    LL_DELETE(session->context->lg_body, body);
+  if (body->release_func)
+    body->release_func(session, body->app_ptr);
+  coap_delete_string(body->query);
+  coap_log(LOG_DEBUG, "** %s: lg_body %p released\n",
+           coap_session_str(session), (void*)body);
+  coap_free_type(COAP_LG_BODY, body);
+}
+
+void
+coap_block_unlink_lg_bodies(coap_context_t *context,
+                            coap_resource_t *resource) {
+  coap_lg_body_t *body;
+  coap_lg_body_t *q;
+
+  LL_FOREACH_SAFE(context->lg_body, body, q) {
+    if (resource == NULL || body->resource == resource) {
+      LL_DELETE(context->lg_body, body);
+      body->linked = 0;
+    }
+  }
+}
+
 int
 coap_add_data_large_internal(coap_session_t *session,
                              coap_pdu_t *pdu,
@@ -344,7 +585,7 @@ coap_add_data_large_internal(coap_session_t *session,
                              void *app_ptr) {
 
   ssize_t avail;
-  coap_block_t block;
+  coap_block_b_t block;
   size_t chunk;
   coap_lg_xmit_t *lg_xmit = NULL;
   uint8_t buf[8];
@@ -376,12 +617,13 @@ coap_add_data_large_internal(coap_session_t *session,
     option = COAP_OPTION_BLOCK1;
 
     /* See if this token is already in use for large bodies (unlikely) */
-    LL_FOREACH_SAFE(session->lg_xmit, lg_xmit, q) {
-      if (full_match(pdu->token, pdu->token_length,
+    LG_XMIT_ITER(session->lg_xmit, lg_xmit, q) {
+      if (COAP_PDU_IS_REQUEST(&lg_xmit->pdu) &&
+          full_match(pdu->token, pdu->token_length,
                      lg_xmit->b.b1.app_token->s,
                      lg_xmit->b.b1.app_token->length)) {
         /* Unfortunately need to free this off as potential size change */
-        LL_DELETE(session->lg_xmit, lg_xmit);
+        LG_XMIT_DELETE(session->lg_xmit, lg_xmit);
         coap_block_delete_lg_xmit(session, lg_xmit);
         lg_xmit = NULL;
         break;
@@ -390,23 +632,16 @@ coap_add_data_large_internal(coap_session_t *session,
   }
   else {
     /* Have to assume that it is a response even if code is 0.00 */
-    coap_lg_xmit_t *q;
-    coap_string_t empty = { 0, NULL};
-
     assert(resource);
     option = COAP_OPTION_BLOCK2;
 
     /* Check if resource+query is already in use for large bodies (unlikely) */
-    LL_FOREACH_SAFE(session->lg_xmit, lg_xmit, q) {
-      if (resource == lg_xmit->b.b2.resource &&
-          coap_string_equal(query ? query : &empty,
-                         lg_xmit->b.b2.query ? lg_xmit->b.b2.query : &empty)) {
-        /* Unfortunately need to free this off as potential size change */
-        LL_DELETE(session->lg_xmit, lg_xmit);
-        coap_block_delete_lg_xmit(session, lg_xmit);
-        lg_xmit = NULL;
-        break;
-      }
+    lg_xmit = lg_xmit_find_b2(session, resource, query);
+    if (lg_xmit) {
+      /* Unfortunately need to free this off as potential size change */
+      LG_XMIT_DELETE(session->lg_xmit, lg_xmit);
+      coap_block_delete_lg_xmit(session, lg_xmit);
+      lg_xmit = NULL;
     }
   }
 
@@ -414,9 +649,11 @@ coap_add_data_large_internal(coap_session_t *session,
   /* May need token of length 8, so account for this */
   avail -= (pdu->token_length <= 8) ? pdu->token_length <= 8 : 0;
   blk_size = coap_flsll((long long)avail) - 4 - 1;
+  if (blk_size > COAP_MAX_BLOCK_SZX)
+    blk_size = COAP_MAX_BLOCK_SZX;
 
   /* see if BLOCKx defined - if so update blk_size as given by app */
-  if (coap_get_block(pdu, option, &block)) {
+  if (coap_get_block_b(session, pdu, option, &block)) {
     if (block.szx < blk_size)
       blk_size = block.szx;
     have_block_defined = 1;
@@ -454,10 +691,13 @@ coap_add_data_large_internal(coap_session_t *session,
     /* Only add in lg_xmit if more than one block needs to be handled */
     uint64_t token;
     size_t rem;
+    coap_lg_xmit_key_t key;
+    coap_lg_xmit_t *in_use;
 
     lg_xmit = coap_malloc_type(COAP_LG_XMIT, sizeof(coap_lg_xmit_t));
     if (!lg_xmit)
       goto fail;
+    memset(lg_xmit, 0, sizeof(coap_lg_xmit_t));
 
     coap_log(LOG_DEBUG, "** %s: lg_xmit %p initialized\n",
              coap_session_str(session), (void*)lg_xmit);
@@ -470,6 +710,7 @@ coap_add_data_large_internal(coap_session_t *session,
     pdu->body_length = 0;
     /* Update lg_xmit with large data information */
     lg_xmit->blk_size = blk_size;
+    lg_xmit->bert_size = 0;
     lg_xmit->option = option;
     lg_xmit->data = data;
     lg_xmit->length = length;
@@ -478,6 +719,8 @@ coap_add_data_large_internal(coap_session_t *session,
     lg_xmit->last_payload = 0;
     lg_xmit->last_used = 0;
     lg_xmit->app_ptr = app_ptr;
+    /* lg_xmit now owns data */
+    release_func = NULL;
     if (COAP_PDU_IS_REQUEST(pdu)) {
       /* Need to keep original token for updating response PDUs */
       lg_xmit->b.b1.app_token = coap_new_binary(pdu->token_length);
@@ -485,14 +728,20 @@ coap_add_data_large_internal(coap_session_t *session,
         goto fail;
       memcpy(lg_xmit->b.b1.app_token->s, pdu->token, pdu->token_length);
       /*
-       * Need to set up new token for use during transmits
+       * Need to set up new token for use during transmits, whose bottom
+       * 32 bits (the hash key) must not be in use by another lg_xmit
        */
       lg_xmit->b.b1.count = 1;
-      token = ((++session->tx_token) & 0xffffffff) +
-              ((uint64_t)lg_xmit->b.b1.count << 32);
-      memset(lg_xmit->b.b1.token, 0, sizeof(lg_xmit->b.b1.token));
-      lg_xmit->b.b1.token_length = coap_encode_var_safe8(lg_xmit->b.b1.token,
-                                                         sizeof(token), token);
+      do {
+        token = ((++session->tx_token) & 0xffffffff) +
+                ((uint64_t)lg_xmit->b.b1.count << 32);
+        memset(lg_xmit->b.b1.token, 0, sizeof(lg_xmit->b.b1.token));
+        lg_xmit->b.b1.token_length = coap_encode_var_safe8(lg_xmit->b.b1.token,
+                                                           sizeof(token),
+                                                           token);
+        lg_xmit_b1_key(&key, lg_xmit->b.b1.token, lg_xmit->b.b1.token_length);
+        LG_XMIT_FIND(session->lg_xmit, key, in_use);
+      } while (in_use);
       /*
        * Token will be updated in pdu later as original pdu may be needed in
        * coap_send_large()
@@ -519,6 +768,36 @@ coap_add_data_large_internal(coap_session_t *session,
         lg_xmit->b.b2.query = NULL;
       }
       lg_xmit->b.b2.etag = etag;
+      /* Expire if there are no further requests for this body */
+      lg_set_last_used(session, &lg_xmit->last_used);
+      if (etag != 0) {
+        /*
+         * The application has identified the representation, so share
+         * the body with any other sessions transmitting the same one.
+         */
+        coap_lg_body_t *body = find_lg_body(session->context, resource,
+                                            query, etag, length);
+
+        if (body) {
+          body->ref++;
+          coap_log(LOG_DEBUG, "** %s: lg_body %p shared (%u)\n",
+                   coap_session_str(session), (void*)body, body->ref);
+          /* Application copy of the data is no longer needed */
+          if (lg_xmit->release_func)
+            lg_xmit->release_func(session, lg_xmit->app_ptr);
+        }
+        else {
+          body = new_lg_body(session->context, resource, query, etag,
+                             maxage, length, data,
+                             lg_xmit->release_func, lg_xmit->app_ptr);
+          if (!body)
+            goto fail;
+        }
+        lg_xmit->body = body;
+        lg_xmit->release_func = NULL;
+        lg_xmit->app_ptr = NULL;
+        lg_xmit->data = data = body->data;
+      }
       if (maxage >= 0) {
         coap_tick_t now;
 
@@ -587,17 +866,43 @@ coap_add_data_large_internal(coap_session_t *session,
                         (block.num << 4) | (block.m << 3) | lg_xmit->blk_size),
                    buf);
     }
+    else if (lg_xmit->blk_size == COAP_BERT_SZX - 1 &&
+             COAP_SESSION_BERT(session) &&
+             avail >= (ssize_t)(2 * chunk + 8)) {
+      /*
+       * Peer supports BERT, so carry as many 1024 byte blocks as will
+       * fit into each PDU https://tools.ietf.org/html/rfc8323#section-6
+       * Allow for the token potentially growing to 8 bytes in subsequent
+       * PDUs.
+       */
+      lg_xmit->bert_size = ((avail - 8) / chunk) * chunk;
+      lg_xmit->blk_size = COAP_BERT_SZX;
+      chunk = lg_xmit->bert_size;
+      block.m = ((block.num << (COAP_BERT_SZX - 1 + 4)) + chunk) <
+                lg_xmit->length;
+      coap_update_option(pdu,
+                  lg_xmit->option,
+                  coap_encode_var_safe(buf, sizeof(buf),
+                        (block.num << 4) | (block.m << 3) | lg_xmit->blk_size),
+                   buf);
+    }
 
+    lg_xmit->offset = block.num * lg_xmit_unit(lg_xmit);
     rem = chunk;
-    if (chunk > lg_xmit->length - block.num * chunk)
-      rem = lg_xmit->length - block.num * chunk;
-    if (!coap_add_data(pdu, rem, &data[block.num * chunk]))
+    if (chunk > lg_xmit->length - lg_xmit->offset)
+      rem = lg_xmit->length - lg_xmit->offset;
+    if (!coap_add_data(pdu, rem, &data[lg_xmit->offset]))
       goto fail;
 
     lg_xmit->last_block = -1;
 
     /* Link the new lg_xmit in */
-    LL_PREPEND(session->lg_xmit,lg_xmit);
+    if (COAP_PDU_IS_REQUEST(pdu))
+      lg_xmit_b1_key(&lg_xmit->key, lg_xmit->b.b1.token,
+                     lg_xmit->b.b1.token_length);
+    else
+      lg_xmit_b2_key(&lg_xmit->key, resource, query);
+    LG_XMIT_ADD(session->lg_xmit, lg_xmit);
   }
   else {
     /* No need to use blocks */
@@ -665,6 +970,10 @@ coap_add_data_large_response(coap_resource_t *resource,
   if (request) {
     if (coap_get_block(request, COAP_OPTION_BLOCK2, &block)) {
       block_requested = 1;
+      if (block.szx == COAP_BERT_SZX) {
+        /* BERT is the same as SZX 6 with potentially multiple blocks */
+        block.szx = COAP_BERT_SZX - 1;
+      }
       if (block.num != 0 && length <= (block.num << (block.szx + 4))) {
         coap_log(LOG_DEBUG, "Illegal block requested (%d > last = %zu)\n",
                  block.num,
@@ -677,6 +986,8 @@ coap_add_data_large_response(coap_resource_t *resource,
   else if (subscription && subscription->has_block2) {
     block = subscription->block;
     block.num = 0;
+    if (block.szx == COAP_BERT_SZX)
+      block.szx = COAP_BERT_SZX - 1;
     block_requested = 1;
     block_opt = COAP_OPTION_BLOCK2;
   }
@@ -752,14 +1063,14 @@ coap_tick_t
 coap_block_check_lg_crcv_timeouts(coap_session_t *session, coap_tick_t now) {
   coap_lg_crcv_t *p;
   coap_lg_crcv_t *q;
-  coap_tick_t partial_timeout = COAP_EXCHANGE_LIFETIME(session);
+  coap_tick_t partial_timeout = lg_partial_timeout(session);
   coap_tick_t tim_rem = -1;
 
-  LL_FOREACH_SAFE(session->lg_crcv, p, q) {
+  LG_CRCV_ITER(session->lg_crcv, p, q) {
     if (!p->observe_set && p->last_used &&
         p->last_used + partial_timeout <= now) {
       /* Expire this entry */
-      LL_DELETE(session->lg_crcv, p);
+      LG_CRCV_DELETE(session->lg_crcv, p);
       coap_block_delete_lg_crcv(session, p);
     }
     else if (!p->observe_set && p->last_used) {
@@ -806,13 +1117,13 @@ coap_tick_t
 coap_block_check_lg_srcv_timeouts(coap_session_t *session, coap_tick_t now) {
   coap_lg_srcv_t *p;
   coap_lg_srcv_t *q;
-  coap_tick_t partial_timeout = COAP_EXCHANGE_LIFETIME(session);
+  coap_tick_t partial_timeout = lg_partial_timeout(session);
   coap_tick_t tim_rem = -1;
 
-  LL_FOREACH_SAFE(session->lg_srcv, p, q) {
+  LG_SRCV_ITER(session->lg_srcv, p, q) {
     if (p->last_used && p->last_used + partial_timeout <= now) {
       /* Expire this entry */
-      LL_DELETE(session->lg_srcv, p);
+      LG_SRCV_DELETE(session->lg_srcv, p);
       coap_block_delete_lg_srcv(session, p);
     }
     else if (p->last_used) {
@@ -824,6 +1135,58 @@ coap_block_check_lg_srcv_timeouts(coap_session_t *session, coap_tick_t now) {
   return tim_rem;
 }
 
+coap_tick_t
+coap_block_check_lg_xmit_timeouts(coap_session_t *session, coap_tick_t now) {
+  coap_lg_xmit_t *p;
+  coap_lg_xmit_t *q;
+  coap_tick_t partial_timeout = lg_partial_timeout(session);
+  coap_tick_t tim_rem = -1;
+
+  LG_XMIT_ITER(session->lg_xmit, p, q) {
+    if (p->last_used && p->last_used + partial_timeout <= now) {
+      /* Expire this entry (and possibly the shared body) */
+      LG_XMIT_DELETE(session->lg_xmit, p);
+      coap_block_delete_lg_xmit(session, p);
+    }
+    else if (p->last_used) {
+      /* Delay until the lg_xmit needs to expire */
+      if (tim_rem > p->last_used + partial_timeout - now)
+        tim_rem = p->last_used + partial_timeout - now;
+    }
+  }
+  return tim_rem;
+}
+
+coap_tick_t
+coap_block_check_lg_timeouts(coap_session_t *session, coap_tick_t now) {
+  coap_tick_t tim_rem = -1;
+  coap_tick_t s_rem;
+
+  if (session->lg_expire == 0)
+    return tim_rem;
+  if (session->lg_expire > now)
+    return session->lg_expire - now;
+
+  /* At least one entry may have expired */
+  if (session->lg_xmit) {
+    s_rem = coap_block_check_lg_xmit_timeouts(session, now);
+    if (s_rem < tim_rem)
+      tim_rem = s_rem;
+  }
+  if (session->lg_crcv) {
+    s_rem = coap_block_check_lg_crcv_timeouts(session, now);
+    if (s_rem < tim_rem)
+      tim_rem = s_rem;
+  }
+  if (session->lg_srcv) {
+    s_rem = coap_block_check_lg_srcv_timeouts(session, now);
+    if (s_rem < tim_rem)
+      tim_rem = s_rem;
+  }
+  session->lg_expire = tim_rem == (coap_tick_t)-1 ? 0 : now + tim_rem;
+  return tim_rem;
+}
+
 coap_lg_crcv_t *
 coap_block_new_lg_crcv(coap_session_t *session, coap_pdu_t *pdu) {
   coap_lg_crcv_t *lg_crcv;
@@ -913,6 +1276,9 @@ coap_block_delete_lg_xmit(coap_session_t *session,
   if (lg_xmit->release_func) {
     lg_xmit->release_func(session, lg_xmit->app_ptr);
   }
+  if (lg_xmit->body) {
+    release_lg_body(session, lg_xmit->body);
+  }
   if (lg_xmit->pdu.token) {
     coap_free_type(COAP_PDU_BUF, lg_xmit->pdu.token - lg_xmit->pdu.hdr_size);
   }
@@ -972,15 +1338,16 @@ coap_handle_request_send_block(coap_session_t *session,
                                coap_resource_t *resource,
                                coap_string_t *query) {
   coap_lg_xmit_t *p;
-  coap_block_t block;
+  coap_block_b_t block;
   uint16_t block_opt = 0;
   uint32_t out_blocks[1];
   const char *error_phrase;
 
-  if (coap_get_block(pdu, COAP_OPTION_BLOCK2, &block)) {
+  if (coap_get_block_b(session, pdu, COAP_OPTION_BLOCK2, &block)) {
     block_opt = COAP_OPTION_BLOCK2;
   }
-  LL_FOREACH(session->lg_xmit, p) {
+  p = lg_xmit_find_b2(session, resource, query);
+  if (p) {
     size_t chunk;
     coap_opt_iterator_t opt_iter;
     coap_opt_iterator_t opt_b_iter;
@@ -988,21 +1355,14 @@ coap_handle_request_send_block(coap_session_t *session,
     uint32_t request_cnt, i;
     coap_opt_t *etag_opt = NULL;
     coap_pdu_t *out_pdu = response;
-    static coap_string_t empty = { 0, NULL};
 
-    if (COAP_PDU_IS_REQUEST(&p->pdu) || resource != p->b.b2.resource ||
-        !coap_string_equal(query ? query : &empty,
-                           p->b.b2.query ? p->b.b2.query : &empty)) {
-      /* try out the next one */
-      continue;
-    }
     etag_opt = coap_check_option(pdu, COAP_OPTION_ETAG, &opt_iter);
     if (etag_opt) {
       uint64_t etag = coap_decode_var_bytes8(coap_opt_value(etag_opt),
                                             coap_opt_length(etag_opt));
       if (etag != p->b.b2.etag) {
-        /* try out the next one */
-        continue;
+        /* Not a match */
+        return 0;
       }
       out_pdu->code = COAP_RESPONSE_CODE(203);
       return 1;
@@ -1013,12 +1373,15 @@ coap_handle_request_send_block(coap_session_t *session,
 
     /* lg_xmit (response) found */
 
-    chunk = (size_t)1 << (p->blk_size + 4);
+    chunk = lg_xmit_chunk(p);
     if (block_opt) {
       coap_log(LOG_DEBUG,
                "found Block option, block size is %zu, block nr. %u, M %d\n",
                (size_t)1 << (block.szx + 4), block.num, block.m);
-      if (block.szx != p->blk_size) {
+      if (block.bert && p->blk_size == COAP_BERT_SZX) {
+        /* Continuing with BERT */
+      }
+      else if (block.szx != p->blk_size) {
         if ((p->offset + chunk) % ((size_t)1 << (block.szx + 4)) == 0) {
           /*
            * Recompute the block number of the previous packet given
@@ -1035,12 +1398,16 @@ coap_handle_request_send_block(coap_session_t *session,
           coap_log(LOG_DEBUG,
                    "ignoring request to increase Block size, "
                    "next block is not aligned on requested block size "
-                   "boundary. (%zu x %u mod %u = %zu (which is not 0)\n",
-                   p->offset/chunk + 1, (1 << (p->blk_size + 4)),
+                   "boundary. (%zu x %zu mod %u = %zu (which is not 0)\n",
+                   p->offset/chunk + 1, chunk,
                    (1 << (block.szx + 4)),
                    (p->offset + chunk) % ((size_t)1 << (block.szx + 4)));
         }
       }
+      if (block.bert && p->blk_size != COAP_BERT_SZX) {
+        /* Not set up for BERT, so respond with SZX 6 blocks */
+        block.bert = 0;
+      }
     }
 
     request_cnt = 0;
@@ -1052,7 +1419,7 @@ coap_handle_request_send_block(coap_session_t *session,
       num = coap_opt_block_num(option);
       if (num > 0xFFFFF) /* 20 bits max for num */
         continue;
-      if (block.szx != COAP_OPT_BLOCK_SZX(option)) {
+      if (block.aszx != COAP_OPT_BLOCK_SZX(option)) {
         coap_add_data(response,
                       sizeof("Changing blocksize during request invalid")-1,
                  (const uint8_t *)"Changing blocksize during request invalid");
@@ -1064,7 +1431,8 @@ coap_handle_request_send_block(coap_session_t *session,
     }
     if (request_cnt == 0) {
       /* Block2 not found - give them the first block */
-      block.szx = p->blk_size;
+      block.bert = p->blk_size == COAP_BERT_SZX;
+      block.szx = block.bert ? COAP_BERT_SZX - 1 : p->blk_size;
       p->offset = 0;
       out_blocks[0] = 0;
       request_cnt = 1;
@@ -1074,7 +1442,8 @@ coap_handle_request_send_block(coap_session_t *session,
       uint8_t buf[8];
 
       block.num = out_blocks[i];
-      p->offset = block.num * chunk;
+      p->offset = block.num << (block.szx + 4);
+      chunk = block.bert ? p->bert_size : (size_t)1 << (block.szx + 4);
 
       if (i + 1 < request_cnt) {
         /* Need to set up a copy of the pdu to send */
@@ -1115,7 +1484,7 @@ coap_handle_request_send_block(coap_session_t *session,
                           sizeof(buf),
                           (block.num << 4) |
                            ((p->offset + chunk < p->length) << 3) |
-                           block.szx),
+                           (block.bert ? COAP_BERT_SZX : block.szx)),
                           buf)) {
         goto internal_issue;
       }
@@ -1131,7 +1500,7 @@ coap_handle_request_send_block(coap_session_t *session,
         else {
           rem = 0;
           /* Entry needs to be expired */
-          coap_ticks(&p->last_used);
+          lg_set_last_used(session, &p->last_used);
         }
         if (!coap_update_option(out_pdu, COAP_OPTION_MAXAGE,
                                 coap_encode_var_safe8(buf,
@@ -1142,13 +1511,14 @@ coap_handle_request_send_block(coap_session_t *session,
         }
       }
 
-      if (!etag_opt && !coap_add_block(out_pdu,
-                                       p->length,
-                                       p->data,
-                                       block.num,
-                                       block.szx)) {
+      if (!etag_opt && (p->offset >= p->length ||
+                        !coap_add_data(out_pdu,
+                                       min(p->length - p->offset, chunk),
+                                       p->data + p->offset))) {
         goto internal_issue;
       }
+      /* Expire if there are no further requests for this body */
+      lg_set_last_used(session, &p->last_used);
       if (i + 1 < request_cnt) {
         coap_send(session, out_pdu);
       }
@@ -1157,9 +1527,9 @@ coap_handle_request_send_block(coap_session_t *session,
 
 fail:
     /* Keep in cache for 4 * ACK_TIMOUT */
-    coap_ticks(&p->last_used);
+    lg_set_last_used(session, &p->last_used);
     goto skip_app_handler;
-  } /* end of LL_FOREACH() */
+  }
   return 0;
 
 skip_app_handler:
@@ -1228,6 +1598,36 @@ update_received_blocks(coap_rblock_t *rec_blocks, uint32_t block_num) {
   return 1;
 }
 
+/*
+ * Update the list of received blocks for all the blocks that are covered
+ * by the payload of @p length (there can be more than one if BERT).
+ */
+static int
+update_received_blocks_b(coap_rblock_t *rec_blocks,
+                         const coap_block_b_t *block, size_t length) {
+  size_t chunk = (size_t)1 << (block->szx + 4);
+  uint32_t count = 1;
+  uint32_t i;
+
+  if (block->bert && length > chunk)
+    count = (uint32_t)((length + chunk - 1) / chunk);
+  for (i = 0; i < count; i++) {
+    if (!update_received_blocks(rec_blocks, block->num + i))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * A BERT block with more to follow can only carry whole 1024 byte blocks
+ * https://tools.ietf.org/html/rfc8323#section-6
+ */
+COAP_STATIC_INLINE int
+bert_block_is_whole(const coap_block_b_t *block, size_t length) {
+  return !block->bert || !block->m ||
+         (length & (((size_t)1 << (block->szx + 4)) - 1)) == 0;
+}
+
 /*
  * Need to check if this is a large PUT / POST using multiple blocks
  *
@@ -1252,7 +1652,7 @@ coap_handle_request_put_block(coap_context_t *context,
   const uint8_t *data = NULL;
   size_t offset = 0;
   size_t total = 0;
-  coap_block_t block;
+  coap_block_b_t block;
   coap_opt_iterator_t opt_iter;
   uint16_t block_option = 0;
 
@@ -1260,9 +1660,15 @@ coap_handle_request_put_block(coap_context_t *context,
   pdu->body_offset = 0;
   pdu->body_total = length;
 
-  if (coap_get_block(pdu, COAP_OPTION_BLOCK1, &block)) {
+  if (coap_get_block_b(session, pdu, COAP_OPTION_BLOCK1, &block)) {
     block_option = COAP_OPTION_BLOCK1;
   }
+  if (block_option && !bert_block_is_whole(&block, length)) {
+    coap_add_data(response, sizeof("Incomplete BERT block")-1,
+                  (const uint8_t *)"Incomplete BERT block");
+    response->code = COAP_RESPONSE_CODE(400);
+    goto skip_app_handler;
+  }
   if (block_option) {
     coap_lg_srcv_t *p;
     coap_opt_t *size_opt = coap_check_option(pdu,
@@ -1279,15 +1685,7 @@ coap_handle_request_put_block(coap_context_t *context,
                                         coap_opt_length(size_opt)) : 0;
     offset = block.num << (block.szx + 4);
 
-    LL_FOREACH(session->lg_srcv, p) {
-      if (resource == p->resource) {
-        break;
-      }
-      if ((p->resource == context->unknown_resource ||
-           resource == context->proxy_uri_resource) &&
-          coap_string_equal(uri_path, p->uri_path))
-        break;
-    }
+    LG_SRCV_FIND(session->lg_srcv, uri_path, p);
     if (!p && block.num != 0) {
       /* random access - no need to track */
       pdu->body_data = data;
@@ -1308,9 +1706,14 @@ coap_handle_request_put_block(coap_context_t *context,
                coap_session_str(session), (void*)p);
       memset(p, 0, sizeof(coap_lg_srcv_t));
       p->resource = resource;
-      if (resource == context->unknown_resource ||
-          resource == context->proxy_uri_resource)
-        p->uri_path = coap_new_str_const(uri_path->s, uri_path->length);
+      p->uri_path = coap_new_str_const(uri_path->s, uri_path->length);
+      if (p->uri_path == NULL) {
+        coap_block_delete_lg_srcv(session, p);
+        coap_add_data(response, sizeof("Memory issue")-1,
+                      (const uint8_t *)"Memory issue");
+        response->code = COAP_RESPONSE_CODE(500);
+        goto skip_app_handler;
+      }
       p->content_format = fmt;
       p->total_len = total;
       p->amount_so_far = length;
@@ -1322,7 +1725,7 @@ coap_handle_request_put_block(coap_context_t *context,
         p->observe_set = 1;
       }
       p->body_data = NULL;
-      LL_PREPEND(session->lg_srcv, p);
+      LG_SRCV_ADD(session->lg_srcv, p);
     }
     if (p) {
       if (fmt != p->content_format) {
@@ -1339,7 +1742,7 @@ coap_handle_request_put_block(coap_context_t *context,
         size_t chunk = (size_t)1 << (block.szx + 4);
         if (!check_if_received_block(&p->rec_blocks, block.num)) {
           /* Update list of blocks received */
-          if (!update_received_blocks(&p->rec_blocks, block.num)) {
+          if (!update_received_blocks_b(&p->rec_blocks, &block, length)) {
             coap_handle_event(context, COAP_EVENT_PARTIAL_BLOCK, session);
             coap_add_data(response, sizeof("Too many missing blocks")-1,
                           (const uint8_t *)"Too many missing blocks");
@@ -1364,7 +1767,7 @@ coap_handle_request_put_block(coap_context_t *context,
                              coap_encode_var_safe(buf, sizeof(buf),
                                (block.num << 4) |
                                (block.m << 3) |
-                               block.szx),
+                               block.aszx),
                              buf);
             response->code = COAP_RESPONSE_CODE(231);
             goto skip_app_handler;
@@ -1393,7 +1796,7 @@ coap_handle_request_put_block(coap_context_t *context,
         /* Check if lg_xmit generated and update PDU code if so */
         coap_check_code_lg_xmit(session, response, resource, query);
         /* Last chunk - free off shortly */
-        coap_ticks(&p->last_used);
+        lg_set_last_used(session, &p->last_used);
         goto skip_app_handler;
       }
       else {
@@ -1412,7 +1815,7 @@ coap_handle_request_put_block(coap_context_t *context,
                            coap_encode_var_safe(buf, sizeof(buf),
                              (block.num << 4) |
                              (block.m << 3) |
-                             block.szx),
+                             block.aszx),
                            buf);
           h(context, resource, session, pdu, token, query, response);
           /* Check if lg_xmit generated and update PDU code if so */
@@ -1431,12 +1834,12 @@ coap_handle_request_put_block(coap_context_t *context,
 
       if (block.m == 0) {
         /* Last chunk - free off all */
-        coap_ticks(&p->last_used);
+        lg_set_last_used(session, &p->last_used);
       }
       goto call_app_handler;
 
 free_lg_recv:
-      LL_DELETE(session->lg_srcv, p);
+      LG_SRCV_DELETE(session->lg_srcv, p);
       coap_block_delete_lg_srcv(session, p);
       goto skip_app_handler;
     }
@@ -1465,23 +1868,27 @@ skip_app_handler:
 int
 coap_handle_response_send_block(coap_session_t *session, coap_pdu_t *rcvd) {
   coap_lg_xmit_t *p;
-  coap_lg_xmit_t *q;
+  coap_lg_xmit_key_t key;
 
-  LL_FOREACH_SAFE(session->lg_xmit, p, q) {
-    if (COAP_PDU_IS_REQUEST(&p->pdu) &&
-        !block_token_match(rcvd->token, rcvd->token_length,
-                    p->b.b1.token, p->b.b1.token_length)) {
-    }
+  /* Tokens used for large bodies always have the block count in the top */
+  if (rcvd->token_length <= 4)
+    return 0;
+  lg_xmit_b1_key(&key, rcvd->token, rcvd->token_length);
+  LG_XMIT_FIND(session->lg_xmit, key, p);
+  if (p && COAP_PDU_IS_REQUEST(&p->pdu)) {
     /* lg_xmit found */
-    size_t chunk = (size_t)1 << (p->blk_size + 4);
-    coap_block_t block;
+    size_t chunk = lg_xmit_chunk(p);
+    coap_block_b_t block;
 
     if (COAP_RESPONSE_CLASS(rcvd->code) == 2 &&
-        coap_get_block(rcvd, p->option, &block)) {
+        coap_get_block_b(session, rcvd, p->option, &block)) {
       coap_log(LOG_DEBUG,
                "found Block option, block size is %u, block nr. %u\n",
                1 << (block.szx + 4), block.num);
-      if (block.szx != p->blk_size) {
+      if (block.bert && p->blk_size == COAP_BERT_SZX) {
+        /* Continuing with BERT */
+      }
+      else if (block.szx != p->blk_size) {
         if ((p->offset + chunk) % ((size_t)1 << (block.szx + 4)) == 0) {
           /*
            * Recompute the block number of the previous packet given the
@@ -1497,8 +1904,8 @@ coap_handle_response_send_block(coap_session_t *session, coap_pdu_t *rcvd) {
         } else {
           coap_log(LOG_DEBUG, "ignoring request to increase Block size, "
              "next block is not aligned on requested block size boundary. "
-             "(%zu x %u mod %u = %zu != 0)\n",
-             p->offset/chunk + 1, (1 << (p->blk_size + 4)),
+             "(%zu x %zu mod %u = %zu != 0)\n",
+             p->offset/chunk + 1, chunk,
              (1 << (block.szx + 4)),
              (p->offset + chunk) % ((size_t)1 << (block.szx + 4)));
         }
@@ -1517,13 +1924,13 @@ coap_handle_response_send_block(coap_session_t *session, coap_pdu_t *rcvd) {
         return 1;
       }
       p->last_block = block.num;
-      p->offset = (block.num + 1) * chunk;
+      p->offset = block.num * lg_xmit_unit(p) + chunk;
       if (p->offset < p->length) {
         /* Build the next PDU request based off the skeletal PDU */
         uint8_t buf[8];
         coap_pdu_t *pdu;
-        uint64_t token = coap_decode_var_bytes8(p->pdu.token,
-                                                p->pdu.token_length);
+        uint64_t token = coap_decode_var_bytes8(p->b.b1.token,
+                                                p->b.b1.token_length);
         uint8_t ltoken[8];
         size_t ltoken_length;
 
@@ -1533,19 +1940,17 @@ coap_handle_response_send_block(coap_session_t *session, coap_pdu_t *rcvd) {
         if (!pdu)
           goto fail_body;
 
-        block.num++;
+        block.num = (uint32_t)(p->offset / lg_xmit_unit(p));
         coap_update_option(pdu, p->option,
                            coap_encode_var_safe(buf, sizeof(buf),
                              (block.num << 4) |
                              ((p->offset + chunk < p->length) << 3) |
-                             block.szx),
+                             p->blk_size),
                            buf);
 
-        if (!coap_add_block(pdu,
-                            p->length,
-                            p->data,
-                            block.num,
-                            block.szx))
+        if (!coap_add_data(pdu,
+                           min(p->length - p->offset, chunk),
+                           p->data + p->offset))
           goto fail_body;
         if (coap_send(session, pdu) == COAP_INVALID_MID)
           goto fail_body;
@@ -1560,14 +1965,13 @@ fail_body:
     coap_log(LOG_DEBUG, "PDU given to app\n");
     coap_show_pdu(LOG_DEBUG, rcvd);
 
-    LL_DELETE(session->lg_xmit, p);
+    LG_XMIT_DELETE(session->lg_xmit, p);
     coap_block_delete_lg_xmit(session, p);
     /*
      * There may be a block response after doing the large request
      * https://tools.ietf.org/html/rfc7959#section-3.3
      */
-    break;
-  } /* end of LL_FOREACH_SAFE */
+  }
   return 0;
 }
 
@@ -1634,22 +2038,18 @@ coap_handle_response_get_block(coap_context_t *context,
                         coap_recurse_t recursive) {
   coap_lg_crcv_t *p;
   int app_has_response = 0;
-  coap_block_t block = {0, 0, 0};
+  coap_block_b_t block;
   int have_block = 0;
   uint16_t block_opt = 0;
   size_t offset;
 
-  LL_FOREACH(session->lg_crcv, p) {
+  memset(&block, 0, sizeof(block));
+  LG_CRCV_FIND(session->lg_crcv, rcvd->token, rcvd->token_length, p);
+  if (p) {
     size_t chunk = 0;
     uint8_t buf[8];
     coap_opt_iterator_t opt_iter;
 
-    if (!full_match(rcvd->token, rcvd->token_length,
-                     p->token, p->token_length)) {
-      /* try out the next one */
-      continue;
-    }
-
     /* lg_crcv found */
 
     if (COAP_RESPONSE_CLASS(rcvd->code) == 2) {
@@ -1664,9 +2064,14 @@ coap_handle_response_get_block(coap_context_t *context,
       coap_get_data(rcvd, &length, &data);
       rcvd->body_offset = 0;
       rcvd->body_total = length;
-      if (coap_get_block(rcvd, COAP_OPTION_BLOCK2, &block)) {
+      if (coap_get_block_b(session, rcvd, COAP_OPTION_BLOCK2, &block)) {
         have_block = 1;
         block_opt = COAP_OPTION_BLOCK2;
+        if (!bert_block_is_whole(&block, length)) {
+          coap_log(LOG_WARNING, "** %s: incomplete BERT block %u\n",
+                   coap_session_str(session), block.num);
+          goto fail_resp;
+        }
       }
       if (have_block) {
         coap_opt_t *fmt_opt = coap_check_option(rcvd,
@@ -1731,12 +2136,11 @@ coap_handle_response_get_block(coap_context_t *context,
             if (!pdu)
               goto fail_resp;
 
-            memcpy(p->token, pdu->token, pdu->token_length);
-            p->token_length = pdu->token_length;
+            lg_crcv_update_token(session, p, pdu->token, pdu->token_length);
 
             coap_update_option(pdu, block_opt,
                                coap_encode_var_safe(buf, sizeof(buf),
-                                      (0 << 4) | (0 << 3) | block.szx),
+                                      (0 << 4) | (0 << 3) | block.aszx),
                                buf);
 
             if (coap_send(session, pdu) == COAP_INVALID_MID)
@@ -1775,7 +2179,7 @@ coap_handle_response_get_block(coap_context_t *context,
         }
         if (!check_if_received_block(&p->rec_blocks, block.num)) {
           /* Update list of blocks received */
-          if (!update_received_blocks(&p->rec_blocks, block.num)) {
+          if (!update_received_blocks_b(&p->rec_blocks, &block, length)) {
             coap_handle_event(context, COAP_EVENT_PARTIAL_BLOCK, session);
             goto fail_resp;
           }
@@ -1796,6 +2200,10 @@ coap_handle_response_get_block(coap_context_t *context,
             coap_pdu_t *pdu;
 
             if (block.m) {
+              /* BERT payloads can hold multiple blocks */
+              uint32_t next_num = block.num + (block.bert && length > chunk ?
+                                   (uint32_t)((length + chunk - 1) / chunk) : 1);
+
               block.m = 0;
 
               /* Ask for the next block */
@@ -1804,16 +2212,16 @@ coap_handle_response_get_block(coap_context_t *context,
               if (!pdu)
                 goto fail_resp;
 
-              memcpy(p->token, pdu->token, pdu->token_length);
-              p->token_length = pdu->token_length;
+              lg_crcv_update_token(session, p, pdu->token,
+                                   pdu->token_length);
 
               /* Only sent with the first block */
               coap_remove_option(pdu, COAP_OPTION_OBSERVE);
 
               coap_update_option(pdu, block_opt,
                                  coap_encode_var_safe(buf, sizeof(buf),
-                                   ((block.num + 1) << 4) |
-                                    (block.m << 3) | block.szx),
+                                   (next_num << 4) |
+                                    (block.m << 3) | block.aszx),
                                  buf);
 
               if (coap_send(session, pdu) == COAP_INVALID_MID)
@@ -1846,7 +2254,10 @@ coap_handle_response_get_block(coap_context_t *context,
             rcvd->body_offset = block.num*chunk;
             rcvd->body_total = size2;
           }
-          if (context->response_handler) {
+          if (session->proxy && session->proxy->upstream) {
+            coap_proxy_handle_response(session, rcvd);
+          }
+          else if (context->response_handler) {
             if (session->block_mode &
                   (COAP_BLOCK_SINGLE_BODY)) {
               coap_log(LOG_DEBUG, "Client app vesion of updated PDU\n");
@@ -1858,13 +2269,15 @@ coap_handle_response_get_block(coap_context_t *context,
           app_has_response = 1;
           /* Set up for the next data body if observing */
           p->initial = 1;
-          memcpy(p->token, p->base_token, p->base_token_length);
-          p->token_length = p->base_token_length;
+          lg_crcv_update_token(session, p, p->base_token,
+                               p->base_token_length);
           if (p->body_data) {
             coap_free_type(COAP_STRING, p->body_data);
             p->body_data = NULL;
           }
           else {
+            if (!p->observe_set)
+              lg_set_last_used(session, &p->last_used);
             goto skip_app_handler;
           }
         }
@@ -1884,10 +2297,13 @@ block_mode:
             rcvd->body_total = block.num*chunk + length;
             /* Set up for the next data body if observing */
             p->initial = 1;
-            memcpy(p->token, p->base_token, p->base_token_length);
-            p->token_length = p->base_token_length;
+            lg_crcv_update_token(session, p, p->base_token,
+                                 p->base_token_length);
+          }
+          if (session->proxy && session->proxy->upstream) {
+            coap_proxy_handle_response(session, rcvd);
           }
-          if (context->response_handler) {
+          else if (context->response_handler) {
             coap_log(LOG_DEBUG, "Client app vesion of updated PDU\n");
             coap_show_pdu(LOG_DEBUG, rcvd);
             context->response_handler(context, session, sent, rcvd,
@@ -1913,24 +2329,23 @@ block_mode:
     if (!block.m && !p->observe_set) {
 fail_resp:
       /* lg_crcv no longer required - cache it */
-      coap_ticks(&p->last_used);
+      lg_set_last_used(session, &p->last_used);
     }
     /* need to put back original token into rcvd */
     coap_update_token(rcvd, p->app_token->length, p->app_token->s);
-    break;
-  } /* LL_FOREACH() */
+  }
 
   /* Check if receiving a block response and if blocks can be set up */
   if (recursive == COAP_RECURSE_OK && !p) {
     if (!sent) {
-      if (coap_get_block(rcvd, COAP_OPTION_BLOCK2, &block)) {
+      if (coap_get_block_b(session, rcvd, COAP_OPTION_BLOCK2, &block)) {
         coap_log(LOG_DEBUG, "** %s: large body receive not supported by "
                  "libcoap unless coap_send_large() is used to transmit "
                  "request\n", coap_session_str(session));
       }
     }
     else if (COAP_RESPONSE_CLASS(rcvd->code) == 2) {
-      if (coap_get_block(rcvd, COAP_OPTION_BLOCK2, &block)) {
+      if (coap_get_block_b(session, rcvd, COAP_OPTION_BLOCK2, &block)) {
         have_block = 1;
         block_opt = COAP_OPTION_BLOCK2;
         if (block.num != 0) {
@@ -1949,7 +2364,7 @@ fail_resp:
         coap_lg_crcv_t *lg_crcv = coap_block_new_lg_crcv(session, sent);
 
         if (lg_crcv) {
-          LL_PREPEND(session->lg_crcv, lg_crcv);
+          LG_CRCV_ADD(session->lg_crcv, lg_crcv);
           return coap_handle_response_get_block(context, session, sent, rcvd,
                                                 COAP_RECURSE_NO);
         }
@@ -1970,20 +2385,11 @@ void
 coap_check_code_lg_xmit(coap_session_t *session, coap_pdu_t *response,
                         coap_resource_t *resource, coap_string_t *query) {
   coap_lg_xmit_t *lg_xmit;
-  coap_string_t empty = { 0, NULL};
 
   if (response->code == 0)
     return;
-  LL_FOREACH(session->lg_xmit, lg_xmit) {
-    if (!COAP_PDU_IS_REQUEST(&lg_xmit->pdu) &&
-        lg_xmit->b.b2.resource == resource &&
-        coap_string_equal(query ? query : &empty,
-                   lg_xmit->b.b2.query ? lg_xmit->b.b2.query : &empty)) {
-      /* lg_xmit found */
-      if (lg_xmit->pdu.code == 0) {
-        lg_xmit->pdu.code = response->code;
-        return;
-      }
-    }
+  lg_xmit = lg_xmit_find_b2(session, resource, query);
+  if (lg_xmit && lg_xmit->pdu.code == 0) {
+    lg_xmit->pdu.code = response->code;
   }
 }
@@ -61,10 +61,31 @@ coap_cache_ignore_options(coap_context_t *ctx,
   return 1;
 }
 
-coap_cache_key_t *
-coap_cache_derive_key(const coap_session_t *session,
-                      const coap_pdu_t *pdu,
-                      coap_cache_session_based_t session_based) {
+/* Returns 1 if option number is part of the cache-key.  ETag options are
+ * left out if skip_etag is set so that requests only differing in the
+ * representations they are validating share a key */
+static int
+cache_key_option(const coap_context_t *ctx, uint16_t number, int skip_etag) {
+  return is_cache_key(ctx, number) &&
+         !(skip_etag && number == COAP_OPTION_ETAG);
+}
+
+/* Fills in the per-option information used for the cache-key.  The option
+ * number is used rather than the encoded delta, which depends on any
+ * preceding options that are not part of the cache-key */
+static void
+cache_key_option_head(uint8_t head[4], uint16_t number, size_t length) {
+  head[0] = (uint8_t)(number >> 8);
+  head[1] = (uint8_t)number;
+  head[2] = (uint8_t)(length >> 8);
+  head[3] = (uint8_t)length;
+}
+
+static coap_cache_key_t *
+cache_derive_digest_key(const coap_session_t *session,
+                        const coap_pdu_t *pdu,
+                        coap_cache_session_based_t session_based,
+                        int skip_etag) {
   coap_opt_t *option;
   coap_opt_iterator_t opt_iter;
   coap_digest_ctx_t *dctx;
@@ -81,14 +102,19 @@ coap_cache_derive_key(const coap_session_t *session,
 
   if (session_based == COAP_CACHE_IS_SESSION_BASED) {
     /* Include the session ptr */
-    if (!coap_digest_update(dctx, (const uint8_t*)session, sizeof(session))) {
+    if (!coap_digest_update(dctx, (const uint8_t*)&session, sizeof(session))) {
       coap_digest_free(dctx);
       return NULL;
     }
   }
   while ((option = coap_option_next(&opt_iter))) {
-    if (is_cache_key(session->context, opt_iter.number)) {
-      if (!coap_digest_update(dctx, option, coap_opt_size(option))) {
+    if (cache_key_option(session->context, opt_iter.number, skip_etag)) {
+      size_t length = coap_opt_length(option);
+      uint8_t head[4];
+
+      cache_key_option_head(head, opt_iter.number, length);
+      if (!coap_digest_update(dctx, head, sizeof(head)) ||
+          !coap_digest_update(dctx, coap_opt_value(option), length)) {
         coap_digest_free(dctx);
         return NULL;
       }
@@ -115,15 +141,286 @@ coap_cache_derive_key(const coap_session_t *session,
   cache_key = coap_malloc_type(COAP_CACHE_KEY, sizeof(coap_cache_key_t));
   if (cache_key) {
     memcpy(cache_key->key, digest.key, sizeof(cache_key->key));
+    cache_key->data = NULL;
+  }
+  return cache_key;
+}
+
+#define SIP_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+    v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;                        \
+    v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;                        \
+    v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+  } while (0)
+
+static uint64_t
+sip_load64(const uint8_t *p) {
+  uint64_t v = 0;
+  int i;
+
+  for (i = 7; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+static void
+sip_store64(uint8_t *p, uint64_t v) {
+  int i;
+
+  for (i = 0; i < 8; i++, v >>= 8)
+    p[i] = (uint8_t)v;
+}
+
+/* SipHash-2-4 with a 128-bit output of in, keyed with the 16 byte key */
+void
+coap_siphash128(const uint8_t *key, const uint8_t *in, size_t inlen,
+                uint8_t out[16]) {
+  uint64_t k0 = sip_load64(key);
+  uint64_t k1 = sip_load64(key + 8);
+  uint64_t v0 = UINT64_C(0x736f6d6570736575) ^ k0;
+  uint64_t v1 = UINT64_C(0x646f72616e646f6d) ^ k1 ^ 0xee;
+  uint64_t v2 = UINT64_C(0x6c7967656e657261) ^ k0;
+  uint64_t v3 = UINT64_C(0x7465646279746573) ^ k1;
+  uint64_t b = (uint64_t)inlen << 56;
+  uint64_t m;
+  size_t i;
+
+  for (; inlen >= 8; inlen -= 8, in += 8) {
+    m = sip_load64(in);
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+  for (i = 0; i < inlen; i++)
+    b |= (uint64_t)in[i] << (8 * i);
+  v3 ^= b;
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+  v0 ^= b;
+
+  v2 ^= 0xee;
+  for (i = 0; i < 4; i++)
+    SIP_ROUND(v0, v1, v2, v3);
+  sip_store64(out, v0 ^ v1 ^ v2 ^ v3);
+  v1 ^= 0xdd;
+  for (i = 0; i < 4; i++)
+    SIP_ROUND(v0, v1, v2, v3);
+  sip_store64(out + 8, v0 ^ v1 ^ v2 ^ v3);
+}
+
+/* Writes the same information as is fed to the digest by
+ * cache_derive_digest_key() into buf, as far as size allows, and sets
+ * *length to the length of all of the information.  Returns 0 if pdu
+ * cannot be parsed. */
+static int
+cache_key_info(const coap_session_t *session, const coap_pdu_t *pdu,
+               coap_cache_session_based_t session_based, int skip_etag,
+               uint8_t *buf, size_t size, size_t *length_out) {
+  coap_opt_t *option;
+  coap_opt_iterator_t opt_iter;
+  size_t length = 0;
+
+  if (!coap_option_iterator_init(pdu, &opt_iter, COAP_OPT_ALL)) {
+    return 0;
+  }
+  if (session_based == COAP_CACHE_IS_SESSION_BASED) {
+    if (sizeof(session) <= size)
+      memcpy(buf, &session, sizeof(session));
+    length += sizeof(session);
+  }
+  while ((option = coap_option_next(&opt_iter))) {
+    if (cache_key_option(session->context, opt_iter.number, skip_etag)) {
+      size_t len = coap_opt_length(option);
+
+      if (length + 4 + len <= size) {
+        cache_key_option_head(buf + length, opt_iter.number, len);
+        memcpy(buf + length + 4, coap_opt_value(option), len);
+      }
+      length += 4 + len;
+    }
+  }
+  /* https://tools.ietf.org/html/rfc8132#section-2 */
+  if (pdu->code == COAP_REQUEST_CODE_FETCH) {
+    size_t len;
+    const uint8_t *data;
+
+    if (coap_get_data(pdu, &len, &data)) {
+      if (length + len <= size)
+        memcpy(buf + length, data, len);
+      length += len;
+    }
+  }
+  *length_out = length;
+  return 1;
+}
+
+/* Hashes the cache-key information with the context's SipHash key.  The
+ * information is kept with the cache-key so that a hash match can be
+ * verified.  It is usually collected in a single pass on the stack. */
+static coap_cache_key_t *
+cache_derive_fast_key(const coap_session_t *session,
+                      const coap_pdu_t *pdu,
+                      coap_cache_session_based_t session_based,
+                      int skip_etag) {
+  coap_cache_key_t *cache_key;
+  coap_binary_t *data;
+  uint8_t buf[256];
+  size_t length;
+
+  if (!cache_key_info(session, pdu, session_based, skip_etag,
+                      buf, sizeof(buf), &length))
+    return NULL;
+  data = coap_new_binary(length);
+  if (!data)
+    return NULL;
+  if (length <= sizeof(buf))
+    memcpy(data->s, buf, length);
+  else
+    cache_key_info(session, pdu, session_based, skip_etag, data->s, length,
+                   &length);
+
+  cache_key = coap_malloc_type(COAP_CACHE_KEY, sizeof(coap_cache_key_t));
+  if (!cache_key) {
+    coap_delete_binary(data);
+    return NULL;
   }
+  memset(cache_key->key, 0, sizeof(cache_key->key));
+  coap_siphash128(session->context->cache_hash_key, data->s, data->length,
+                  cache_key->key);
+  cache_key->data = data;
   return cache_key;
 }
 
+static coap_cache_key_t *
+cache_derive_key(const coap_session_t *session,
+                 const coap_pdu_t *pdu,
+                 coap_cache_session_based_t session_based,
+                 int skip_etag) {
+  if (session->context->cache_key_mode == COAP_CACHE_KEY_FAST)
+    return cache_derive_fast_key(session, pdu, session_based, skip_etag);
+  return cache_derive_digest_key(session, pdu, session_based, skip_etag);
+}
+
+int
+coap_cache_key_verify(const coap_cache_key_t *a, const coap_cache_key_t *b) {
+  if (!a->data || !b->data)
+    return 1;
+  if (a->data->length == b->data->length &&
+      memcmp(a->data->s, b->data->s, a->data->length) == 0)
+    return 1;
+  coap_log(LOG_DEBUG, "cache-key hash collision\n");
+  return 0;
+}
+
+coap_cache_key_t *
+coap_cache_derive_key(const coap_session_t *session,
+                      const coap_pdu_t *pdu,
+                      coap_cache_session_based_t session_based) {
+  return cache_derive_key(session, pdu, session_based, 0);
+}
+
 void
 coap_delete_cache_key(coap_cache_key_t *cache_key) {
+  if (cache_key)
+    coap_delete_binary(cache_key->data);
   coap_free_type(COAP_CACHE_KEY, cache_key);
 }
 
+static coap_pdu_t *
+cache_copy_pdu(const coap_pdu_t *pdu) {
+  coap_pdu_t *copy = coap_pdu_init(pdu->type, pdu->code, pdu->mid,
+                                   pdu->alloc_size);
+
+  if (!copy)
+    return NULL;
+  if (!coap_pdu_resize(copy, pdu->alloc_size)) {
+    coap_delete_pdu(copy);
+    return NULL;
+  }
+  /* Need to get the appropriate data across */
+  memcpy(copy, pdu, offsetof(coap_pdu_t, token));
+  memcpy(copy->token, pdu->token, pdu->used_size);
+  /* And adjust all the pointers etc. */
+  copy->data = pdu->data ? copy->token + (pdu->data - pdu->token) : NULL;
+  return copy;
+}
+
+/* The number of bytes accounted against the context limit for an entry */
+static size_t
+cache_entry_size(const coap_cache_entry_t *cache_entry) {
+  size_t size = sizeof(coap_cache_entry_t) + sizeof(coap_cache_key_t);
+
+  if (cache_entry->cache_key->data)
+    size += sizeof(coap_binary_t) + cache_entry->cache_key->data->length;
+
+  if (cache_entry->pdu)
+    size += sizeof(coap_pdu_t) + cache_entry->pdu->max_hdr_size +
+            cache_entry->pdu->alloc_size;
+  return size;
+}
+
+/* Inserts cache_entry into the context's expiry list, which is kept in
+ * expire_ticks order.  New expiry times are usually the latest, so the
+ * search starts at the tail. */
+static void
+cache_expire_insert(coap_context_t *ctx, coap_cache_entry_t *cache_entry) {
+  coap_cache_entry_t *el = ctx->cache_expire ? ctx->cache_expire->exp_prev :
+                                               NULL;
+
+  while (el && el->expire_ticks > cache_entry->expire_ticks) {
+    el = el == ctx->cache_expire ? NULL : el->exp_prev;
+  }
+  if (el) {
+    DL_APPEND_ELEM2(ctx->cache_expire, el, cache_entry, exp_prev, exp_next);
+  }
+  else {
+    DL_PREPEND2(ctx->cache_expire, cache_entry, exp_prev, exp_next);
+  }
+}
+
+/* Restarts the idle timeout of cache_entry, and makes it the most
+ * recently used */
+static void
+cache_entry_touch(coap_context_t *ctx, coap_cache_entry_t *cache_entry) {
+  if (cache_entry->lru_next) {
+    DL_DELETE2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+    DL_APPEND2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+  }
+  if (cache_entry->idle_timeout > 0) {
+    coap_ticks(&cache_entry->expire_ticks);
+    cache_entry->expire_ticks +=
+               (coap_tick_t)cache_entry->idle_timeout * COAP_TICKS_PER_SECOND;
+    DL_DELETE2(ctx->cache_expire, cache_entry, exp_prev, exp_next);
+    cache_expire_insert(ctx, cache_entry);
+  }
+}
+
+/* Evicts least recently used entries until size more bytes fit */
+static void
+cache_make_room(coap_context_t *ctx, size_t size) {
+  if (ctx->max_cache_size == 0)
+    return;
+  while (ctx->cache_lru && ctx->cache_size + size > ctx->max_cache_size) {
+    ctx->cache_stats.evictions++;
+    coap_delete_cache_entry(ctx, ctx->cache_lru);
+  }
+}
+
+/* Accounts for the (already hashed) cache_entry, evicting others if the
+ * context's size limit would otherwise be exceeded */
+static void
+cache_entry_link(coap_context_t *ctx, coap_cache_entry_t *cache_entry) {
+  cache_entry->size = cache_entry_size(cache_entry);
+  cache_make_room(ctx, cache_entry->size);
+  ctx->cache_size += cache_entry->size;
+  DL_APPEND2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+  if (cache_entry->expire_ticks)
+    cache_expire_insert(ctx, cache_entry);
+}
+
 coap_cache_entry_t *
 coap_new_cache_entry(coap_session_t *session, const coap_pdu_t *pdu,
                coap_cache_record_pdu_t record_pdu,
@@ -137,33 +434,32 @@ coap_new_cache_entry(coap_session_t *session, const coap_pdu_t *pdu,
 
   memset(entry, 0, sizeof(coap_cache_entry_t));
   entry->session = session;
+  if (session_based == COAP_CACHE_IS_SESSION_BASED && session->transient) {
+    /* Entry is keyed on the session, so it has to outlive this request */
+    session->transient = COAP_SESSION_TRANSIENT_KEEP;
+  }
   if (record_pdu == COAP_CACHE_RECORD_PDU) {
-    entry->pdu = coap_pdu_init(pdu->type, pdu->code, pdu->mid, pdu->alloc_size);
-    if (entry->pdu) {
-      if (!coap_pdu_resize(entry->pdu, pdu->alloc_size)) {
-        coap_delete_pdu(entry->pdu);
-        coap_free_type(COAP_CACHE_ENTRY, entry);
-        return NULL;
-      }
-      /* Need to get the appropriate data across */
-      memcpy(entry->pdu, pdu, offsetof(coap_pdu_t, token));
-      memcpy(entry->pdu->token, pdu->token, pdu->used_size);
-      /* And adjust all the pointers etc. */
-      entry->pdu->data = entry->pdu->token + (pdu->data - pdu->token);
+    entry->pdu = cache_copy_pdu(pdu);
+    if (!entry->pdu) {
+      coap_free_type(COAP_CACHE_ENTRY, entry);
+      return NULL;
     }
   }
   entry->cache_key = coap_cache_derive_key(session, pdu, session_based);
   if (!entry->cache_key) {
+    coap_delete_pdu(entry->pdu);
     coap_free_type(COAP_CACHE_ENTRY, entry);
     return NULL;
   }
   entry->idle_timeout = idle_timeout;
   if (idle_timeout > 0) {
     coap_ticks(&entry->expire_ticks);
-    entry->expire_ticks += idle_timeout * COAP_TICKS_PER_SECOND;
+    entry->expire_ticks += (coap_tick_t)idle_timeout * COAP_TICKS_PER_SECOND;
   }
 
-  HASH_ADD(hh, session->context->cache, cache_key[0], sizeof(coap_cache_key_t), entry);
+  HASH_ADD(hh, session->context->cache, cache_key[0],
+           sizeof(entry->cache_key->key), entry);
+  cache_entry_link(session->context, entry);
   return entry;
 }
 
@@ -173,11 +469,17 @@ coap_cache_get_by_key(coap_context_t *ctx, const coap_cache_key_t *cache_key) {
 
   assert(cache_key);
   if (cache_key) {
-    HASH_FIND(hh, ctx->cache, cache_key, sizeof(coap_cache_key_t), cache_entry);
+    HASH_FIND(hh, ctx->cache, cache_key, sizeof(cache_key->key), cache_entry);
+    if (cache_entry &&
+        !coap_cache_key_verify(cache_key, cache_entry->cache_key))
+      cache_entry = NULL;
   }
-  if (cache_entry && cache_entry->idle_timeout > 0) {
-    coap_ticks(&cache_entry->expire_ticks);
-    cache_entry->expire_ticks += cache_entry->idle_timeout * COAP_TICKS_PER_SECOND;
+  if (cache_entry) {
+    ctx->cache_stats.hits++;
+    cache_entry_touch(ctx, cache_entry);
+  }
+  else {
+    ctx->cache_stats.misses++;
   }
   return cache_entry;
 }
@@ -194,10 +496,6 @@ coap_cache_get_by_pdu(coap_session_t *session,
 
   cache_entry = coap_cache_get_by_key(session->context, cache_key);
   coap_delete_cache_key(cache_key);
-  if (cache_entry && cache_entry->idle_timeout > 0) {
-    coap_ticks(&cache_entry->expire_ticks);
-    cache_entry->expire_ticks += cache_entry->idle_timeout * COAP_TICKS_PER_SECOND;
-  }
   return cache_entry;
 }
 
@@ -206,9 +504,17 @@ coap_delete_cache_entry(coap_context_t *ctx, coap_cache_entry_t *cache_entry) {
 
   assert(cache_entry);
 
-  if (cache_entry) {
+  if (cache_entry->resource) {
+    HASH_DELETE(hh, ctx->response_cache, cache_entry);
+  }
+  else {
     HASH_DELETE(hh, ctx->cache, cache_entry);
   }
+  ctx->cache_size -= cache_entry->size;
+  DL_DELETE2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+  if (cache_entry->expire_ticks) {
+    DL_DELETE2(ctx->cache_expire, cache_entry, exp_prev, exp_next);
+  }
   if (cache_entry->pdu) {
     coap_delete_pdu(cache_entry->pdu);
   }
@@ -237,17 +543,279 @@ coap_cache_get_app_data(const coap_cache_entry_t *cache_entry) {
   return cache_entry->app_data;
 }
 
+coap_tick_t
+coap_expire_cache_entries(coap_context_t *ctx, coap_tick_t now) {
+  while (ctx->cache_expire && ctx->cache_expire->expire_ticks <= now) {
+    ctx->cache_stats.expiries++;
+    coap_delete_cache_entry(ctx, ctx->cache_expire);
+  }
+  return ctx->cache_expire ? ctx->cache_expire->expire_ticks - now : 0;
+}
+
 void
-coap_expire_cache_entries(coap_context_t *ctx) {
-  coap_tick_t now;
+coap_context_set_cache_size(coap_context_t *ctx, size_t size) {
+  ctx->max_cache_size = size;
+  ctx->cache_size_set = 1;
+  cache_make_room(ctx, 0);
+}
+
+size_t
+coap_context_get_cache_size(const coap_context_t *ctx) {
+  return ctx->max_cache_size;
+}
+
+void
+coap_cache_get_stats(const coap_context_t *ctx, coap_cache_stats_t *stats) {
+  *stats = ctx->cache_stats;
+  stats->entries = HASH_COUNT(ctx->cache) + HASH_COUNT(ctx->response_cache);
+  stats->bytes = ctx->cache_size;
+}
+
+void
+coap_context_set_cache_key_mode(coap_context_t *ctx,
+                                coap_cache_key_mode_t mode) {
   coap_cache_entry_t *cp, *ctmp;
 
-  coap_ticks(&now);
+  if (mode == ctx->cache_key_mode)
+    return;
+  /* Keys derived in the old mode will no longer match */
   HASH_ITER(hh, ctx->cache, cp, ctmp) {
-    if (cp->idle_timeout > 0) {
-      if (cp->expire_ticks <= now) {
-        coap_delete_cache_entry(ctx, cp);
-      }
+    coap_delete_cache_entry(ctx, cp);
+  }
+  HASH_ITER(hh, ctx->response_cache, cp, ctmp) {
+    coap_delete_cache_entry(ctx, cp);
+  }
+  if (mode == COAP_CACHE_KEY_FAST)
+    coap_prng(ctx->cache_hash_key, sizeof(ctx->cache_hash_key));
+  ctx->cache_key_mode = mode;
+}
+
+coap_cache_key_mode_t
+coap_context_get_cache_key_mode(const coap_context_t *ctx) {
+  return ctx->cache_key_mode;
+}
+
+/* Checks whether request can be answered from, or its response added to,
+ * the response cache.  Observe and block-wise requests are always left to
+ * the handler. */
+static int
+cache_response_eligible(const coap_pdu_t *request) {
+  coap_opt_iterator_t opt_iter;
+
+  if (request->code != COAP_REQUEST_CODE_GET &&
+      request->code != COAP_REQUEST_CODE_FETCH)
+    return 0;
+  if (coap_check_option(request, COAP_OPTION_OBSERVE, &opt_iter) ||
+      coap_check_option(request, COAP_OPTION_BLOCK1, &opt_iter) ||
+      coap_check_option(request, COAP_OPTION_BLOCK2, &opt_iter))
+    return 0;
+  return 1;
+}
+
+/* Returns 1 if one of the ETag options of request matches etag */
+static int
+cache_etag_match(const coap_pdu_t *request, const coap_opt_t *etag) {
+  coap_opt_iterator_t opt_iter;
+  coap_opt_filter_t filter;
+  coap_opt_t *option;
+
+  coap_option_filter_clear(&filter);
+  coap_option_filter_set(&filter, COAP_OPTION_ETAG);
+  coap_option_iterator_init(request, &opt_iter, &filter);
+  while ((option = coap_option_next(&opt_iter))) {
+    if (coap_opt_length(option) == coap_opt_length(etag) &&
+        memcmp(coap_opt_value(option), coap_opt_value(etag),
+               coap_opt_length(etag)) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* Drops everything from response other than its header and token */
+static void
+cache_reset_response(coap_pdu_t *response) {
+  response->code = 0;
+  response->max_opt = 0;
+  response->used_size = response->token_length;
+  response->data = NULL;
+}
+
+/* Fills in response (which only holds the token) from the cache entry,
+ * with Max-Age set to what is left of the entry's freshness */
+static int
+cache_fill_response(const coap_cache_entry_t *cache_entry,
+                    const coap_pdu_t *request,
+                    coap_pdu_t *response, coap_tick_t now) {
+  const coap_pdu_t *cached = cache_entry->pdu;
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *option;
+  coap_opt_t *etag;
+  uint8_t buf[4];
+  unsigned int max_age;
+  size_t len;
+  const uint8_t *data;
+
+  max_age = (unsigned int)((cache_entry->expire_ticks - now +
+                            COAP_TICKS_PER_SECOND - 1) / COAP_TICKS_PER_SECOND);
+
+  etag = coap_check_option(cached, COAP_OPTION_ETAG, &opt_iter);
+  if (etag && cache_etag_match(request, etag)) {
+    /* https://tools.ietf.org/html/rfc7252#section-5.10.6.2 */
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_VALID);
+    if (!coap_add_option(response, COAP_OPTION_ETAG, coap_opt_length(etag),
+                         coap_opt_value(etag)))
+      goto fail;
+  }
+  else {
+    coap_pdu_set_code(response, cached->code);
+    coap_option_iterator_init(cached, &opt_iter, COAP_OPT_ALL);
+    while ((option = coap_option_next(&opt_iter))) {
+      if (opt_iter.number == COAP_OPTION_MAXAGE)
+        continue;
+      if (!coap_add_option(response, opt_iter.number, coap_opt_length(option),
+                           coap_opt_value(option)))
+        goto fail;
+    }
+  }
+  if (!coap_update_option(response, COAP_OPTION_MAXAGE,
+                          coap_encode_var_safe(buf, sizeof(buf), max_age),
+                          buf))
+    goto fail;
+  if (response->code != COAP_RESPONSE_CODE_VALID &&
+      coap_get_data(cached, &len, &data)) {
+    if (!coap_add_data(response, len, data))
+      goto fail;
+  }
+  return 1;
+
+fail:
+  cache_reset_response(response);
+  return 0;
+}
+
+int
+coap_cache_response_lookup(coap_session_t *session,
+                           coap_resource_t *resource,
+                           const coap_pdu_t *request,
+                           coap_pdu_t *response) {
+  coap_context_t *ctx = session->context;
+  coap_cache_key_t *cache_key;
+  coap_cache_entry_t *cache_entry;
+  coap_tick_t now;
+
+  if (!ctx->response_cache || !cache_response_eligible(request))
+    return 0;
+
+  cache_key = cache_derive_key(session, request, COAP_CACHE_NOT_SESSION_BASED,
+                               1);
+  if (!cache_key)
+    return 0;
+  HASH_FIND(hh, ctx->response_cache, cache_key, sizeof(cache_key->key),
+            cache_entry);
+  if (cache_entry &&
+      !coap_cache_key_verify(cache_key, cache_entry->cache_key))
+    cache_entry = NULL;
+  coap_delete_cache_key(cache_key);
+  coap_ticks(&now);
+  if (cache_entry && cache_entry->expire_ticks <= now) {
+    ctx->cache_stats.expiries++;
+    coap_delete_cache_entry(ctx, cache_entry);
+    cache_entry = NULL;
+  }
+  if (!cache_entry || cache_entry->resource != resource ||
+      !cache_fill_response(cache_entry, request, response, now)) {
+    ctx->cache_stats.misses++;
+    return 0;
+  }
+  ctx->cache_stats.hits++;
+  cache_entry_touch(ctx, cache_entry);
+  coap_log(LOG_DEBUG, "***%s: %d.%02d response for '%*.*s' from cache\n",
+           coap_session_str(session),
+           response->code >> 5, response->code & 0x1f,
+           (int)resource->uri_path->length, (int)resource->uri_path->length,
+           resource->uri_path->s);
+  return 1;
+}
+
+void
+coap_cache_response_store(coap_session_t *session,
+                          coap_resource_t *resource,
+                          const coap_pdu_t *request,
+                          coap_pdu_t *response) {
+  coap_context_t *ctx = session->context;
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *option;
+  coap_cache_key_t *cache_key;
+  coap_cache_entry_t *cache_entry;
+  unsigned int max_age = COAP_DEFAULT_MAX_AGE;
+  coap_tick_t now;
+
+  if (response->code != COAP_RESPONSE_CODE_CONTENT || response->lg_xmit ||
+      !cache_response_eligible(request) ||
+      coap_check_option(response, COAP_OPTION_BLOCK2, &opt_iter) ||
+      coap_check_option(response, COAP_OPTION_OBSERVE, &opt_iter))
+    return;
+
+  option = coap_check_option(response, COAP_OPTION_MAXAGE, &opt_iter);
+  if (option)
+    max_age = coap_decode_var_bytes(coap_opt_value(option),
+                                    coap_opt_length(option));
+  if (max_age == 0)
+    return;
+
+  cache_key = cache_derive_key(session, request, COAP_CACHE_NOT_SESSION_BASED,
+                               1);
+  if (!cache_key)
+    return;
+  HASH_FIND(hh, ctx->response_cache, cache_key, sizeof(cache_key->key),
+            cache_entry);
+  if (cache_entry)
+    coap_delete_cache_entry(ctx, cache_entry);
+
+  cache_entry = coap_malloc_type(COAP_CACHE_ENTRY, sizeof(coap_cache_entry_t));
+  if (!cache_entry) {
+    coap_delete_cache_key(cache_key);
+    return;
+  }
+  memset(cache_entry, 0, sizeof(coap_cache_entry_t));
+  cache_entry->cache_key = cache_key;
+  cache_entry->resource = resource;
+  cache_entry->pdu = cache_copy_pdu(response);
+  if (!cache_entry->pdu) {
+    coap_delete_cache_key(cache_key);
+    coap_free_type(COAP_CACHE_ENTRY, cache_entry);
+    return;
+  }
+  if (ctx->max_cache_size && cache_entry_size(cache_entry) > ctx->max_cache_size) {
+    coap_delete_pdu(cache_entry->pdu);
+    coap_delete_cache_key(cache_key);
+    coap_free_type(COAP_CACHE_ENTRY, cache_entry);
+    return;
+  }
+  coap_ticks(&now);
+  cache_entry->expire_ticks = now + (coap_tick_t)max_age * COAP_TICKS_PER_SECOND;
+  HASH_ADD(hh, ctx->response_cache, cache_key[0], sizeof(cache_key->key),
+           cache_entry);
+  cache_entry_link(ctx, cache_entry);
+
+  option = coap_check_option(response, COAP_OPTION_ETAG, &opt_iter);
+  if (option && cache_etag_match(request, option)) {
+    /* The handler did not do the validation, so answer with 2.03 here */
+    cache_reset_response(response);
+    cache_fill_response(cache_entry, request, response, now);
+  }
+}
+
+void
+coap_cache_invalidate_resource(coap_resource_t *resource) {
+  coap_context_t *ctx = resource->context;
+  coap_cache_entry_t *cp, *ctmp;
+
+  if (!ctx)
+    return;
+  HASH_ITER(hh, ctx->response_cache, cp, ctmp) {
+    if (cp->resource == resource) {
+      coap_delete_cache_entry(ctx, cp);
     }
   }
 }
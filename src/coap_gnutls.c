@@ -73,7 +73,6 @@ typedef struct coap_ssl_t {
   const uint8_t *pdu;
   unsigned pdu_len;
   unsigned peekmode;
-  gnutls_datum_t cookie_key;
 } coap_ssl_t;
 
 /*
@@ -84,7 +83,7 @@ typedef struct coap_ssl_t {
 typedef struct coap_gnutls_env_t {
   gnutls_session_t g_session;
   gnutls_psk_client_credentials_t psk_cl_credentials;
-  gnutls_psk_server_credentials_t psk_sv_credentials;
+  /* Not set for a server, which uses those of coap_gnutls_context_t */
   gnutls_certificate_credentials_t pki_credentials;
   coap_ssl_t coap_ssl_data;
   /* If not set, need to do gnutls_handshake */
@@ -111,6 +110,18 @@ typedef struct psk_sni_entry {
   gnutls_psk_server_credentials_t psk_credentials;
 } psk_sni_entry;
 
+/*
+ * Server credentials that have been replaced by a change of the context's
+ * setup, but may still be bound to the sessions that were set up before.
+ * GnuTLS does not reference count credentials, so these are only freed
+ * along with the context.
+ */
+typedef struct retired_credentials {
+  struct retired_credentials *next;
+  gnutls_psk_server_credentials_t psk_credentials;
+  gnutls_certificate_credentials_t pki_credentials;
+} retired_credentials;
+
 typedef struct coap_gnutls_context_t {
   coap_dtls_pki_t setup_data;
   int psk_pki_enabled;
@@ -122,6 +133,11 @@ typedef struct coap_gnutls_context_t {
   char *root_ca_file;
   char *root_ca_path;
   gnutls_priority_t priority_cache;
+  gnutls_priority_t priority_no_tls13; /* for Identity Hint Callback */
+  /* Shared by all the server sessions, built by the first one */
+  gnutls_psk_server_credentials_t psk_sv_credentials;
+  gnutls_certificate_credentials_t pki_sv_credentials;
+  retired_credentials *retired;
 } coap_gnutls_context_t;
 
 typedef enum coap_free_bye_t {
@@ -230,6 +246,31 @@ coap_gnutls_log_func(int level, const char* text)
   coap_log(LOG_DEBUG + level - 2, "%s", text);
 }
 
+/*
+ * Stops the shared server credentials from being bound to new sessions, as
+ * the setup that they were built from is being changed.
+ */
+static void
+retire_server_credentials(coap_gnutls_context_t *g_context) {
+  retired_credentials *retired;
+
+  if (!g_context->psk_sv_credentials && !g_context->pki_sv_credentials)
+    return;
+  retired = gnutls_malloc(sizeof(retired_credentials));
+  if (!retired) {
+    /* Leak rather than free what sessions may still be using */
+    coap_log(LOG_WARNING, "retire_server_credentials: malloc failure\n");
+  }
+  else {
+    retired->psk_credentials = g_context->psk_sv_credentials;
+    retired->pki_credentials = g_context->pki_sv_credentials;
+    retired->next = g_context->retired;
+    g_context->retired = retired;
+  }
+  g_context->psk_sv_credentials = NULL;
+  g_context->pki_sv_credentials = NULL;
+}
+
 /*
  * return 0 failed
  *        1 passed
@@ -245,6 +286,7 @@ coap_dtls_context_set_pki(coap_context_t *c_context,
   if (!g_context || !setup_data)
     return 0;
 
+  retire_server_credentials(g_context);
   g_context->setup_data = *setup_data;
   if (!g_context->setup_data.verify_peer_cert) {
     /* Needs to be clear so that no CA DNs are transmitted */
@@ -302,6 +344,7 @@ coap_dtls_context_set_pki_root_cas(coap_context_t *c_context,
              "not defined\n");
     return 0;
   }
+  retire_server_credentials(g_context);
   if (g_context->root_ca_file) {
     gnutls_free(g_context->root_ca_file);
     g_context->root_ca_file = NULL;
@@ -337,6 +380,7 @@ coap_dtls_context_set_spsk(coap_context_t *c_context,
   if (!g_context || !setup_data)
     return 0;
 
+  retire_server_credentials(g_context);
   g_context->psk_pki_enabled |= IS_PSK;
   return 1;
 }
@@ -442,6 +486,25 @@ coap_dtls_new_context(coap_context_t *c_context COAP_UNUSED) {
                  "gnutls_priority_init: %s\n", gnutls_strerror(ret));
       goto fail;
     }
+    if (tls_version->version >= 0x030604) {
+      /* Used instead if an Identity Hint Callback is set */
+      if (tls_version->version >= 0x030606) {
+        priority = VARIANTS_NO_TLS13_3_6_6;
+      }
+      else {
+        priority = VARIANTS_NO_TLS13_3_6_4;
+      }
+      ret = gnutls_priority_init(&g_context->priority_no_tls13, priority, &err);
+      if (ret != GNUTLS_E_SUCCESS) {
+        if (ret == GNUTLS_E_INVALID_REQUEST)
+          coap_log(LOG_WARNING,
+                   "gnutls_priority_init: Syntax error at: %s\n", err);
+        else
+          coap_log(LOG_WARNING,
+                   "gnutls_priority_init: %s\n", gnutls_strerror(ret));
+        goto fail;
+      }
+    }
   }
   return g_context;
 
@@ -476,7 +539,25 @@ coap_dtls_free_context(void *handle) {
   if (g_context->psk_sni_entry_list)
     gnutls_free(g_context->psk_sni_entry_list);
 
-  gnutls_priority_deinit(g_context->priority_cache);
+  if (g_context->psk_sv_credentials)
+    gnutls_psk_free_server_credentials(g_context->psk_sv_credentials);
+  if (g_context->pki_sv_credentials)
+    gnutls_certificate_free_credentials(g_context->pki_sv_credentials);
+  while (g_context->retired) {
+    retired_credentials *retired = g_context->retired;
+
+    g_context->retired = retired->next;
+    if (retired->psk_credentials)
+      gnutls_psk_free_server_credentials(retired->psk_credentials);
+    if (retired->pki_credentials)
+      gnutls_certificate_free_credentials(retired->pki_credentials);
+    gnutls_free(retired);
+  }
+
+  if (g_context->priority_cache)
+    gnutls_priority_deinit(g_context->priority_cache);
+  if (g_context->priority_no_tls13)
+    gnutls_priority_deinit(g_context->priority_no_tls13);
 
   gnutls_global_deinit();
   gnutls_free(g_context);
@@ -517,10 +598,10 @@ psk_client_callback(gnutls_session_t g_session,
   }
 
   g_context = (coap_gnutls_context_t *)c_session->context->dtls_context;
-  if (g_context == NULL)
+  if (g_context == NULL || c_session->psk == NULL)
     return -1;
 
-  setup_data = &c_session->cpsk_setup_data;
+  setup_data = &c_session->psk->cpsk_setup_data;
 
   if (hint)
     hint_len = strlen(hint);
@@ -966,7 +1047,6 @@ get_asn1_spki(const uint8_t *data, size_t size)
  */
 static int
 setup_pki_credentials(gnutls_certificate_credentials_t *pki_credentials,
-                      gnutls_session_t g_session,
                       coap_gnutls_context_t *g_context,
                       coap_dtls_pki_t *setup_data, coap_dtls_role_t role)
 {
@@ -1336,8 +1416,6 @@ setup_pki_credentials(gnutls_certificate_credentials_t *pki_credentials,
             "gnutls_certificate_set_x509_trust_dir");
 #endif
   }
-  gnutls_certificate_send_x509_rdn_sequence(g_session,
-                                      setup_data->check_common_ca ? 0 : 1);
   if (!(g_context->psk_pki_enabled & IS_PKI)) {
     /* No PKI defined at all - still need a trust set up for 3.6.0 or later */
     G_CHECK(gnutls_certificate_set_x509_system_trust(*pki_credentials),
@@ -1601,7 +1679,6 @@ post_client_hello_gnutls_pki(gnutls_session_t g_session)
       sni_setup_data.pki_key = *new_entry;
       if ((ret = setup_pki_credentials(
                            &g_context->pki_sni_entry_list[i].pki_credentials,
-                           g_session,
                            g_context,
                            &sni_setup_data, COAP_DTLS_ROLE_SERVER)) < 0) {
         int keep_ret = ret;
@@ -1635,11 +1712,19 @@ setup_client_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
 {
   coap_gnutls_context_t *g_context =
              (coap_gnutls_context_t *)c_session->context->dtls_context;
+  const coap_binary_t *resume = coap_session_tls_resume_state(c_session);
   int ret;
 
   g_context->psk_pki_enabled |= IS_CLIENT;
+  if (resume &&
+      gnutls_session_set_data(g_env->g_session, resume->s,
+                              resume->length) == GNUTLS_E_SUCCESS) {
+    coap_log(LOG_DEBUG, "*  %s: resuming (D)TLS session\n",
+             coap_session_str(c_session));
+  }
   if (g_context->psk_pki_enabled & IS_PSK) {
-    coap_dtls_cpsk_t *setup_data = &c_session->cpsk_setup_data;
+    coap_dtls_cpsk_t *setup_data = c_session->psk ?
+                                   &c_session->psk->cpsk_setup_data : NULL;
     G_CHECK(gnutls_psk_allocate_client_credentials(&g_env->psk_cl_credentials),
             "gnutls_psk_allocate_client_credentials");
     gnutls_psk_set_client_credentials_function(g_env->psk_cl_credentials,
@@ -1648,38 +1733,18 @@ setup_client_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
                                    g_env->psk_cl_credentials),
             "gnutls_credentials_set");
     /* Issue SNI if requested */
-    if (setup_data->client_sni) {
+    if (setup_data && setup_data->client_sni) {
       G_CHECK(gnutls_server_name_set(g_env->g_session, GNUTLS_NAME_DNS,
                                      setup_data->client_sni,
                                      strlen(setup_data->client_sni)),
               "gnutls_server_name_set");
     }
-    if (setup_data->validate_ih_call_back) {
-      const char *err;
-      coap_tls_version_t* tls_version = coap_get_tls_library_version();
-
-      if (tls_version->version >= 0x030604) {
-        /* Disable TLS1.3 if Identity Hint Callback set */
-        const char *priority;
-
-        if (tls_version->version >= 0x030606) {
-          priority = VARIANTS_NO_TLS13_3_6_6;
-        }
-        else {
-          priority = VARIANTS_NO_TLS13_3_6_4;
-        }
-        ret = gnutls_priority_set_direct(g_env->g_session,
-              priority, &err);
-        if (ret < 0) {
-          if (ret == GNUTLS_E_INVALID_REQUEST)
-            coap_log(LOG_WARNING,
-                     "gnutls_priority_set_direct: Syntax error at: %s\n", err);
-          else
-            coap_log(LOG_WARNING,
-                     "gnutls_priority_set_direct: %s\n", gnutls_strerror(ret));
-          goto fail;
-        }
-      }
+    if (setup_data && setup_data->validate_ih_call_back &&
+        g_context->priority_no_tls13) {
+      /* Disable TLS1.3 if Identity Hint Callback set */
+      G_CHECK(gnutls_priority_set(g_env->g_session,
+                                  g_context->priority_no_tls13),
+              "gnutls_priority_set");
     }
   }
 
@@ -1690,10 +1755,11 @@ setup_client_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
      * This works providing COAP_PKI_KEY_PEM has a value of 0.
      */
     coap_dtls_pki_t *setup_data = &g_context->setup_data;
-    G_CHECK(setup_pki_credentials(&g_env->pki_credentials, g_env->g_session,
-                                  g_context, setup_data,
-                                  COAP_DTLS_ROLE_CLIENT),
+    G_CHECK(setup_pki_credentials(&g_env->pki_credentials, g_context,
+                                  setup_data, COAP_DTLS_ROLE_CLIENT),
             "setup_pki_credentials");
+    gnutls_certificate_send_x509_rdn_sequence(g_env->g_session,
+                                      setup_data->check_common_ca ? 0 : 1);
 
     G_CHECK(gnutls_credentials_set(g_env->g_session, GNUTLS_CRD_CERTIFICATE,
                                    g_env->pki_credentials),
@@ -1753,10 +1819,12 @@ psk_server_callback(gnutls_session_t g_session,
     identity = "";
 
   /* Track the Identity being used */
-  if (c_session->psk_identity)
-    coap_delete_bin_const(c_session->psk_identity);
-  c_session->psk_identity = coap_new_bin_const((const uint8_t *)identity,
-                                               identity_len);
+  {
+    coap_bin_const_t lidentity;
+    lidentity.length = identity_len;
+    lidentity.s = (const uint8_t*)identity;
+    coap_session_refresh_psk_identity(c_session, &lidentity);
+  }
 
   coap_log(LOG_DEBUG, "got psk_identity: '%.*s'\n",
                       (int)identity_len, identity);
@@ -1800,18 +1868,42 @@ setup_server_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
 {
   coap_gnutls_context_t *g_context =
              (coap_gnutls_context_t *)c_session->context->dtls_context;
+  const coap_dtls_ticket_key_t *key =
+                           coap_dtls_ticket_key_current(c_session->context);
+  uint8_t master_key[sizeof(key->cipher_key) + sizeof(key->mac_key)];
+  gnutls_datum_t ticket_key;
   int ret = GNUTLS_E_SUCCESS;
 
   g_context->psk_pki_enabled |= IS_SERVER;
+  /*
+   * GnuTLS derives its ticket keys from the one master key, so tickets
+   * sealed before the context's ticket key was last replaced are refused
+   */
+  memcpy(master_key, key->cipher_key, sizeof(key->cipher_key));
+  memcpy(&master_key[sizeof(key->cipher_key)], key->mac_key,
+         sizeof(key->mac_key));
+  ticket_key.data = master_key;
+  ticket_key.size = sizeof(master_key);
+  G_CHECK(gnutls_session_ticket_enable_server(g_env->g_session, &ticket_key),
+          "gnutls_session_ticket_enable_server");
+  gnutls_db_set_cache_expiration(g_env->g_session, COAP_DTLS_RESUME_LIFETIME);
   if (g_context->psk_pki_enabled & IS_PSK) {
-    G_CHECK(setup_psk_credentials(
-                             &g_env->psk_sv_credentials,
-                             g_context,
-                             &c_session->context->spsk_setup_data),
-            "setup_psk_credentials\n");
+    if (!g_context->psk_sv_credentials) {
+      gnutls_psk_server_credentials_t psk_credentials = NULL;
+
+      ret = setup_psk_credentials(&psk_credentials, g_context,
+                                  &c_session->context->spsk_setup_data);
+      if (ret < 0) {
+        /* YUK - A memory leak in 3.3.0 (fixed by 3.3.26) of hint */
+        if (psk_credentials)
+          gnutls_psk_free_server_credentials(psk_credentials);
+      }
+      G_CHECK(ret, "setup_psk_credentials\n");
+      g_context->psk_sv_credentials = psk_credentials;
+    }
     G_CHECK(gnutls_credentials_set(g_env->g_session,
                                    GNUTLS_CRD_PSK,
-                                   g_env->psk_sv_credentials),
+                                   g_context->psk_sv_credentials),
             "gnutls_credentials_set\n");
     gnutls_handshake_set_post_client_hello_function(g_env->g_session,
                                                 post_client_hello_gnutls_psk);
@@ -1819,10 +1911,18 @@ setup_server_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
 
   if (g_context->psk_pki_enabled & IS_PKI) {
     coap_dtls_pki_t *setup_data = &g_context->setup_data;
-    G_CHECK(setup_pki_credentials(&g_env->pki_credentials, g_env->g_session,
-                                  g_context, setup_data,
-                                  COAP_DTLS_ROLE_SERVER),
-            "setup_pki_credentials");
+    if (!g_context->pki_sv_credentials) {
+      gnutls_certificate_credentials_t pki_credentials = NULL;
+
+      ret = setup_pki_credentials(&pki_credentials, g_context, setup_data,
+                                  COAP_DTLS_ROLE_SERVER);
+      if (ret < 0 && pki_credentials)
+        gnutls_certificate_free_credentials(pki_credentials);
+      G_CHECK(ret, "setup_pki_credentials");
+      g_context->pki_sv_credentials = pki_credentials;
+    }
+    gnutls_certificate_send_x509_rdn_sequence(g_env->g_session,
+                                      setup_data->check_common_ca ? 0 : 1);
 
     if (setup_data->verify_peer_cert) {
       gnutls_certificate_server_set_request(g_env->g_session,
@@ -1837,7 +1937,7 @@ setup_server_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
                                                 post_client_hello_gnutls_pki);
 
     G_CHECK(gnutls_credentials_set(g_env->g_session, GNUTLS_CRD_CERTIFICATE,
-                                   g_env->pki_credentials),
+                                   g_context->pki_sv_credentials),
             "gnutls_credentials_set\n");
   }
   return GNUTLS_E_SUCCESS;
@@ -2029,20 +2129,14 @@ coap_dtls_free_gnutls_env(coap_gnutls_context_t *g_context,
         gnutls_psk_free_client_credentials(g_env->psk_cl_credentials);
         g_env->psk_cl_credentials = NULL;
       }
-      else {
-        /* YUK - A memory leak in 3.3.0 (fixed by 3.3.26) of hint */
-        if (g_env->psk_sv_credentials != NULL)
-          gnutls_psk_free_server_credentials(g_env->psk_sv_credentials);
-        g_env->psk_sv_credentials = NULL;
-      }
     }
     if ((g_context->psk_pki_enabled & IS_PKI) ||
         (g_context->psk_pki_enabled &
          (IS_PSK | IS_PKI | IS_CLIENT)) == IS_CLIENT) {
-      gnutls_certificate_free_credentials(g_env->pki_credentials);
+      if (g_env->pki_credentials != NULL)
+        gnutls_certificate_free_credentials(g_env->pki_credentials);
       g_env->pki_credentials = NULL;
     }
-    gnutls_free(g_env->coap_ssl_data.cookie_key.data);
     gnutls_free(g_env);
   }
 }
@@ -2428,6 +2522,40 @@ coap_dtls_receive(coap_session_t *c_session,
   return ret;
 }
 
+int
+coap_dtls_hello_needs_cookie(void) {
+  return 1;
+}
+
+int
+coap_dtls_can_offload_handshake(void) {
+  return 0;
+}
+
+coap_binary_t *
+coap_dtls_get_resume_state(coap_session_t *c_session) {
+  coap_gnutls_env_t *g_env = (coap_gnutls_env_t *)c_session->tls;
+  coap_binary_t *state = NULL;
+  gnutls_datum_t data;
+
+  if (!g_env || !g_env->established)
+    return NULL;
+#if (GNUTLS_VERSION_NUMBER >= 0x030603)
+  /* A TLS 1.3 session is only resumable once its ticket has arrived */
+  if (gnutls_protocol_get_version(g_env->g_session) == GNUTLS_TLS1_3 &&
+      !(gnutls_session_get_flags(g_env->g_session) &
+        GNUTLS_SFLAGS_SESSION_TICKET))
+    return NULL;
+#endif /* GNUTLS_VERSION_NUMBER >= 0x030603 */
+  if (gnutls_session_get_data2(g_env->g_session, &data) != GNUTLS_E_SUCCESS)
+    return NULL;
+  state = coap_new_binary(data.size);
+  if (state)
+    memcpy(state->s, data.data, data.size);
+  gnutls_free(data.data);
+  return state;
+}
+
 /*
  * return -1  failure
  *         0  not completed
@@ -2446,36 +2574,24 @@ coap_dtls_hello(coap_session_t *c_session,
     g_env = coap_dtls_new_gnutls_env(c_session, GNUTLS_SERVER);
     if (g_env) {
       c_session->tls = g_env;
-      gnutls_key_generate(&g_env->coap_ssl_data.cookie_key,
-                          GNUTLS_COOKIE_KEY_SIZE);
     }
     else {
       /* error should have already been reported */
       return -1;
     }
   }
-  if (data_len > 0) {
+  if (data_len > 13 + 6) {
     gnutls_dtls_prestate_st prestate;
-    uint8_t *data_rw;
 
+    /*
+     * The cookie has already been checked, so carry on from the
+     * HelloVerifyRequest that was sent, as gnutls_dtls_cookie_verify()
+     * would have set up.
+     */
     memset(&prestate, 0, sizeof(prestate));
-    /* Need to do this to not get a compiler warning about const parameters */
-    memcpy (&data_rw, &data, sizeof(data_rw));
-    ret = gnutls_dtls_cookie_verify(&g_env->coap_ssl_data.cookie_key,
-                                     &c_session->addr_info,
-                                     sizeof(c_session->addr_info),
-                                     data_rw, data_len,
-                                     &prestate);
-    if (ret < 0) {  /* cookie not valid */
-      coap_log(LOG_DEBUG, "Invalid Cookie - sending Hello Verify\n");
-      gnutls_dtls_cookie_send(&g_env->coap_ssl_data.cookie_key,
-                              &c_session->addr_info,
-                              sizeof(c_session->addr_info),
-                              &prestate,
-                              c_session,
-                              coap_dgram_write);
-      return 0;
-    }
+    prestate.record_seq = data[10];     /* client's record seq */
+    prestate.hsk_read_seq = data[13 + 5]; /* client's hsk seq */
+    prestate.hsk_write_seq = 0;         /* HelloVerifyRequest's hsk seq */
     gnutls_dtls_prestate_set(g_env->g_session, &prestate);
   }
 
@@ -2514,6 +2630,23 @@ unsigned int coap_dtls_get_overhead(coap_session_t *c_session COAP_UNUSED) {
   return 37;
 }
 
+int
+coap_dtls_can_hibernate(void) {
+  /* GnuTLS can restore the sequence numbers of a connection, not its keys */
+  return 0;
+}
+
+coap_binary_t *
+coap_dtls_hibernate(coap_session_t *c_session COAP_UNUSED) {
+  return NULL;
+}
+
+void *
+coap_dtls_rehydrate(coap_session_t *c_session COAP_UNUSED,
+                    const coap_binary_t *state COAP_UNUSED) {
+  return NULL;
+}
+
 #if !COAP_DISABLE_TCP
 /*
  * return +ve data amount
@@ -0,0 +1,510 @@
+/* coap_handshake.c -- Worker threads for (D)TLS handshakes
+*
+* Copyright (C) 2021 The libcoap project
+*
+* This file is part of the CoAP library libcoap. Please see
+* README for terms of use.
+*/
+
+#include "coap2/coap_internal.h"
+
+#if COAP_HANDSHAKE_THREADS
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef COAP_EPOLL_SUPPORT
+#include <sys/epoll.h>
+#endif /* COAP_EPOLL_SUPPORT */
+#endif /* COAP_HANDSHAKE_THREADS */
+
+/* Where a job is (coap_handshake_job_t state) */
+#define COAP_HANDSHAKE_IDLE    0 /* not handed to the workers */
+#define COAP_HANDSHAKE_QUEUED  1 /* in the queue of the pool */
+#define COAP_HANDSHAKE_RUNNING 2 /* being run by a worker */
+#define COAP_HANDSHAKE_DONE    3 /* in the done list of the pool */
+
+int
+coap_handshake_data_add(coap_handshake_data_t **list,
+                        const uint8_t *data, size_t length) {
+  coap_handshake_data_t *entry;
+
+  entry = coap_malloc(sizeof(coap_handshake_data_t) + length);
+  if (!entry)
+    return 0;
+  entry->next = NULL;
+  entry->length = length;
+  entry->s = (uint8_t *)(entry + 1);
+  memcpy(entry->s, data, length);
+  LL_APPEND(*list, entry);
+  return 1;
+}
+
+#if COAP_HANDSHAKE_THREADS
+
+static void
+coap_handshake_data_free(coap_handshake_data_t *list) {
+  coap_handshake_data_t *entry, *rtmp;
+
+  LL_FOREACH_SAFE(list, entry, rtmp) {
+    coap_free(entry);
+  }
+}
+
+struct coap_handshake_pool_t {
+  pthread_mutex_t lock;         /* protects the queues and job states */
+  pthread_cond_t work;          /* signalled when a job is queued */
+  pthread_cond_t finished;      /* signalled when a job has been run */
+  pthread_mutex_t state_lock;   /* see coap_handshake_lock() */
+  pthread_t *threads;
+  unsigned int count;           /* number of threads started */
+  unsigned int busy;            /* number of jobs queued, running or done */
+  int stop;                     /* set to end the threads */
+  int woken;                    /* set when the pipe has been written to */
+  coap_handshake_job_t *queue;  /* jobs waiting for a worker */
+  coap_handshake_job_t *done;   /* jobs waiting for the I/O thread */
+  int wake_fd;                  /* write end of the wake up pipe */
+  coap_socket_t wakeup;         /* read end of the wake up pipe */
+  coap_context_t *context;
+};
+
+static void *
+coap_handshake_worker(void *arg) {
+  coap_handshake_pool_t *pool = (coap_handshake_pool_t *)arg;
+  coap_handshake_job_t *job;
+  int result;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && !pool->queue)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    if (pool->stop)
+      break;
+    job = pool->queue;
+    DL_DELETE(pool->queue, job);
+    job->state = COAP_HANDSHAKE_RUNNING;
+    pthread_mutex_unlock(&pool->lock);
+
+    result = job->run(job);
+
+    pthread_mutex_lock(&pool->lock);
+    job->result = result;
+    job->state = COAP_HANDSHAKE_DONE;
+    DL_APPEND(pool->done, job);
+    pthread_cond_broadcast(&pool->finished);
+    if (!pool->woken) {
+      static const uint8_t wake = 1;
+
+      if (write(pool->wake_fd, &wake, sizeof(wake)) == 1)
+        pool->woken = 1;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static void
+coap_handshake_stop(coap_handshake_pool_t *pool) {
+  unsigned int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->count; i++)
+    pthread_join(pool->threads[i], NULL);
+  pool->count = 0;
+}
+
+static void
+coap_handshake_delete_pool(coap_handshake_pool_t *pool) {
+  coap_handshake_stop(pool);
+  assert(pool->busy == 0);
+#ifdef COAP_EPOLL_SUPPORT
+  if (pool->wakeup.fd != COAP_INVALID_SOCKET) {
+    struct epoll_event event;
+
+    /* Kernels prior to 2.6.9 expect non NULL event parameter */
+    if (epoll_ctl(pool->context->epfd, EPOLL_CTL_DEL, pool->wakeup.fd,
+                  &event) == -1)
+      coap_log(LOG_ERR, "%s: epoll_ctl DEL failed: %s (%d)\n",
+               "coap_handshake_delete_pool", coap_socket_strerror(), errno);
+  }
+#endif /* COAP_EPOLL_SUPPORT */
+  if (pool->wakeup.fd != COAP_INVALID_SOCKET)
+    close(pool->wakeup.fd);
+  if (pool->wake_fd != -1)
+    close(pool->wake_fd);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->finished);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->state_lock);
+  coap_free(pool->threads);
+  coap_free(pool);
+}
+
+static coap_handshake_pool_t *
+coap_handshake_new_pool(coap_context_t *context, unsigned int threads) {
+  coap_handshake_pool_t *pool;
+  int fds[2];
+  sigset_t all, old;
+  unsigned int i;
+
+  pool = coap_malloc(sizeof(coap_handshake_pool_t));
+  if (!pool)
+    return NULL;
+  memset(pool, 0, sizeof(coap_handshake_pool_t));
+  pool->context = context;
+  pool->wake_fd = -1;
+  pool->wakeup.fd = COAP_INVALID_SOCKET;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_mutex_init(&pool->state_lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+
+  pool->threads = coap_malloc(threads * sizeof(pthread_t));
+  if (!pool->threads)
+    goto error;
+  if (pipe(fds) == -1) {
+    coap_log(LOG_ERR, "coap_context_set_handshake_threads: pipe: %s\n",
+             coap_socket_strerror());
+    goto error;
+  }
+  pool->wakeup.fd = fds[0];
+  pool->wake_fd = fds[1];
+  if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+      fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1) {
+    coap_log(LOG_ERR, "coap_context_set_handshake_threads: fcntl: %s\n",
+             coap_socket_strerror());
+    goto error;
+  }
+  pool->wakeup.flags = COAP_SOCKET_WANT_READ;
+#ifdef COAP_EPOLL_SUPPORT
+  {
+    struct epoll_event event;
+
+    /* Needed if running 32bit as ptr is only 32bit */
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    /* Neither an endpoint nor a session socket */
+    event.data.ptr = &pool->wakeup;
+    if (epoll_ctl(context->epfd, EPOLL_CTL_ADD, pool->wakeup.fd,
+                  &event) == -1) {
+      coap_log(LOG_ERR, "%s: epoll_ctl ADD failed: %s (%d)\n",
+               "coap_context_set_handshake_threads",
+               coap_socket_strerror(), errno);
+      close(pool->wakeup.fd);
+      pool->wakeup.fd = COAP_INVALID_SOCKET;
+      goto error;
+    }
+  }
+#endif /* COAP_EPOLL_SUPPORT */
+
+  /* Signals are left to the application threads */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, coap_handshake_worker,
+                       pool) != 0)
+      break;
+    pool->count++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (pool->count != threads) {
+    coap_log(LOG_ERR,
+             "coap_context_set_handshake_threads: cannot start thread %u\n",
+             pool->count + 1);
+    goto error;
+  }
+  return pool;
+
+error:
+  coap_handshake_delete_pool(pool);
+  return NULL;
+}
+
+int
+coap_context_set_handshake_threads(coap_context_t *context,
+                                   unsigned int threads) {
+  coap_handshake_pool_t *pool = context->handshake_pool;
+
+  if (threads > COAP_HANDSHAKE_MAX_THREADS)
+    threads = COAP_HANDSHAKE_MAX_THREADS;
+  if (pool && pool->count == threads)
+    return 1;
+  if (threads && !coap_dtls_can_offload_handshake()) {
+    coap_log(LOG_WARNING, "coap_context_set_handshake_threads: "
+             "not supported by the (D)TLS library\n");
+    return 0;
+  }
+  if (pool) {
+    if (pool->busy) {
+      coap_log(LOG_WARNING, "coap_context_set_handshake_threads: "
+               "cannot change while handshakes are being run\n");
+      return 0;
+    }
+    coap_handshake_delete_pool(pool);
+    context->handshake_pool = NULL;
+  }
+  if (threads) {
+    context->handshake_pool = coap_handshake_new_pool(context, threads);
+    if (!context->handshake_pool)
+      return 0;
+  }
+  return 1;
+}
+
+unsigned int
+coap_context_get_handshake_threads(const coap_context_t *context) {
+  return context->handshake_pool ? context->handshake_pool->count : 0;
+}
+
+int
+coap_handshake_offload(coap_session_t *session, void *tls,
+                       const uint8_t *data, size_t length,
+                       coap_handshake_run_t run, coap_handshake_done_t done) {
+  coap_handshake_pool_t *pool = session->context->handshake_pool;
+  coap_handshake_job_t *job;
+  int idle;
+
+  if (!pool || !coap_session_secure_block(session))
+    return 0;
+  job = session->secure->handshake;
+  if (!job) {
+    job = coap_malloc(sizeof(coap_handshake_job_t));
+    if (!job)
+      return 0;
+    memset(job, 0, sizeof(coap_handshake_job_t));
+    job->session = session;
+    session->secure->handshake = job;
+  }
+  pthread_mutex_lock(&pool->lock);
+  idle = job->state == COAP_HANDSHAKE_IDLE;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!idle) {
+    /* The step must not be overtaken, so a record that cannot be kept is
+       dropped and left for the peer to retransmit */
+    if (data && !coap_handshake_data_add(&job->pending, data, length))
+      coap_log(LOG_WARNING, "*  %s: handshake record dropped\n",
+               coap_session_str(session));
+    return 1;
+  }
+  if (data && !coap_handshake_data_add(&job->in, data, length))
+    return 0;
+  job->tls = tls;
+  job->run = run;
+  job->done = done;
+
+  pthread_mutex_lock(&pool->lock);
+  job->state = COAP_HANDSHAKE_QUEUED;
+  pool->busy++;
+  DL_APPEND(pool->queue, job);
+  pthread_cond_signal(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  return 1;
+}
+
+int
+coap_handshake_busy(const coap_session_t *session) {
+  coap_handshake_pool_t *pool = session->context->handshake_pool;
+  int busy;
+
+  if (!session->secure || !session->secure->handshake || !pool)
+    return 0;
+  pthread_mutex_lock(&pool->lock);
+  busy = session->secure->handshake->state != COAP_HANDSHAKE_IDLE;
+  pthread_mutex_unlock(&pool->lock);
+  return busy;
+}
+
+static void
+coap_handshake_free_job(coap_handshake_job_t *job) {
+  coap_handshake_data_free(job->in);
+  coap_handshake_data_free(job->pending);
+  coap_handshake_data_free(job->out);
+  coap_free(job);
+}
+
+void
+coap_handshake_cancel(coap_session_t *session) {
+  coap_handshake_job_t *job = session->secure ? session->secure->handshake :
+                                                NULL;
+  coap_handshake_pool_t *pool = session->context ?
+                                session->context->handshake_pool : NULL;
+
+  if (!job)
+    return;
+  /* A pool is only freed once none of its jobs are busy */
+  if (pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (job->state == COAP_HANDSHAKE_RUNNING)
+      pthread_cond_wait(&pool->finished, &pool->lock);
+    if (job->state != COAP_HANDSHAKE_IDLE) {
+      if (job->state == COAP_HANDSHAKE_QUEUED)
+        DL_DELETE(pool->queue, job);
+      else
+        DL_DELETE(pool->done, job);
+      pool->busy--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  session->secure->handshake = NULL;
+  coap_handshake_free_job(job);
+}
+
+void
+coap_handshake_process(coap_context_t *context) {
+  coap_handshake_pool_t *pool = context->handshake_pool;
+  coap_handshake_job_t *job;
+  coap_handshake_data_t *pending, *entry;
+  coap_session_t *session;
+
+  if (!pool)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  if (pool->woken) {
+    uint8_t drain[16];
+
+    while (read(pool->wakeup.fd, drain, sizeof(drain)) > 0)
+      ;
+    pool->woken = 0;
+  }
+  pool->wakeup.flags &= ~COAP_SOCKET_CAN_READ;
+
+  /* A job is taken off the list one at a time, as completing one step can
+     cancel the others */
+  while ((job = pool->done) != NULL) {
+    DL_DELETE(pool->done, job);
+    job->state = COAP_HANDSHAKE_IDLE;
+    pool->busy--;
+    pthread_mutex_unlock(&pool->lock);
+
+    session = job->session;
+    /* Make sure the session object is not deleted in any callbacks */
+    coap_session_reference(session);
+    job->done(job);
+    if (session->secure && session->secure->handshake == job) {
+      coap_handshake_data_free(job->out);
+      job->out = NULL;
+      /* Any records that the step has not used come before those that
+         came in during the step */
+      pending = job->in;
+      LL_CONCAT(pending, job->pending);
+      job->in = NULL;
+      job->pending = NULL;
+      if (job->result != 0) {
+        session->secure->handshake = NULL;
+        coap_handshake_free_job(job);
+      }
+      while ((entry = pending) != NULL) {
+        pending = entry->next;
+        if (session->tls && session->proto == COAP_PROTO_DTLS)
+          coap_dtls_receive(session, entry->s, entry->length);
+        coap_free(entry);
+      }
+    }
+    coap_session_release(session);
+
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void
+coap_handshake_lock(coap_context_t *context) {
+  if (context && context->handshake_pool)
+    pthread_mutex_lock(&context->handshake_pool->state_lock);
+}
+
+void
+coap_handshake_unlock(coap_context_t *context) {
+  if (context && context->handshake_pool)
+    pthread_mutex_unlock(&context->handshake_pool->state_lock);
+}
+
+coap_socket_t *
+coap_handshake_socket(coap_context_t *context) {
+  return context->handshake_pool ? &context->handshake_pool->wakeup : NULL;
+}
+
+void
+coap_handshake_free_pool(coap_context_t *context) {
+  if (context->handshake_pool) {
+    coap_handshake_delete_pool(context->handshake_pool);
+    context->handshake_pool = NULL;
+  }
+}
+
+#else /* ! COAP_HANDSHAKE_THREADS */
+
+int
+coap_context_set_handshake_threads(coap_context_t *context,
+                                   unsigned int threads) {
+  (void)context;
+  if (threads) {
+    coap_log(LOG_WARNING, "coap_context_set_handshake_threads: "
+             "not supported\n");
+    return 0;
+  }
+  return 1;
+}
+
+unsigned int
+coap_context_get_handshake_threads(const coap_context_t *context) {
+  (void)context;
+  return 0;
+}
+
+int
+coap_handshake_offload(coap_session_t *session, void *tls,
+                       const uint8_t *data, size_t length,
+                       coap_handshake_run_t run, coap_handshake_done_t done) {
+  (void)session;
+  (void)tls;
+  (void)data;
+  (void)length;
+  (void)run;
+  (void)done;
+  return 0;
+}
+
+int
+coap_handshake_busy(const coap_session_t *session) {
+  (void)session;
+  return 0;
+}
+
+void
+coap_handshake_cancel(coap_session_t *session) {
+  (void)session;
+}
+
+void
+coap_handshake_process(coap_context_t *context) {
+  (void)context;
+}
+
+void
+coap_handshake_lock(coap_context_t *context) {
+  (void)context;
+}
+
+void
+coap_handshake_unlock(coap_context_t *context) {
+  (void)context;
+}
+
+coap_socket_t *
+coap_handshake_socket(coap_context_t *context) {
+  (void)context;
+  return NULL;
+}
+
+void
+coap_handshake_free_pool(coap_context_t *context) {
+  (void)context;
+}
+
+#endif /* ! COAP_HANDSHAKE_THREADS */
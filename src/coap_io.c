@@ -125,6 +125,12 @@ coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len) {
   return -1;
 }
 
+ssize_t
+coap_socket_writev(coap_socket_t *sock, const coap_bin_const_t *bufs,
+                   size_t count) {
+  return -1;
+}
+
 ssize_t
 coap_socket_read(coap_socket_t *sock, uint8_t *data, size_t data_len) {
   return -1;
@@ -421,16 +427,13 @@ coap_epoll_ctl_mod(coap_socket_t *sock,
 }
 #endif /* COAP_EPOLL_SUPPORT */
 
-ssize_t
-coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len) {
-  ssize_t r;
-
-  sock->flags &= ~(COAP_SOCKET_WANT_WRITE | COAP_SOCKET_CAN_WRITE);
-#ifdef _WIN32
-  r = send(sock->fd, (const char *)data, (int)data_len, 0);
-#else
-  r = send(sock->fd, data, data_len, 0);
-#endif
+/*
+ * Updates the flags of sock for the result r of writing data_len bytes to it,
+ * returning what coap_socket_write() returns.
+ */
+static ssize_t
+coap_socket_write_done(coap_socket_t *sock, ssize_t r, size_t data_len,
+                       const char *func) {
   if (r == COAP_SOCKET_ERROR) {
 #ifdef _WIN32
     if (WSAGetLastError() == WSAEWOULDBLOCK) {
@@ -445,17 +448,15 @@ coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len) {
                          EPOLLOUT |
                           ((sock->flags & COAP_SOCKET_WANT_READ) ?
                            EPOLLIN : 0),
-                         __func__);
+                         func);
 #endif /* COAP_EPOLL_SUPPORT */
       return 0;
     }
     if (errno == EPIPE || errno == ECONNRESET) {
-      coap_log(LOG_INFO, "coap_socket_write: send: %s\n",
-               coap_socket_strerror());
+      coap_log(LOG_INFO, "%s: send: %s\n", func, coap_socket_strerror());
     }
     else {
-      coap_log(LOG_WARNING, "coap_socket_write: send: %s\n",
-               coap_socket_strerror());
+      coap_log(LOG_WARNING, "%s: send: %s\n", func, coap_socket_strerror());
     }
     return -1;
   }
@@ -466,12 +467,67 @@ coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len) {
                          EPOLLOUT |
                           ((sock->flags & COAP_SOCKET_WANT_READ) ?
                            EPOLLIN : 0),
-                         __func__);
+                         func);
 #endif /* COAP_EPOLL_SUPPORT */
   }
   return r;
 }
 
+ssize_t
+coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len) {
+  ssize_t r;
+
+  sock->flags &= ~(COAP_SOCKET_WANT_WRITE | COAP_SOCKET_CAN_WRITE);
+#ifdef _WIN32
+  r = send(sock->fd, (const char *)data, (int)data_len, 0);
+#else
+  r = send(sock->fd, data, data_len, 0);
+#endif
+  return coap_socket_write_done(sock, r, data_len, __func__);
+}
+
+ssize_t
+coap_socket_writev(coap_socket_t *sock, const coap_bin_const_t *bufs,
+                   size_t count) {
+  ssize_t r;
+  size_t data_len = 0;
+  size_t i;
+#ifdef _WIN32
+  WSABUF iov[COAP_SOCKET_MAX_IOV];
+  DWORD sent;
+#elif defined(HAVE_SYS_UIO_H)
+  struct iovec iov[COAP_SOCKET_MAX_IOV];
+#endif
+
+  if (count > COAP_SOCKET_MAX_IOV)
+    count = COAP_SOCKET_MAX_IOV;
+  for (i = 0; i < count; i++) {
+#ifdef _WIN32
+    iov[i].buf = (CHAR *)bufs[i].s;
+    iov[i].len = (ULONG)bufs[i].length;
+#elif defined(HAVE_SYS_UIO_H)
+    iov[i].iov_base = (void *)bufs[i].s;
+    iov[i].iov_len = bufs[i].length;
+#endif
+    data_len += bufs[i].length;
+  }
+
+  sock->flags &= ~(COAP_SOCKET_WANT_WRITE | COAP_SOCKET_CAN_WRITE);
+#ifdef _WIN32
+  if (WSASend(sock->fd, iov, (DWORD)count, &sent, 0, NULL, NULL) == 0)
+    r = (ssize_t)sent;
+  else
+    r = COAP_SOCKET_ERROR;
+#elif defined(HAVE_SYS_UIO_H)
+  r = writev(sock->fd, iov, (int)count);
+#else /* ! _WIN32 && ! HAVE_SYS_UIO_H */
+  /* Only the first buffer, the caller comes back for the rest */
+  data_len = count ? bufs[0].length : 0;
+  r = send(sock->fd, count ? bufs[0].s : NULL, data_len, 0);
+#endif /* ! _WIN32 && ! HAVE_SYS_UIO_H */
+  return coap_socket_write_done(sock, r, data_len, __func__);
+}
+
 ssize_t
 coap_socket_read(coap_socket_t *sock, uint8_t *data, size_t data_len) {
   ssize_t r;
@@ -1090,6 +1146,29 @@ coap_io_prepare_io(coap_context_t *ctx,
   }
 #endif /* WITHOUT_ASYNC */
 
+  /* Check to see if any cache-entries have expired */
+  s_timeout = coap_expire_cache_entries(ctx, now);
+  if (s_timeout) {
+    if (timeout == 0 || s_timeout < timeout)
+      timeout = s_timeout;
+  }
+
+  /* Check on name resolutions and requests of the forward proxy */
+  s_timeout = coap_proxy_check(ctx, now);
+  if (s_timeout) {
+    if (timeout == 0 || s_timeout < timeout)
+      timeout = s_timeout;
+  }
+
+#ifndef COAP_EPOLL_SUPPORT
+  /* Wakes up when the handshake workers have finished a step */
+  if (coap_handshake_socket(ctx) && *num_sockets < max_sockets)
+    sockets[(*num_sockets)++] = coap_handshake_socket(ctx);
+  /* Wakes up when other threads have submitted calls */
+  if (coap_submit_socket(ctx) && *num_sockets < max_sockets)
+    sockets[(*num_sockets)++] = coap_submit_socket(ctx);
+#endif /* ! COAP_EPOLL_SUPPORT */
+
   LL_FOREACH(ctx->endpoint, ep) {
 #ifndef COAP_EPOLL_SUPPORT
     if (ep->sock.flags & (COAP_SOCKET_WANT_READ | COAP_SOCKET_WANT_WRITE | COAP_SOCKET_WANT_ACCEPT)) {
@@ -1109,12 +1188,29 @@ coap_io_prepare_io(coap_context_t *ctx,
           if (timeout == 0 || s_timeout < timeout)
             timeout = s_timeout;
         }
-        /* Check if any server large receives have timed out */
-        if (s->lg_srcv) {
-          s_timeout = coap_block_check_lg_srcv_timeouts(s, now);
-          if (timeout == 0 || s_timeout < timeout)
+        /* Check if an idle DTLS session can let go of its (D)TLS objects */
+        if (ctx->hibernate_timeout > 0 && s->tls &&
+            s->proto == COAP_PROTO_DTLS &&
+            s->state == COAP_SESSION_STATE_ESTABLISHED) {
+          coap_tick_t hibernate = s->last_rx_tx +
+                            ctx->hibernate_timeout * COAP_TICKS_PER_SECOND;
+
+          if (hibernate <= now) {
+            coap_session_hibernate(s);
+          } else {
+            s_timeout = hibernate - now;
+            if (timeout == 0 || s_timeout < timeout)
+              timeout = s_timeout;
+          }
+        }
+        /* Check if any large transmits or receives have timed out */
+        if (s->lg_expire) {
+          s_timeout = coap_block_check_lg_timeouts(s, now);
+          if (s->lg_expire && (timeout == 0 || s_timeout < timeout))
             timeout = s_timeout;
         }
+        /* Write out what has been held back before waiting */
+        coap_session_flush(s, now);
 #ifndef COAP_EPOLL_SUPPORT
         if (s->sock.flags & (COAP_SOCKET_WANT_READ | COAP_SOCKET_WANT_WRITE)) {
           if (*num_sockets < max_sockets)
@@ -1154,27 +1250,30 @@ coap_io_prepare_io(coap_context_t *ctx,
      && s->state == COAP_SESSION_STATE_CSM
      && ctx->csm_timeout > 0
     ) {
-      if (s->csm_tx == 0) {
-        s->csm_tx = now;
-      } else if (s->csm_tx + ctx->csm_timeout * COAP_TICKS_PER_SECOND <= now) {
+      if (s->tcp->csm_tx == 0) {
+        s->tcp->csm_tx = now;
+      } else if (s->tcp->csm_tx + ctx->csm_timeout * COAP_TICKS_PER_SECOND <= now) {
         /* Make sure the session object is not deleted in the callback */
         coap_session_reference(s);
         coap_session_disconnected(s, COAP_NACK_NOT_DELIVERABLE);
         coap_session_release(s);
         continue;
       }
-      s_timeout = (s->csm_tx + ctx->csm_timeout * COAP_TICKS_PER_SECOND) - now;
+      s_timeout = (s->tcp->csm_tx + ctx->csm_timeout * COAP_TICKS_PER_SECOND) - now;
       if (timeout == 0 || s_timeout < timeout)
         timeout = s_timeout;
     }
 
-    /* Check if any client large receives have timed out */
-    if (s->lg_crcv) {
-      s_timeout = coap_block_check_lg_crcv_timeouts(s, now);
-      if (timeout == 0 || s_timeout < timeout)
+    /* Check if any large transmits or receives have timed out */
+    if (s->lg_expire) {
+      s_timeout = coap_block_check_lg_timeouts(s, now);
+      if (s->lg_expire && (timeout == 0 || s_timeout < timeout))
         timeout = s_timeout;
     }
 
+    /* Write out what has been held back before waiting */
+    coap_session_flush(s, now);
+
 #ifndef COAP_EPOLL_SUPPORT
     if (s->sock.flags & (COAP_SOCKET_WANT_READ | COAP_SOCKET_WANT_WRITE | COAP_SOCKET_WANT_CONNECT)) {
       if (*num_sockets < max_sockets)
@@ -1209,7 +1308,8 @@ coap_io_prepare_io(coap_context_t *ctx,
         if (ep->proto == COAP_PROTO_DTLS) {
           SESSIONS_ITER(ep->sessions, s, rtmp) {
             if (s->state == COAP_SESSION_STATE_HANDSHAKE &&
-                s->proto == COAP_PROTO_DTLS && s->tls) {
+                s->proto == COAP_PROTO_DTLS && s->tls &&
+                !coap_handshake_busy(s)) {
               coap_tick_t tls_timeout = coap_dtls_get_timeout(s, now);
               while (tls_timeout > 0 && tls_timeout <= now) {
                 coap_log(LOG_DEBUG, "** %s: DTLS retransmit timeout\n",
@@ -1233,7 +1333,8 @@ coap_io_prepare_io(coap_context_t *ctx,
       }
       SESSIONS_ITER(ctx->sessions, s, rtmp) {
         if (s->state == COAP_SESSION_STATE_HANDSHAKE &&
-            s->proto == COAP_PROTO_DTLS && s->tls) {
+            s->proto == COAP_PROTO_DTLS && s->tls &&
+            !coap_handshake_busy(s)) {
           coap_tick_t tls_timeout = coap_dtls_get_timeout(s, now);
           while (tls_timeout > 0 && tls_timeout <= now) {
             coap_log(LOG_DEBUG, "** %s: DTLS retransmit timeout\n", coap_session_str(s));
@@ -1445,8 +1546,9 @@ coap_io_process_with_fds(coap_context_t *ctx, uint32_t timeout_ms,
   } while (nfds == COAP_MAX_EPOLL_EVENTS);
 
 #endif /* COAP_EPOLL_SUPPORT */
-  coap_expire_cache_entries(ctx);
   coap_ticks(&now);
+  coap_expire_cache_entries(ctx, now);
+  coap_proxy_check(ctx, now);
 #ifndef WITHOUT_ASYNC
   /* Check to see if we need to send off any Async requests as delay might
      have been updated */
@@ -92,6 +92,8 @@ static void coap_recv(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_
     goto error;
   LWIP_ASSERT("Proto not supported for LWIP", COAP_PROTO_NOT_RELIABLE(session->proto));
   coap_dispatch(ep->context, session, pdu);
+  coap_session_cid_rebind_done(session);
+  coap_session_check_transient(session);
 
   coap_delete_pdu(pdu);
   packet->pbuf = NULL;
@@ -223,6 +225,12 @@ coap_socket_write(coap_socket_t *sock, const uint8_t *data, size_t data_len) {
   return -1;
 }
 
+ssize_t
+coap_socket_writev(coap_socket_t *sock, const coap_bin_const_t *bufs,
+                   size_t count) {
+  return -1;
+}
+
 ssize_t
 coap_socket_read(coap_socket_t *sock, uint8_t *data, size_t data_len) {
   return -1;
@@ -46,10 +46,15 @@
 #include <mbedtls/error.h>
 #include <mbedtls/certs.h>
 #include <mbedtls/timing.h>
-#include <mbedtls/ssl_cookie.h>
 #include <mbedtls/oid.h>
 #include <mbedtls/debug.h>
 #include <mbedtls/sha256.h>
+#if defined(MBEDTLS_SSL_TICKET_C)
+#include <mbedtls/ssl_ticket.h>
+#endif /* MBEDTLS_SSL_TICKET_C */
+#if defined(MBEDTLS_SSL_CACHE_C)
+#include <mbedtls/ssl_cache.h>
+#endif /* MBEDTLS_SSL_CACHE_C */
 #if defined(ESPIDF_VERSION) && defined(CONFIG_MBEDTLS_DEBUG)
 #include <mbedtls/esp_debug.h>
 #endif /* ESPIDF_VERSION && CONFIG_MBEDTLS_DEBUG */
@@ -96,7 +101,6 @@ typedef struct coap_mbedtls_env_t {
   mbedtls_x509_crt cacert;
   mbedtls_x509_crt public_cert;
   mbedtls_pk_context private_key;
-  mbedtls_ssl_cookie_ctx cookie_ctx;
   /* If not set, need to do do_mbedtls_handshake */
   int established;
   int seen_client_hello;
@@ -127,6 +131,14 @@ typedef struct coap_mbedtls_context_t {
   char *root_ca_file;
   char *root_ca_path;
   int psk_pki_enabled;
+#if defined(MBEDTLS_SSL_TICKET_C)
+  /* Session tickets of all the server sessions are sealed with these keys */
+  mbedtls_ssl_ticket_context ticket_ctx;
+  int ticket_setup;
+#endif /* MBEDTLS_SSL_TICKET_C */
+#if defined(MBEDTLS_SSL_CACHE_C)
+  mbedtls_ssl_cache_context cache;
+#endif /* MBEDTLS_SSL_CACHE_C */
 } coap_mbedtls_context_t;
 
 typedef enum coap_enc_method_t {
@@ -878,6 +890,40 @@ psk_sni_callback(void *p_info, mbedtls_ssl_context *ssl,
 }
 #endif /* MBEDTLS_KEY_EXCHANGE__SOME__PSK_ENABLED */
 
+#if defined(MBEDTLS_SSL_PROTO_DTLS)
+/*
+ * The cookies are the library's stateless ones, which have already been
+ * checked before the ClientHello gets to Mbed TLS.
+ */
+static int
+cookie_write_callback(void *p_info, unsigned char **p, unsigned char *end,
+                      const unsigned char *cli_id, size_t cli_id_len)
+{
+  coap_session_t *c_session = (coap_session_t *)p_info;
+
+  (void)cli_id;
+  (void)cli_id_len;
+  if (end - *p < COAP_DTLS_COOKIE_LENGTH)
+    return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+  coap_dtls_cookie_generate(c_session->context, &c_session->addr_hash, *p);
+  *p += COAP_DTLS_COOKIE_LENGTH;
+  return 0;
+}
+
+static int
+cookie_check_callback(void *p_info, const unsigned char *cookie,
+                      size_t cookie_len, const unsigned char *cli_id,
+                      size_t cli_id_len)
+{
+  coap_session_t *c_session = (coap_session_t *)p_info;
+
+  (void)cli_id;
+  (void)cli_id_len;
+  return coap_dtls_cookie_verify(c_session->context, &c_session->addr_hash,
+                                 cookie, cookie_len) ? 0 : -1;
+}
+#endif /* MBEDTLS_SSL_PROTO_DTLS */
+
 static int setup_server_ssl_session(coap_session_t *c_session,
                                     coap_mbedtls_env_t *m_env)
 {
@@ -886,7 +932,6 @@ static int setup_server_ssl_session(coap_session_t *c_session,
   int ret = 0;
   m_context->psk_pki_enabled |= IS_SERVER;
 
-  mbedtls_ssl_cookie_init(&m_env->cookie_ctx);
   if ((ret = mbedtls_ssl_config_defaults(&m_env->conf,
                   MBEDTLS_SSL_IS_SERVER,
                   c_session->proto == COAP_PROTO_DTLS ?
@@ -899,6 +944,18 @@ static int setup_server_ssl_session(coap_session_t *c_session,
   }
 
   mbedtls_ssl_conf_rng(&m_env->conf, mbedtls_ctr_drbg_random, &m_env->ctr_drbg);
+#if defined(MBEDTLS_SSL_TICKET_C)
+  if (m_context->ticket_setup)
+    mbedtls_ssl_conf_session_tickets_cb(&m_env->conf,
+                                        mbedtls_ssl_ticket_write,
+                                        mbedtls_ssl_ticket_parse,
+                                        &m_context->ticket_ctx);
+#endif /* MBEDTLS_SSL_TICKET_C */
+#if defined(MBEDTLS_SSL_CACHE_C)
+  mbedtls_ssl_conf_session_cache(&m_env->conf, &m_context->cache,
+                                 mbedtls_ssl_cache_get,
+                                 mbedtls_ssl_cache_set);
+#endif /* MBEDTLS_SSL_CACHE_C */
 
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
   mbedtls_ssl_conf_handshake_timeout(&m_env->conf, COAP_DTLS_RETRANSMIT_MS,
@@ -930,18 +987,9 @@ static int setup_server_ssl_session(coap_session_t *c_session,
     }
   }
 
-  if ((ret = mbedtls_ssl_cookie_setup(&m_env->cookie_ctx,
-                                  mbedtls_ctr_drbg_random,
-                                  &m_env->ctr_drbg)) != 0) {
-    coap_log(LOG_ERR, "mbedtls_ssl_cookie_setup: returned -0x%x: '%s'\n",
-             -ret, get_error_string(ret));
-    goto fail;
-  }
-
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
-  mbedtls_ssl_conf_dtls_cookies(&m_env->conf, mbedtls_ssl_cookie_write,
-                                mbedtls_ssl_cookie_check,
-                                &m_env->cookie_ctx );
+  mbedtls_ssl_conf_dtls_cookies(&m_env->conf, cookie_write_callback,
+                                cookie_check_callback, c_session);
 #if MBEDTLS_VERSION_NUMBER >= 0x02100100
   mbedtls_ssl_set_mtu(&m_env->ssl, (uint16_t)c_session->mtu);
 #endif /* MBEDTLS_VERSION_NUMBER >= 0x02100100 */
@@ -1075,9 +1123,9 @@ static int setup_client_ssl_session(coap_session_t *c_session,
     mbedtls_ssl_conf_psk(&m_env->conf, (const unsigned char *)psk_key,
                          psk_len, (const unsigned char *)identity,
                          identity_len);
-    if (c_session->cpsk_setup_data.client_sni) {
+    if (c_session->psk && c_session->psk->cpsk_setup_data.client_sni) {
       mbedtls_ssl_set_hostname(&m_env->ssl,
-                               c_session->cpsk_setup_data.client_sni);
+                               c_session->psk->cpsk_setup_data.client_sni);
     }
     /* Identity Hint currently not supported in Mbed TLS so code removed */
 
@@ -1140,7 +1188,6 @@ static void mbedtls_cleanup(coap_mbedtls_env_t *m_env)
   mbedtls_ssl_config_free(&m_env->conf);
   mbedtls_ctr_drbg_free(&m_env->ctr_drbg);
   mbedtls_ssl_free(&m_env->ssl);
-  mbedtls_ssl_cookie_free(&m_env->cookie_ctx);
 }
 
 static void
@@ -1264,8 +1311,13 @@ mbedtls_debug_out(void *ctx COAP_UNUSED, int level,
   coap_log(log_level, "%s:%04d: %s", file, line, str);
 }
 
+/*
+ * If state is set, the connection is restored from it (see
+ * coap_dtls_rehydrate()) rather than set up for a new handshake.
+ */
 static coap_mbedtls_env_t *coap_dtls_new_mbedtls_env(coap_session_t *c_session,
-                                                     coap_dtls_role_t role)
+                                                     coap_dtls_role_t role,
+                                                  const coap_binary_t *state)
 {
   int ret = 0;
   coap_mbedtls_env_t *m_env = (coap_mbedtls_env_t *)c_session->tls;
@@ -1310,10 +1362,70 @@ static coap_mbedtls_env_t *coap_dtls_new_mbedtls_env(coap_session_t *c_session,
 
   mbedtls_ssl_conf_min_version(&m_env->conf, MBEDTLS_SSL_MAJOR_VERSION_3,
                                MBEDTLS_SSL_MINOR_VERSION_3);
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+  /*
+   * Servers ask for a Connection ID so that records keep reaching the
+   * session when NAT changes the address of the peer.  Clients only
+   * offer to send one.
+   */
+  mbedtls_ssl_conf_cid(&m_env->conf,
+                       role == COAP_DTLS_ROLE_SERVER ? COAP_DTLS_CID_LENGTH : 0,
+                       MBEDTLS_SSL_UNEXPECTED_CID_IGNORE);
+#endif /* MBEDTLS_SSL_DTLS_CONNECTION_ID */
 
   if ((ret = mbedtls_ssl_setup(&m_env->ssl, &m_env->conf)) != 0) {
     goto fail;
   }
+#if defined(MBEDTLS_SSL_CONTEXT_SERIALIZATION)
+  if (state) {
+    /* The Connection ID and the session are in the saved connection */
+    mbedtls_ssl_set_bio(&m_env->ssl, c_session, coap_dgram_write,
+                        coap_dgram_read, NULL);
+    mbedtls_ssl_set_timer_cb(&m_env->ssl, &m_env->timer,
+                             mbedtls_timing_set_delay,
+                             mbedtls_timing_get_delay);
+    mbedtls_ssl_conf_dbg(&m_env->conf, mbedtls_debug_out, stdout);
+    if ((ret = mbedtls_ssl_context_load(&m_env->ssl, state->s,
+                                        state->length)) != 0) {
+      coap_log(LOG_WARNING, "mbedtls_ssl_context_load returned -0x%x: '%s'\n",
+               -ret, get_error_string(ret));
+      coap_dtls_free_mbedtls_env(m_env);
+      return NULL;
+    }
+    m_env->established = 1;
+    return m_env;
+  }
+#else /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION */
+  (void)state;
+#endif /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION */
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+  if (role == COAP_DTLS_ROLE_CLIENT) {
+    const coap_binary_t *resume = coap_session_tls_resume_state(c_session);
+
+    if (resume) {
+      mbedtls_ssl_session ssl_session;
+
+      mbedtls_ssl_session_init(&ssl_session);
+      if (mbedtls_ssl_session_load(&ssl_session, resume->s,
+                                   resume->length) == 0 &&
+          mbedtls_ssl_set_session(&m_env->ssl, &ssl_session) == 0)
+        coap_log(LOG_DEBUG, "*  %s: resuming (D)TLS session\n",
+                 coap_session_str(c_session));
+      mbedtls_ssl_session_free(&ssl_session);
+    }
+  }
+#endif /* MBEDTLS_VERSION_NUMBER >= 0x02130000 */
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+  if (role == COAP_DTLS_ROLE_SERVER) {
+    uint8_t cid[COAP_DTLS_CID_LENGTH];
+
+    if (coap_session_new_cid(c_session, cid))
+      mbedtls_ssl_set_cid(&m_env->ssl, MBEDTLS_SSL_CID_ENABLED,
+                          cid, sizeof(cid));
+  } else {
+    mbedtls_ssl_set_cid(&m_env->ssl, MBEDTLS_SSL_CID_ENABLED, NULL, 0);
+  }
+#endif /* MBEDTLS_SSL_DTLS_CONNECTION_ID */
   mbedtls_ssl_set_bio(&m_env->ssl, c_session, coap_dgram_write,
                       coap_dgram_read, NULL);
   mbedtls_ssl_set_timer_cb(&m_env->ssl, &m_env->timer,
@@ -1346,6 +1458,14 @@ int coap_tls_is_supported(void)
   return 0;
 }
 
+#if defined(MBEDTLS_SSL_TICKET_C)
+static int
+coap_ticket_rng(void *ctx COAP_UNUSED, unsigned char *buf, size_t len)
+{
+  return coap_prng(buf, len) ? 0 : MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+}
+#endif /* MBEDTLS_SSL_TICKET_C */
+
 void *coap_dtls_new_context(coap_context_t *c_context)
 {
   coap_mbedtls_context_t *m_context;
@@ -1354,6 +1474,22 @@ void *coap_dtls_new_context(coap_context_t *c_context)
   m_context = (coap_mbedtls_context_t *)mbedtls_malloc(sizeof(coap_mbedtls_context_t));
   if (m_context) {
       memset(m_context, 0, sizeof(coap_mbedtls_context_t));
+#if defined(MBEDTLS_SSL_TICKET_C)
+      /* Mbed TLS replaces the ticket key, and keeps the previous one */
+      mbedtls_ssl_ticket_init(&m_context->ticket_ctx);
+      m_context->ticket_setup =
+                mbedtls_ssl_ticket_setup(&m_context->ticket_ctx,
+                                         coap_ticket_rng, NULL,
+                                         MBEDTLS_CIPHER_AES_256_GCM,
+                                         COAP_DTLS_RESUME_LIFETIME / 2) == 0;
+#endif /* MBEDTLS_SSL_TICKET_C */
+#if defined(MBEDTLS_SSL_CACHE_C)
+      mbedtls_ssl_cache_init(&m_context->cache);
+      mbedtls_ssl_cache_set_max_entries(&m_context->cache,
+                                        COAP_DTLS_SESSION_CACHE_SIZE);
+      mbedtls_ssl_cache_set_timeout(&m_context->cache,
+                                    COAP_DTLS_RESUME_LIFETIME);
+#endif /* MBEDTLS_SSL_CACHE_C */
   }
   return m_context;
 }
@@ -1510,6 +1646,12 @@ void coap_dtls_free_context(void *dtls_context)
     mbedtls_free(m_context->root_ca_path);
   if (m_context->root_ca_file)
     mbedtls_free(m_context->root_ca_file);
+#if defined(MBEDTLS_SSL_TICKET_C)
+  mbedtls_ssl_ticket_free(&m_context->ticket_ctx);
+#endif /* MBEDTLS_SSL_TICKET_C */
+#if defined(MBEDTLS_SSL_CACHE_C)
+  mbedtls_ssl_cache_free(&m_context->cache);
+#endif /* MBEDTLS_SSL_CACHE_C */
 
   mbedtls_free(m_context);
 }
@@ -1524,7 +1666,8 @@ void *coap_dtls_new_client_session(coap_session_t *c_session)
   return NULL;
 #else /* MBEDTLS_SSL_CLI_C */
   coap_mbedtls_env_t *m_env = coap_dtls_new_mbedtls_env(c_session,
-                                                       COAP_DTLS_ROLE_CLIENT);
+                                                       COAP_DTLS_ROLE_CLIENT,
+                                                       NULL);
   int ret;
 
   if (m_env) {
@@ -1811,6 +1954,45 @@ finish:
   return ret;
 }
 
+int coap_dtls_hello_needs_cookie(void)
+{
+  return 1;
+}
+
+int coap_dtls_can_offload_handshake(void)
+{
+  return 0;
+}
+
+coap_binary_t *coap_dtls_get_resume_state(coap_session_t *c_session)
+{
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+  coap_mbedtls_env_t *m_env = (coap_mbedtls_env_t *)c_session->tls;
+  mbedtls_ssl_session ssl_session;
+  coap_binary_t *state = NULL;
+  size_t len = 0;
+
+  if (!m_env || !m_env->established)
+    return NULL;
+  mbedtls_ssl_session_init(&ssl_session);
+  if (mbedtls_ssl_get_session(&m_env->ssl, &ssl_session) == 0 &&
+      mbedtls_ssl_session_save(&ssl_session, NULL, 0, &len) ==
+                                           MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
+    state = coap_new_binary(len);
+    if (state &&
+        mbedtls_ssl_session_save(&ssl_session, state->s, len, &len) != 0) {
+      coap_delete_binary(state);
+      state = NULL;
+    }
+  }
+  mbedtls_ssl_session_free(&ssl_session);
+  return state;
+#else /* MBEDTLS_VERSION_NUMBER < 0x02130000 */
+  (void)c_session;
+  return NULL;
+#endif /* MBEDTLS_VERSION_NUMBER < 0x02130000 */
+}
+
 /*
  * return -1  failure
  *         0  not completed
@@ -1834,7 +2016,7 @@ int coap_dtls_hello(coap_session_t *c_session,
   int ret;
 
   if (!m_env) {
-    m_env = coap_dtls_new_mbedtls_env(c_session, COAP_DTLS_ROLE_SERVER);
+    m_env = coap_dtls_new_mbedtls_env(c_session, COAP_DTLS_ROLE_SERVER, NULL);
     if (m_env) {
       c_session->tls = m_env;
     }
@@ -1896,6 +2078,68 @@ unsigned int coap_dtls_get_overhead(coap_session_t *c_session)
   return expansion;
 }
 
+int coap_dtls_can_hibernate(void)
+{
+#if defined(MBEDTLS_SSL_CONTEXT_SERIALIZATION) && \
+    defined(MBEDTLS_SSL_PROTO_DTLS)
+  return 1;
+#else /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION || ! MBEDTLS_SSL_PROTO_DTLS */
+  return 0;
+#endif /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION || ! MBEDTLS_SSL_PROTO_DTLS */
+}
+
+coap_binary_t *coap_dtls_hibernate(coap_session_t *c_session)
+{
+#if defined(MBEDTLS_SSL_CONTEXT_SERIALIZATION) && \
+    defined(MBEDTLS_SSL_PROTO_DTLS)
+  coap_mbedtls_env_t *m_env = (coap_mbedtls_env_t *)c_session->tls;
+  coap_binary_t *state;
+  size_t len = 0;
+  int ret;
+
+  if (!m_env || !m_env->established)
+    return NULL;
+  /* Refused while a record has not been fully read or sent */
+  if (mbedtls_ssl_context_save(&m_env->ssl, NULL, 0, &len) !=
+                                            MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL)
+    return NULL;
+  state = coap_new_binary(len);
+  if (!state)
+    return NULL;
+  if ((ret = mbedtls_ssl_context_save(&m_env->ssl, state->s, len,
+                                      &len)) != 0) {
+    coap_log(LOG_WARNING, "mbedtls_ssl_context_save returned -0x%x: '%s'\n",
+             -ret, get_error_string(ret));
+    coap_delete_binary(state);
+    return NULL;
+  }
+  state->length = len;
+  /* The saved connection can no longer be used, so is freed */
+  coap_dtls_free_mbedtls_env(m_env);
+  return state;
+#else /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION || ! MBEDTLS_SSL_PROTO_DTLS */
+  (void)c_session;
+  return NULL;
+#endif /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION || ! MBEDTLS_SSL_PROTO_DTLS */
+}
+
+void *coap_dtls_rehydrate(coap_session_t *c_session,
+                          const coap_binary_t *state)
+{
+#if defined(MBEDTLS_SSL_CONTEXT_SERIALIZATION) && \
+    defined(MBEDTLS_SSL_PROTO_DTLS)
+  return coap_dtls_new_mbedtls_env(c_session,
+                                   c_session->type == COAP_SESSION_TYPE_CLIENT ?
+                                     COAP_DTLS_ROLE_CLIENT :
+                                     COAP_DTLS_ROLE_SERVER,
+                                   state);
+#else /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION || ! MBEDTLS_SSL_PROTO_DTLS */
+  (void)c_session;
+  (void)state;
+  return NULL;
+#endif /* ! MBEDTLS_SSL_CONTEXT_SERIALIZATION || ! MBEDTLS_SSL_PROTO_DTLS */
+}
+
 #if !COAP_DISABLE_TCP
 void *coap_tls_new_client_session(coap_session_t *c_session COAP_UNUSED,
                                   int *connected COAP_UNUSED)
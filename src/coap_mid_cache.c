@@ -0,0 +1,144 @@
+/* coap_mid_cache.c -- Message-ID deduplication of Confirmable requests
+*
+* Copyright (C) 2021 The libcoap project
+*
+* This file is part of the CoAP library libcoap. Please see
+* README for terms of use.
+*/
+
+#include "coap2/coap_internal.h"
+
+/* The number of bytes accounted against the context limit for entry e */
+#define MID_CACHE_ENTRY_SIZE(e) \
+  (sizeof(coap_mid_cache_t) + ((e)->response ? (e)->response->length : 0))
+
+static void
+coap_mid_cache_delete(coap_mid_cache_t *entry) {
+  coap_session_t *session = entry->session;
+  coap_context_t *context = session->context;
+
+  context->mid_cache_size -= MID_CACHE_ENTRY_SIZE(entry);
+  DL_DELETE2(context->mid_cache_lru, entry, lru_prev, lru_next);
+  MID_CACHE_DELETE(session->mid_cache, entry);
+  coap_delete_binary(entry->response);
+  coap_free_type(COAP_MID_CACHE, entry);
+}
+
+/*
+ * Removes expired entries from the front of the LRU list, and then least
+ * recently used entries (other than keep) until needed more bytes fit.
+ */
+static void
+coap_mid_cache_trim(coap_context_t *context, size_t needed, coap_tick_t now,
+                    coap_mid_cache_t *keep) {
+  while (context->mid_cache_lru && context->mid_cache_lru != keep &&
+         (context->mid_cache_lru->expire <= now ||
+          context->mid_cache_size + needed > context->max_mid_cache_size)) {
+    coap_mid_cache_delete(context->mid_cache_lru);
+  }
+}
+
+static void
+coap_mid_cache_touch(coap_context_t *context, coap_mid_cache_t *entry) {
+  if (entry->lru_next) {
+    DL_DELETE2(context->mid_cache_lru, entry, lru_prev, lru_next);
+    DL_APPEND2(context->mid_cache_lru, entry, lru_prev, lru_next);
+  }
+}
+
+int
+coap_mid_cache_check(coap_session_t *session, const coap_pdu_t *pdu) {
+  coap_context_t *context = session->context;
+  coap_mid_cache_t *entry;
+  coap_mid_t mid = pdu->mid;
+  coap_tick_t now;
+
+  if (context->max_mid_cache_size == 0 || session->transient ||
+      COAP_PROTO_RELIABLE(session->proto))
+    return 0;
+
+  coap_ticks(&now);
+  MID_CACHE_FIND(session->mid_cache, mid, entry);
+  if (entry) {
+    if (entry->expire > now && entry->response) {
+      coap_log(LOG_DEBUG, "** %s: mid=0x%x: duplicate, resending response\n",
+               coap_session_str(session), mid);
+      coap_mid_cache_touch(context, entry);
+      if (session->proto == COAP_PROTO_DTLS) {
+        if (coap_session_rehydrate(session))
+          coap_dtls_send(session, entry->response->s,
+                         entry->response->length);
+      }
+      else
+        coap_session_send(session, entry->response->s,
+                          entry->response->length);
+      return 1;
+    }
+    /* Expired, or nothing was sent back, so handle the request again */
+    coap_mid_cache_delete(entry);
+  }
+
+  if (sizeof(coap_mid_cache_t) > context->max_mid_cache_size)
+    return 0;
+  coap_mid_cache_trim(context, sizeof(coap_mid_cache_t), now, NULL);
+  entry = coap_malloc_type(COAP_MID_CACHE, sizeof(coap_mid_cache_t));
+  if (!entry)
+    return 0;
+  memset(entry, 0, sizeof(coap_mid_cache_t));
+  entry->session = session;
+  entry->mid = mid;
+  entry->expire = now +
+           (coap_tick_t)COAP_EXCHANGE_LIFETIME(session) * COAP_TICKS_PER_SECOND;
+  MID_CACHE_ADD(session->mid_cache, entry);
+  DL_APPEND2(context->mid_cache_lru, entry, lru_prev, lru_next);
+  context->mid_cache_size += sizeof(coap_mid_cache_t);
+  return 0;
+}
+
+void
+coap_mid_cache_set_response(coap_session_t *session, const coap_pdu_t *pdu) {
+  coap_context_t *context = session->context;
+  coap_mid_cache_t *entry;
+  coap_mid_t mid = pdu->mid;
+  size_t length = pdu->used_size + pdu->hdr_size;
+  coap_tick_t now;
+
+  MID_CACHE_FIND(session->mid_cache, mid, entry);
+  if (!entry || entry->response)
+    return;
+
+  if (sizeof(coap_mid_cache_t) + length > context->max_mid_cache_size) {
+    coap_mid_cache_delete(entry);
+    return;
+  }
+  coap_ticks(&now);
+  coap_mid_cache_touch(context, entry);
+  coap_mid_cache_trim(context, length, now, entry);
+  entry->response = coap_new_binary(length);
+  if (!entry->response) {
+    coap_mid_cache_delete(entry);
+    return;
+  }
+  memcpy(entry->response->s, pdu->token - pdu->hdr_size, length);
+  context->mid_cache_size += length;
+}
+
+void
+coap_mid_cache_free_session(coap_session_t *session) {
+  coap_mid_cache_t *entry, *rtmp;
+
+  MID_CACHE_ITER(session->mid_cache, entry, rtmp) {
+    coap_mid_cache_delete(entry);
+  }
+}
+
+void
+coap_context_set_mid_cache_size(coap_context_t *context, size_t size) {
+  context->max_mid_cache_size = size;
+  coap_mid_cache_trim(context, 0, 0, NULL);
+}
+
+size_t
+coap_context_get_mid_cache_size(const coap_context_t *context) {
+  return context->max_mid_cache_size;
+}
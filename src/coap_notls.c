@@ -138,6 +138,21 @@ coap_dtls_receive(coap_session_t *session COAP_UNUSED,
   return -1;
 }
 
+int
+coap_dtls_hello_needs_cookie(void) {
+  return 0;
+}
+
+int
+coap_dtls_can_offload_handshake(void) {
+  return 0;
+}
+
+coap_binary_t *
+coap_dtls_get_resume_state(coap_session_t *session COAP_UNUSED) {
+  return NULL;
+}
+
 int
 coap_dtls_hello(coap_session_t *session COAP_UNUSED,
   const uint8_t *data COAP_UNUSED,
@@ -150,6 +165,22 @@ unsigned int coap_dtls_get_overhead(coap_session_t *session COAP_UNUSED) {
   return 0;
 }
 
+int
+coap_dtls_can_hibernate(void) {
+  return 0;
+}
+
+coap_binary_t *
+coap_dtls_hibernate(coap_session_t *session COAP_UNUSED) {
+  return NULL;
+}
+
+void *
+coap_dtls_rehydrate(coap_session_t *session COAP_UNUSED,
+                    const coap_binary_t *state COAP_UNUSED) {
+  return NULL;
+}
+
 void *coap_tls_new_client_session(coap_session_t *session COAP_UNUSED, int *connected COAP_UNUSED) {
   return NULL;
 }
@@ -62,6 +62,9 @@
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
 #include <openssl/x509v3.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
 
 #ifdef COAP_EPOLL_SUPPORT
 # include <sys/epoll.h>
@@ -100,7 +103,6 @@
 typedef struct coap_dtls_context_t {
   SSL_CTX *ctx;
   SSL *ssl;        /* OpenSSL object for listening to connection requests */
-  HMAC_CTX *cookie_hmac;
   BIO_METHOD *meth;
   BIO_ADDR *bio_addr;
 } coap_dtls_context_t;
@@ -231,6 +233,11 @@ typedef struct coap_ssl_st {
   unsigned pdu_len;
   unsigned peekmode;
   coap_tick_t timeout;
+  coap_handshake_job_t *job;   /* set while run by a handshake thread */
+  int cork;                    /* set while records are to be staged */
+  uint8_t *stage;              /* records to send in one datagram */
+  size_t stage_len;
+  size_t stage_size;
 } coap_ssl_data;
 
 static int coap_dgram_create(BIO *a) {
@@ -249,8 +256,10 @@ static int coap_dgram_destroy(BIO *a) {
   if (a == NULL)
     return 0;
   data = (coap_ssl_data *)BIO_get_data(a);
-  if (data != NULL)
+  if (data != NULL) {
+    free(data->stage);
     free(data);
+  }
   return 1;
 }
 
@@ -281,10 +290,18 @@ static int coap_dgram_read(BIO *a, char *out, int outl) {
   return ret;
 }
 
-static int coap_dgram_write(BIO *a, const char *in, int inl) {
+static int coap_dgram_send(BIO *a, const char *in, int inl) {
   int ret = 0;
   coap_ssl_data *data = (coap_ssl_data *)BIO_get_data(a);
 
+  if (data->job) {
+    /* Sent by the I/O thread once the handshake step is done */
+    BIO_clear_retry_flags(a);
+    if (!coap_handshake_data_add(&data->job->out, (const uint8_t *)in,
+                                 (size_t)inl))
+      return -1;
+    return inl;
+  }
   if (data->session) {
     if (data->session->sock.flags == COAP_SOCKET_EMPTY && data->session->endpoint == NULL) {
       /* socket was closed on client due to error */
@@ -302,6 +319,50 @@ static int coap_dgram_write(BIO *a, const char *in, int inl) {
   return ret;
 }
 
+/*
+ * Sends the records that coap_dgram_write() has staged, as one datagram.
+ */
+static void coap_dgram_flush(BIO *a) {
+  coap_ssl_data *data = (coap_ssl_data *)BIO_get_data(a);
+
+  if (data->stage_len) {
+    /* A lost datagram is retransmitted as for any other */
+    coap_dgram_send(a, (const char *)data->stage, (int)data->stage_len);
+    data->stage_len = 0;
+    BIO_clear_retry_flags(a);
+  }
+}
+
+/*
+ * OpenSSL only buffers the records of a flight while in handshake, so those
+ * sent afterwards (such as a retransmitted last flight, or alerts) are
+ * staged while corked, and then sent together as far as the MTU allows.
+ */
+static int coap_dgram_write(BIO *a, const char *in, int inl) {
+  coap_ssl_data *data = (coap_ssl_data *)BIO_get_data(a);
+  size_t limit;
+
+  if (!data->cork || !data->session)
+    return coap_dgram_send(a, in, inl);
+  limit = data->session->mtu;
+  if (data->stage_len + (size_t)inl > limit)
+    coap_dgram_flush(a);
+  if ((size_t)inl > limit)
+    return coap_dgram_send(a, in, inl);
+  if (data->stage_size < limit) {
+    uint8_t *stage = realloc(data->stage, limit);
+
+    if (!stage)
+      return coap_dgram_send(a, in, inl);
+    data->stage = stage;
+    data->stage_size = limit;
+  }
+  memcpy(data->stage + data->stage_len, in, inl);
+  data->stage_len += inl;
+  BIO_clear_retry_flags(a);
+  return inl;
+}
+
 static int coap_dgram_puts(BIO *a, const char *pstr) {
   return coap_dgram_write(a, pstr, (int)strlen(pstr));
 }
@@ -333,8 +394,11 @@ static long coap_dgram_ctrl(BIO *a, int cmd, long num, void *ptr) {
   case BIO_CTRL_DGRAM_GET_FALLBACK_MTU:
     ret = -1;
     break;
-  case BIO_CTRL_DUP:
   case BIO_CTRL_FLUSH:
+    coap_dgram_flush(a);
+    ret = 1;
+    break;
+  case BIO_CTRL_DUP:
   case BIO_CTRL_DGRAM_MTU_DISCOVER:
   case BIO_CTRL_DGRAM_SET_CONNECTED:
     ret = 1;
@@ -370,35 +434,104 @@ static int
 coap_dtls_generate_cookie(SSL *ssl,
                          unsigned char *cookie,
                          unsigned int *cookie_len) {
-  coap_dtls_context_t *dtls =
-            (coap_dtls_context_t *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
   coap_ssl_data *data = (coap_ssl_data*)BIO_get_data(SSL_get_rbio(ssl));
-  int r = HMAC_Init_ex(dtls->cookie_hmac, NULL, 0, NULL, NULL);
-  r &= HMAC_Update(dtls->cookie_hmac,
-                   (const uint8_t*)&data->session->addr_info.local.addr,
-                   (size_t)data->session->addr_info.local.size);
-  r &= HMAC_Update(dtls->cookie_hmac,
-                   (const uint8_t*)&data->session->addr_info.remote.addr,
-                   (size_t)data->session->addr_info.remote.size);
-  r &= HMAC_Final(dtls->cookie_hmac, cookie, cookie_len);
-  return r;
+
+  coap_dtls_cookie_generate(data->session->context,
+                            &data->session->addr_hash, cookie);
+  *cookie_len = COAP_DTLS_COOKIE_LENGTH;
+  return 1;
 }
 
 static int
 coap_dtls_verify_cookie(SSL *ssl,
                         const uint8_t *cookie,
                         unsigned int cookie_len) {
-  uint8_t hmac[32];
-  unsigned len = 32;
-  if (coap_dtls_generate_cookie(ssl, hmac, &len) &&
-      cookie_len == len && memcmp(cookie, hmac, len) == 0)
-    return 1;
-  else
+  coap_ssl_data *data = (coap_ssl_data*)BIO_get_data(SSL_get_rbio(ssl));
+
+  return coap_dtls_cookie_verify(data->session->context,
+                                 &data->session->addr_hash,
+                                 cookie, cookie_len);
+}
+
+/*
+ * Session tickets are sealed with the ticket keys of the CoAP context, so
+ * that they are shared by the DTLS and TLS contexts and replaced regularly.
+ */
+static int
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+coap_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc) {
+#else /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+coap_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc) {
+#endif /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+  coap_session_t *session = (coap_session_t *)SSL_get_app_data(ssl);
+  const coap_dtls_ticket_key_t *key;
+  int is_current = 1;
+  int ret = -1;
+
+  if (!session || !session->context)
     return 0;
+  /* The keys are replaced while being used by other handshake threads */
+  coap_handshake_lock(session->context);
+  if (enc) {
+    key = coap_dtls_ticket_key_current(session->context);
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+      goto finish;
+    memcpy(key_name, key->name, sizeof(key->name));
+    if (!EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->cipher_key, iv))
+      goto finish;
+  }
+  else {
+    key = coap_dtls_ticket_key_find(session->context, key_name, &is_current);
+    if (!key) {
+      ret = 0;
+      goto finish;
+    }
+    if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->cipher_key, iv))
+      goto finish;
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  {
+    OSSL_PARAM params[3];
+
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                                  (void *)key->mac_key,
+                                                  sizeof(key->mac_key));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                 (char *)"SHA256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    if (!EVP_MAC_CTX_set_params(hctx, params))
+      goto finish;
+  }
+#else /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+  if (!HMAC_Init_ex(hctx, key->mac_key, sizeof(key->mac_key), EVP_sha256(),
+                    NULL))
+    goto finish;
+#endif /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+  /* A ticket sealed with the previous key gets replaced */
+  ret = is_current ? 1 : 2;
+
+finish:
+  coap_handshake_unlock(session->context);
+  return ret;
+}
+
+static const unsigned char coap_sid_ctx[] = "libcoap";
+
+static void
+coap_set_resume_prefs(SSL_CTX *ctx) {
+  SSL_CTX_sess_set_cache_size(ctx, COAP_DTLS_SESSION_CACHE_SIZE);
+  SSL_CTX_set_timeout(ctx, COAP_DTLS_RESUME_LIFETIME);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, coap_ticket_key_callback);
+#else /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+  SSL_CTX_set_tlsext_ticket_key_cb(ctx, coap_ticket_key_callback);
+#endif /* OPENSSL_VERSION_NUMBER < 0x30000000L */
 }
 
 static unsigned int
-coap_dtls_psk_client_callback(
+coap_dtls_psk_client_callback_locked(
   SSL *ssl,
   const char *hint,
   char *identity,
@@ -416,20 +549,22 @@ coap_dtls_psk_client_callback(
       c_session->context->get_client_psk == NULL)
     return 0;
   o_context = (coap_openssl_context_t *)c_session->context->dtls_context;
-  if (o_context == NULL)
+  if (o_context == NULL || c_session->psk == NULL)
     return 0;
-  setup_data = &c_session->cpsk_setup_data;
+  setup_data = &c_session->psk->cpsk_setup_data;
 
-  if (c_session->psk_hint) {
-    coap_delete_bin_const(c_session->psk_hint);
-    c_session->psk_hint = NULL;
-  }
   if (hint) {
+    coap_bin_const_t temp;
+
     hint_len = strlen(hint);
-    c_session->psk_hint = coap_new_bin_const((const uint8_t *)hint, hint_len);
+    temp.s = (const uint8_t *)hint;
+    temp.length = hint_len;
+    coap_session_refresh_psk_hint(c_session, &temp);
   }
-  else
+  else {
+    coap_session_refresh_psk_hint(c_session, NULL);
     hint = "";
+  }
 
   coap_log(LOG_DEBUG, "got psk_identity_hint: '%.*s'\n", (int)hint_len, hint);
 
@@ -449,19 +584,13 @@ coap_dtls_psk_client_callback(
     if (psk_info->key.length > max_psk_len)
       return 0;
 
-    if (c_session->psk_identity) {
-      coap_delete_bin_const(c_session->psk_identity);
-    }
     identity_len = psk_info->identity.length;
-    c_session->psk_identity = coap_new_bin_const(psk_info->identity.s, identity_len);
+    coap_session_refresh_psk_identity(c_session, &psk_info->identity);
     memcpy(identity, psk_info->identity.s, identity_len);
     identity[identity_len] = '\000';
 
-    if (c_session->psk_key) {
-      coap_delete_bin_const(c_session->psk_key);
-    }
     psk_len = psk_info->key.length;
-    c_session->psk_key = coap_new_bin_const(psk_info->key.s, psk_len);
+    coap_session_refresh_psk_key(c_session, &psk_info->key);
     memcpy(psk, psk_info->key.s, psk_len);
 
     return (unsigned int)psk_len;
@@ -479,7 +608,30 @@ coap_dtls_psk_client_callback(
 }
 
 static unsigned int
-coap_dtls_psk_server_callback(
+coap_dtls_psk_client_callback(
+  SSL *ssl,
+  const char *hint,
+  char *identity,
+  unsigned int max_identity_len,
+  unsigned char *psk,
+  unsigned int max_psk_len
+) {
+  coap_session_t *session = (coap_session_t*)SSL_get_app_data(ssl);
+  coap_context_t *context = session ? session->context : NULL;
+  unsigned int ret;
+
+  /* May be run by a handshake thread, alongside the application callbacks
+     and the session state updates of the others */
+  coap_handshake_lock(context);
+  ret = coap_dtls_psk_client_callback_locked(ssl, hint, identity,
+                                             max_identity_len, psk,
+                                             max_psk_len);
+  coap_handshake_unlock(context);
+  return ret;
+}
+
+static unsigned int
+coap_dtls_psk_server_callback_locked(
   SSL *ssl,
   const char *identity,
   unsigned char *psk,
@@ -502,10 +654,12 @@ coap_dtls_psk_server_callback(
     identity = "";
 
   /* Track the Identity being used */
-  if (c_session->psk_identity)
-    coap_delete_bin_const(c_session->psk_identity);
-  c_session->psk_identity = coap_new_bin_const((const uint8_t *)identity,
-                                               identity_len);
+  {
+    coap_bin_const_t lidentity;
+    lidentity.length = identity_len;
+    lidentity.s = (const uint8_t*)identity;
+    coap_session_refresh_psk_identity(c_session, &lidentity);
+  }
 
   coap_log(LOG_DEBUG, "got psk_identity: '%.*s'\n",
            (int)identity_len, identity);
@@ -535,7 +689,26 @@ coap_dtls_psk_server_callback(
                                                       max_psk_len);
 }
 
-static void coap_dtls_info_callback(const SSL *ssl, int where, int ret) {
+static unsigned int
+coap_dtls_psk_server_callback(
+  SSL *ssl,
+  const char *identity,
+  unsigned char *psk,
+  unsigned int max_psk_len
+) {
+  coap_session_t *session = (coap_session_t*)SSL_get_app_data(ssl);
+  coap_context_t *context = session ? session->context : NULL;
+  unsigned int ret;
+
+  /* Run by the handshake threads, if there are any */
+  coap_handshake_lock(context);
+  ret = coap_dtls_psk_server_callback_locked(ssl, identity, psk, max_psk_len);
+  coap_handshake_unlock(context);
+  return ret;
+}
+
+static void
+coap_dtls_info_callback_locked(const SSL *ssl, int where, int ret) {
   coap_session_t *session = (coap_session_t*)SSL_get_app_data(ssl);
   const char *pstr;
   int w = where &~SSL_ST_MASK;
@@ -596,6 +769,17 @@ static void coap_dtls_info_callback(const SSL *ssl, int where, int ret) {
     session->dtls_event = COAP_EVENT_DTLS_RENEGOTIATE;
 }
 
+static void
+coap_dtls_info_callback(const SSL *ssl, int where, int ret) {
+  coap_session_t *session = (coap_session_t*)SSL_get_app_data(ssl);
+  coap_context_t *context = session ? session->context : NULL;
+
+  /* Run by the handshake threads, if there are any */
+  coap_handshake_lock(context);
+  coap_dtls_info_callback_locked(ssl, where, ret);
+  coap_handshake_unlock(context);
+}
+
 #if !COAP_DISABLE_TCP
 static int coap_sock_create(BIO *a) {
   BIO_set_init(a, 1);
@@ -709,8 +893,6 @@ void *coap_dtls_new_context(coap_context_t *coap_context) {
 
   context = (coap_openssl_context_t *)coap_malloc(sizeof(coap_openssl_context_t));
   if (context) {
-    uint8_t cookie_secret[32];
-
     memset(context, 0, sizeof(coap_openssl_context_t));
 
     /* Set up DTLS context */
@@ -721,20 +903,19 @@ void *coap_dtls_new_context(coap_context_t *coap_context) {
     SSL_CTX_set_app_data(context->dtls.ctx, &context->dtls);
     SSL_CTX_set_read_ahead(context->dtls.ctx, 1);
     coap_set_user_prefs(context->dtls.ctx);
-    memset(cookie_secret, 0, sizeof(cookie_secret));
-    if (!RAND_bytes(cookie_secret, (int)sizeof(cookie_secret))) {
-      if (dtls_log_level >= LOG_WARNING)
-        coap_log(LOG_WARNING,
-                 "Insufficient entropy for random cookie generation");
-      coap_prng(cookie_secret, sizeof(cookie_secret));
-    }
-    context->dtls.cookie_hmac = HMAC_CTX_new();
-    if (!HMAC_Init_ex(context->dtls.cookie_hmac, cookie_secret, (int)sizeof(cookie_secret), EVP_sha256(), NULL))
-      goto error;
+    /* The cookies are the library's stateless ones, checked before the
+       ClientHello gets to DTLSv1_listen() */
     SSL_CTX_set_cookie_generate_cb(context->dtls.ctx, coap_dtls_generate_cookie);
     SSL_CTX_set_cookie_verify_cb(context->dtls.ctx, coap_dtls_verify_cookie);
     SSL_CTX_set_info_callback(context->dtls.ctx, coap_dtls_info_callback);
     SSL_CTX_set_options(context->dtls.ctx, SSL_OP_NO_QUERY_MTU);
+    coap_set_resume_prefs(context->dtls.ctx);
+    /*
+     * Needed to resume sessions where the client certificate was checked.
+     * Not set for TLS, as TLS 1.3 external PSKs then fail the handshake.
+     */
+    SSL_CTX_set_session_id_context(context->dtls.ctx, coap_sid_ctx,
+                                   sizeof(coap_sid_ctx) - 1);
     context->dtls.meth = BIO_meth_new(BIO_TYPE_DGRAM, "coapdgram");
     if (!context->dtls.meth)
       goto error;
@@ -757,6 +938,7 @@ void *coap_dtls_new_context(coap_context_t *coap_context) {
     SSL_CTX_set_min_proto_version(context->tls.ctx, TLS1_VERSION);
     coap_set_user_prefs(context->tls.ctx);
     SSL_CTX_set_info_callback(context->tls.ctx, coap_dtls_info_callback);
+    coap_set_resume_prefs(context->tls.ctx);
     context->tls.meth = BIO_meth_new(BIO_TYPE_SOCKET, "coapsock");
     if (!context->tls.meth)
       goto error;
@@ -792,6 +974,13 @@ coap_dtls_context_set_spsk(coap_context_t *c_context,
 #if !COAP_DISABLE_TCP
   SSL_CTX_set_psk_server_callback(o_context->tls.ctx,
                                   coap_dtls_psk_server_callback);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  /*
+   * The PSK callback would be passed a TLS 1.3 ticket as an identity, and
+   * a TLS 1.3 PSK handshake is already abbreviated, so none are sent
+   */
+  SSL_CTX_set_num_tickets(o_context->tls.ctx, 0);
+#endif /* OPENSSL_VERSION_NUMBER >= 0x10101000L */
 #endif /* !COAP_DISABLE_TCP */
   if (setup_data->psk_info.hint.s) {
     char hint[COAP_DTLS_HINT_LENGTH];
@@ -1826,7 +2015,7 @@ get_san_or_cn_from_cert(X509* x509) {
 }
 
 static int
-tls_verify_call_back(int preverify_ok, X509_STORE_CTX *ctx) {
+tls_verify_call_back_locked(int preverify_ok, X509_STORE_CTX *ctx) {
   SSL *ssl = X509_STORE_CTX_get_ex_data(ctx,
                               SSL_get_ex_data_X509_STORE_CTX_idx());
   coap_session_t *session = SSL_get_app_data(ssl);
@@ -1923,6 +2112,21 @@ tls_verify_call_back(int preverify_ok, X509_STORE_CTX *ctx) {
   return preverify_ok;
 }
 
+static int
+tls_verify_call_back(int preverify_ok, X509_STORE_CTX *ctx) {
+  SSL *ssl = X509_STORE_CTX_get_ex_data(ctx,
+                              SSL_get_ex_data_X509_STORE_CTX_idx());
+  coap_session_t *session = ssl ? (coap_session_t*)SSL_get_app_data(ssl) : NULL;
+  coap_context_t *context = session ? session->context : NULL;
+  int ret;
+
+  /* Run by the handshake threads, if there are any */
+  coap_handshake_lock(context);
+  ret = tls_verify_call_back_locked(preverify_ok, ctx);
+  coap_handshake_unlock(context);
+  return ret;
+}
+
 #if OPENSSL_VERSION_NUMBER < 0x10101000L
 /*
  * During the SSL/TLS initial negotiations, tls_secret_call_back() is called so
@@ -1951,7 +2155,7 @@ tls_secret_call_back(SSL *ssl,
       session->context == NULL)
     return 0;
 
-  if ((session->psk_key) ||
+  if ((session->psk && session->psk->psk_key) ||
       (session->context->spsk_setup_data.psk_info.key.s &&
        session->context->spsk_setup_data.psk_info.key.length)) {
     /* Is PSK being requested - if so, we need to change algorithms */
@@ -2001,9 +2205,9 @@ tls_secret_call_back(SSL *ssl,
     }
   }
   else {
-    if (session->psk_key) {
-      memcpy(secret, session->psk_key->s, session->psk_key->length);
-      *secretlen = session->psk_key->length;
+    if (session->psk && session->psk->psk_key) {
+      memcpy(secret, session->psk->psk_key->s, session->psk->psk_key->length);
+      *secretlen = session->psk->psk_key->length;
     }
     else if (session->context->spsk_setup_data.psk_info.key.s &&
              session->context->spsk_setup_data.psk_info.key.length) {
@@ -2031,9 +2235,9 @@ tls_secret_call_back(SSL *ssl,
  * coap_dtls_context_set_pki()
  */
 static int
-tls_server_name_call_back(SSL *ssl,
-                          int *sd COAP_UNUSED,
-                          void *arg
+tls_server_name_call_back_locked(SSL *ssl,
+                                 int *sd COAP_UNUSED,
+                                 void *arg
 ) {
   coap_dtls_pki_t *setup_data = (coap_dtls_pki_t*)arg;
 
@@ -2119,6 +2323,19 @@ error:
   return SSL_TLSEXT_ERR_ALERT_WARNING;
 }
 
+static int
+tls_server_name_call_back(SSL *ssl, int *sd, void *arg) {
+  coap_session_t *session = ssl ? (coap_session_t*)SSL_get_app_data(ssl) : NULL;
+  coap_context_t *context = session ? session->context : NULL;
+  int ret;
+
+  /* The SNI entries of the context are shared by the handshake threads */
+  coap_handshake_lock(context);
+  ret = tls_server_name_call_back_locked(ssl, sd, arg);
+  coap_handshake_unlock(context);
+  return ret;
+}
+
 /*
  * During the SSL/TLS initial negotiations, psk_tls_server_name_call_back() is
  * called to see if SNI is being used.
@@ -2127,9 +2344,9 @@ error:
  * in coap_dtls_context_set_spsk()
  */
 static int
-psk_tls_server_name_call_back(SSL *ssl,
-                          int *sd COAP_UNUSED,
-                          void *arg
+psk_tls_server_name_call_back_locked(SSL *ssl,
+                                 int *sd COAP_UNUSED,
+                                 void *arg
 ) {
   coap_dtls_spsk_t *setup_data = (coap_dtls_spsk_t*)arg;
 
@@ -2225,6 +2442,18 @@ psk_tls_server_name_call_back(SSL *ssl,
 error:
   return SSL_TLSEXT_ERR_ALERT_WARNING;
 }
+
+static int
+psk_tls_server_name_call_back(SSL *ssl, int *sd, void *arg) {
+  coap_session_t *session = ssl ? (coap_session_t*)SSL_get_app_data(ssl) : NULL;
+  coap_context_t *context = session ? session->context : NULL;
+  int ret;
+
+  coap_handshake_lock(context);
+  ret = psk_tls_server_name_call_back_locked(ssl, sd, arg);
+  coap_handshake_unlock(context);
+  return ret;
+}
 #else /* OPENSSL_VERSION_NUMBER >= 0x10101000L */
 /*
  * During the SSL/TLS initial negotiations, tls_client_hello_call_back() is
@@ -2235,9 +2464,9 @@ error:
  * Set up by SSL_CTX_set_client_hello_cb().
  */
 static int
-tls_client_hello_call_back(SSL *ssl,
-                          int *al,
-                          void *arg COAP_UNUSED
+tls_client_hello_call_back_locked(SSL *ssl,
+                                 int *al,
+                                 void *arg COAP_UNUSED
 ) {
   coap_session_t *session;
   coap_openssl_context_t *dtls_context;
@@ -2266,7 +2495,7 @@ tls_client_hello_call_back(SSL *ssl,
   /*
    * See if PSK being requested
    */
-  if ((session->psk_key) ||
+  if ((session->psk && session->psk->psk_key) ||
       (session->context->spsk_setup_data.psk_info.key.s &&
        session->context->spsk_setup_data.psk_info.key.length)) {
     size_t len = SSL_client_hello_get0_ciphers(ssl, &out);
@@ -2433,6 +2662,19 @@ is_x509:
   return SSL_CLIENT_HELLO_SUCCESS;
 }
 
+static int
+tls_client_hello_call_back(SSL *ssl, int *al, void *arg) {
+  coap_session_t *session = ssl ? (coap_session_t*)SSL_get_app_data(ssl) : NULL;
+  coap_context_t *context = session ? session->context : NULL;
+  int ret;
+
+  /* The SNI entries of the context are shared by the handshake threads */
+  coap_handshake_lock(context);
+  ret = tls_client_hello_call_back_locked(ssl, al, arg);
+  coap_handshake_unlock(context);
+  return ret;
+}
+
 /*
  * During the SSL/TLS initial negotiations, psk_tls_client_hello_call_back() is
  * called early in the Client Hello processing so it is possible to determine
@@ -2441,9 +2683,9 @@ is_x509:
  * Set up by SSL_CTX_set_client_hello_cb().
  */
 static int
-psk_tls_client_hello_call_back(SSL *ssl,
-                          int *al,
-                          void *arg COAP_UNUSED
+psk_tls_client_hello_call_back_locked(SSL *ssl,
+                                 int *al,
+                                 void *arg COAP_UNUSED
 ) {
   coap_session_t *c_session;
   coap_openssl_context_t *o_context;
@@ -2548,6 +2790,18 @@ int_err:
   *al = SSL_AD_INTERNAL_ERROR;
   return SSL_CLIENT_HELLO_ERROR;
 }
+
+static int
+psk_tls_client_hello_call_back(SSL *ssl, int *al, void *arg) {
+  coap_session_t *session = ssl ? (coap_session_t*)SSL_get_app_data(ssl) : NULL;
+  coap_context_t *context = session ? session->context : NULL;
+  int ret;
+
+  coap_handshake_lock(context);
+  ret = psk_tls_client_hello_call_back_locked(ssl, al, arg);
+  coap_handshake_unlock(context);
+  return ret;
+}
 #endif /* OPENSSL_VERSION_NUMBER >= 0x10101000L */
 
 int
@@ -2701,8 +2955,6 @@ void coap_dtls_free_context(void *handle) {
     SSL_free(context->dtls.ssl);
   if (context->dtls.ctx)
     SSL_CTX_free(context->dtls.ctx);
-  if (context->dtls.cookie_hmac)
-    HMAC_CTX_free(context->dtls.cookie_hmac);
   if (context->dtls.meth)
     BIO_meth_free(context->dtls.meth);
   if (context->dtls.bio_addr)
@@ -2732,6 +2984,92 @@ void coap_dtls_free_context(void *handle) {
   coap_free(context);
 }
 
+/*
+ * Runs a DTLS handshake step on a handshake thread (see
+ * coap_handshake_offload()).  The records that are sent are captured by
+ * coap_dgram_write() and sent by coap_dtls_handshake_done() on the I/O
+ * thread.
+ */
+static int
+coap_dtls_handshake_run(coap_handshake_job_t *job) {
+  SSL *ssl = (SSL *)job->tls;
+  coap_session_t *session = job->session;
+  coap_ssl_data *ssl_data = (coap_ssl_data*)BIO_get_data(SSL_get_rbio(ssl));
+  coap_handshake_data_t *record;
+  int r;
+
+  ssl_data->job = job;
+  session->dtls_event = -1;
+  do {
+    record = job->in;
+    if (record) {
+      job->in = record->next;
+      ssl_data->pdu = record->s;
+      ssl_data->pdu_len = (unsigned)record->length;
+    }
+    /* The error queue is per thread, and may hold another session's errors */
+    ERR_clear_error();
+    r = SSL_do_handshake(ssl);
+    if (r <= 0) {
+      int err = SSL_get_error(ssl, r);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        r = 0;
+      } else {
+        if (err == SSL_ERROR_ZERO_RETURN)
+          session->dtls_event = COAP_EVENT_DTLS_CLOSED;
+        else
+          session->dtls_event = COAP_EVENT_DTLS_ERROR;
+        r = -1;
+      }
+    }
+    ssl_data->pdu = NULL;
+    ssl_data->pdu_len = 0;
+    coap_free(record);
+  } while (r == 0 && job->in);
+  ssl_data->job = NULL;
+
+  if (session->dtls_event == COAP_EVENT_DTLS_ERROR ||
+      session->dtls_event == COAP_EVENT_DTLS_CLOSED)
+    r = -1;
+  return r;
+}
+
+/*
+ * Sends what coap_dtls_handshake_run() has captured, and updates the
+ * session for the outcome of the step.
+ */
+static void
+coap_dtls_handshake_done(coap_handshake_job_t *job) {
+  coap_session_t *session = job->session;
+  coap_handshake_data_t *record;
+
+  assert(session->tls == job->tls);
+  if (session->sock.flags != COAP_SOCKET_EMPTY || session->endpoint) {
+    LL_FOREACH(job->out, record) {
+      coap_session_send(session, record->s, record->length);
+    }
+  }
+
+  if (job->result == 1) {
+    coap_log(COAP_LOG_CIPHERS, "*  %s: Using cipher: %s\n",
+             coap_session_str(session), SSL_get_cipher_name(job->tls));
+    coap_handle_event(session->context, COAP_EVENT_DTLS_CONNECTED, session);
+    coap_session_connected(session);
+    /* Anything that came in the datagram of the last flight */
+    while (session->tls && SSL_has_pending(session->tls)) {
+      if (coap_dtls_receive(session, NULL, 0) < 0)
+        break;
+    }
+  } else if (session->dtls_event >= 0) {
+    /* COAP_EVENT_DTLS_CLOSED event reported in coap_session_disconnected() */
+    if (session->dtls_event != COAP_EVENT_DTLS_CLOSED)
+      coap_handle_event(session->context, session->dtls_event, session);
+    if (session->dtls_event == COAP_EVENT_DTLS_ERROR ||
+        session->dtls_event == COAP_EVENT_DTLS_CLOSED)
+      coap_session_disconnected(session, COAP_NACK_TLS_FAILED);
+  }
+}
+
 void * coap_dtls_new_server_session(coap_session_t *session) {
   BIO *nbio = NULL;
   SSL *nssl = NULL, *ssl = NULL;
@@ -2768,6 +3106,15 @@ void * coap_dtls_new_server_session(coap_session_t *session) {
     }
   }
 
+  /* The ClientHello is answered by a handshake thread, if there are any */
+  if (coap_handshake_offload(session, ssl, data->pdu, data->pdu_len,
+                             coap_dtls_handshake_run,
+                             coap_dtls_handshake_done)) {
+    data->pdu = NULL;
+    data->pdu_len = 0;
+    return ssl;
+  }
+
   r = SSL_accept(ssl);
   if (r == -1) {
     int err = SSL_get_error(ssl, r);
@@ -2793,12 +3140,26 @@ setup_client_ssl_session(coap_session_t *session, SSL *ssl
 ) {
   coap_openssl_context_t *context =
                     ((coap_openssl_context_t *)session->context->dtls_context);
+  const coap_binary_t *resume = coap_session_tls_resume_state(session);
+
+  if (resume) {
+    const unsigned char *p = resume->s;
+    SSL_SESSION *ssl_session = d2i_SSL_SESSION(NULL, &p, (long)resume->length);
+
+    if (ssl_session) {
+      if (SSL_set_session(ssl, ssl_session) == 1)
+        coap_log(LOG_DEBUG, "*  %s: resuming (D)TLS session\n",
+                 coap_session_str(session));
+      SSL_SESSION_free(ssl_session);
+    }
+  }
 
   if (context->psk_pki_enabled & IS_PSK) {
-    coap_dtls_cpsk_t *setup_data = &session->cpsk_setup_data;
+    coap_dtls_cpsk_t *setup_data = session->psk ?
+                                   &session->psk->cpsk_setup_data : NULL;
 
     /* Issue SNI if requested */
-    if (setup_data->client_sni &&
+    if (setup_data && setup_data->client_sni &&
         SSL_set_tlsext_host_name (ssl, setup_data->client_sni) != 1) {
           coap_log(LOG_WARNING, "SSL_set_tlsext_host_name: set '%s' failed",
                    setup_data->client_sni);
@@ -2806,7 +3167,7 @@ setup_client_ssl_session(coap_session_t *session, SSL *ssl
     SSL_set_psk_client_callback(ssl, coap_dtls_psk_client_callback);
     SSL_set_psk_server_callback(ssl, coap_dtls_psk_server_callback);
     SSL_set_cipher_list(ssl, COAP_OPENSSL_PSK_CIPHERS);
-    if (setup_data->validate_ih_call_back) {
+    if (setup_data && setup_data->validate_ih_call_back) {
       if (session->proto == COAP_PROTO_DTLS) {
         SSL_set_max_proto_version(ssl, DTLS1_2_VERSION);
       }
@@ -2909,7 +3270,7 @@ error:
 
 void coap_dtls_session_update_mtu(coap_session_t *session) {
   SSL *ssl = (SSL *)session->tls;
-  if (ssl)
+  if (ssl && !coap_handshake_busy(session))
     SSL_set_mtu(ssl, (long)session->mtu);
 }
 
@@ -2920,6 +3281,8 @@ void coap_dtls_free_session(coap_session_t *session) {
       int r = SSL_shutdown(ssl);
       if (r == 0) r = SSL_shutdown(ssl);
     }
+    /* Anything staged by a coap_dtls_receive() that is freeing the session */
+    coap_dgram_flush(SSL_get_wbio(ssl));
     SSL_free(ssl);
     session->tls = NULL;
     if (session->context)
@@ -2931,11 +3294,22 @@ int coap_dtls_send(coap_session_t *session,
   const uint8_t *data, size_t data_len) {
   int r;
   SSL *ssl = (SSL *)session->tls;
+  coap_ssl_data *ssl_data;
+  int cork;
 
   assert(ssl != NULL);
 
+  /*
+   * Application data goes in its own datagram, as not all peers look for
+   * more than one record in a datagram once in session
+   */
+  ssl_data = (coap_ssl_data*)BIO_get_data(SSL_get_wbio(ssl));
+  coap_dgram_flush(SSL_get_wbio(ssl));
+  cork = ssl_data->cork;
+  ssl_data->cork = 0;
   session->dtls_event = -1;
   r = SSL_write(ssl, data, (int)data_len);
+  ssl_data->cork = cork;
 
   if (r <= 0) {
     int err = SSL_get_error(ssl, r);
@@ -2994,6 +3368,41 @@ void coap_dtls_handle_timeout(coap_session_t *session) {
   }
 }
 
+coap_binary_t *coap_dtls_get_resume_state(coap_session_t *session) {
+  SSL *ssl = (SSL *)session->tls;
+  SSL_SESSION *ssl_session;
+  coap_binary_t *state = NULL;
+  unsigned char *p;
+  int len;
+
+  if (!ssl || !SSL_is_init_finished(ssl))
+    return NULL;
+  ssl_session = SSL_get1_session(ssl);
+  if (!ssl_session)
+    return NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  /* A TLS 1.3 session is only resumable once its ticket has arrived */
+  if (SSL_SESSION_is_resumable(ssl_session))
+#endif /* OPENSSL_VERSION_NUMBER >= 0x10101000L */
+  {
+    len = i2d_SSL_SESSION(ssl_session, NULL);
+    if (len > 0 && (state = coap_new_binary((size_t)len)) != NULL) {
+      p = state->s;
+      i2d_SSL_SESSION(ssl_session, &p);
+    }
+  }
+  SSL_SESSION_free(ssl_session);
+  return state;
+}
+
+int coap_dtls_hello_needs_cookie(void) {
+  return 1;
+}
+
+int coap_dtls_can_offload_handshake(void) {
+  return 1;
+}
+
 int coap_dtls_hello(coap_session_t *session,
   const uint8_t *data, size_t data_len) {
   coap_dtls_context_t *dtls = &((coap_openssl_context_t *)session->context->dtls_context)->dtls;
@@ -3038,8 +3447,26 @@ int coap_dtls_receive(coap_session_t *session,
 
   assert(ssl != NULL);
 
+  /* Too short for the PDU below, and cannot hold a record anyway */
+  if (data_len && data_len < DTLS1_RT_HEADER_LENGTH) {
+    coap_log(LOG_DEBUG, "*  %s: dropped %zu byte datagram\n",
+             coap_session_str(session), data_len);
+    return 0;
+  }
+
+  /* The handshake may be left to (or still be with) a handshake thread */
+  if ((coap_handshake_busy(session) || SSL_in_init(ssl)) &&
+      coap_handshake_offload(session, ssl, data, data_len,
+                             coap_dtls_handshake_run,
+                             coap_dtls_handshake_done))
+    return 0;
+
   int in_init = SSL_in_init(ssl);
-  uint8_t pdu[COAP_RXBUFFER_SIZE];
+  /* The plaintext of a record is shorter than the datagram it came in */
+  size_t max_len = data_len && data_len < COAP_RXBUFFER_SIZE ?
+                                         data_len : COAP_RXBUFFER_SIZE;
+  coap_pdu_t *pdu;
+  int err;
   ssl_data = (coap_ssl_data*)BIO_get_data(SSL_get_rbio(ssl));
   assert(ssl_data != NULL);
 
@@ -3049,43 +3476,67 @@ int coap_dtls_receive(coap_session_t *session,
   }
   ssl_data->pdu = data;
   ssl_data->pdu_len = (unsigned)data_len;
+  /* What is sent other than application data can go in one datagram */
+  ssl_data->cork = !in_init;
 
   session->dtls_event = -1;
-  r = SSL_read(ssl, pdu, (int)sizeof(pdu));
-  if (r > 0) {
-    r =  coap_handle_dgram(session->context, session, pdu, (size_t)r);
-    goto finished;
-  } else {
-    int err = SSL_get_error(ssl, r);
-    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-      if (in_init && SSL_is_init_finished(ssl)) {
-        coap_log(COAP_LOG_CIPHERS, "*  %s: Using cipher: %s\n",
-                 coap_session_str(session), SSL_get_cipher_name(ssl));
-        coap_handle_event(session->context, COAP_EVENT_DTLS_CONNECTED, session);
-        coap_session_connected(session);
-      }
-      r = 0;
-    } else {
-      if (err == SSL_ERROR_ZERO_RETURN)        /* Got a close notify alert from the remote side */
-        session->dtls_event = COAP_EVENT_DTLS_CLOSED;
-      else if (err == SSL_ERROR_SSL)
-        session->dtls_event = COAP_EVENT_DTLS_ERROR;
+  for (;;) {
+    /* The record is decrypted straight into the PDU that handles it */
+    pdu = coap_pdu_init(0, 0, 0, max_len - COAP_PDU_MAX_UDP_HEADER_SIZE);
+    if (!pdu ||
+        !coap_pdu_resize(pdu, max_len - COAP_PDU_MAX_UDP_HEADER_SIZE)) {
+      coap_delete_pdu(pdu);
       r = -1;
+      goto finished;
     }
-    if (session->dtls_event >= 0) {
-      /* COAP_EVENT_DTLS_CLOSED event reported in coap_session_disconnected() */
-      if (session->dtls_event != COAP_EVENT_DTLS_CLOSED)
-        coap_handle_event(session->context, session->dtls_event, session);
-      if (session->dtls_event == COAP_EVENT_DTLS_ERROR ||
-          session->dtls_event == COAP_EVENT_DTLS_CLOSED) {
-        coap_session_disconnected(session, COAP_NACK_TLS_FAILED);
-        ssl_data = NULL;
-        r = -1;
-      }
+    r = SSL_read(ssl, pdu->token - COAP_PDU_MAX_UDP_HEADER_SIZE, (int)max_len);
+    if (r <= 0) {
+      coap_delete_pdu(pdu);
+      break;
+    }
+    r = coap_handle_dgram_pdu(session->context, session, pdu, (size_t)r);
+    if (session->tls != ssl) {
+      /* Freed while handling the PDU */
+      ssl_data = NULL;
+      goto finished;
+    }
+    /* A datagram may hold more than one record */
+    if (!SSL_has_pending(ssl))
+      goto finished;
+  }
+  err = SSL_get_error(ssl, r);
+  if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+    if (in_init && SSL_is_init_finished(ssl)) {
+      coap_log(COAP_LOG_CIPHERS, "*  %s: Using cipher: %s\n",
+               coap_session_str(session), SSL_get_cipher_name(ssl));
+      coap_handle_event(session->context, COAP_EVENT_DTLS_CONNECTED, session);
+      coap_session_connected(session);
+    }
+    r = 0;
+  } else {
+    if (err == SSL_ERROR_ZERO_RETURN)        /* Got a close notify alert from the remote side */
+      session->dtls_event = COAP_EVENT_DTLS_CLOSED;
+    else if (err == SSL_ERROR_SSL)
+      session->dtls_event = COAP_EVENT_DTLS_ERROR;
+    r = -1;
+  }
+  if (session->dtls_event >= 0) {
+    /* COAP_EVENT_DTLS_CLOSED event reported in coap_session_disconnected() */
+    if (session->dtls_event != COAP_EVENT_DTLS_CLOSED)
+      coap_handle_event(session->context, session->dtls_event, session);
+    if (session->dtls_event == COAP_EVENT_DTLS_ERROR ||
+        session->dtls_event == COAP_EVENT_DTLS_CLOSED) {
+      coap_session_disconnected(session, COAP_NACK_TLS_FAILED);
+      ssl_data = NULL;
+      r = -1;
     }
   }
 
 finished:
+  if (ssl_data) {
+    ssl_data->cork = 0;
+    coap_dgram_flush(SSL_get_wbio(ssl));
+  }
   if (ssl_data && ssl_data->pdu_len) {
     /* pdu data is held on stack which will not stay there */
     coap_log(LOG_DEBUG, "coap_dtls_receive: ret %d: remaining data %u\n", r, ssl_data->pdu_len);
@@ -3098,7 +3549,7 @@ finished:
 unsigned int coap_dtls_get_overhead(coap_session_t *session) {
   unsigned int overhead = 37;
   const SSL_CIPHER *s_ciph = NULL;
-  if (session->tls != NULL)
+  if (session->tls != NULL && !coap_handshake_busy(session))
     s_ciph = SSL_get_current_cipher(session->tls);
   if ( s_ciph ) {
     unsigned int ivlen, maclen, blocksize = 1, pad = 0;
@@ -3151,6 +3602,20 @@ unsigned int coap_dtls_get_overhead(coap_session_t *session) {
   return overhead;
 }
 
+int coap_dtls_can_hibernate(void) {
+  /* OpenSSL cannot export the keys and sequence numbers of a connection */
+  return 0;
+}
+
+coap_binary_t *coap_dtls_hibernate(coap_session_t *session COAP_UNUSED) {
+  return NULL;
+}
+
+void *coap_dtls_rehydrate(coap_session_t *session COAP_UNUSED,
+                          const coap_binary_t *state COAP_UNUSED) {
+  return NULL;
+}
+
 #if !COAP_DISABLE_TCP
 void *coap_tls_new_client_session(coap_session_t *session, int *connected) {
   BIO *bio = NULL;
@@ -0,0 +1,1314 @@
+/* coap_proxy.c -- Forward proxy for CoAP requests
+*
+* Copyright (C) 2021 The libcoap project
+*
+* This file is part of the CoAP library libcoap. Please see
+* README for terms of use.
+*/
+
+/* getaddrinfo_a() is a GNU extension */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
+#include "coap2/coap_internal.h"
+
+#if COAP_PROXY_SUPPORT
+
+#include <ctype.h>
+#include <stdio.h>
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#ifdef HAVE_WS2TCPIP_H
+#include <ws2tcpip.h>
+#endif
+
+/* The longest host name that is looked up */
+#define PROXY_MAX_HOST 255
+
+#ifdef HAVE_GETADDRINFO_A
+/* An outstanding getaddrinfo_a() lookup */
+typedef struct proxy_resolver_t {
+  struct gaicb gai;
+  struct addrinfo hints;
+  char name[PROXY_MAX_HOST + 1];
+} proxy_resolver_t;
+#endif /* HAVE_GETADDRINFO_A */
+
+int
+coap_proxy_is_supported(void) {
+  return 1;
+}
+
+static coap_proto_t
+proxy_scheme_proto(coap_uri_scheme_t scheme) {
+  switch (scheme) {
+  case COAP_URI_SCHEME_COAPS:
+    return COAP_PROTO_DTLS;
+  case COAP_URI_SCHEME_COAP_TCP:
+    return COAP_PROTO_TCP;
+  case COAP_URI_SCHEME_COAPS_TCP:
+    return COAP_PROTO_TLS;
+  case COAP_URI_SCHEME_COAP:
+  case COAP_URI_SCHEME_HTTP:
+  case COAP_URI_SCHEME_HTTPS:
+  default:
+    return COAP_PROTO_UDP;
+  }
+}
+
+static int
+proxy_scheme_supported(coap_uri_scheme_t scheme) {
+  switch (scheme) {
+  case COAP_URI_SCHEME_COAP:
+    return 1;
+  case COAP_URI_SCHEME_COAPS:
+    return coap_dtls_is_supported();
+  case COAP_URI_SCHEME_COAP_TCP:
+    return coap_tcp_is_supported();
+  case COAP_URI_SCHEME_COAPS_TCP:
+    return coap_tls_is_supported();
+  case COAP_URI_SCHEME_HTTP:
+  case COAP_URI_SCHEME_HTTPS:
+  default:
+    return 0;
+  }
+}
+
+static void
+proxy_release_body(coap_session_t *session COAP_UNUSED, void *app_ptr) {
+  coap_delete_binary(app_ptr);
+}
+
+/* Sends code back to the client (and to those of any collapsed requests)
+ * in place of the response to req */
+static void
+proxy_respond_error(coap_proxy_req_t *req, coap_pdu_code_t code) {
+  coap_session_t *incoming = req->incoming;
+  coap_proxy_req_t *follower;
+  coap_pdu_t *pdu;
+
+  LL_FOREACH2(req->followers, follower, f_next) {
+    proxy_respond_error(follower, code);
+  }
+  pdu = coap_pdu_init(req->type == COAP_MESSAGE_CON ? COAP_MESSAGE_CON :
+                                                      COAP_MESSAGE_NON,
+                      code, coap_new_message_id(incoming),
+                      coap_session_max_pdu_size(incoming));
+  if (!pdu)
+    return;
+  if (!coap_add_token(pdu, req->incoming_token->length,
+                      req->incoming_token->s)) {
+    coap_delete_pdu(pdu);
+    return;
+  }
+  coap_log(LOG_DEBUG, "***%s: proxy: %d.%02d for forwarded request\n",
+           coap_session_str(incoming), code >> 5, code & 0x1f);
+  if (coap_send(incoming, pdu) == COAP_INVALID_MID)
+    coap_log(LOG_INFO, "***%s: proxy: cannot send %d.%02d\n",
+             coap_session_str(incoming), code >> 5, code & 0x1f);
+}
+
+static void
+proxy_free_req(coap_proxy_req_t *req) {
+  coap_proxy_upstream_t *upstream = req->upstream;
+  coap_context_t *context = req->incoming->context;
+  coap_proxy_req_t *follower, *ftmp;
+
+  LL_FOREACH_SAFE2(req->followers, follower, ftmp, f_next) {
+    proxy_free_req(follower);
+  }
+  if (req->cache_key) {
+    HASH_DELETE(ch, context->proxy_collapse, req);
+    coap_delete_cache_key(req->cache_key);
+  }
+  switch (req->state) {
+  case COAP_PROXY_REQ_QUEUED:
+    DL_DELETE2(upstream->queue, req, q_prev, q_next);
+    upstream->queued--;
+    break;
+  case COAP_PROXY_REQ_SENT:
+    HASH_DELETE(hh, upstream->reqs, req);
+    upstream->inflight--;
+    break;
+  case COAP_PROXY_REQ_COLLAPSED:
+    LL_DELETE2(req->leader->followers, req, f_next);
+    break;
+  case COAP_PROXY_REQ_OBSERVING:
+  default:
+    HASH_DELETE(hh, upstream->reqs, req);
+    break;
+  }
+  if (req->state == COAP_PROXY_REQ_QUEUED ||
+      req->state == COAP_PROXY_REQ_SENT)
+    DL_DELETE2(context->proxy_reqs, req, exp_prev, exp_next);
+  coap_ticks(&upstream->last_used);
+
+  coap_session_release(req->incoming);
+  coap_delete_binary(req->incoming_token);
+  coap_delete_string(req->query);
+  coap_delete_optlist(req->optlist);
+  coap_delete_binary(req->body);
+  coap_delete_binary(req->body_data);
+  coap_free(req);
+}
+
+/* Answers and frees all the requests of upstream, which is not to be used
+ * any more */
+static void
+proxy_fail_upstream(coap_proxy_upstream_t *upstream, coap_pdu_code_t code) {
+  coap_proxy_req_t *req, *rtmp;
+
+  upstream->failed = 1;
+  DL_FOREACH_SAFE2(upstream->queue, req, rtmp, q_next) {
+    proxy_respond_error(req, code);
+    proxy_free_req(req);
+  }
+  HASH_ITER(hh, upstream->reqs, req, rtmp) {
+    if (req->state == COAP_PROXY_REQ_SENT)
+      proxy_respond_error(req, code);
+    proxy_free_req(req);
+  }
+}
+
+static void
+proxy_cancel_resolver(coap_proxy_upstream_t *upstream) {
+#ifdef HAVE_GETADDRINFO_A
+  proxy_resolver_t *resolver = upstream->resolver;
+
+  if (!resolver)
+    return;
+  if (gai_cancel(&resolver->gai) == EAI_NOTCANCELED) {
+    const struct gaicb *list[1];
+
+    list[0] = &resolver->gai;
+    while (gai_error(&resolver->gai) == EAI_INPROGRESS)
+      gai_suspend(list, 1, NULL);
+  }
+  if (resolver->gai.ar_result)
+    freeaddrinfo(resolver->gai.ar_result);
+  coap_free(resolver);
+#endif /* HAVE_GETADDRINFO_A */
+  upstream->resolver = NULL;
+  upstream->resolving = 0;
+}
+
+/* Returns the proxy state of session, allocating it if needed */
+static coap_session_proxy_t *
+proxy_session_block(coap_session_t *session) {
+  if (!session->proxy) {
+    session->proxy = (coap_session_proxy_t *)coap_malloc_type(
+                                                COAP_SESSION_PROXY,
+                                                sizeof(coap_session_proxy_t));
+    if (!session->proxy) {
+      coap_log(LOG_WARNING, "No memory to store session proxy information\n");
+      return NULL;
+    }
+    memset(session->proxy, 0, sizeof(coap_session_proxy_t));
+  }
+  return session->proxy;
+}
+
+/* Frees the proxy state of session once nothing is left in it */
+static void
+proxy_session_trim(coap_session_t *session) {
+  if (session->proxy && !session->proxy->upstream && !session->proxy->body) {
+    coap_free_type(COAP_SESSION_PROXY, session->proxy);
+    session->proxy = NULL;
+  }
+}
+
+static void
+proxy_free_upstream(coap_context_t *context, coap_proxy_upstream_t *upstream) {
+  coap_proxy_req_t *req, *rtmp;
+
+  HASH_DELETE(hh, context->proxy_upstreams, upstream);
+  DL_FOREACH_SAFE2(upstream->queue, req, rtmp, q_next) {
+    proxy_free_req(req);
+  }
+  HASH_ITER(hh, upstream->reqs, req, rtmp) {
+    proxy_free_req(req);
+  }
+  proxy_cancel_resolver(upstream);
+  if (upstream->session) {
+    coap_log(LOG_DEBUG, "***%s: proxy: upstream session released\n",
+             coap_session_str(upstream->session));
+    upstream->session->proxy->upstream = NULL;
+    proxy_session_trim(upstream->session);
+    coap_session_release(upstream->session);
+  }
+  coap_delete_binary(upstream->key);
+  coap_delete_string(upstream->host);
+  coap_free(upstream);
+}
+
+/* Fills in server with the first usable address of res */
+static int
+proxy_take_address(const struct addrinfo *res, uint16_t port,
+                   coap_address_t *server) {
+  const struct addrinfo *ainfo;
+
+  for (ainfo = res; ainfo != NULL; ainfo = ainfo->ai_next) {
+    switch (ainfo->ai_family) {
+    case AF_INET:
+    case AF_INET6:
+      coap_address_init(server);
+      server->size = (socklen_t)ainfo->ai_addrlen;
+      memcpy(&server->addr, ainfo->ai_addr, ainfo->ai_addrlen);
+      if (ainfo->ai_family == AF_INET)
+        server->addr.sin.sin_port = htons(port);
+      else
+        server->addr.sin6.sin6_port = htons(port);
+      return 1;
+    default:
+      ;
+    }
+  }
+  return 0;
+}
+
+/* Creates the session of upstream to server */
+static int
+proxy_connect(coap_context_t *context, coap_proxy_upstream_t *upstream,
+              const coap_address_t *server) {
+  coap_proto_t proto = proxy_scheme_proto(upstream->scheme);
+  coap_str_const_t host;
+  coap_session_t *session;
+
+  host.length = upstream->host->length;
+  host.s = upstream->host->s;
+  if (context->proxy_session_handler)
+    session = context->proxy_session_handler(context, server, proto, &host);
+  else if (proto == COAP_PROTO_UDP || proto == COAP_PROTO_TCP)
+    session = coap_new_client_session(context, NULL, server, proto);
+  else {
+    coap_log(LOG_WARNING,
+             "proxy: a session handler is needed for secure upstreams\n");
+    session = NULL;
+  }
+  if (!session)
+    return 0;
+  if (!proxy_session_block(session)) {
+    coap_session_release(session);
+    return 0;
+  }
+  session->proxy->upstream = upstream;
+  upstream->session = session;
+  coap_log(LOG_DEBUG, "***%s: proxy: new upstream session for '%s'\n",
+           coap_session_str(session), upstream->host->s);
+  return 1;
+}
+
+/* Resolves the host of upstream and creates its session.  Address literals
+ * are handled straight away, and host names are looked up in the
+ * background where the system supports it. */
+static int
+proxy_resolve(coap_context_t *context, coap_proxy_upstream_t *upstream) {
+  const char *name = (const char *)upstream->host->s;
+  struct addrinfo hints;
+  struct addrinfo *res = NULL;
+  coap_address_t server;
+  int error;
+  int ok;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_flags = AI_NUMERICHOST;
+  if (getaddrinfo(name, NULL, &hints, &res) == 0) {
+    upstream->numeric = 1;
+  }
+  else {
+#ifdef HAVE_GETADDRINFO_A
+    proxy_resolver_t *resolver;
+    struct gaicb *list[1];
+
+    resolver = coap_malloc(sizeof(proxy_resolver_t));
+    if (!resolver)
+      return 0;
+    memset(resolver, 0, sizeof(proxy_resolver_t));
+    memcpy(resolver->name, name, upstream->host->length);
+    resolver->hints.ai_socktype = SOCK_DGRAM;
+    resolver->hints.ai_family = AF_UNSPEC;
+    resolver->gai.ar_name = resolver->name;
+    resolver->gai.ar_request = &resolver->hints;
+    list[0] = &resolver->gai;
+    error = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL);
+    if (error != 0) {
+      coap_log(LOG_WARNING, "proxy: cannot resolve '%s': %s\n", name,
+               gai_strerror(error));
+      coap_free(resolver);
+      return 0;
+    }
+    upstream->resolver = resolver;
+    upstream->resolving = 1;
+    return 1;
+#else /* ! HAVE_GETADDRINFO_A */
+    hints.ai_flags = 0;
+    error = getaddrinfo(name, NULL, &hints, &res);
+    if (error != 0) {
+      coap_log(LOG_WARNING, "proxy: cannot resolve '%s': %s\n", name,
+               gai_strerror(error));
+      return 0;
+    }
+#endif /* ! HAVE_GETADDRINFO_A */
+  }
+  ok = proxy_take_address(res, upstream->port, &server) &&
+       proxy_connect(context, upstream, &server);
+  freeaddrinfo(res);
+  return ok;
+}
+
+#ifdef HAVE_GETADDRINFO_A
+/* Creates the session of upstream once its host name has been resolved */
+static void
+proxy_check_resolver(coap_context_t *context, coap_proxy_upstream_t *upstream) {
+  proxy_resolver_t *resolver = upstream->resolver;
+  coap_address_t server;
+  int error = gai_error(&resolver->gai);
+
+  if (error == EAI_INPROGRESS)
+    return;
+  if (error != 0 ||
+      !proxy_take_address(resolver->gai.ar_result, upstream->port, &server) ||
+      !proxy_connect(context, upstream, &server)) {
+    coap_log(LOG_WARNING, "proxy: cannot resolve '%s': %s\n", resolver->name,
+             error != 0 ? gai_strerror(error) : "no usable address");
+    proxy_fail_upstream(upstream, COAP_RESPONSE_CODE_BAD_GATEWAY);
+  }
+  proxy_cancel_resolver(upstream);
+}
+#endif /* HAVE_GETADDRINFO_A */
+
+static coap_proxy_upstream_t *
+proxy_get_upstream(coap_context_t *context, coap_uri_scheme_t scheme,
+                   const coap_str_const_t *host, uint16_t port) {
+  coap_proxy_upstream_t *upstream;
+  uint8_t key[3 + PROXY_MAX_HOST];
+  size_t key_length = 3 + host->length;
+  size_t i;
+
+  if (host->length == 0 || host->length > PROXY_MAX_HOST)
+    return NULL;
+  key[0] = (uint8_t)scheme;
+  key[1] = port >> 8;
+  key[2] = port & 0xff;
+  for (i = 0; i < host->length; i++)
+    key[3 + i] = (uint8_t)tolower(host->s[i]);
+
+  HASH_FIND(hh, context->proxy_upstreams, key, key_length, upstream);
+  if (upstream && upstream->failed) {
+    proxy_free_upstream(context, upstream);
+    upstream = NULL;
+  }
+  if (upstream)
+    return upstream;
+
+  upstream = coap_malloc(sizeof(coap_proxy_upstream_t));
+  if (!upstream)
+    return NULL;
+  memset(upstream, 0, sizeof(coap_proxy_upstream_t));
+  upstream->key = coap_new_binary(key_length);
+  upstream->host = coap_new_string(host->length);
+  if (!upstream->key || !upstream->host)
+    goto fail;
+  memcpy(upstream->key->s, key, key_length);
+  memcpy(upstream->host->s, host->s, host->length);
+  upstream->scheme = scheme;
+  upstream->port = port;
+  coap_ticks(&upstream->last_used);
+  if (!proxy_resolve(context, upstream))
+    goto fail;
+  HASH_ADD_KEYPTR(hh, context->proxy_upstreams, upstream->key->s,
+                  upstream->key->length, upstream);
+  return upstream;
+
+fail:
+  coap_delete_binary(upstream->key);
+  coap_delete_string(upstream->host);
+  coap_free(upstream);
+  return NULL;
+}
+
+static int
+proxy_can_send(const coap_proxy_upstream_t *upstream) {
+  unsigned int max_inflight;
+
+  if (!upstream->session || upstream->failed)
+    return 0;
+  max_inflight = upstream->session->context->proxy_max_inflight;
+  return max_inflight == 0 || upstream->inflight < max_inflight;
+}
+
+/* Sends the queued req to its upstream server */
+static void
+proxy_send(coap_proxy_req_t *req) {
+  coap_proxy_upstream_t *upstream = req->upstream;
+  coap_session_t *ongoing = upstream->session;
+  coap_binary_t *body = req->body;
+  coap_pdu_t *pdu;
+  uint8_t token[8];
+
+  DL_DELETE2(upstream->queue, req, q_prev, q_next);
+  upstream->queued--;
+  req->state = COAP_PROXY_REQ_SENT;
+  upstream->inflight++;
+
+  if (req->token == 0) {
+    coap_session_new_token(ongoing, &req->token_length, token);
+    req->token = coap_decode_var_bytes8(token, req->token_length);
+  }
+  else {
+    coap_encode_var_safe8(token, sizeof(token), req->token);
+  }
+  HASH_ADD(hh, upstream->reqs, token, sizeof(req->token), req);
+
+  pdu = coap_pdu_init(req->type, req->code, coap_new_message_id(ongoing),
+                      coap_session_max_pdu_size(ongoing));
+  if (!pdu || !coap_add_token(pdu, req->token_length, token) ||
+      (req->optlist && !coap_add_optlist_pdu(pdu, &req->optlist))) {
+    coap_delete_pdu(pdu);
+    goto fail;
+  }
+  coap_delete_optlist(req->optlist);
+  req->optlist = NULL;
+  if (body) {
+    /* body is released by coap_add_data_large_request(), even on failure */
+    req->body = NULL;
+    if (!coap_add_data_large_request(ongoing, pdu, body->length, body->s,
+                                     proxy_release_body, body)) {
+      coap_delete_pdu(pdu);
+      goto fail;
+    }
+  }
+  if (coap_send_large(ongoing, pdu) == COAP_INVALID_MID) {
+    proxy_respond_error(req, COAP_RESPONSE_CODE_BAD_GATEWAY);
+    proxy_free_req(req);
+  }
+  return;
+
+fail:
+  proxy_respond_error(req, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+  proxy_free_req(req);
+}
+
+/* Sends as many queued requests as the in-flight limit allows */
+static void
+proxy_dispatch(coap_proxy_upstream_t *upstream) {
+  while (upstream->queue && proxy_can_send(upstream)) {
+    proxy_send(upstream->queue);
+  }
+}
+
+/* Returns 1 if the Proxy-Scheme option opt is name, ignoring case */
+static int
+proxy_scheme_is(const coap_opt_t *opt, const char *name) {
+  const uint8_t *value = coap_opt_value(opt);
+  size_t length = coap_opt_length(opt);
+  size_t i;
+
+  if (length != strlen(name))
+    return 0;
+  for (i = 0; i < length; i++) {
+    if (tolower(value[i]) != name[i])
+      return 0;
+  }
+  return 1;
+}
+
+/* Gets the URI that request is to be forwarded to from its Proxy-Uri or
+ * Proxy-Scheme option.  The URI components point into request. */
+static int
+proxy_get_uri(const coap_pdu_t *request, coap_uri_t *uri,
+              coap_opt_t **proxy_uri, coap_pdu_t *response) {
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *opt;
+
+  memset(uri, 0, sizeof(coap_uri_t));
+  *proxy_uri = coap_check_option(request, COAP_OPTION_PROXY_URI, &opt_iter);
+  if (*proxy_uri) {
+    if (coap_split_proxy_uri(coap_opt_value(*proxy_uri),
+                             coap_opt_length(*proxy_uri), uri) < 0) {
+      /* https://tools.ietf.org/html/rfc7252#section-5.7.2 */
+      coap_log(LOG_WARNING, "proxy: Proxy-Uri not decodable\n");
+      coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
+      return 0;
+    }
+    return 1;
+  }
+
+  opt = coap_check_option(request, COAP_OPTION_PROXY_SCHEME, &opt_iter);
+  if (!opt) {
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_NOT_FOUND);
+    return 0;
+  }
+  if (proxy_scheme_is(opt, "coaps+tcp")) {
+    uri->scheme = COAP_URI_SCHEME_COAPS_TCP;
+    uri->port = COAPS_DEFAULT_PORT;
+  }
+  else if (proxy_scheme_is(opt, "coap+tcp")) {
+    uri->scheme = COAP_URI_SCHEME_COAP_TCP;
+    uri->port = COAP_DEFAULT_PORT;
+  }
+  else if (proxy_scheme_is(opt, "coaps")) {
+    uri->scheme = COAP_URI_SCHEME_COAPS;
+    uri->port = COAPS_DEFAULT_PORT;
+  }
+  else if (proxy_scheme_is(opt, "coap")) {
+    uri->scheme = COAP_URI_SCHEME_COAP;
+    uri->port = COAP_DEFAULT_PORT;
+  }
+  else {
+    coap_log(LOG_WARNING, "proxy: unsupported Proxy-Scheme '%.*s'\n",
+             coap_opt_length(opt), (const char *)coap_opt_value(opt));
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
+    return 0;
+  }
+  opt = coap_check_option(request, COAP_OPTION_URI_HOST, &opt_iter);
+  if (opt) {
+    uri->host.length = coap_opt_length(opt);
+    uri->host.s = coap_opt_value(opt);
+  }
+  opt = coap_check_option(request, COAP_OPTION_URI_PORT, &opt_iter);
+  if (opt) {
+    uri->port = coap_decode_var_bytes(coap_opt_value(opt),
+                                      coap_opt_length(opt));
+  }
+  return 1;
+}
+
+/* Splits a Uri-Path or Uri-Query of a Proxy-Uri into options */
+static int
+proxy_add_split_options(coap_optlist_t **optlist, uint16_t number,
+                        const coap_str_const_t *str) {
+  size_t buflen = 4 * str->length + 3;
+  uint8_t *buf = coap_malloc(buflen);
+  uint8_t *opt;
+  int res;
+  int ok = 1;
+
+  if (!buf)
+    return 0;
+  if (number == COAP_OPTION_URI_PATH)
+    res = coap_split_path(str->s, str->length, buf, &buflen);
+  else
+    res = coap_split_query(str->s, str->length, buf, &buflen);
+  for (opt = buf; ok && res-- > 0; opt += coap_opt_size(opt)) {
+    ok = coap_insert_optlist(optlist,
+                             coap_new_optlist(number, coap_opt_length(opt),
+                                              coap_opt_value(opt)));
+  }
+  coap_free(buf);
+  return ok;
+}
+
+/* Builds the options of the request to send upstream */
+static int
+proxy_build_options(coap_context_t *context,
+                    const coap_proxy_upstream_t *upstream,
+                    const coap_pdu_t *request, const coap_uri_t *uri,
+                    const coap_opt_t *proxy_uri, coap_optlist_t **optlist) {
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *option;
+  uint8_t portbuf[2];
+  int direct = context->proxy_next_host == NULL;
+
+  if (direct) {
+    if (!upstream->numeric &&
+        !coap_insert_optlist(optlist,
+                             coap_new_optlist(COAP_OPTION_URI_HOST,
+                                              uri->host.length,
+                                              uri->host.s)))
+      return 0;
+    if (uri->port != (coap_uri_scheme_is_secure(uri) ?
+                      COAPS_DEFAULT_PORT : COAP_DEFAULT_PORT) &&
+        !coap_insert_optlist(optlist,
+                             coap_new_optlist(COAP_OPTION_URI_PORT,
+                               coap_encode_var_safe(portbuf, sizeof(portbuf),
+                                                    uri->port),
+                               portbuf)))
+      return 0;
+    if (proxy_uri) {
+      if (uri->path.length &&
+          !proxy_add_split_options(optlist, COAP_OPTION_URI_PATH, &uri->path))
+        return 0;
+      if (uri->query.length &&
+          !proxy_add_split_options(optlist, COAP_OPTION_URI_QUERY,
+                                   &uri->query))
+        return 0;
+    }
+  }
+
+  coap_option_iterator_init(request, &opt_iter, COAP_OPT_ALL);
+  while ((option = coap_option_next(&opt_iter))) {
+    switch (opt_iter.number) {
+    case COAP_OPTION_PROXY_URI:
+    case COAP_OPTION_PROXY_SCHEME:
+    case COAP_OPTION_URI_HOST:
+    case COAP_OPTION_URI_PORT:
+      /* Replaced by the options added above, unless going to a next hop */
+      if (direct)
+        break;
+      /* Fall through */
+    default:
+      if (!coap_insert_optlist(optlist,
+                               coap_new_optlist(opt_iter.number,
+                                                coap_opt_length(option),
+                                                coap_opt_value(option))))
+        return 0;
+      break;
+    case COAP_OPTION_BLOCK1:
+    case COAP_OPTION_BLOCK2:
+      /* The bodies are reassembled */
+      break;
+    }
+  }
+  return 1;
+}
+
+/* Returns the cache-key on which request is collapsed with identical ones,
+ * or NULL if it is not to be collapsed */
+static coap_cache_key_t *
+proxy_collapse_key(coap_session_t *session, const coap_pdu_t *request) {
+  coap_opt_iterator_t opt_iter;
+
+  if ((request->code != COAP_REQUEST_CODE_GET &&
+       request->code != COAP_REQUEST_CODE_FETCH) ||
+      coap_check_option(request, COAP_OPTION_OBSERVE, &opt_iter) ||
+      coap_check_option(request, COAP_OPTION_BLOCK1, &opt_iter))
+    return NULL;
+  return coap_cache_derive_key(session, request, COAP_CACHE_NOT_SESSION_BASED);
+}
+
+/* Holds request as a follower of the identical leader, to be answered with
+ * a copy of its response */
+static int
+proxy_follow(coap_proxy_req_t *leader, coap_session_t *session,
+             const coap_pdu_t *request, coap_pdu_t *response) {
+  coap_bin_const_t token = coap_pdu_get_token(request);
+  coap_proxy_req_t *req;
+
+  req = coap_malloc(sizeof(coap_proxy_req_t));
+  if (!req) {
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+    return 0;
+  }
+  memset(req, 0, sizeof(coap_proxy_req_t));
+  req->incoming_token = coap_new_binary(token.length);
+  if (!req->incoming_token) {
+    coap_free(req);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+    return 0;
+  }
+  memcpy(req->incoming_token->s, token.s, token.length);
+  req->query = coap_get_query(request);
+  req->upstream = leader->upstream;
+  req->incoming = coap_session_reference(session);
+  req->resource = leader->resource;
+  req->type = coap_pdu_get_type(request);
+  req->code = coap_pdu_get_code(request);
+  req->state = COAP_PROXY_REQ_COLLAPSED;
+  req->leader = leader;
+  LL_APPEND2(leader->followers, req, f_next);
+  coap_log(LOG_DEBUG, "***%s: proxy: request collapsed into one in flight\n",
+           coap_session_str(session));
+  return 1;
+}
+
+int
+coap_proxy_forward_request(coap_session_t *session,
+                           const coap_pdu_t *request,
+                           coap_pdu_t *response,
+                           coap_resource_t *resource) {
+  coap_context_t *context = session->context;
+  coap_proxy_upstream_t *upstream;
+  coap_proxy_req_t *req;
+  coap_proxy_req_t *leader;
+  coap_cache_key_t *cache_key;
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *proxy_uri;
+  coap_uri_t uri;
+  coap_uri_scheme_t scheme;
+  coap_str_const_t host;
+  uint16_t port;
+  coap_bin_const_t token = coap_pdu_get_token(request);
+  coap_binary_t *body = NULL;
+  size_t size;
+  const uint8_t *data;
+  size_t offset;
+  size_t total;
+  coap_tick_t now;
+
+  if (!proxy_get_uri(request, &uri, &proxy_uri, response))
+    return 0;
+  if (context->proxy_next_host) {
+    scheme = context->proxy_next_scheme;
+    host.length = context->proxy_next_host->length;
+    host.s = context->proxy_next_host->s;
+    port = context->proxy_next_port;
+  }
+  else {
+    scheme = uri.scheme;
+    host = uri.host;
+    port = uri.port;
+  }
+  if (host.length == 0 || !proxy_scheme_supported(scheme)) {
+    coap_log(LOG_WARNING, "proxy: cannot forward to scheme %d host '%.*s'\n",
+             scheme, (int)host.length, (const char *)host.s);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
+    return 0;
+  }
+
+  /* Reassemble a request body that is being received with Block1 */
+  if (coap_get_data_large(request, &size, &data, &offset, &total) &&
+      size != total) {
+    if (!proxy_session_block(session)) {
+      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+      return 0;
+    }
+    session->proxy->body = coap_block_build_body(session->proxy->body, size,
+                                                 data, offset, total);
+    if (!session->proxy->body) {
+      proxy_session_trim(session);
+      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+      return 0;
+    }
+    if (offset + size != total) {
+      coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTINUE);
+      return 1;
+    }
+    body = session->proxy->body;
+    session->proxy->body = NULL;
+    proxy_session_trim(session);
+  }
+  else if (size) {
+    body = coap_new_binary(size);
+    if (!body) {
+      coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+      return 0;
+    }
+    memcpy(body->s, data, size);
+  }
+
+  /* Only one of a set of identical GET or FETCH requests goes upstream at
+   * a time */
+  cache_key = proxy_collapse_key(session, request);
+  if (cache_key) {
+    HASH_FIND(ch, context->proxy_collapse, cache_key->key,
+              sizeof(cache_key->key), leader);
+    if (leader) {
+      int match = coap_cache_key_verify(cache_key, leader->cache_key);
+
+      coap_delete_cache_key(cache_key);
+      cache_key = NULL;
+      if (match) {
+        coap_delete_binary(body);
+        return proxy_follow(leader, session, request, response);
+      }
+    }
+  }
+
+  upstream = proxy_get_upstream(context, scheme, &host, port);
+  if (!upstream) {
+    coap_delete_cache_key(cache_key);
+    coap_delete_binary(body);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_BAD_GATEWAY);
+    return 0;
+  }
+  if (context->proxy_max_queued && !proxy_can_send(upstream) &&
+      upstream->queued >= context->proxy_max_queued) {
+    coap_log(LOG_DEBUG, "***%s: proxy: upstream queue for '%s' is full\n",
+             coap_session_str(session), upstream->host->s);
+    coap_delete_cache_key(cache_key);
+    coap_delete_binary(body);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE);
+    return 0;
+  }
+
+  req = coap_malloc(sizeof(coap_proxy_req_t));
+  if (!req) {
+    coap_delete_cache_key(cache_key);
+    coap_delete_binary(body);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+    return 0;
+  }
+  memset(req, 0, sizeof(coap_proxy_req_t));
+  req->body = body;
+  req->incoming_token = coap_new_binary(token.length);
+  if (!req->incoming_token ||
+      !proxy_build_options(context, upstream, request, &uri, proxy_uri,
+                           &req->optlist)) {
+    coap_delete_binary(req->incoming_token);
+    coap_delete_optlist(req->optlist);
+    coap_delete_cache_key(cache_key);
+    coap_delete_binary(body);
+    coap_free(req);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+    return 0;
+  }
+  if (cache_key) {
+    req->cache_key = cache_key;
+    HASH_ADD_KEYPTR(ch, context->proxy_collapse, cache_key->key,
+                    sizeof(cache_key->key), req);
+  }
+  memcpy(req->incoming_token->s, token.s, token.length);
+  req->query = coap_get_query(request);
+  req->upstream = upstream;
+  req->incoming = coap_session_reference(session);
+  req->resource = resource;
+  req->type = coap_pdu_get_type(request);
+  req->code = coap_pdu_get_code(request);
+  req->state = COAP_PROXY_REQ_QUEUED;
+  coap_ticks(&now);
+  req->expire = now + COAP_PROXY_EXCHANGE_TIMEOUT * COAP_TICKS_PER_SECOND;
+  DL_APPEND2(context->proxy_reqs, req, exp_prev, exp_next);
+
+  if (coap_check_option(request, COAP_OPTION_OBSERVE, &opt_iter)) {
+    coap_proxy_req_t *old, *rtmp;
+
+    /* Re-registrations and deregistrations need the token of the original
+     * registration upstream */
+    HASH_ITER(hh, upstream->reqs, old, rtmp) {
+      if (old->incoming == session &&
+          coap_binary_equal(old->incoming_token, req->incoming_token)) {
+        req->token = old->token;
+        req->token_length = old->token_length;
+        proxy_free_req(old);
+        break;
+      }
+    }
+  }
+
+  DL_APPEND2(upstream->queue, req, q_prev, q_next);
+  upstream->queued++;
+  proxy_dispatch(upstream);
+  return 1;
+}
+
+/* Returns a copy of body, which is NULL if there is none */
+static coap_binary_t *
+proxy_copy_body(const coap_binary_t *body) {
+  coap_binary_t *copy;
+
+  if (!body)
+    return NULL;
+  copy = coap_new_binary(body->length);
+  if (copy)
+    memcpy(copy->s, body->s, body->length);
+  return copy;
+}
+
+/* Passes received, with body in place of its payload, back to the client
+ * of req.  body is released. */
+static void
+proxy_pass_back(coap_proxy_req_t *req, const coap_pdu_t *received,
+                coap_binary_t *body) {
+  coap_session_t *incoming = req->incoming;
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *option;
+  coap_optlist_t *optlist = NULL;
+  coap_pdu_t *pdu;
+  int large;
+  uint16_t media_type = COAP_MEDIATYPE_TEXT_PLAIN;
+  int maxage = -1;
+  uint64_t etag = 0;
+
+  pdu = coap_pdu_init(received->type == COAP_MESSAGE_ACK ||
+                      req->state == COAP_PROXY_REQ_COLLAPSED ?
+                        req->type : received->type,
+                      received->code, coap_new_message_id(incoming),
+                      coap_session_max_pdu_size(incoming));
+  if (!pdu || !coap_add_token(pdu, req->incoming_token->length,
+                              req->incoming_token->s)) {
+    coap_delete_pdu(pdu);
+    coap_delete_binary(body);
+    return;
+  }
+
+  /* A body that does not fit into a single PDU is passed back with Block2,
+   * in which case coap_add_data_large_response() adds the Content-Format,
+   * Max-Age and ETag options. */
+  large = body && pdu->max_size &&
+          pdu->used_size + (received->used_size - received->token_length) +
+          body->length + 1 > pdu->max_size;
+  coap_option_iterator_init(received, &opt_iter, COAP_OPT_ALL);
+  while ((option = coap_option_next(&opt_iter))) {
+    switch (opt_iter.number) {
+    case COAP_OPTION_BLOCK2:
+    case COAP_OPTION_SIZE2:
+      break;
+    case COAP_OPTION_CONTENT_FORMAT:
+      media_type = coap_decode_var_bytes(coap_opt_value(option),
+                                         coap_opt_length(option));
+      if (large)
+        break;
+      goto copy;
+    case COAP_OPTION_MAXAGE:
+      maxage = coap_decode_var_bytes(coap_opt_value(option),
+                                     coap_opt_length(option));
+      if (large)
+        break;
+      goto copy;
+    case COAP_OPTION_ETAG:
+      etag = coap_decode_var_bytes8(coap_opt_value(option),
+                                    coap_opt_length(option));
+      if (large)
+        break;
+      goto copy;
+    default:
+copy:
+      coap_insert_optlist(&optlist,
+                          coap_new_optlist(opt_iter.number,
+                                           coap_opt_length(option),
+                                           coap_opt_value(option)));
+      break;
+    }
+  }
+  coap_add_optlist_pdu(pdu, &optlist);
+  coap_delete_optlist(optlist);
+
+  if (large) {
+    coap_add_data_large_response(req->resource, incoming, NULL, pdu,
+                                 req->incoming_token, req->query,
+                                 media_type, maxage, etag, body->length,
+                                 body->s, proxy_release_body, body);
+  }
+  else if (body) {
+    coap_add_data(pdu, body->length, body->s);
+    coap_delete_binary(body);
+  }
+  coap_send_large(incoming, pdu);
+}
+
+coap_response_t
+coap_proxy_handle_response(coap_session_t *session,
+                           const coap_pdu_t *received) {
+  coap_proxy_upstream_t *upstream = session->proxy ? session->proxy->upstream :
+                                                     NULL;
+  coap_proxy_req_t *req;
+  coap_proxy_req_t *follower;
+  coap_bin_const_t token = coap_pdu_get_token(received);
+  uint64_t value;
+  coap_opt_iterator_t opt_iter;
+  coap_binary_t *body = NULL;
+  int observe;
+  size_t size;
+  const uint8_t *data;
+  size_t offset;
+  size_t total;
+
+  if (token.length > sizeof(value))
+    return COAP_RESPONSE_FAIL;
+  value = coap_decode_var_bytes8(token.s, token.length);
+  HASH_FIND(hh, upstream->reqs, &value, sizeof(value), req);
+  if (!req || req->token_length != token.length) {
+    coap_log(LOG_DEBUG,
+             "***%s: proxy: response does not match a forwarded request\n",
+             coap_session_str(session));
+    return COAP_RESPONSE_FAIL;
+  }
+  observe = COAP_RESPONSE_CLASS(received->code) == 2 &&
+            coap_check_option(received, COAP_OPTION_OBSERVE, &opt_iter);
+
+  /* Reassemble a response body that is being received with Block2 */
+  if (coap_get_data_large(received, &size, &data, &offset, &total) &&
+      size != total) {
+    req->body_data = coap_block_build_body(req->body_data, size, data,
+                                           offset, total);
+    if (!req->body_data) {
+      proxy_respond_error(req, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+      goto done;
+    }
+    if (offset + size != total)
+      return COAP_RESPONSE_OK;
+    body = req->body_data;
+    req->body_data = NULL;
+  }
+  else if (size) {
+    body = coap_new_binary(size);
+    if (!body) {
+      proxy_respond_error(req, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+      goto done;
+    }
+    memcpy(body->s, data, size);
+  }
+
+  /* The clients of collapsed requests get the same response */
+  LL_FOREACH2(req->followers, follower, f_next) {
+    coap_binary_t *copy = proxy_copy_body(body);
+
+    if (body && !copy)
+      proxy_respond_error(follower, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+    else
+      proxy_pass_back(follower, received, copy);
+  }
+  proxy_pass_back(req, received, body);
+
+done:
+  if (observe) {
+    if (req->state == COAP_PROXY_REQ_SENT) {
+      /* Further notifications are passed back until it is cancelled */
+      DL_DELETE2(session->context->proxy_reqs, req, exp_prev, exp_next);
+      req->state = COAP_PROXY_REQ_OBSERVING;
+      upstream->inflight--;
+    }
+  }
+  else {
+    proxy_free_req(req);
+  }
+  proxy_dispatch(upstream);
+  return COAP_RESPONSE_OK;
+}
+
+/* Forgets req without answering it.  If requests have been collapsed into
+ * it, the first of them takes its place. */
+static void
+proxy_forget_req(coap_proxy_req_t *req) {
+  coap_proxy_req_t *follower = req->followers;
+
+  if (follower) {
+    coap_session_t *incoming = req->incoming;
+    coap_binary_t *incoming_token = req->incoming_token;
+    coap_string_t *query = req->query;
+    coap_pdu_type_t type = req->type;
+
+    req->incoming = follower->incoming;
+    req->incoming_token = follower->incoming_token;
+    req->query = follower->query;
+    req->type = follower->type;
+    follower->incoming = incoming;
+    follower->incoming_token = incoming_token;
+    follower->query = query;
+    follower->type = type;
+    req = follower;
+  }
+  proxy_free_req(req);
+}
+
+/* Forgets the requests that came in on session (with token, if given),
+ * without answering them */
+static void
+proxy_forget_incoming(coap_context_t *context, coap_session_t *session,
+                      const coap_bin_const_t *token) {
+  coap_proxy_upstream_t *upstream, *utmp;
+  coap_proxy_req_t *req, *rtmp;
+  coap_proxy_req_t *follower, *ftmp;
+
+  if (!token) {
+    HASH_ITER(ch, context->proxy_collapse, req, rtmp) {
+      LL_FOREACH_SAFE2(req->followers, follower, ftmp, f_next) {
+        if (follower->incoming == session)
+          proxy_free_req(follower);
+      }
+    }
+  }
+  HASH_ITER(hh, context->proxy_upstreams, upstream, utmp) {
+    DL_FOREACH_SAFE2(upstream->queue, req, rtmp, q_next) {
+      if (req->incoming == session && !token)
+        proxy_forget_req(req);
+    }
+    HASH_ITER(hh, upstream->reqs, req, rtmp) {
+      if (req->incoming == session &&
+          (!token || (req->state == COAP_PROXY_REQ_OBSERVING &&
+                      coap_binary_equal(req->incoming_token, token)))) {
+        proxy_forget_req(req);
+      }
+    }
+  }
+}
+
+void
+coap_proxy_handle_nack(coap_session_t *session, const coap_pdu_t *sent,
+                       coap_nack_reason_t reason) {
+  coap_proxy_upstream_t *upstream = session->proxy ? session->proxy->upstream :
+                                                     NULL;
+  coap_proxy_req_t *req;
+  coap_bin_const_t token = coap_pdu_get_token(sent);
+  uint64_t value;
+
+  if (!upstream) {
+    /* A client that no longer wants the notifications passed back to it */
+    if (reason == COAP_NACK_RST || reason == COAP_NACK_TOO_MANY_RETRIES)
+      proxy_forget_incoming(session->context, session, &token);
+    return;
+  }
+  if (reason == COAP_NACK_ICMP_ISSUE || token.length > sizeof(value))
+    return;
+  value = coap_decode_var_bytes8(token.s, token.length);
+  HASH_FIND(hh, upstream->reqs, &value, sizeof(value), req);
+  if (!req || req->token_length != token.length)
+    return;
+  /* Queued requests are sent from coap_proxy_check(), not from here */
+  proxy_respond_error(req, reason == COAP_NACK_TOO_MANY_RETRIES ?
+                             COAP_RESPONSE_CODE_GATEWAY_TIMEOUT :
+                             COAP_RESPONSE_CODE_BAD_GATEWAY);
+  proxy_free_req(req);
+}
+
+void
+coap_proxy_handle_event(coap_session_t *session, coap_event_t event) {
+  switch (event) {
+  case COAP_EVENT_DTLS_CLOSED:
+  case COAP_EVENT_DTLS_ERROR:
+  case COAP_EVENT_TCP_CLOSED:
+  case COAP_EVENT_TCP_FAILED:
+  case COAP_EVENT_SESSION_CLOSED:
+  case COAP_EVENT_SESSION_FAILED:
+    break;
+  default:
+    return;
+  }
+  if (session->proxy && session->proxy->upstream) {
+    /* The session is released from coap_proxy_check() */
+    coap_log(LOG_DEBUG, "***%s: proxy: upstream session failed\n",
+             coap_session_str(session));
+    proxy_fail_upstream(session->proxy->upstream,
+                        COAP_RESPONSE_CODE_BAD_GATEWAY);
+  }
+  else {
+    proxy_forget_incoming(session->context, session, NULL);
+  }
+}
+
+coap_tick_t
+coap_proxy_check(coap_context_t *context, coap_tick_t now) {
+  coap_proxy_upstream_t *upstream, *utmp;
+  coap_proxy_req_t *req;
+  coap_tick_t timeout = 0;
+  coap_tick_t idle_timeout;
+
+  /* The forwarded requests are on proxy_reqs in order of expiry */
+  while (context->proxy_reqs && context->proxy_reqs->expire <= now) {
+    req = context->proxy_reqs;
+    coap_log(LOG_DEBUG, "***%s: proxy: no response from '%s'\n",
+             coap_session_str(req->incoming), req->upstream->host->s);
+    proxy_respond_error(req, COAP_RESPONSE_CODE_GATEWAY_TIMEOUT);
+    proxy_free_req(req);
+  }
+  if (context->proxy_reqs)
+    timeout = context->proxy_reqs->expire - now;
+
+  idle_timeout = (context->session_timeout ? context->session_timeout :
+                  COAP_DEFAULT_SESSION_TIMEOUT) * COAP_TICKS_PER_SECOND;
+  HASH_ITER(hh, context->proxy_upstreams, upstream, utmp) {
+#ifdef HAVE_GETADDRINFO_A
+    if (upstream->resolving) {
+      proxy_check_resolver(context, upstream);
+      if (upstream->resolving) {
+        if (timeout == 0 || COAP_PROXY_RESOLVE_POLL < timeout)
+          timeout = COAP_PROXY_RESOLVE_POLL;
+        continue;
+      }
+    }
+#endif /* HAVE_GETADDRINFO_A */
+    if (upstream->failed) {
+      proxy_free_upstream(context, upstream);
+      continue;
+    }
+    proxy_dispatch(upstream);
+    if (!upstream->reqs && !upstream->queue) {
+      if (upstream->last_used + idle_timeout <= now) {
+        proxy_free_upstream(context, upstream);
+        continue;
+      }
+      if (timeout == 0 || upstream->last_used + idle_timeout - now < timeout)
+        timeout = upstream->last_used + idle_timeout - now;
+    }
+  }
+  return timeout;
+}
+
+void
+coap_proxy_free_all(coap_context_t *context) {
+  coap_proxy_upstream_t *upstream, *utmp;
+
+  HASH_ITER(hh, context->proxy_upstreams, upstream, utmp) {
+    proxy_free_upstream(context, upstream);
+  }
+  coap_delete_string(context->proxy_next_host);
+  context->proxy_next_host = NULL;
+}
+
+int
+coap_context_set_proxy_next_hop(coap_context_t *context,
+                                const coap_uri_t *next_hop) {
+  coap_string_t *host = NULL;
+
+  if (next_hop) {
+    host = coap_new_string(next_hop->host.length);
+    if (!host)
+      return 0;
+    memcpy(host->s, next_hop->host.s, next_hop->host.length);
+    context->proxy_next_scheme = next_hop->scheme;
+    context->proxy_next_port = next_hop->port;
+  }
+  coap_delete_string(context->proxy_next_host);
+  context->proxy_next_host = host;
+  return 1;
+}
+
+#else /* ! COAP_PROXY_SUPPORT */
+
+int
+coap_proxy_is_supported(void) {
+  return 0;
+}
+
+int
+coap_proxy_forward_request(coap_session_t *session COAP_UNUSED,
+                           const coap_pdu_t *request COAP_UNUSED,
+                           coap_pdu_t *response,
+                           coap_resource_t *resource COAP_UNUSED) {
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
+  return 0;
+}
+
+coap_response_t
+coap_proxy_handle_response(coap_session_t *session COAP_UNUSED,
+                           const coap_pdu_t *received COAP_UNUSED) {
+  return COAP_RESPONSE_FAIL;
+}
+
+void
+coap_proxy_handle_nack(coap_session_t *session COAP_UNUSED,
+                       const coap_pdu_t *sent COAP_UNUSED,
+                       coap_nack_reason_t reason COAP_UNUSED) {
+}
+
+void
+coap_proxy_handle_event(coap_session_t *session COAP_UNUSED,
+                        coap_event_t event COAP_UNUSED) {
+}
+
+coap_tick_t
+coap_proxy_check(coap_context_t *context COAP_UNUSED,
+                 coap_tick_t now COAP_UNUSED) {
+  return 0;
+}
+
+void
+coap_proxy_free_all(coap_context_t *context COAP_UNUSED) {
+}
+
+int
+coap_context_set_proxy_next_hop(coap_context_t *context COAP_UNUSED,
+                                const coap_uri_t *next_hop COAP_UNUSED) {
+  return 0;
+}
+
+#endif /* ! COAP_PROXY_SUPPORT */
+
+void
+coap_context_set_proxy_limits(coap_context_t *context,
+                              unsigned int max_inflight,
+                              unsigned int max_queued) {
+  context->proxy_max_inflight = max_inflight;
+  context->proxy_max_queued = max_queued;
+}
+
+void
+coap_register_proxy_session_handler(coap_context_t *context,
+                                    coap_proxy_session_handler_t handler) {
+  context->proxy_session_handler = handler;
+}
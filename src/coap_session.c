@@ -19,6 +19,16 @@
 #endif /* COAP_EPOLL_SUPPORT */
 #include <errno.h>
 
+/*
+ * State that only some sessions need goes in one of the separately
+ * allocated blocks rather than making every session larger.  The limit
+ * holds for the sockets API on a 64-bit host.
+ */
+#if defined(__LP64__) && !defined(WITH_LWIP) && !defined(WITH_CONTIKI) && \
+    !defined(RIOT_VERSION)
+COAP_STATIC_ASSERT(sizeof(coap_session_t) <= 464, session_size);
+#endif
+
 void
 coap_session_set_max_retransmit (coap_session_t *session, unsigned int value) {
   if (value > 0)
@@ -64,9 +74,149 @@ coap_session_get_ack_random_factor (const coap_session_t *session) {
   return session->ack_random_factor;
 }
 
+void
+coap_session_set_nstart (coap_session_t *session, unsigned int value) {
+  if (value > 0 && value <= UINT8_MAX) {
+    session->nstart = (uint8_t)value;
+    session->cwnd = session->nstart;
+    session->cwnd_acks = 0;
+  }
+  coap_log(LOG_DEBUG, "***%s: session nstart set to %d\n",
+           coap_session_str(session), session->nstart);
+}
+
+unsigned int
+coap_session_get_nstart (const coap_session_t *session) {
+  return session->nstart;
+}
+
+void
+coap_session_cwnd_ack(coap_session_t *session, const coap_queue_t *node) {
+  if (node->retransmit_cnt || session->cwnd >= session->nstart)
+    return;
+  if (++session->cwnd_acks >= session->cwnd) {
+    session->cwnd++;
+    session->cwnd_acks = 0;
+    coap_log(LOG_DEBUG, "***%s: congestion window increased to %d\n",
+             coap_session_str(session), session->cwnd);
+  }
+}
+
+void
+coap_session_cwnd_loss(coap_session_t *session) {
+  session->cwnd_acks = 0;
+  if (session->cwnd > 1) {
+    session->cwnd /= 2;
+    coap_log(LOG_DEBUG, "***%s: congestion window decreased to %d\n",
+             coap_session_str(session), session->cwnd);
+  }
+}
+
+static int
+coap_session_cocoa_block(coap_session_t *session) {
+  if (!session->cocoa) {
+    session->cocoa = (coap_session_cocoa_t*)coap_malloc_type(
+                                                COAP_SESSION_COCOA,
+                                                sizeof(coap_session_cocoa_t));
+    if (!session->cocoa) {
+      coap_log(LOG_WARNING, "No memory to store session CoCoA information\n");
+      return 0;
+    }
+    memset(session->cocoa, 0, sizeof(coap_session_cocoa_t));
+  }
+  return 1;
+}
+
+void
+coap_session_set_cocoa (coap_session_t *session, int cocoa) {
+  if (cocoa) {
+    coap_session_cocoa_block(session);
+  }
+  else if (session->cocoa) {
+    coap_free_type(COAP_SESSION_COCOA, session->cocoa);
+    session->cocoa = NULL;
+  }
+  coap_log(LOG_DEBUG, "***%s: session CoCoA RTO estimation %s\n",
+           coap_session_str(session), session->cocoa ? "enabled" : "disabled");
+}
+
+int
+coap_session_get_cocoa (const coap_session_t *session) {
+  return session->cocoa != NULL;
+}
+
+/*
+ * Server sessions that are unreferenced and have nothing waiting on their
+ * delayqueue are kept on the endpoint's idle_sessions list, and those of
+ * them still in (D)TLS set up also on its hs_sessions list.  Entries are
+ * appended as they become idle or see traffic, so the head of each list
+ * is the least recently used candidate for eviction.
+ */
+static uint8_t
+coap_session_idle_class(const coap_session_t *session) {
+  if (session->endpoint == NULL || session->transient ||
+      session->ref != 0 || session->delayqueue != NULL)
+    return 0;
+  if (session->type == COAP_SESSION_TYPE_SERVER)
+    return COAP_SESSION_IDLE_SERVER |
+           (session->state == COAP_SESSION_STATE_HANDSHAKE ?
+            COAP_SESSION_IDLE_HS : 0);
+  if (session->type == COAP_SESSION_TYPE_HELLO)
+    return COAP_SESSION_IDLE_HS;
+  return 0;
+}
+
+static void
+coap_session_idle_unlink(coap_session_t *session, uint8_t flags) {
+  coap_endpoint_t *ep = session->endpoint;
+
+  flags &= session->idle_flags;
+  if (flags & COAP_SESSION_IDLE_SERVER) {
+    DL_DELETE2(ep->idle_sessions, session, idle_prev, idle_next);
+    ep->num_idle--;
+  }
+  if (flags & COAP_SESSION_IDLE_HS) {
+    DL_DELETE2(ep->hs_sessions, session, hs_prev, hs_next);
+    ep->num_hs--;
+  }
+  session->idle_flags &= ~flags;
+}
+
+static void
+coap_session_idle_link(coap_session_t *session, uint8_t flags) {
+  coap_endpoint_t *ep = session->endpoint;
+
+  flags &= ~session->idle_flags;
+  if (flags & COAP_SESSION_IDLE_SERVER) {
+    DL_APPEND2(ep->idle_sessions, session, idle_prev, idle_next);
+    ep->num_idle++;
+  }
+  if (flags & COAP_SESSION_IDLE_HS) {
+    DL_APPEND2(ep->hs_sessions, session, hs_prev, hs_next);
+    ep->num_hs++;
+  }
+  session->idle_flags |= flags;
+}
+
+void
+coap_session_idle_update(coap_session_t *session) {
+  uint8_t flags = coap_session_idle_class(session);
+
+  coap_session_idle_unlink(session, (uint8_t)~flags);
+  coap_session_idle_link(session, flags);
+}
+
+/* Move session to the most recently used end of the endpoint lists */
+static void
+coap_session_idle_touch(coap_session_t *session) {
+  coap_session_idle_unlink(session, session->idle_flags);
+  coap_session_idle_update(session);
+}
+
 coap_session_t *
 coap_session_reference(coap_session_t *session) {
-  ++session->ref;
+  if (++session->ref == 1)
+    coap_session_idle_update(session);
   return session;
 }
 
@@ -77,8 +227,12 @@ coap_session_release(coap_session_t *session) {
     assert(session->ref > 0);
     if (session->ref > 0)
       --session->ref;
-    if (session->ref == 0 && session->type == COAP_SESSION_TYPE_CLIENT)
-      coap_session_free(session);
+    if (session->ref == 0) {
+      if (session->type == COAP_SESSION_TYPE_CLIENT)
+        coap_session_free(session);
+      else
+        coap_session_idle_update(session);
+    }
 #else /* __COVERITY__ */
     /* Coverity scan is fooled by the reference counter leading to
      * false positives for USE_AFTER_FREE. */
@@ -104,14 +258,11 @@ coap_session_get_app_data(const coap_session_t *session) {
   return session->app;
 }
 
-static coap_session_t *
-coap_make_session(coap_proto_t proto, coap_session_type_t type,
-  const coap_addr_hash_t *addr_hash, const coap_address_t *local_addr,
-  const coap_address_t *remote_addr, int ifindex, coap_context_t *context,
-  coap_endpoint_t *endpoint) {
-  coap_session_t *session = (coap_session_t*)coap_malloc_type(COAP_SESSION, sizeof(coap_session_t));
-  if (!session)
-    return NULL;
+static void
+coap_session_setup(coap_session_t *session, coap_proto_t proto,
+  coap_session_type_t type, const coap_addr_hash_t *addr_hash,
+  const coap_address_t *local_addr, const coap_address_t *remote_addr,
+  int ifindex, coap_context_t *context, coap_endpoint_t *endpoint) {
   memset(session, 0, sizeof(*session));
   session->proto = proto;
   session->type = type;
@@ -143,10 +294,35 @@ coap_make_session(coap_proto_t proto, coap_session_type_t type,
     }
   }
   session->max_retransmit = COAP_DEFAULT_MAX_RETRANSMIT;
+  session->nstart = COAP_DEFAULT_NSTART;
+  session->cwnd = COAP_DEFAULT_NSTART;
   session->ack_timeout = COAP_DEFAULT_ACK_TIMEOUT;
   session->ack_random_factor = COAP_DEFAULT_ACK_RANDOM_FACTOR;
+  if (context->cocoa)
+    coap_session_cocoa_block(session);
   session->dtls_event = -1;
   session->last_ping_mid = COAP_INVALID_MID;
+}
+
+static coap_session_t *
+coap_make_session(coap_proto_t proto, coap_session_type_t type,
+  const coap_addr_hash_t *addr_hash, const coap_address_t *local_addr,
+  const coap_address_t *remote_addr, int ifindex, coap_context_t *context,
+  coap_endpoint_t *endpoint) {
+  coap_session_t *session = (coap_session_t*)coap_malloc_type(COAP_SESSION, sizeof(coap_session_t));
+  if (!session)
+    return NULL;
+  coap_session_setup(session, proto, type, addr_hash, local_addr, remote_addr,
+                     ifindex, context, endpoint);
+  if (COAP_PROTO_RELIABLE(proto)) {
+    session->tcp = (coap_session_tcp_t*)coap_malloc_type(COAP_SESSION_TCP,
+                                                sizeof(coap_session_tcp_t));
+    if (!session->tcp) {
+      coap_free_type(COAP_SESSION, session);
+      return NULL;
+    }
+    memset(session->tcp, 0, sizeof(coap_session_tcp_t));
+  }
 
   /* initialize message id */
   coap_prng((unsigned char *)&session->tx_mid, sizeof(session->tx_mid));
@@ -154,6 +330,17 @@ coap_make_session(coap_proto_t proto, coap_session_type_t type,
   return session;
 }
 
+/*
+ * A hibernated session is closed as if it still had its (D)TLS objects.
+ */
+static void
+coap_session_free_hibernated(coap_session_t *session) {
+  coap_delete_binary(session->secure->hibernated);
+  session->secure->hibernated = NULL;
+  if (session->context)
+    coap_handle_event(session->context, COAP_EVENT_DTLS_CLOSED, session);
+}
+
 void coap_session_mfree(coap_session_t *session) {
   coap_queue_t *q, *tmp;
   coap_cache_entry_t *cp, *ctmp;
@@ -162,7 +349,7 @@ void coap_session_mfree(coap_session_t *session) {
   coap_lg_srcv_t *sq, *stmp;
 
   /* Need to do this before (D)TLS and socket is closed down */
-  LL_FOREACH_SAFE(session->lg_crcv, cq, etmp) {
+  LG_CRCV_ITER(session->lg_crcv, cq, etmp) {
     if (cq->observe_set) {
       /* Need to close down observe */
       if (coap_cancel_observe(session, cq->app_token, COAP_MESSAGE_NON)) {
@@ -178,12 +365,28 @@ void coap_session_mfree(coap_session_t *session) {
         }
       }
     }
-    LL_DELETE(session->lg_crcv, cq);
+    LG_CRCV_DELETE(session->lg_crcv, cq);
     coap_block_delete_lg_crcv(session, cq);
   }
-
-  if (session->partial_pdu)
-    coap_delete_pdu(session->partial_pdu);
+  coap_mid_cache_free_session(session);
+  if (session->proxy) {
+    coap_delete_binary(session->proxy->body);
+    coap_free_type(COAP_SESSION_PROXY, session->proxy);
+    session->proxy = NULL;
+  }
+
+  if (session->tcp) {
+    if (session->tcp->partial_pdu)
+      coap_delete_pdu(session->tcp->partial_pdu);
+    coap_free(session->tcp->write_batch);
+    coap_free_type(COAP_SESSION_TCP, session->tcp);
+    session->tcp = NULL;
+  }
+  coap_handshake_cancel(session);
+  if (coap_session_is_hibernated(session))
+    coap_session_free_hibernated(session);
+  if (session->tls && session->state == COAP_SESSION_STATE_ESTABLISHED)
+    coap_session_save_tls_state(session);
   if (session->proto == COAP_PROTO_DTLS)
     coap_dtls_free_session(session);
 #if !COAP_DISABLE_TCP
@@ -192,12 +395,30 @@ void coap_session_mfree(coap_session_t *session) {
 #endif /* !COAP_DISABLE_TCP */
   if (session->sock.flags != COAP_SOCKET_EMPTY)
     coap_socket_close(&session->sock);
-  if (session->psk_identity)
-    coap_free(session->psk_identity);
-  if (session->psk_key)
-    coap_free(session->psk_key);
-  if (session->psk_hint)
-    coap_free(session->psk_hint);
+  if (session->psk) {
+    if (session->psk->psk_identity)
+      coap_free(session->psk->psk_identity);
+    if (session->psk->psk_key)
+      coap_free(session->psk->psk_key);
+    if (session->psk->psk_hint)
+      coap_free(session->psk->psk_hint);
+    coap_free_type(COAP_SESSION_PSK, session->psk);
+    session->psk = NULL;
+  }
+  if (session->cid) {
+    if (session->endpoint)
+      HASH_DELETE(hh, session->endpoint->cid_sessions, session->cid);
+    coap_free_type(COAP_SESSION_CID, session->cid);
+    session->cid = NULL;
+  }
+  if (session->cocoa) {
+    coap_free_type(COAP_SESSION_COCOA, session->cocoa);
+    session->cocoa = NULL;
+  }
+  if (session->secure) {
+    coap_free_type(COAP_SESSION_SECURE, session->secure);
+    session->secure = NULL;
+  }
 
   HASH_ITER(hh, session->context->cache, cp, ctmp) {
     /* cp->session is NULL if not session based */
@@ -206,16 +427,16 @@ void coap_session_mfree(coap_session_t *session) {
     }
   }
   LL_FOREACH_SAFE(session->delayqueue, q, tmp) {
-    if (q->pdu->type==COAP_MESSAGE_CON && session->context && session->context->nack_handler)
-      session->context->nack_handler(session->context, session, q->pdu, session->proto == COAP_PROTO_DTLS ? COAP_NACK_TLS_FAILED : COAP_NACK_NOT_DELIVERABLE, q->id);
+    if (q->pdu->type==COAP_MESSAGE_CON && session->context)
+      coap_handle_nack(session, q->pdu, session->proto == COAP_PROTO_DTLS ? COAP_NACK_TLS_FAILED : COAP_NACK_NOT_DELIVERABLE, q->id);
     coap_delete_node(q);
   }
-  LL_FOREACH_SAFE(session->lg_xmit, lq, ltmp) {
-    LL_DELETE(session->lg_xmit, lq);
+  LG_XMIT_ITER(session->lg_xmit, lq, ltmp) {
+    LG_XMIT_DELETE(session->lg_xmit, lq);
     coap_block_delete_lg_xmit(session, lq);
   }
-  LL_FOREACH_SAFE(session->lg_srcv, sq, stmp) {
-    LL_DELETE(session->lg_srcv, sq);
+  LG_SRCV_ITER(session->lg_srcv, sq, stmp) {
+    LG_SRCV_DELETE(session->lg_srcv, sq);
     coap_block_delete_lg_srcv(session, sq);
   }
 }
@@ -226,6 +447,8 @@ void coap_session_free(coap_session_t *session) {
   assert(session->ref == 0);
   if (session->ref)
     return;
+  if (session->endpoint)
+    coap_session_idle_unlink(session, session->idle_flags);
   coap_session_mfree(session);
   if (session->endpoint) {
     if (session->endpoint->sessions)
@@ -306,6 +529,145 @@ ssize_t coap_session_write(coap_session_t *session, const uint8_t *data, size_t
   return bytes_written;
 }
 
+#if !COAP_DISABLE_TCP
+/*
+ * Copies the PDUs from the head of the delayqueue of the TLS session that fit
+ * into one record to tcp->write_batch, if there are at least two of them.
+ */
+static void
+coap_session_batch_tls(coap_session_t *session) {
+  coap_session_tcp_t *tcp = session->tcp;
+  coap_queue_t *q;
+  size_t offset = tcp->partial_write;
+  size_t length = 0;
+  unsigned int count = 0;
+
+  if (tcp->write_retry)
+    return;
+  LL_FOREACH(session->delayqueue, q) {
+    size_t pdu_len = q->pdu->used_size + q->pdu->hdr_size - offset;
+
+    if (length + pdu_len > COAP_SESSION_MAX_TLS_BATCH)
+      break;
+    length += pdu_len;
+    count++;
+    offset = 0;
+  }
+  if (count < 2)
+    return;
+  tcp->write_batch = coap_malloc(length);
+  if (!tcp->write_batch)
+    return;
+  tcp->write_batch_len = length;
+  offset = tcp->partial_write;
+  length = 0;
+  for (q = session->delayqueue; count--; q = q->next) {
+    size_t pdu_len = q->pdu->used_size + q->pdu->hdr_size - offset;
+
+    memcpy(tcp->write_batch + length,
+           q->pdu->token - q->pdu->hdr_size + offset, pdu_len);
+    length += pdu_len;
+    offset = 0;
+  }
+}
+#endif /* !COAP_DISABLE_TCP */
+
+void
+coap_session_write_delayed(coap_session_t *session, coap_tick_t now) {
+#if !COAP_DISABLE_TCP
+  coap_session_tcp_t *tcp = session->tcp;
+
+  while (session->delayqueue) {
+    coap_queue_t *q;
+    ssize_t bytes_written;
+    size_t data_len;
+
+    if (session->proto == COAP_PROTO_TCP) {
+      coap_bin_const_t bufs[COAP_SOCKET_MAX_IOV];
+      size_t count = 0;
+      size_t offset = tcp->partial_write;
+
+      data_len = 0;
+      for (q = session->delayqueue; q && count < COAP_SOCKET_MAX_IOV;
+           q = q->next) {
+        bufs[count].s = q->pdu->token - q->pdu->hdr_size + offset;
+        bufs[count].length = q->pdu->used_size + q->pdu->hdr_size - offset;
+        data_len += bufs[count].length;
+        count++;
+        offset = 0;
+      }
+      bytes_written = coap_socket_writev(&session->sock, bufs, count);
+    } else if (session->proto == COAP_PROTO_TLS) {
+      /* A write that could not complete is retried with the same data */
+      if (!tcp->write_batch)
+        coap_session_batch_tls(session);
+      if (tcp->write_batch) {
+        data_len = tcp->write_batch_len;
+        bytes_written = coap_tls_write(session, tcp->write_batch, data_len);
+      } else {
+        q = session->delayqueue;
+        data_len = q->pdu->used_size + q->pdu->hdr_size - tcp->partial_write;
+        bytes_written = coap_tls_write(session,
+                    q->pdu->token - q->pdu->hdr_size + tcp->partial_write,
+                    data_len);
+        tcp->write_retry = bytes_written == 0;
+      }
+      if (bytes_written != 0) {
+        coap_free(tcp->write_batch);
+        tcp->write_batch = NULL;
+        tcp->write_batch_len = 0;
+      }
+    } else {
+      bytes_written = -1;
+      data_len = 0;
+    }
+    if (bytes_written <= 0) {
+      if (bytes_written < 0)
+        coap_log(LOG_DEBUG,  "*   %s: failed to send %zu bytes\n",
+                 coap_session_str(session), data_len);
+      break;
+    }
+    session->last_rx_tx = now;
+    coap_log(LOG_DEBUG, "*  %s: sent %zd bytes\n",
+             coap_session_str(session), bytes_written);
+
+    /* Take the PDUs that have been written in full off the queue */
+    data_len = (size_t)bytes_written;
+    while ((q = session->delayqueue) != NULL &&
+           tcp->partial_write + data_len >=
+           q->pdu->used_size + q->pdu->hdr_size) {
+      data_len -= q->pdu->used_size + q->pdu->hdr_size - tcp->partial_write;
+      tcp->partial_write = 0;
+      coap_log(LOG_DEBUG, "** %s: mid=0x%x: transmitted after delay\n",
+               coap_session_str(session), (int)q->pdu->mid);
+      session->delayqueue = q->next;
+      coap_delete_node(q);
+    }
+    if (data_len) {
+      /* The connection is full, the rest waits for it to become writable */
+      tcp->partial_write += data_len;
+      break;
+    }
+    if (session->sock.flags & COAP_SOCKET_WANT_WRITE)
+      break;
+  }
+#else /* COAP_DISABLE_TCP */
+  (void)session;
+  (void)now;
+#endif /* COAP_DISABLE_TCP */
+}
+
+void
+coap_session_flush(coap_session_t *session, coap_tick_t now) {
+  if (session->delayqueue && session->tcp &&
+      session->state == COAP_SESSION_STATE_ESTABLISHED &&
+      (session->sock.flags & COAP_SOCKET_CONNECTED) &&
+      !(session->sock.flags & COAP_SOCKET_WANT_WRITE)) {
+    coap_session_write_delayed(session, now);
+    coap_session_idle_update(session);
+  }
+}
+
 ssize_t
 coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
                        coap_queue_t *node)
@@ -319,12 +681,15 @@ coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
     node->t = 0;
   } else {
     coap_queue_t *q = NULL;
-    /* Check that the same mid is not getting re-used in violation of RFC7252 */
-    LL_FOREACH(session->delayqueue, q) {
-      if (q->id == pdu->mid) {
-        coap_log(LOG_ERR, "**  %s: mid=0x%x: already in-use - dropped\n",
-                 coap_session_str(session), pdu->mid);
-        return COAP_INVALID_MID;
+    /* Check that the same mid is not getting re-used in violation of RFC7252.
+       Reliable transports have no message IDs, so all of their PDUs have 0 */
+    if (COAP_PROTO_NOT_RELIABLE(session->proto)) {
+      LL_FOREACH(session->delayqueue, q) {
+        if (q->id == pdu->mid) {
+          coap_log(LOG_ERR, "**  %s: mid=0x%x: already in-use - dropped\n",
+                   coap_session_str(session), pdu->mid);
+          return COAP_INVALID_MID;
+        }
       }
     }
     node = coap_new_node();
@@ -340,6 +705,7 @@ coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
     }
   }
   LL_APPEND(session->delayqueue, node);
+  coap_session_idle_update(session);
   coap_log(LOG_DEBUG, "** %s: mid=0x%x: delayed\n",
            coap_session_str(session), node->id);
   return COAP_PDU_DELAYED;
@@ -352,7 +718,8 @@ void coap_session_send_csm(coap_session_t *session) {
   assert(COAP_PROTO_RELIABLE(session->proto));
   coap_log(LOG_DEBUG, "***%s: sending CSM\n", coap_session_str(session));
   session->state = COAP_SESSION_STATE_CSM;
-  session->partial_write = 0;
+  session->tcp->partial_write = 0;
+  coap_session_idle_update(session);
   if (session->mtu == 0)
     session->mtu = COAP_DEFAULT_MTU;  /* base value */
   pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_SIGNALING_CODE_CSM, 0, 20);
@@ -400,10 +767,13 @@ void coap_session_connected(coap_session_t *session) {
              coap_session_str(session));
     if (session->state == COAP_SESSION_STATE_CSM)
       coap_handle_event(session->context, COAP_EVENT_SESSION_CONNECTED, session);
+    if (session->tls)
+      coap_session_save_tls_state(session);
+    if (session->tcp)
+      session->tcp->partial_write = 0;
   }
 
   session->state = COAP_SESSION_STATE_ESTABLISHED;
-  session->partial_write = 0;
 
   if ( session->proto==COAP_PROTO_DTLS) {
     session->tls_overhead = coap_dtls_get_overhead(session);
@@ -413,11 +783,20 @@ void coap_session_connected(coap_session_t *session) {
     }
   }
 
+  if (COAP_PROTO_RELIABLE(session->proto)) {
+    coap_tick_t now;
+
+    coap_ticks(&now);
+    coap_session_write_delayed(session, now);
+    coap_session_idle_update(session);
+    return;
+  }
+
   while (session->delayqueue && session->state == COAP_SESSION_STATE_ESTABLISHED) {
     ssize_t bytes_written;
     coap_queue_t *q = session->delayqueue;
-    if (q->pdu->type == COAP_MESSAGE_CON && COAP_PROTO_NOT_RELIABLE(session->proto)) {
-      if (session->con_active >= COAP_DEFAULT_NSTART)
+    if (q->pdu->type == COAP_MESSAGE_CON) {
+      if (COAP_SESSION_CWND_FULL(session))
         break;
       session->con_active++;
     }
@@ -428,27 +807,16 @@ void coap_session_connected(coap_session_t *session) {
     coap_log(LOG_DEBUG, "** %s: mid=0x%x: transmitted after delay\n",
              coap_session_str(session), (int)q->pdu->mid);
     bytes_written = coap_session_send_pdu(session, q->pdu);
-    if (q->pdu->type == COAP_MESSAGE_CON && COAP_PROTO_NOT_RELIABLE(session->proto)) {
+    if (q->pdu->type == COAP_MESSAGE_CON) {
       if (coap_wait_ack(session->context, session, q) >= 0)
         q = NULL;
     }
-    if (COAP_PROTO_NOT_RELIABLE(session->proto)) {
-      if (q)
-        coap_delete_node(q);
-      if (bytes_written < 0)
-        break;
-    } else {
-      if (bytes_written <= 0 || (size_t)bytes_written < q->pdu->used_size + q->pdu->hdr_size) {
-        q->next = session->delayqueue;
-        session->delayqueue = q;
-        if (bytes_written > 0)
-          session->partial_write = (size_t)bytes_written;
-        break;
-      } else {
-        coap_delete_node(q);
-      }
-    }
+    if (q)
+      coap_delete_node(q);
+    if (bytes_written < 0)
+      break;
   }
+  coap_session_idle_update(session);
 }
 
 void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reason) {
@@ -460,7 +828,14 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
            coap_session_str(session), reason);
   coap_delete_observers( session->context, session );
 
+  coap_handshake_cancel(session);
+  if (coap_session_is_hibernated(session))
+    coap_session_free_hibernated(session);
   if ( session->tls) {
+    /* Saved again, as a TLS 1.3 ticket comes after the handshake */
+    if (session->state == COAP_SESSION_STATE_ESTABLISHED &&
+        reason != COAP_NACK_TLS_FAILED)
+      coap_session_save_tls_state(session);
     if (session->proto == COAP_PROTO_DTLS)
       coap_dtls_free_session(session);
 #if !COAP_DISABLE_TCP
@@ -477,11 +852,18 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
 
   session->con_active = 0;
 
-  if (session->partial_pdu) {
-    coap_delete_pdu(session->partial_pdu);
-    session->partial_pdu = NULL;
+  if (session->tcp) {
+    if (session->tcp->partial_pdu) {
+      coap_delete_pdu(session->tcp->partial_pdu);
+      session->tcp->partial_pdu = NULL;
+    }
+    session->tcp->partial_read = 0;
+    coap_free(session->tcp->write_batch);
+    session->tcp->write_batch = NULL;
+    session->tcp->write_batch_len = 0;
+    session->tcp->write_retry = 0;
+    session->tcp->partial_write = 0;
   }
-  session->partial_read = 0;
 
   while (session->delayqueue) {
     coap_queue_t *q = session->delayqueue;
@@ -495,18 +877,13 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
     {
       /* Make sure that we try a re-transmit later on ICMP error */
       if (coap_wait_ack(session->context, session, q) >= 0) {
-        if (session->context->nack_handler) {
-          session->context->nack_handler(session->context, session, q->pdu,
-                                         reason, q->id);
-        }
+        coap_handle_nack(session, q->pdu, reason, q->id);
         q = NULL;
       }
     }
-    if (q && q->pdu->type == COAP_MESSAGE_CON
-      && session->context->nack_handler)
+    if (q && q->pdu->type == COAP_MESSAGE_CON)
     {
-      session->context->nack_handler(session->context, session, q->pdu,
-                                     reason, q->id);
+      coap_handle_nack(session, q->pdu, reason, q->id);
     }
     if (q)
       coap_delete_node(q);
@@ -514,16 +891,16 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
   if (reason != COAP_NACK_ICMP_ISSUE) {
     coap_cancel_session_messages(session->context, session, reason);
   }
-  else if (session->context->nack_handler) {
+  else {
     coap_queue_t *q = session->context->sendqueue;
     while (q) {
       if (q->session == session) {
-        session->context->nack_handler(session->context, session, q->pdu,
-                                       reason, q->id);
+        coap_handle_nack(session, q->pdu, reason, q->id);
       }
       q = q->next;
     }
   }
+  coap_session_idle_update(session);
 
 #if !COAP_DISABLE_TCP
   if (COAP_PROTO_RELIABLE(session->proto)) {
@@ -551,101 +928,685 @@ coap_make_addr_hash(coap_addr_hash_t *addr_hash, coap_proto_t proto,
   addr_hash->proto = proto;
 }
 
-coap_session_t *
-coap_endpoint_get_session(coap_endpoint_t *endpoint,
-  const coap_packet_t *packet, coap_tick_t now) {
-  coap_session_t *session;
-  coap_session_t *rtmp;
-  unsigned int num_idle = 0;
-  unsigned int num_hs = 0;
-  coap_session_t *oldest = NULL;
-  coap_session_t *oldest_hs = NULL;
-  coap_addr_hash_t addr_hash;
+/*
+ * Stateless UDP: a request from a peer that has no session is handled on
+ * the endpoint's transient session, which is re-initialized for each such
+ * peer and never added to the endpoint's sessions.
+ */
+static coap_session_t *
+coap_endpoint_transient_session(coap_endpoint_t *endpoint,
+  const coap_addr_hash_t *addr_hash, const coap_packet_t *packet,
+  coap_tick_t now) {
+  coap_session_t *session = endpoint->transient;
+  uint16_t tx_mid;
 
-  coap_make_addr_hash(&addr_hash, endpoint->proto, &packet->addr_info);
-  SESSIONS_FIND(endpoint->sessions, addr_hash, session);
-  if (session) {
-    /* Maybe mcast or unicast IP address which is not in the hash */
-    coap_address_copy(&session->addr_info.local, &packet->addr_info.local);
-    session->ifindex = packet->ifindex;
-    session->last_rx_tx = now;
-    return session;
+  if (session == NULL) {
+    session = (coap_session_t*)coap_malloc_type(COAP_SESSION,
+                                                 sizeof(coap_session_t));
+    if (!session)
+      return NULL;
+    coap_prng((unsigned char *)&tx_mid, sizeof(tx_mid));
+    endpoint->transient = session;
   }
+  else {
+    /* Carry on with the message ids rather than drawing a new random one */
+    tx_mid = session->tx_mid;
+  }
+  coap_session_setup(session, COAP_PROTO_UDP, COAP_SESSION_TYPE_SERVER,
+                     addr_hash, &packet->addr_info.local,
+                     &packet->addr_info.remote, packet->ifindex,
+                     endpoint->context, endpoint);
+  session->tx_mid = tx_mid;
+  session->transient = COAP_SESSION_TRANSIENT;
+  session->state = COAP_SESSION_STATE_ESTABLISHED;
+  session->last_rx_tx = now;
+  return session;
+}
 
-  SESSIONS_ITER(endpoint->sessions, session, rtmp) {
-    if (session->ref == 0 && session->delayqueue == NULL) {
-      if (session->type == COAP_SESSION_TYPE_SERVER) {
-        ++num_idle;
-        if (oldest==NULL || session->last_rx_tx < oldest->last_rx_tx)
-          oldest = session;
-
-        if (session->state == COAP_SESSION_STATE_HANDSHAKE) {
-          ++num_hs;
-          /* See if this is a partial (D)TLS session set up
-             which needs to be cleared down to prevent DOS */
-          if ((session->last_rx_tx + COAP_PARTIAL_SESSION_TIMEOUT_TICKS) < now) {
-            if (oldest_hs == NULL ||
-                session->last_rx_tx < oldest_hs->last_rx_tx)
-              oldest_hs = session;
-          }
-        }
-      }
-      else if (session->type == COAP_SESSION_TYPE_HELLO) {
-        ++num_hs;
-        /* See if this is a partial (D)TLS session set up for Client Hello
-           which needs to be cleared down to prevent DOS */
-        if ((session->last_rx_tx + COAP_PARTIAL_SESSION_TIMEOUT_TICKS) < now) {
-          if (oldest_hs == NULL ||
-              session->last_rx_tx < oldest_hs->last_rx_tx)
-            oldest_hs = session;
-        }
+void
+coap_session_check_transient(coap_session_t *session) {
+  coap_endpoint_t *endpoint = session->endpoint;
+
+  if (!session->transient)
+    return;
+  if (session->transient != COAP_SESSION_TRANSIENT_KEEP &&
+      session->ref == 0 && session->delayqueue == NULL &&
+      session->lg_xmit == NULL && session->lg_srcv == NULL &&
+      session->app == NULL)
+    return;
+
+  /* State has to be kept for this peer, so make this a normal session */
+  endpoint->transient = NULL;
+  session->transient = 0;
+  SESSIONS_ADD(endpoint->sessions, session);
+  coap_session_idle_update(session);
+  coap_log(LOG_DEBUG, "***%s: new incoming session\n",
+           coap_session_str(session));
+}
+
+/*
+ * Generic header structure of the DTLS record layer.
+ * typedef struct __attribute__((__packed__)) {
+ *   uint8_t content_type;           content type of the included message
+ *   uint16_t version;               Protocol version
+ *   uint16_t epoch;                 counter for cipher state changes
+ *   uint8_t sequence_number[6];     sequence number
+ *   uint16_t length;                length of the following fragment
+ *   uint8_t handshake;              If content_type == DTLS_CT_HANDSHAKE
+ * } dtls_record_handshake_t;
+ *
+ * The handshake header that follows has the handshake type, a 3 byte
+ * length, a 2 byte message_seq, and a 3 byte fragment offset and fragment
+ * length.  A ClientHello then starts with client_version and random,
+ * followed by the session_id and cookie, each prefixed by its length.
+ */
+#define OFF_CONTENT_TYPE      0  /* offset of content_type in dtls_record_handshake_t */
+#define OFF_EPOCH             3  /* offset of epoch in dtls_record_handshake_t */
+#define OFF_RECORD_LENGTH    11  /* offset of length in dtls_record_handshake_t */
+#define OFF_CID              11  /* offset of the CID that comes before length
+                                    in a record of type DTLS_CT_TLS12_CID */
+#define DTLS_CT_ALERT        21  /* Content Type Alert */
+#define DTLS_CT_HANDSHAKE    22  /* Content Type Handshake */
+#define DTLS_CT_TLS12_CID    25  /* Content Type Record with Connection ID */
+#define OFF_HANDSHAKE_TYPE   13  /* offset of handshake in dtls_record_handshake_t */
+#define DTLS_HT_CLIENT_HELLO  1  /* Client Hello handshake type */
+#define DTLS_HT_HELLO_VERIFY_REQUEST 3 /* Hello Verify Request handshake type */
+#define DTLS_RH_LENGTH       13  /* length of the record header */
+#define DTLS_HH_LENGTH       12  /* length of the handshake header */
+#define OFF_SESSION_ID       (DTLS_RH_LENGTH + DTLS_HH_LENGTH + 2 + 32)
+
+static uint32_t
+dtls_get_uint24(const uint8_t *p) {
+  return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static void
+dtls_put_uint24(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 16);
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)v;
+}
+
+static void
+coap_dtls_cookie_mac(const uint8_t *secret, const coap_addr_hash_t *addr_hash,
+                     uint8_t cookie[COAP_DTLS_COOKIE_LENGTH]) {
+  coap_siphash128(secret, (const uint8_t *)addr_hash, sizeof(*addr_hash),
+                  cookie);
+}
+
+/* Replaces the cookie secrets that are due, so that no cookie is accepted
+ * for longer than two COAP_DTLS_COOKIE_SECRET_TICKS however rarely new ones
+ * are handed out */
+static void
+coap_dtls_cookie_rotate(coap_context_t *context) {
+  coap_tick_t now;
+
+  coap_ticks(&now);
+  if (!context->dtls_cookie_init ||
+      now - context->dtls_cookie_drawn >= 2 * COAP_DTLS_COOKIE_SECRET_TICKS) {
+    coap_prng(context->dtls_cookie_secret,
+              sizeof(context->dtls_cookie_secret));
+    context->dtls_cookie_drawn = now;
+    context->dtls_cookie_init = 1;
+  }
+  else if (now - context->dtls_cookie_drawn >= COAP_DTLS_COOKIE_SECRET_TICKS) {
+    /* Cookies handed out just before stay valid until the next change */
+    memcpy(context->dtls_cookie_secret[1], context->dtls_cookie_secret[0],
+           sizeof(context->dtls_cookie_secret[1]));
+    coap_prng(context->dtls_cookie_secret[0],
+              sizeof(context->dtls_cookie_secret[0]));
+    context->dtls_cookie_drawn = now;
+  }
+}
+
+void
+coap_dtls_cookie_generate(coap_context_t *context,
+                          const coap_addr_hash_t *addr_hash,
+                          uint8_t cookie[COAP_DTLS_COOKIE_LENGTH]) {
+  coap_dtls_cookie_rotate(context);
+  coap_dtls_cookie_mac(context->dtls_cookie_secret[0], addr_hash, cookie);
+}
+
+int
+coap_dtls_cookie_verify(coap_context_t *context,
+                        const coap_addr_hash_t *addr_hash,
+                        const uint8_t *cookie, size_t cookie_len) {
+  uint8_t expected[COAP_DTLS_COOKIE_LENGTH];
+  size_t i, j;
+  uint8_t diff;
+
+  if (!context->dtls_cookie_init || cookie_len != COAP_DTLS_COOKIE_LENGTH)
+    return 0;
+  coap_dtls_cookie_rotate(context);
+  for (i = 0; i < 2; i++) {
+    coap_dtls_cookie_mac(context->dtls_cookie_secret[i], addr_hash, expected);
+    for (diff = 0, j = 0; j < sizeof(expected); j++)
+      diff |= expected[j] ^ cookie[j];
+    if (diff == 0)
+      return 1;
+  }
+  return 0;
+}
+
+const coap_dtls_ticket_key_t *
+coap_dtls_ticket_key_current(coap_context_t *context) {
+  coap_tick_t now;
+
+  coap_ticks(&now);
+  if (!context->dtls_ticket_key_init) {
+    coap_prng(context->dtls_ticket_key, sizeof(context->dtls_ticket_key));
+    context->dtls_ticket_key_drawn = now;
+    context->dtls_ticket_key_init = 1;
+  }
+  else if (now - context->dtls_ticket_key_drawn >= COAP_DTLS_TICKET_KEY_TICKS) {
+    context->dtls_ticket_key[1] = context->dtls_ticket_key[0];
+    coap_prng(&context->dtls_ticket_key[0],
+              sizeof(context->dtls_ticket_key[0]));
+    context->dtls_ticket_key_drawn = now;
+  }
+  return &context->dtls_ticket_key[0];
+}
+
+const coap_dtls_ticket_key_t *
+coap_dtls_ticket_key_find(coap_context_t *context,
+                        const uint8_t name[COAP_DTLS_TICKET_KEY_NAME_LENGTH],
+                        int *is_current) {
+  const coap_dtls_ticket_key_t *current = coap_dtls_ticket_key_current(context);
+
+  *is_current = memcmp(name, current->name, sizeof(current->name)) == 0;
+  if (*is_current)
+    return current;
+  if (memcmp(name, context->dtls_ticket_key[1].name,
+             sizeof(context->dtls_ticket_key[1].name)) == 0)
+    return &context->dtls_ticket_key[1];
+  return NULL;
+}
+
+static void
+coap_tls_resume_key(coap_tls_resume_key_t *key, coap_proto_t proto,
+                    const coap_address_t *server,
+                    const uint8_t credentials[COAP_TLS_CREDENTIALS_LENGTH]) {
+  memset(key, 0, sizeof(coap_tls_resume_key_t));
+  coap_address_copy(&key->server.remote, server);
+  if (coap_address_get_port(&key->server.remote) == 0)
+    coap_address_set_port(&key->server.remote, COAPS_DEFAULT_PORT);
+  key->server.proto = proto;
+  memcpy(key->credentials, credentials, sizeof(key->credentials));
+}
+
+/*
+ * Stores the client (D)TLS state for key, replacing any earlier one.
+ * The hash is kept in the order the states were stored in, so once it is
+ * full the oldest state is dropped.
+ */
+static int
+coap_tls_resume_store(coap_context_t *context,
+                      const coap_tls_resume_key_t *key, coap_binary_t *state) {
+  coap_tls_resume_t *resume;
+
+  HASH_FIND(hh, context->tls_resume, key, sizeof(coap_tls_resume_key_t),
+            resume);
+  if (resume) {
+    HASH_DELETE(hh, context->tls_resume, resume);
+    coap_delete_binary(resume->state);
+  }
+  else {
+    if (HASH_COUNT(context->tls_resume) >= COAP_TLS_RESUME_MAX_SERVERS) {
+      resume = context->tls_resume;
+      HASH_DELETE(hh, context->tls_resume, resume);
+      coap_delete_binary(resume->state);
+    }
+    else {
+      resume = (coap_tls_resume_t *)coap_malloc(sizeof(coap_tls_resume_t));
+      if (!resume) {
+        coap_delete_binary(state);
+        return 0;
       }
     }
+    memset(resume, 0, sizeof(coap_tls_resume_t));
+    memcpy(&resume->key, key, sizeof(coap_tls_resume_key_t));
   }
+  resume->state = state;
+  HASH_ADD(hh, context->tls_resume, key, sizeof(coap_tls_resume_key_t),
+           resume);
+  return 1;
+}
 
-  if (endpoint->context->max_idle_sessions > 0 &&
-      num_idle >= endpoint->context->max_idle_sessions) {
-    coap_session_free(oldest);
+/* Folds length bytes of data into the hash of client credentials */
+static void
+coap_tls_credentials_add(uint8_t credentials[COAP_TLS_CREDENTIALS_LENGTH],
+                         const void *data, size_t length) {
+  coap_siphash128(credentials, (const uint8_t *)data, length, credentials);
+}
+
+static void
+coap_tls_credentials_add_str(uint8_t credentials[COAP_TLS_CREDENTIALS_LENGTH],
+                             const char *s) {
+  coap_tls_credentials_add(credentials, s ? s : "", s ? strlen(s) : 0);
+}
+
+/* The credentials of the client session, all zero if it was set up
+ * without any */
+static const uint8_t *
+coap_session_tls_credentials(const coap_session_t *session) {
+  static const uint8_t none[COAP_TLS_CREDENTIALS_LENGTH];
+
+  return session->secure ? session->secure->credentials : none;
+}
+
+/* Sets the credentials of the client session from the PSK identity and SNI
+ * it is set up with.  Returns 0 if they cannot be stored. */
+static int
+coap_session_tls_credentials_psk(coap_session_t *session,
+                                 const coap_dtls_cpsk_t *setup_data) {
+  coap_session_secure_t *secure = coap_session_secure_block(session);
+  uint8_t *credentials;
+
+  if (!secure)
+    return 0;
+  credentials = secure->credentials;
+  memset(credentials, 0, sizeof(secure->credentials));
+  coap_tls_credentials_add(credentials, "psk", 3);
+  coap_tls_credentials_add(credentials,
+                           setup_data->psk_info.identity.s,
+                           setup_data->psk_info.identity.length);
+  coap_tls_credentials_add_str(credentials, setup_data->client_sni);
+  return 1;
+}
+
+/* Sets the credentials of the client session from the certificate (or raw
+ * public key) and SNI it is set up with.  Returns 0 if they cannot be
+ * stored. */
+static int
+coap_session_tls_credentials_pki(coap_session_t *session,
+                                 const coap_dtls_pki_t *setup_data) {
+  const coap_dtls_key_t *key = &setup_data->pki_key;
+  coap_session_secure_t *secure = coap_session_secure_block(session);
+  uint8_t *credentials;
+
+  if (!secure)
+    return 0;
+  credentials = secure->credentials;
+  memset(credentials, 0, sizeof(secure->credentials));
+  coap_tls_credentials_add(credentials, "pki", 3);
+  coap_tls_credentials_add(credentials, &setup_data->is_rpk_not_cert, 1);
+  switch (key->key_type) {
+  case COAP_PKI_KEY_PEM:
+    coap_tls_credentials_add_str(credentials, key->key.pem.public_cert);
+    break;
+  case COAP_PKI_KEY_PEM_BUF:
+    coap_tls_credentials_add(credentials, key->key.pem_buf.public_cert,
+                             key->key.pem_buf.public_cert_len);
+    break;
+  case COAP_PKI_KEY_ASN1:
+    coap_tls_credentials_add(credentials, key->key.asn1.public_cert,
+                             key->key.asn1.public_cert_len);
+    break;
+  case COAP_PKI_KEY_PKCS11:
+    coap_tls_credentials_add_str(credentials, key->key.pkcs11.public_cert);
+    break;
+  default:
+    break;
   }
-  else if (oldest_hs) {
-    coap_log(LOG_WARNING, "***%s: Incomplete session timed out\n",
-             coap_session_str(oldest_hs));
-    coap_session_free(oldest_hs);
+  coap_tls_credentials_add_str(credentials, setup_data->client_sni);
+  return 1;
+}
+
+const coap_binary_t *
+coap_session_tls_resume_state(const coap_session_t *session) {
+  coap_tls_resume_key_t key;
+  coap_tls_resume_t *resume;
+
+  coap_tls_resume_key(&key, session->proto, &session->addr_info.remote,
+                      coap_session_tls_credentials(session));
+  HASH_FIND(hh, session->context->tls_resume, &key,
+            sizeof(coap_tls_resume_key_t), resume);
+  return resume ? resume->state : NULL;
+}
+
+void
+coap_session_save_tls_state(coap_session_t *session) {
+  coap_tls_resume_key_t key;
+  coap_binary_t *state;
+
+  if (session->type != COAP_SESSION_TYPE_CLIENT || !session->tls ||
+      !session->context)
+    return;
+  state = coap_dtls_get_resume_state(session);
+  if (state) {
+    coap_tls_resume_key(&key, session->proto, &session->addr_info.remote,
+                        coap_session_tls_credentials(session));
+    coap_tls_resume_store(session->context, &key, state);
   }
+}
 
-  if (num_hs > (endpoint->context->max_handshake_sessions ?
-              endpoint->context->max_handshake_sessions :
-              COAP_DEFAULT_MAX_HANDSHAKE_SESSIONS)) {
-    /* Maxed out on number of sessions in (D)TLS negotiation state */
-    coap_log(LOG_DEBUG,
-             "Oustanding sessions in COAP_SESSION_STATE_HANDSHAKE too "
-             "large.  New request ignored\n");
+int
+coap_session_hibernate(coap_session_t *session) {
+  coap_binary_t *state;
+
+  if (session->proto != COAP_PROTO_DTLS ||
+      session->type != COAP_SESSION_TYPE_SERVER ||
+      session->state != COAP_SESSION_STATE_ESTABLISHED ||
+      !session->tls || coap_handshake_busy(session) ||
+      !coap_session_secure_block(session))
+    return 0;
+  state = coap_dtls_hibernate(session);
+  if (!state)
+    return 0;
+  session->tls = NULL;
+  session->secure->hibernated = state;
+  coap_log(LOG_DEBUG, "***%s: DTLS: session hibernated (%zu bytes)\n",
+           coap_session_str(session), state->length);
+  return 1;
+}
+
+int
+coap_session_rehydrate(coap_session_t *session) {
+  if (!coap_session_is_hibernated(session))
+    return 1;
+  session->tls = coap_dtls_rehydrate(session, session->secure->hibernated);
+  coap_delete_binary(session->secure->hibernated);
+  session->secure->hibernated = NULL;
+  if (!session->tls) {
+    coap_log(LOG_WARNING, "***%s: DTLS: session cannot be restored\n",
+             coap_session_str(session));
+    coap_session_disconnected(session, COAP_NACK_TLS_FAILED);
+    return 0;
+  }
+  coap_log(LOG_DEBUG, "***%s: DTLS: session restored\n",
+           coap_session_str(session));
+  return 1;
+}
+
+void
+coap_context_free_tls_resume(coap_context_t *context) {
+  coap_tls_resume_t *resume, *rtmp;
+
+  HASH_ITER(hh, context->tls_resume, resume, rtmp) {
+    HASH_DELETE(hh, context->tls_resume, resume);
+    coap_delete_binary(resume->state);
+    coap_free(resume);
+  }
+}
+
+coap_binary_t *
+coap_session_export_tls_state(coap_session_t *session) {
+  coap_binary_t *state;
+  coap_binary_t *export;
+
+  if (!session || session->type != COAP_SESSION_TYPE_CLIENT ||
+      !session->tls || session->state != COAP_SESSION_STATE_ESTABLISHED)
     return NULL;
+  state = coap_dtls_get_resume_state(session);
+  if (!state)
+    return NULL;
+  export = coap_new_binary(1 + COAP_TLS_CREDENTIALS_LENGTH + state->length);
+  if (export) {
+    /* Tagged, so that it is not given to another (D)TLS library, and with
+       the credentials that it may be resumed with */
+    export->s[0] = (uint8_t)coap_get_tls_library_version()->type;
+    memcpy(&export->s[1], coap_session_tls_credentials(session),
+           COAP_TLS_CREDENTIALS_LENGTH);
+    memcpy(&export->s[1 + COAP_TLS_CREDENTIALS_LENGTH], state->s,
+           state->length);
+  }
+  coap_delete_binary(state);
+  return export;
+}
+
+int
+coap_context_import_tls_state(coap_context_t *context,
+                              const coap_address_t *server,
+                              coap_proto_t proto,
+                              const uint8_t *data, size_t length) {
+  coap_tls_resume_key_t key;
+  coap_binary_t *state;
+
+  if (!context || !server || !data ||
+      length <= 1 + COAP_TLS_CREDENTIALS_LENGTH ||
+      (proto != COAP_PROTO_DTLS && proto != COAP_PROTO_TLS))
+    return 0;
+  if (data[0] != (uint8_t)coap_get_tls_library_version()->type) {
+    coap_log(LOG_WARNING,
+             "coap_context_import_tls_state: state is for another (D)TLS "
+             "library\n");
+    return 0;
   }
+  state = coap_new_binary(length - 1 - COAP_TLS_CREDENTIALS_LENGTH);
+  if (!state)
+    return 0;
+  memcpy(state->s, &data[1 + COAP_TLS_CREDENTIALS_LENGTH], state->length);
+  coap_tls_resume_key(&key, proto, server, &data[1]);
+  return coap_tls_resume_store(context, &key, state);
+}
 
-  if (endpoint->proto == COAP_PROTO_DTLS) {
-    /*
-     * Need to check that this actually is a Client Hello before wasting
-     * time allocating and then freeing off session.
-     */
+/*
+ * Checks the cookie in the ClientHello from a peer without a session.  If
+ * it is missing or not valid, the peer is sent a HelloVerifyRequest with a
+ * new cookie straight from the endpoint, so nothing is kept for it until it
+ * has shown that it owns its address.
+ *
+ * Returns 1 if the ClientHello carries a valid cookie, else 0.
+ */
+static int
+coap_endpoint_check_cookie(coap_endpoint_t *endpoint,
+  const coap_addr_hash_t *addr_hash, const coap_packet_t *packet,
+  const uint8_t *payload, size_t length) {
+  coap_session_t hvr_session;
+  uint8_t hvr[DTLS_RH_LENGTH + DTLS_HH_LENGTH + 3 + COAP_DTLS_COOKIE_LENGTH];
+  size_t record_len;
+  size_t hello_len;
+  size_t offset;
+  size_t cookie_len;
+
+  record_len = ((size_t)payload[OFF_RECORD_LENGTH] << 8) |
+               payload[OFF_RECORD_LENGTH + 1];
+  if (record_len + DTLS_RH_LENGTH > length ||
+      record_len < DTLS_HH_LENGTH ||
+      payload[OFF_EPOCH] != 0 || payload[OFF_EPOCH + 1] != 0) {
+    coap_log(LOG_DEBUG, "*  %s: ClientHello record invalid, dropped\n",
+             coap_endpoint_str(endpoint));
+    return 0;
+  }
+  hello_len = dtls_get_uint24(&payload[OFF_HANDSHAKE_TYPE + 1]);
+  if (dtls_get_uint24(&payload[OFF_HANDSHAKE_TYPE + 6]) != 0 ||
+      dtls_get_uint24(&payload[OFF_HANDSHAKE_TYPE + 9]) != hello_len ||
+      hello_len + DTLS_HH_LENGTH > record_len) {
+    /* The cookie can only be found in an unfragmented ClientHello */
+    coap_log(LOG_DEBUG, "*  %s: ClientHello fragmented, dropped\n",
+             coap_endpoint_str(endpoint));
+    return 0;
+  }
+  length = DTLS_RH_LENGTH + DTLS_HH_LENGTH + hello_len;
+  offset = OFF_SESSION_ID;
+  if (offset >= length || offset + 1 + payload[offset] >= length) {
+    coap_log(LOG_DEBUG, "*  %s: ClientHello too short, dropped\n",
+             coap_endpoint_str(endpoint));
+    return 0;
+  }
+  offset += 1 + payload[offset];
+  cookie_len = payload[offset++];
+  if (offset + cookie_len > length) {
+    coap_log(LOG_DEBUG, "*  %s: ClientHello too short, dropped\n",
+             coap_endpoint_str(endpoint));
+    return 0;
+  }
+  if (cookie_len &&
+      coap_dtls_cookie_verify(endpoint->context, addr_hash,
+                              &payload[offset], cookie_len))
+    return 1;
+
+  /* Record header, echoing the ClientHello's epoch and sequence number */
+  hvr[OFF_CONTENT_TYPE] = DTLS_CT_HANDSHAKE;
+  /* RFC6347 4.2.1 DTLS 1.0 is used whatever version gets negotiated */
+  hvr[1] = 0xfe;
+  hvr[2] = 0xff;
+  memcpy(&hvr[OFF_EPOCH], &payload[OFF_EPOCH], 8);
+  hvr[OFF_RECORD_LENGTH] = 0;
+  hvr[OFF_RECORD_LENGTH + 1] = (uint8_t)(sizeof(hvr) - DTLS_RH_LENGTH);
+  /* Handshake header, the first message with message_seq 0 */
+  hvr[OFF_HANDSHAKE_TYPE] = DTLS_HT_HELLO_VERIFY_REQUEST;
+  dtls_put_uint24(&hvr[OFF_HANDSHAKE_TYPE + 1],
+                  (uint32_t)(3 + COAP_DTLS_COOKIE_LENGTH));
+  hvr[OFF_HANDSHAKE_TYPE + 4] = 0;
+  hvr[OFF_HANDSHAKE_TYPE + 5] = 0;
+  dtls_put_uint24(&hvr[OFF_HANDSHAKE_TYPE + 6], 0);
+  dtls_put_uint24(&hvr[OFF_HANDSHAKE_TYPE + 9],
+                  (uint32_t)(3 + COAP_DTLS_COOKIE_LENGTH));
+  /* HelloVerifyRequest with server_version and cookie */
+  offset = DTLS_RH_LENGTH + DTLS_HH_LENGTH;
+  hvr[offset++] = 0xfe;
+  hvr[offset++] = 0xff;
+  hvr[offset++] = COAP_DTLS_COOKIE_LENGTH;
+  coap_dtls_cookie_generate(endpoint->context, addr_hash, &hvr[offset]);
+
+  /* Only used to address the HelloVerifyRequest */
+  memset(&hvr_session, 0, sizeof(hvr_session));
+  hvr_session.proto = endpoint->proto;
+  hvr_session.type = COAP_SESSION_TYPE_HELLO;
+  hvr_session.addr_info = packet->addr_info;
+  hvr_session.ifindex = packet->ifindex;
+  hvr_session.context = endpoint->context;
+  hvr_session.endpoint = endpoint;
+  coap_log(LOG_DEBUG, "*  %s: %s ClientHello cookie, sending Hello Verify\n",
+           coap_endpoint_str(endpoint), cookie_len ? "invalid" : "no");
+  coap_socket_send(&endpoint->sock, &hvr_session, hvr, sizeof(hvr));
+  return 0;
+}
+
+int
+coap_session_new_cid(coap_session_t *session,
+                     uint8_t cid[COAP_DTLS_CID_LENGTH]) {
+  coap_endpoint_t *endpoint = session->endpoint;
+  coap_session_cid_t *cid_block;
+  coap_session_cid_t *other;
+
+  if (!endpoint)
+    return 0;
+  if (!session->cid) {
+    cid_block = (coap_session_cid_t*)coap_malloc_type(COAP_SESSION_CID,
+                                                sizeof(coap_session_cid_t));
+    if (!cid_block) {
+      coap_log(LOG_ERR, "No memory to store session Connection ID\n");
+      return 0;
+    }
+    memset(cid_block, 0, sizeof(coap_session_cid_t));
+    cid_block->session = session;
+    do {
+      coap_prng(cid_block->cid, sizeof(cid_block->cid));
+      HASH_FIND(hh, endpoint->cid_sessions, cid_block->cid,
+                sizeof(cid_block->cid), other);
+    } while (other);
+    HASH_ADD(hh, endpoint->cid_sessions, cid, sizeof(cid_block->cid),
+             cid_block);
+    session->cid = cid_block;
+  }
+  memcpy(cid, session->cid->cid, COAP_DTLS_CID_LENGTH);
+  return 1;
+}
+
+void
+coap_session_cid_rebind(coap_session_t *session) {
+  coap_session_cid_t *cid = session->cid;
+  coap_endpoint_t *endpoint = session->endpoint;
+  coap_addr_hash_t addr_hash;
+  coap_session_t *other;
+
+  if (!cid || !cid->rebinding)
+    return;
+  cid->rebinding = 0;
+  coap_make_addr_hash(&addr_hash, session->proto, &cid->rebound);
+  SESSIONS_FIND(endpoint->sessions, addr_hash, other);
+  if (other) {
+    if (other->ref) {
+      coap_log(LOG_DEBUG, "***%s: new peer address in use\n",
+               coap_session_str(session));
+      return;
+    }
+    /* Left over from a previous peer at that address */
+    coap_session_free(other);
+  }
+  SESSIONS_DELETE(endpoint->sessions, session);
+  session->addr_hash = addr_hash;
+  coap_address_copy(&session->addr_info.remote, &cid->rebound.remote);
+  coap_address_copy(&session->addr_info.local, &cid->rebound.local);
+  session->ifindex = cid->rebound_ifindex;
+  SESSIONS_ADD(endpoint->sessions, session);
+  coap_log(LOG_DEBUG, "***%s: peer address changed\n",
+           coap_session_str(session));
+}
+
+void
+coap_session_cid_rebind_done(coap_session_t *session) {
+  if (session->cid)
+    session->cid->rebinding = 0;
+}
+
+/*
+ * Returns the session whose Connection ID is in the DTLS record in packet,
+ * if any.  A record from another address only moves the session once it
+ * has been decrypted (see coap_session_cid_rebind()), as anyone can copy
+ * a CID.
+ */
+static coap_session_t *
+coap_endpoint_find_cid(coap_endpoint_t *endpoint,
+  const coap_addr_hash_t *addr_hash, const coap_packet_t *packet) {
+#ifdef WITH_LWIP
+  const uint8_t *payload = (const uint8_t*)packet->pbuf->payload;
+  size_t length = packet->pbuf->len;
+#else /* ! WITH_LWIP */
+  const uint8_t *payload = (const uint8_t*)packet->payload;
+  size_t length = packet->length;
+#endif /* ! WITH_LWIP */
+  coap_session_cid_t *cid;
+
+  if (length < OFF_CID + COAP_DTLS_CID_LENGTH ||
+      payload[OFF_CONTENT_TYPE] != DTLS_CT_TLS12_CID)
+    return NULL;
+  HASH_FIND(hh, endpoint->cid_sessions, &payload[OFF_CID],
+            COAP_DTLS_CID_LENGTH, cid);
+  if (!cid)
+    return NULL;
+  cid->rebinding = memcmp(addr_hash, &cid->session->addr_hash,
+                          sizeof(coap_addr_hash_t)) != 0;
+  if (cid->rebinding) {
+    cid->rebound = packet->addr_info;
+    cid->rebound_ifindex = packet->ifindex;
+  }
+  return cid->session;
+}
+
+coap_session_t *
+coap_endpoint_get_session(coap_endpoint_t *endpoint,
+  const coap_packet_t *packet, coap_tick_t now) {
+  coap_session_t *session = NULL;
+  coap_addr_hash_t addr_hash;
+
+  coap_make_addr_hash(&addr_hash, endpoint->proto, &packet->addr_info);
+  if (endpoint->cid_sessions)
+    session = coap_endpoint_find_cid(endpoint, &addr_hash, packet);
+  if (!session)
+    SESSIONS_FIND(endpoint->sessions, addr_hash, session);
+  if (session) {
+    if (!session->cid || !session->cid->rebinding) {
+      /* Maybe mcast or unicast IP address which is not in the hash */
+      coap_address_copy(&session->addr_info.local, &packet->addr_info.local);
+      session->ifindex = packet->ifindex;
+    }
+    session->last_rx_tx = now;
+    coap_session_idle_touch(session);
+    return session;
+  }
 
+  if (endpoint->proto == COAP_PROTO_UDP && endpoint->context->stateless_udp)
+    return coap_endpoint_transient_session(endpoint, &addr_hash, packet, now);
+
+  if (endpoint->proto == COAP_PROTO_DTLS) {
     /*
-     * Generic header structure of the DTLS record layer.
-     * typedef struct __attribute__((__packed__)) {
-     *   uint8_t content_type;           content type of the included message
-     *   uint16_t version;               Protocol version
-     *   uint16_t epoch;                 counter for cipher state changes
-     *   uint8_t sequence_number[6];     sequence number
-     *   uint16_t length;                length of the following fragment
-     *   uint8_t handshake;              If content_type == DTLS_CT_HANDSHAKE
-     * } dtls_record_handshake_t;
+     * Need to check that this actually is a Client Hello with a valid
+     * cookie before other sessions make room for a new one, or any time is
+     * wasted allocating and then freeing off a session.
      */
-#define OFF_CONTENT_TYPE      0  /* offset of content_type in dtls_record_handshake_t */
-#define DTLS_CT_ALERT        21  /* Content Type Alert */
-#define DTLS_CT_HANDSHAKE    22  /* Content Type Handshake */
-#define OFF_HANDSHAKE_TYPE   13  /* offset of handshake in dtls_record_handshake_t */
-#define DTLS_HT_CLIENT_HELLO  1  /* Client Hello handshake type */
-
 #ifdef WITH_LWIP
     const uint8_t *payload = (const uint8_t*)packet->pbuf->payload;
     size_t length = packet->pbuf->len;
@@ -669,7 +1630,36 @@ coap_endpoint_get_session(coap_endpoint_t *endpoint,
          payload[OFF_CONTENT_TYPE], payload[OFF_HANDSHAKE_TYPE]);
       return NULL;
     }
+    if (coap_dtls_hello_needs_cookie() &&
+        !coap_endpoint_check_cookie(endpoint, &addr_hash, packet,
+                                    payload, length))
+      return NULL;
   }
+
+  if (endpoint->context->max_idle_sessions > 0 &&
+      endpoint->num_idle >= endpoint->context->max_idle_sessions) {
+    coap_session_free(endpoint->idle_sessions);
+  }
+  else if (endpoint->hs_sessions &&
+           (endpoint->hs_sessions->last_rx_tx +
+            COAP_PARTIAL_SESSION_TIMEOUT_TICKS) < now) {
+    /* The least recently used partial (D)TLS session set up (or Client
+       Hello) needs to be cleared down to prevent DOS */
+    coap_log(LOG_WARNING, "***%s: Incomplete session timed out\n",
+             coap_session_str(endpoint->hs_sessions));
+    coap_session_free(endpoint->hs_sessions);
+  }
+
+  if (endpoint->num_hs > (endpoint->context->max_handshake_sessions ?
+              endpoint->context->max_handshake_sessions :
+              COAP_DEFAULT_MAX_HANDSHAKE_SESSIONS)) {
+    /* Maxed out on number of sessions in (D)TLS negotiation state */
+    coap_log(LOG_DEBUG,
+             "Oustanding sessions in COAP_SESSION_STATE_HANDSHAKE too "
+             "large.  New request ignored\n");
+    return NULL;
+  }
+
   session = coap_make_session(endpoint->proto, COAP_SESSION_TYPE_SERVER,
                               &addr_hash, &packet->addr_info.local,
                               &packet->addr_info.remote,
@@ -682,6 +1672,7 @@ coap_endpoint_get_session(coap_endpoint_t *endpoint,
       session->type = COAP_SESSION_TYPE_HELLO;
     }
     SESSIONS_ADD(endpoint->sessions, session);
+    coap_session_idle_update(session);
     coap_log(LOG_DEBUG, "***%s: new incoming session\n",
              coap_session_str(session));
   }
@@ -697,6 +1688,7 @@ coap_session_new_dtls_session(coap_session_t *session,
     session->tls = coap_dtls_new_server_session(session);
     if (session->tls) {
       session->state = COAP_SESSION_STATE_HANDSHAKE;
+      coap_session_idle_update(session);
     } else {
       coap_session_free(session);
       session = NULL;
@@ -874,28 +1866,33 @@ coap_session_accept(coap_session_t *session) {
   if (session->proto == COAP_PROTO_TCP) {
     coap_session_send_csm(session);
   } else if (session->proto == COAP_PROTO_TLS) {
-    int connected = 0;
-    session->tls = coap_tls_new_server_session(session, &connected);
-    if (session->tls) {
-      session->state = COAP_SESSION_STATE_HANDSHAKE;
-      if (connected) {
-        coap_handle_event(session->context, COAP_EVENT_DTLS_CONNECTED, session);
-        coap_session_send_csm(session);
-      }
-    } else {
-      /* Need to free session object. As a new session may not yet
-       * have been referenced, we call coap_session_reference() first
-       * before trying to release the object.
-       */
-      coap_session_reference(session);
-      coap_session_release(session);
-      session = NULL;
-    }
+    /* The TLS session is set up by coap_session_accept_tls() once the
+       ClientHello has arrived */
+    session->state = COAP_SESSION_STATE_HANDSHAKE;
   }
 #endif /* COAP_DISABLE_TCP */
   return session;
 }
 
+#if !COAP_DISABLE_TCP
+int
+coap_session_accept_tls(coap_session_t *session) {
+  int connected = 0;
+
+  session->tls = coap_tls_new_server_session(session, &connected);
+  if (!session->tls) {
+    coap_session_disconnected(session, COAP_NACK_TLS_FAILED);
+    return 0;
+  }
+  coap_session_idle_update(session);
+  if (connected) {
+    coap_handle_event(session->context, COAP_EVENT_DTLS_CONNECTED, session);
+    coap_session_send_csm(session);
+  }
+  return 1;
+}
+#endif /* !COAP_DISABLE_TCP */
+
 coap_session_t *coap_new_client_session(
   coap_context_t *ctx,
   const coap_address_t *local_if,
@@ -948,15 +1945,22 @@ coap_session_t *coap_new_client_session_psk2(
   coap_session_t *session = coap_session_create_client(ctx, local_if,
                                                        server, proto);
 
+  coap_session_psk_t *psk;
+
   if (!session)
     return NULL;
 
-  session->cpsk_setup_data = *setup_data;
+  psk = coap_session_psk_block(session);
+  if (!psk) {
+    coap_session_release(session);
+    return NULL;
+  }
+  psk->cpsk_setup_data = *setup_data;
   if (setup_data->psk_info.identity.s) {
-    session->psk_identity =
+    psk->psk_identity =
                       coap_new_bin_const(setup_data->psk_info.identity.s,
                                          setup_data->psk_info.identity.length);
-    if (!session->psk_identity) {
+    if (!psk->psk_identity) {
       coap_log(LOG_WARNING, "Cannot store session Identity (PSK)\n");
       coap_session_release(session);
       return NULL;
@@ -969,9 +1973,9 @@ coap_session_t *coap_new_client_session_psk2(
   }
 
   if (setup_data->psk_info.key.s && setup_data->psk_info.key.length > 0) {
-    session->psk_key = coap_new_bin_const(setup_data->psk_info.key.s,
-                                          setup_data->psk_info.key.length);
-    if (!session->psk_key) {
+    psk->psk_key = coap_new_bin_const(setup_data->psk_info.key.s,
+                                      setup_data->psk_info.key.length);
+    if (!psk->psk_key) {
       coap_log(LOG_WARNING, "Cannot store session pre-shared key (PSK)\n");
       coap_session_release(session);
       return NULL;
@@ -989,25 +1993,66 @@ coap_session_t *coap_new_client_session_psk2(
       return NULL;
     }
   }
+  if (!coap_session_tls_credentials_psk(session, setup_data)) {
+    coap_session_release(session);
+    return NULL;
+  }
   coap_log(LOG_DEBUG, "***%s: new outgoing session\n",
            coap_session_str(session));
   return coap_session_connect(session);
 }
 
+coap_session_psk_t *
+coap_session_psk_block(coap_session_t *session) {
+  if (!session->psk) {
+    session->psk = (coap_session_psk_t*)coap_malloc_type(COAP_SESSION_PSK,
+                                                sizeof(coap_session_psk_t));
+    if (!session->psk) {
+      coap_log(LOG_ERR, "No memory to store session PSK information\n");
+      return NULL;
+    }
+    memset(session->psk, 0, sizeof(coap_session_psk_t));
+  }
+  return session->psk;
+}
+
+coap_session_secure_t *
+coap_session_secure_block(coap_session_t *session) {
+  if (!session->secure) {
+    session->secure = (coap_session_secure_t*)coap_malloc_type(
+                                                COAP_SESSION_SECURE,
+                                                sizeof(coap_session_secure_t));
+    if (!session->secure) {
+      coap_log(LOG_ERR, "No memory to store session (D)TLS information\n");
+      return NULL;
+    }
+    memset(session->secure, 0, sizeof(coap_session_secure_t));
+  }
+  return session->secure;
+}
+
 int coap_session_refresh_psk_hint(coap_session_t *session,
   const coap_bin_const_t *psk_hint
 ) {
+  coap_session_psk_t *psk;
+  coap_bin_const_t *old_psk_hint;
+
+  if (!session->psk && !(psk_hint && psk_hint->s))
+    return 1;
+  psk = coap_session_psk_block(session);
+  if (!psk)
+    return 0;
   /* We may be refreshing the hint with the same hint */
-  coap_bin_const_t *old_psk_hint = session->psk_hint;
+  old_psk_hint = psk->psk_hint;
 
   if (psk_hint && psk_hint->s) {
-    if (session->psk_hint) {
-      if (coap_binary_equal(session->psk_hint, psk_hint))
+    if (psk->psk_hint) {
+      if (coap_binary_equal(psk->psk_hint, psk_hint))
         return 1;
     }
-    session->psk_hint = coap_new_bin_const(psk_hint->s,
-                                           psk_hint->length);
-    if (!session->psk_hint) {
+    psk->psk_hint = coap_new_bin_const(psk_hint->s,
+                                       psk_hint->length);
+    if (!psk->psk_hint) {
       coap_log(LOG_ERR, "No memory to store identity hint (PSK)\n");
       if (old_psk_hint)
         coap_delete_bin_const(old_psk_hint);
@@ -1015,7 +2060,7 @@ int coap_session_refresh_psk_hint(coap_session_t *session,
     }
   }
   else {
-    session->psk_hint = NULL;
+    psk->psk_hint = NULL;
   }
   if (old_psk_hint)
     coap_delete_bin_const(old_psk_hint);
@@ -1026,16 +2071,24 @@ int coap_session_refresh_psk_hint(coap_session_t *session,
 int coap_session_refresh_psk_key(coap_session_t *session,
   const coap_bin_const_t *psk_key
 ) {
+  coap_session_psk_t *psk;
+  coap_bin_const_t *old_psk_key;
+
+  if (!session->psk && !(psk_key && psk_key->s))
+    return 1;
+  psk = coap_session_psk_block(session);
+  if (!psk)
+    return 0;
   /* We may be refreshing the key with the same key */
-  coap_bin_const_t *old_psk_key = session->psk_key;
+  old_psk_key = psk->psk_key;
 
   if (psk_key && psk_key->s) {
-    if (session->psk_key) {
-      if (coap_binary_equal(session->psk_key, psk_key))
+    if (psk->psk_key) {
+      if (coap_binary_equal(psk->psk_key, psk_key))
         return 1;
     }
-    session->psk_key = coap_new_bin_const(psk_key->s, psk_key->length);
-    if (!session->psk_key) {
+    psk->psk_key = coap_new_bin_const(psk_key->s, psk_key->length);
+    if (!psk->psk_key) {
       coap_log(LOG_ERR, "No memory to store pre-shared key (PSK)\n");
       if (old_psk_key)
         coap_delete_bin_const(old_psk_key);
@@ -1043,7 +2096,7 @@ int coap_session_refresh_psk_key(coap_session_t *session,
     }
   }
   else {
-    session->psk_key = NULL;
+    psk->psk_key = NULL;
   }
   if (old_psk_key)
     coap_delete_bin_const(old_psk_key);
@@ -1051,17 +2104,54 @@ int coap_session_refresh_psk_key(coap_session_t *session,
   return 1;
 }
 
+int coap_session_refresh_psk_identity(coap_session_t *session,
+  const coap_bin_const_t *psk_identity
+) {
+  coap_session_psk_t *psk;
+  coap_bin_const_t *old_psk_identity;
+
+  if (!session->psk && !(psk_identity && psk_identity->s))
+    return 1;
+  psk = coap_session_psk_block(session);
+  if (!psk)
+    return 0;
+  /* We may be refreshing the identity with the same identity */
+  old_psk_identity = psk->psk_identity;
+
+  if (psk_identity && psk_identity->s) {
+    if (psk->psk_identity) {
+      if (coap_binary_equal(psk->psk_identity, psk_identity))
+        return 1;
+    }
+    psk->psk_identity = coap_new_bin_const(psk_identity->s,
+                                           psk_identity->length);
+    if (!psk->psk_identity) {
+      coap_log(LOG_ERR, "No memory to store identity (PSK)\n");
+      if (old_psk_identity)
+        coap_delete_bin_const(old_psk_identity);
+      return 0;
+    }
+  }
+  else {
+    psk->psk_identity = NULL;
+  }
+  if (old_psk_identity)
+    coap_delete_bin_const(old_psk_identity);
+
+  return 1;
+}
+
 const coap_bin_const_t *
 coap_session_get_psk_hint(const coap_session_t *session) {
-  if (session)
-    return session->psk_hint;
+  if (session && session->psk)
+    return session->psk->psk_hint;
   return NULL;
 }
 
 const coap_bin_const_t *
 coap_session_get_psk_key(const coap_session_t *session) {
-  if (session)
-    return session->psk_key;
+  if (session && session->psk)
+    return session->psk->psk_key;
   return NULL;
 }
 
@@ -1098,6 +2188,10 @@ coap_session_t *coap_new_client_session_pki(
       coap_session_release(session);
       return NULL;
     }
+    if (!coap_session_tls_credentials_pki(session, setup_data)) {
+      coap_session_release(session);
+      return NULL;
+    }
   }
   coap_log(LOG_DEBUG, "***%s: new outgoing session\n",
            coap_session_str(session));
@@ -1109,19 +2203,39 @@ coap_session_t *coap_new_server_session(
   coap_endpoint_t *ep
 ) {
   coap_session_t *session;
+#if !COAP_DISABLE_TCP
+  coap_socket_t sock;
+  coap_addr_tuple_t addr_info;
+  coap_addr_hash_t addr_hash;
+  int any = coap_address_isany(&ep->bind_addr);
+
+  /* Accept first, so that an empty accept queue costs no session */
+  memset(&sock, 0, sizeof(sock));
+  coap_address_init(&addr_info.remote);
+  if (any)
+    coap_address_init(&addr_info.local);
+  else
+    coap_address_copy(&addr_info.local, &ep->bind_addr);
+  if (!coap_socket_accept_tcp(&ep->sock, &sock,
+                              any ? &addr_info.local : NULL,
+                              &addr_info.remote))
+    return NULL;
+  coap_make_addr_hash(&addr_hash, ep->proto, &addr_info);
+
+  session = coap_make_session( ep->proto, COAP_SESSION_TYPE_SERVER,
+                               &addr_hash, &addr_info.local,
+                               &addr_info.remote, 0, ctx, ep );
+  if (!session) {
+    coap_socket_close(&sock);
+    return NULL;
+  }
+  session->sock.fd = sock.fd;
+#else /* COAP_DISABLE_TCP */
   session = coap_make_session( ep->proto, COAP_SESSION_TYPE_SERVER,
                                NULL, NULL, NULL, 0, ctx, ep );
   if (!session)
-    goto error;
-
-#if !COAP_DISABLE_TCP
-  if (!coap_socket_accept_tcp(&ep->sock, &session->sock,
-                              &session->addr_info.local,
-                              &session->addr_info.remote))
-    goto error;
-  coap_make_addr_hash(&session->addr_hash, session->proto, &session->addr_info);
-
-#endif /* !COAP_DISABLE_TCP */
+    return NULL;
+#endif /* COAP_DISABLE_TCP */
   session->sock.flags |= COAP_SOCKET_NOT_EMPTY | COAP_SOCKET_CONNECTED
                        | COAP_SOCKET_WANT_READ;
 #ifdef COAP_EPOLL_SUPPORT
@@ -1131,16 +2245,13 @@ coap_session_t *coap_new_server_session(
                    __func__);
 #endif /* COAP_EPOLL_SUPPORT */
   SESSIONS_ADD(ep->sessions, session);
+  coap_session_idle_update(session);
   if (session) {
     coap_log(LOG_DEBUG, "***%s: new incoming session\n",
              coap_session_str(session));
     session = coap_session_accept(session);
   }
   return session;
-
-error:
-  coap_session_free(session);
-  return NULL;
 }
 
 void
@@ -1275,6 +2386,9 @@ coap_new_endpoint(coap_context_t *context, const coap_address_t *listen_addr, co
   } else if (proto==COAP_PROTO_TCP || proto==COAP_PROTO_TLS) {
     if (!coap_socket_bind_tcp(&ep->sock, listen_addr, &ep->bind_addr))
       goto error;
+    /* A TLS client speaks first, so nothing is lost by waiting for it */
+    if (proto == COAP_PROTO_TLS)
+      coap_socket_defer_accept_tcp(&ep->sock, COAP_TLS_DEFER_ACCEPT_SECS);
     ep->sock.flags |= COAP_SOCKET_WANT_ACCEPT;
 #endif /* !COAP_DISABLE_TCP */
   } else {
@@ -1331,6 +2445,10 @@ coap_free_endpoint(coap_endpoint_t *ep) {
         coap_session_free(session);
       }
     }
+    if (ep->transient) {
+      coap_session_mfree(ep->transient);
+      coap_free_type(COAP_SESSION, ep->transient);
+    }
     if (ep->sock.flags != COAP_SOCKET_EMPTY) {
       /*
        * ep->sock.endpoint is set in coap_new_endpoint().
@@ -1378,7 +2496,12 @@ coap_session_get_by_peer(const coap_context_t *ctx,
 }
 
 const char *coap_session_str(const coap_session_t *session) {
+#if COAP_HANDSHAKE_THREADS
+  /* The handshake threads log with it too */
+  static __thread char szSession[2 * (INET6_ADDRSTRLEN + 8) + 24];
+#else /* ! COAP_HANDSHAKE_THREADS */
   static char szSession[2 * (INET6_ADDRSTRLEN + 8) + 24];
+#endif /* ! COAP_HANDSHAKE_THREADS */
   char *p = szSession, *end = szSession + sizeof(szSession);
   if (coap_print_addr(&session->addr_info.local,
                       (unsigned char*)p, end - p) > 0)
@@ -0,0 +1,365 @@
+/* coap_submit.c -- Submitting work to a context from other threads
+*
+* Copyright (C) 2021 The libcoap project
+*
+* This file is part of the CoAP library libcoap. Please see
+* README for terms of use.
+*/
+
+#include "coap2/coap_internal.h"
+
+#if COAP_SUBMIT_QUEUE
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif /* HAVE_SYS_EVENTFD_H */
+#ifdef COAP_EPOLL_SUPPORT
+#include <sys/epoll.h>
+#endif /* COAP_EPOLL_SUPPORT */
+
+struct coap_submit_queue_t {
+  coap_submit_t *head;          /* newest call first, only updated
+                                   atomically */
+  int wake_fd;                  /* eventfd, or write end of the pipe */
+  coap_socket_t wakeup;         /* eventfd, or read end of the pipe */
+  coap_context_t *context;
+};
+
+static void
+coap_submit_delete_queue(coap_submit_queue_t *queue) {
+#ifdef COAP_EPOLL_SUPPORT
+  if (queue->wakeup.fd != COAP_INVALID_SOCKET) {
+    struct epoll_event event;
+
+    /* Kernels prior to 2.6.9 expect non NULL event parameter */
+    if (epoll_ctl(queue->context->epfd, EPOLL_CTL_DEL, queue->wakeup.fd,
+                  &event) == -1)
+      coap_log(LOG_ERR, "%s: epoll_ctl DEL failed: %s (%d)\n",
+               "coap_submit_delete_queue", coap_socket_strerror(), errno);
+  }
+#endif /* COAP_EPOLL_SUPPORT */
+  if (queue->wake_fd != -1 && queue->wake_fd != queue->wakeup.fd)
+    close(queue->wake_fd);
+  if (queue->wakeup.fd != COAP_INVALID_SOCKET)
+    close(queue->wakeup.fd);
+  coap_free(queue);
+}
+
+static coap_submit_queue_t *
+coap_submit_new_queue(coap_context_t *context) {
+  coap_submit_queue_t *queue;
+
+  queue = coap_malloc(sizeof(coap_submit_queue_t));
+  if (!queue)
+    return NULL;
+  memset(queue, 0, sizeof(coap_submit_queue_t));
+  queue->context = context;
+  queue->wake_fd = -1;
+  queue->wakeup.fd = COAP_INVALID_SOCKET;
+
+#ifdef HAVE_SYS_EVENTFD_H
+  queue->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (queue->wakeup.fd == -1) {
+    coap_log(LOG_ERR, "coap_context_set_submit_queue: eventfd: %s\n",
+             coap_socket_strerror());
+    goto error;
+  }
+  queue->wake_fd = queue->wakeup.fd;
+#else /* ! HAVE_SYS_EVENTFD_H */
+  {
+    int fds[2];
+
+    if (pipe(fds) == -1) {
+      coap_log(LOG_ERR, "coap_context_set_submit_queue: pipe: %s\n",
+               coap_socket_strerror());
+      goto error;
+    }
+    queue->wakeup.fd = fds[0];
+    queue->wake_fd = fds[1];
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1) {
+      coap_log(LOG_ERR, "coap_context_set_submit_queue: fcntl: %s\n",
+               coap_socket_strerror());
+      goto error;
+    }
+  }
+#endif /* ! HAVE_SYS_EVENTFD_H */
+  queue->wakeup.flags = COAP_SOCKET_WANT_READ;
+#ifdef COAP_EPOLL_SUPPORT
+  {
+    struct epoll_event event;
+
+    /* Needed if running 32bit as ptr is only 32bit */
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    /* Neither an endpoint nor a session socket */
+    event.data.ptr = &queue->wakeup;
+    if (epoll_ctl(context->epfd, EPOLL_CTL_ADD, queue->wakeup.fd,
+                  &event) == -1) {
+      coap_log(LOG_ERR, "%s: epoll_ctl ADD failed: %s (%d)\n",
+               "coap_context_set_submit_queue",
+               coap_socket_strerror(), errno);
+      if (queue->wake_fd == queue->wakeup.fd)
+        queue->wake_fd = -1;
+      close(queue->wakeup.fd);
+      queue->wakeup.fd = COAP_INVALID_SOCKET;
+      goto error;
+    }
+  }
+#endif /* COAP_EPOLL_SUPPORT */
+  return queue;
+
+error:
+  coap_submit_delete_queue(queue);
+  return NULL;
+}
+
+/*
+ * Takes the calls that have been submitted, oldest first.  A pending wake
+ * up is cleared before the calls are taken, so that a call pushed onto the
+ * empty queue afterwards wakes up the I/O thread again.
+ */
+static coap_submit_t *
+coap_submit_take(coap_submit_queue_t *queue) {
+  coap_submit_t *call, *next, *list = NULL;
+  uint8_t drain[16];
+
+  if (queue->wakeup.flags & COAP_SOCKET_CAN_READ) {
+    while (read(queue->wakeup.fd, drain, sizeof(drain)) > 0)
+      ;
+    queue->wakeup.flags &= ~COAP_SOCKET_CAN_READ;
+  }
+
+  call = __atomic_exchange_n(&queue->head, NULL, __ATOMIC_ACQUIRE);
+  while (call) {
+    next = call->next;
+    call->next = list;
+    list = call;
+    call = next;
+  }
+  return list;
+}
+
+static void
+coap_submit_discard(coap_submit_t *call) {
+  coap_delete_pdu(call->pdu);
+  coap_delete_string(call->query);
+  coap_free(call);
+}
+
+static void
+coap_submit_run(coap_submit_t *call) {
+  switch (call->type) {
+  case COAP_SUBMIT_SEND:
+    if (call->pdu->type == COAP_MESSAGE_CON ||
+        call->pdu->type == COAP_MESSAGE_NON)
+      call->pdu->mid = coap_new_message_id(call->session);
+    coap_send(call->session, call->pdu);
+    call->pdu = NULL;
+    break;
+  case COAP_SUBMIT_NOTIFY:
+    coap_resource_notify_observers(call->resource, call->query);
+    break;
+  case COAP_SUBMIT_RELEASE:
+    coap_session_release(call->session);
+    break;
+  default:
+    break;
+  }
+  coap_submit_discard(call);
+}
+
+/*
+ * Pushes call onto the queue of context.  This is the only part that runs on
+ * the submitting threads.
+ */
+static int
+coap_submit_push(coap_context_t *context, coap_submit_t *call) {
+  coap_submit_queue_t *queue = context ? context->submit_queue : NULL;
+  coap_submit_t *head;
+
+  if (!queue) {
+    coap_log(LOG_WARNING, "coap_submit: context has no submit queue\n");
+    coap_submit_discard(call);
+    return 0;
+  }
+  head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+  do {
+    call->next = head;
+  } while (!__atomic_compare_exchange_n(&queue->head, &head, call, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  if (!head) {
+    /* The I/O thread may be waiting for the queue to fill */
+#ifdef HAVE_SYS_EVENTFD_H
+    static const uint64_t wake = 1;
+#else /* ! HAVE_SYS_EVENTFD_H */
+    static const uint8_t wake = 1;
+#endif /* ! HAVE_SYS_EVENTFD_H */
+
+    /* A full pipe is already readable, so the result does not matter */
+    if (write(queue->wake_fd, &wake, sizeof(wake)) == -1) {
+      /* do nothing */;
+    }
+  }
+  return 1;
+}
+
+static coap_submit_t *
+coap_submit_new(coap_submit_type_t type) {
+  coap_submit_t *call = coap_malloc(sizeof(coap_submit_t));
+
+  if (call) {
+    memset(call, 0, sizeof(coap_submit_t));
+    call->type = type;
+  }
+  return call;
+}
+
+int
+coap_context_set_submit_queue(coap_context_t *context, int enable) {
+  coap_submit_queue_t *queue = context->submit_queue;
+
+  if (enable && !queue) {
+    context->submit_queue = coap_submit_new_queue(context);
+    return context->submit_queue != NULL;
+  }
+  if (!enable && queue) {
+    coap_submit_process(context);
+    coap_submit_delete_queue(queue);
+    context->submit_queue = NULL;
+  }
+  return 1;
+}
+
+int
+coap_submit_send(coap_session_t *session, coap_pdu_t *pdu) {
+  coap_submit_t *call = coap_submit_new(COAP_SUBMIT_SEND);
+
+  if (!call) {
+    coap_delete_pdu(pdu);
+    return 0;
+  }
+  call->session = session;
+  call->pdu = pdu;
+  return coap_submit_push(session->context, call);
+}
+
+int
+coap_submit_notify_observers(coap_resource_t *resource,
+                             const coap_string_t *query) {
+  coap_submit_t *call = coap_submit_new(COAP_SUBMIT_NOTIFY);
+
+  if (!call)
+    return 0;
+  call->resource = resource;
+  if (query) {
+    call->query = coap_new_string(query->length);
+    if (!call->query) {
+      coap_submit_discard(call);
+      return 0;
+    }
+    memcpy(call->query->s, query->s, query->length);
+  }
+  return coap_submit_push(resource->context, call);
+}
+
+int
+coap_submit_session_release(coap_session_t *session) {
+  coap_submit_t *call = coap_submit_new(COAP_SUBMIT_RELEASE);
+
+  if (!call)
+    return 0;
+  call->session = session;
+  return coap_submit_push(session->context, call);
+}
+
+void
+coap_submit_process(coap_context_t *context) {
+  coap_submit_t *call, *next;
+
+  if (!context->submit_queue)
+    return;
+  for (call = coap_submit_take(context->submit_queue); call; call = next) {
+    next = call->next;
+    coap_submit_run(call);
+  }
+}
+
+coap_socket_t *
+coap_submit_socket(coap_context_t *context) {
+  return context->submit_queue ? &context->submit_queue->wakeup : NULL;
+}
+
+void
+coap_submit_free_queue(coap_context_t *context) {
+  coap_submit_t *call, *next;
+
+  if (!context->submit_queue)
+    return;
+  /* The sessions and resources are about to go, along with the references
+     held to them */
+  for (call = coap_submit_take(context->submit_queue); call; call = next) {
+    next = call->next;
+    coap_submit_discard(call);
+  }
+  coap_submit_delete_queue(context->submit_queue);
+  context->submit_queue = NULL;
+}
+
+#else /* ! COAP_SUBMIT_QUEUE */
+
+int
+coap_context_set_submit_queue(coap_context_t *context, int enable) {
+  (void)context;
+  if (enable) {
+    coap_log(LOG_WARNING, "coap_context_set_submit_queue: not supported\n");
+    return 0;
+  }
+  return 1;
+}
+
+int
+coap_submit_send(coap_session_t *session, coap_pdu_t *pdu) {
+  (void)session;
+  coap_delete_pdu(pdu);
+  return 0;
+}
+
+int
+coap_submit_notify_observers(coap_resource_t *resource,
+                             const coap_string_t *query) {
+  (void)resource;
+  (void)query;
+  return 0;
+}
+
+int
+coap_submit_session_release(coap_session_t *session) {
+  (void)session;
+  return 0;
+}
+
+void
+coap_submit_process(coap_context_t *context) {
+  (void)context;
+}
+
+coap_socket_t *
+coap_submit_socket(coap_context_t *context) {
+  (void)context;
+  return NULL;
+}
+
+void
+coap_submit_free_queue(coap_context_t *context) {
+  (void)context;
+}
+
+#endif /* ! COAP_SUBMIT_QUEUE */
+
+int
+coap_context_get_submit_queue(const coap_context_t *context) {
+  return context->submit_queue != NULL;
+}
@@ -7,6 +7,11 @@
  * of use.
  */
 
+/* accept4() is a GNU extension */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
 #include "coap2/coap_internal.h"
 
 #include <errno.h>
@@ -16,6 +21,9 @@
 # define OPTVAL_T(t)         (t)
 # define OPTVAL_GT(t)        (t)
 #endif
+#ifdef HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
 #ifdef HAVE_SYS_IOCTL_H
  #include <sys/ioctl.h>
 #endif
@@ -262,7 +270,7 @@ coap_socket_bind_tcp(coap_socket_t *sock,
     goto error;
   }
 
-  if (listen(sock->fd, 5) == COAP_SOCKET_ERROR) {
+  if (listen(sock->fd, COAP_TCP_LISTEN_BACKLOG) == COAP_SOCKET_ERROR) {
     coap_log(LOG_ALERT, "coap_socket_bind_tcp: listen: %s\n",
              coap_socket_strerror());
     goto  error;
@@ -275,34 +283,63 @@ error:
   return 0;
 }
 
+void
+coap_socket_defer_accept_tcp(coap_socket_t *sock, int seconds) {
+#ifdef TCP_DEFER_ACCEPT
+  if (setsockopt(sock->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, OPTVAL_T(&seconds),
+                 sizeof(seconds)) == COAP_SOCKET_ERROR)
+    coap_log(LOG_WARNING,
+             "coap_socket_defer_accept_tcp: setsockopt TCP_DEFER_ACCEPT: %s\n",
+             coap_socket_strerror());
+#else /* ! TCP_DEFER_ACCEPT */
+  (void)sock;
+  (void)seconds;
+#endif /* ! TCP_DEFER_ACCEPT */
+}
+
 int
 coap_socket_accept_tcp(coap_socket_t *server,
                        coap_socket_t *new_client,
                        coap_address_t *local_addr,
                        coap_address_t *remote_addr) {
-#ifndef RIOT_VERSION
+#if !defined(RIOT_VERSION) && !(defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK))
 #ifdef _WIN32
   u_long u_on = 1;
 #else
   int on = 1;
 #endif
-#endif /* RIOT_VERSION */
+#endif /* ! RIOT_VERSION && ! (HAVE_ACCEPT4 && SOCK_NONBLOCK) */
 
   server->flags &= ~COAP_SOCKET_CAN_ACCEPT;
 
+#if defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK)
+  /* The new socket comes out non-blocking, saving an ioctl() */
+  new_client->fd = accept4(server->fd, &remote_addr->addr.sa,
+                           &remote_addr->size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else /* ! (HAVE_ACCEPT4 && SOCK_NONBLOCK) */
   new_client->fd = accept(server->fd, &remote_addr->addr.sa,
                           &remote_addr->size);
+#endif /* ! (HAVE_ACCEPT4 && SOCK_NONBLOCK) */
   if (new_client->fd == COAP_INVALID_SOCKET) {
-    coap_log(LOG_WARNING, "coap_socket_accept_tcp: accept: %s\n",
-             coap_socket_strerror());
+#ifdef _WIN32
+    if (WSAGetLastError() != WSAEWOULDBLOCK)
+#elif EAGAIN != EWOULDBLOCK
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+#else
+    if (errno != EAGAIN && errno != EINTR)
+#endif
+      coap_log(LOG_WARNING, "coap_socket_accept_tcp: accept: %s\n",
+               coap_socket_strerror());
     return 0;
   }
 
-  if (getsockname( new_client->fd, &local_addr->addr.sa, &local_addr->size) < 0)
+  /* Only needed if the listening socket is not bound to a single address */
+  if (local_addr &&
+      getsockname( new_client->fd, &local_addr->addr.sa, &local_addr->size) < 0)
     coap_log(LOG_WARNING, "coap_socket_accept_tcp: getsockname: %s\n",
              coap_socket_strerror());
 
-#ifndef RIOT_VERSION
+#if !defined(RIOT_VERSION) && !(defined(HAVE_ACCEPT4) && defined(SOCK_NONBLOCK))
   #ifdef _WIN32
   if (ioctlsocket(new_client->fd, FIONBIO, &u_on) == COAP_SOCKET_ERROR) {
 #else
@@ -311,7 +348,7 @@ coap_socket_accept_tcp(coap_socket_t *server,
     coap_log(LOG_WARNING, "coap_socket_accept_tcp: ioctl FIONBIO: %s\n",
              coap_socket_strerror());
   }
-#endif /* RIOT_VERSION */
+#endif /* ! RIOT_VERSION && ! (HAVE_ACCEPT4 && SOCK_NONBLOCK) */
   return 1;
 }
 #endif /* !COAP_DISABLE_TCP */
@@ -210,10 +210,11 @@ get_psk_info(struct dtls_context_t *dtls_context,
   case DTLS_PSK_IDENTITY:
 
     if (!coap_context || !coap_context->get_client_psk ||
-        coap_session->type != COAP_SESSION_TYPE_CLIENT)
+        coap_session->type != COAP_SESSION_TYPE_CLIENT ||
+        !coap_session->psk)
       goto error;
 
-    setup_cdata = &coap_session->cpsk_setup_data;
+    setup_cdata = &coap_session->psk->cpsk_setup_data;
 
     temp.s = id;
     temp.length = id_len;
@@ -237,11 +238,8 @@ get_psk_info(struct dtls_context_t *dtls_context,
       if (psk_info->key.length > sizeof(psk))
         return 0;
 
-      if (coap_session->psk_identity) {
-        coap_delete_bin_const(coap_session->psk_identity);
-      }
       identity_length = psk_info->identity.length;
-      coap_session->psk_identity = coap_new_bin_const(psk_info->identity.s, identity_length);
+      coap_session_refresh_psk_identity(coap_session, &psk_info->identity);
       memcpy(result, psk_info->identity.s, identity_length);
       result[identity_length] = '\000';
 
@@ -281,9 +279,9 @@ get_psk_info(struct dtls_context_t *dtls_context,
         id = (const uint8_t *)"";
 
       /* Track the Identity being used */
-      if (coap_session->psk_identity)
-        coap_delete_bin_const(coap_session->psk_identity);
-      coap_session->psk_identity = coap_new_bin_const(id, id_len);
+      temp.s = id;
+      temp.length = id_len;
+      coap_session_refresh_psk_identity(coap_session, &temp);
 
       coap_log(LOG_DEBUG, "got psk_identity: '%.*s'\n",
                (int)id_len, id);
@@ -633,6 +631,24 @@ coap_dtls_receive(coap_session_t *session,
   return err;
 }
 
+int
+coap_dtls_hello_needs_cookie(void) {
+  /* TinyDTLS does its own stateless cookie exchange */
+  return 0;
+}
+
+int
+coap_dtls_can_offload_handshake(void) {
+  /* The TinyDTLS context is shared by all the sessions */
+  return 0;
+}
+
+coap_binary_t *
+coap_dtls_get_resume_state(coap_session_t *session COAP_UNUSED) {
+  /* TinyDTLS does not support session resumption */
+  return NULL;
+}
+
 int
 coap_dtls_hello(coap_session_t *session,
   const uint8_t *data,
@@ -665,6 +681,23 @@ unsigned int coap_dtls_get_overhead(coap_session_t *session) {
   return 13 + 8 + 8;
 }
 
+int
+coap_dtls_can_hibernate(void) {
+  /* The TinyDTLS peers are kept in the shared context */
+  return 0;
+}
+
+coap_binary_t *
+coap_dtls_hibernate(coap_session_t *session COAP_UNUSED) {
+  return NULL;
+}
+
+void *
+coap_dtls_rehydrate(coap_session_t *session COAP_UNUSED,
+                    const coap_binary_t *state COAP_UNUSED) {
+  return NULL;
+}
+
 int coap_tls_is_supported(void) {
   return 0;
 }
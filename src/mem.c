@@ -137,6 +137,58 @@
 #define COAP_MAX_SESSIONS           (COAP_MAX_ENDPOINTS)
 #endif /* COAP_MAX_CONTEXTS */
 
+/**
+ * The maximum number of sessions with reliable transport state (TCP or TLS)
+ * on platforms that allocate fixed-size memory blocks. Default is 2.
+ */
+#ifndef COAP_MAX_TCP_SESSIONS
+#define COAP_MAX_TCP_SESSIONS       (2U)
+#endif /* COAP_MAX_TCP_SESSIONS */
+
+/**
+ * The maximum number of sessions with pre-shared key state on platforms
+ * that allocate fixed-size memory blocks. Default is
+ * #COAP_MAX_DTLS_SESSIONS.
+ */
+#ifndef COAP_MAX_PSK_SESSIONS
+#define COAP_MAX_PSK_SESSIONS       (COAP_MAX_DTLS_SESSIONS)
+#endif /* COAP_MAX_PSK_SESSIONS */
+
+/**
+ * The maximum number of server sessions with a DTLS Connection ID on
+ * platforms that allocate fixed-size memory blocks. Default is
+ * #COAP_MAX_DTLS_SESSIONS.
+ */
+#ifndef COAP_MAX_CID_SESSIONS
+#define COAP_MAX_CID_SESSIONS       (COAP_MAX_DTLS_SESSIONS)
+#endif /* COAP_MAX_CID_SESSIONS */
+
+/**
+ * The maximum number of sessions estimating their retransmission timeout
+ * using CoCoA on platforms that allocate fixed-size memory blocks. Default
+ * is 2.
+ */
+#ifndef COAP_MAX_COCOA_SESSIONS
+#define COAP_MAX_COCOA_SESSIONS     (2U)
+#endif /* COAP_MAX_COCOA_SESSIONS */
+
+/**
+ * The maximum number of sessions with (D)TLS client credentials on
+ * platforms that allocate fixed-size memory blocks. Default is
+ * #COAP_MAX_DTLS_SESSIONS.
+ */
+#ifndef COAP_MAX_SECURE_SESSIONS
+#define COAP_MAX_SECURE_SESSIONS    (COAP_MAX_DTLS_SESSIONS)
+#endif /* COAP_MAX_SECURE_SESSIONS */
+
+/**
+ * The maximum number of sessions with forward proxy state on platforms
+ * that allocate fixed-size memory blocks. Default is 2.
+ */
+#ifndef COAP_MAX_PROXY_SESSIONS
+#define COAP_MAX_PROXY_SESSIONS     (2U)
+#endif /* COAP_MAX_PROXY_SESSIONS */
+
 /**
  * The maximum number of optlist entries on platforms that allocate
  * fixed-size memory blocks.
@@ -169,6 +221,14 @@
 #define COAP_MAX_CACHE_ENTRIES        (2U)
 #endif /* COAP_MAX_CACHE_ENTRIES */
 
+/**
+ * The maximum number of Message-ID deduplication entries that allocate
+ * fixed-size memory blocks.
+ */
+#ifndef COAP_MAX_MID_CACHE
+#define COAP_MAX_MID_CACHE        (2U)
+#endif /* COAP_MAX_MID_CACHE */
+
 /* The memstr is the storage for holding coap_string_t structure
  * together with its contents. */
 union memstr_t {
@@ -229,6 +289,24 @@ static memarray_t dtls_storage;
 static coap_session_t session_storage_data[COAP_MAX_SESSIONS];
 static memarray_t session_storage;
 
+static coap_session_tcp_t session_tcp_storage_data[COAP_MAX_TCP_SESSIONS];
+static memarray_t session_tcp_storage;
+
+static coap_session_psk_t session_psk_storage_data[COAP_MAX_PSK_SESSIONS];
+static memarray_t session_psk_storage;
+
+static coap_session_cid_t session_cid_storage_data[COAP_MAX_CID_SESSIONS];
+static memarray_t session_cid_storage;
+
+static coap_session_cocoa_t session_cocoa_storage_data[COAP_MAX_COCOA_SESSIONS];
+static memarray_t session_cocoa_storage;
+
+static coap_session_secure_t session_secure_storage_data[COAP_MAX_SECURE_SESSIONS];
+static memarray_t session_secure_storage;
+
+static coap_session_proxy_t session_proxy_storage_data[COAP_MAX_PROXY_SESSIONS];
+static memarray_t session_proxy_storage;
+
 /* The optbuf_t is the storage for holding optlist nodes. */
 struct optbuf_t {
   coap_optlist_t optlist;
@@ -243,6 +321,9 @@ static memarray_t cache_key_storage;
 static coap_cache_entry_t cache_entry_storage_data[COAP_MAX_CACHE_ENTRIES];
 static memarray_t cache_entry_storage;
 
+static coap_mid_cache_t mid_cache_storage_data[COAP_MAX_MID_CACHE];
+static memarray_t mid_cache_storage;
+
 #define INIT_STORAGE(Storage, Count)  \
   memarray_init(&(Storage ## _storage), (Storage ## _storage_data), sizeof(Storage ## _storage_data[0]), (Count));
 
@@ -264,9 +345,16 @@ coap_memory_init(void) {
   INIT_STORAGE(dtls, COAP_MAX_DTLS_SESSIONS);
 #endif
   INIT_STORAGE(session, COAP_MAX_SESSIONS);
+  INIT_STORAGE(session_tcp, COAP_MAX_TCP_SESSIONS);
+  INIT_STORAGE(session_psk, COAP_MAX_PSK_SESSIONS);
+  INIT_STORAGE(session_cid, COAP_MAX_CID_SESSIONS);
+  INIT_STORAGE(session_cocoa, COAP_MAX_COCOA_SESSIONS);
+  INIT_STORAGE(session_secure, COAP_MAX_SECURE_SESSIONS);
+  INIT_STORAGE(session_proxy, COAP_MAX_PROXY_SESSIONS);
   INIT_STORAGE(option, COAP_MAX_OPTIONS);
   INIT_STORAGE(cache_key, COAP_MAX_CACHE_KEYS);
   INIT_STORAGE(cache_entry, COAP_MAX_CACHE_ENTRIES);
+  INIT_STORAGE(mid_cache, COAP_MAX_MID_CACHE);
 }
 
 static memarray_t *
@@ -287,9 +375,16 @@ get_container(coap_memory_tag_t type) {
   case COAP_DTLS_SESSION:    return &dtls_storage;
 #endif
   case COAP_SESSION:         return &session_storage;
+  case COAP_SESSION_TCP:     return &session_tcp_storage;
+  case COAP_SESSION_PSK:     return &session_psk_storage;
+  case COAP_SESSION_CID:     return &session_cid_storage;
+  case COAP_SESSION_COCOA:   return &session_cocoa_storage;
+  case COAP_SESSION_SECURE:  return &session_secure_storage;
+  case COAP_SESSION_PROXY:   return &session_proxy_storage;
   case COAP_OPTLIST:         return &option_storage;
   case COAP_CACHE_KEY:       return &cache_key_storage;
   case COAP_CACHE_ENTRY:     return &cache_key_entry;
+  case COAP_MID_CACHE:       return &mid_cache_storage;
   case COAP_STRING:
     /* fall through */
   default:
@@ -399,6 +494,14 @@ MEMB(cache_entry_storage, coap_cache_entry_t, COAP_MAX_CACHE_ENTRIES);
 MEMB(lg_xmit_storage, coap_lg_xmit_t, COAP_MAX_LG_XMIT);
 MEMB(lg_crcv_storage, coap_lg_crcv_t, COAP_MAX_LG_CRCV);
 MEMB(lg_srcv_storage, coap_lg_srcv_t, COAP_MAX_LG_SRCV);
+MEMB(lg_body_storage, coap_lg_body_t, COAP_MAX_LG_BODY);
+MEMB(session_tcp_storage, coap_session_tcp_t, COAP_MAX_SESSIONS);
+MEMB(session_psk_storage, coap_session_psk_t, COAP_MAX_SESSIONS);
+MEMB(session_cid_storage, coap_session_cid_t, COAP_MAX_SESSIONS);
+MEMB(session_cocoa_storage, coap_session_cocoa_t, COAP_MAX_SESSIONS);
+MEMB(session_secure_storage, coap_session_secure_t, COAP_MAX_SESSIONS);
+MEMB(session_proxy_storage, coap_session_proxy_t, COAP_MAX_SESSIONS);
+MEMB(mid_cache_storage, coap_mid_cache_t, COAP_MAX_MID_CACHE);
 
 static struct memb *
 get_container(coap_memory_tag_t type) {
@@ -415,6 +518,14 @@ get_container(coap_memory_tag_t type) {
   case COAP_LG_XMIT: return &lg_xmit_storage;
   case COAP_LG_CRCV: return &lg_crcv_storage;
   case COAP_LG_SRCV: return &lg_srcv_storage;
+  case COAP_LG_BODY: return &lg_body_storage;
+  case COAP_SESSION_TCP: return &session_tcp_storage;
+  case COAP_SESSION_PSK: return &session_psk_storage;
+  case COAP_SESSION_CID: return &session_cid_storage;
+  case COAP_SESSION_COCOA: return &session_cocoa_storage;
+  case COAP_SESSION_SECURE: return &session_secure_storage;
+  case COAP_SESSION_PROXY: return &session_proxy_storage;
+  case COAP_MID_CACHE: return &mid_cache_storage;
   default:
     return &string_storage;
   }
@@ -435,6 +546,14 @@ coap_memory_init(void) {
   memb_init(&lg_xmit_storage);
   memb_init(&lg_crcv_storage);
   memb_init(&lg_srcv_storage);
+  memb_init(&lg_body_storage);
+  memb_init(&session_tcp_storage);
+  memb_init(&session_psk_storage);
+  memb_init(&session_cid_storage);
+  memb_init(&session_cocoa_storage);
+  memb_init(&session_secure_storage);
+  memb_init(&session_proxy_storage);
+  memb_init(&mid_cache_storage);
 }
 
 void *
@@ -300,19 +300,25 @@ coap_get_session_client_psk(
   uint8_t *psk, size_t max_psk_len
 ) {
   const coap_dtls_cpsk_info_t *psk_info;
+  const coap_session_psk_t *spsk = session->psk;
   (void)hint;
   (void)hint_len;
 
-  if (session->psk_identity && session->psk_key) {
-    if (session->psk_identity->length <= max_identity_len &&
-        session->psk_key->length <= max_psk_len) {
-      memcpy(identity, session->psk_identity->s, session->psk_identity->length);
-      memcpy(psk, session->psk_key->s, session->psk_key->length);
-      *identity_len = session->psk_identity->length;
-      return session->psk_key->length;
+  if (!spsk) {
+    /* Not set up by coap_new_client_session_psk2() */
+    *identity_len = 0;
+    return 0;
+  }
+  if (spsk->psk_identity && spsk->psk_key) {
+    if (spsk->psk_identity->length <= max_identity_len &&
+        spsk->psk_key->length <= max_psk_len) {
+      memcpy(identity, spsk->psk_identity->s, spsk->psk_identity->length);
+      memcpy(psk, spsk->psk_key->s, spsk->psk_key->length);
+      *identity_len = spsk->psk_identity->length;
+      return spsk->psk_key->length;
     }
   }
-  psk_info = &session->cpsk_setup_data.psk_info;
+  psk_info = &spsk->cpsk_setup_data.psk_info;
   if (psk_info->identity.s && psk_info->identity.length > 0 &&
       psk_info->key.s && psk_info->key.length > 0) {
     if (psk_info->identity.length <= max_identity_len &&
@@ -341,10 +347,10 @@ coap_get_context_server_psk(
   if (!session)
     return 0;
 
-  if (session->psk_key &&
-      session->psk_key->length <= max_psk_len) {
-    memcpy(psk, session->psk_key->s, session->psk_key->length);
-    return session->psk_key->length;
+  if (session->psk && session->psk->psk_key &&
+      session->psk->psk_key->length <= max_psk_len) {
+    memcpy(psk, session->psk->psk_key->s, session->psk->psk_key->length);
+    return session->psk->psk_key->length;
   }
   psk_info = &session->context->spsk_setup_data.psk_info;
   if (psk_info->key.s && psk_info->key.length > 0 &&
@@ -366,11 +372,11 @@ coap_get_context_server_hint(
   if (!session)
     return 0;
 
-  if (session->psk_hint &&
-      session->psk_hint->s && session->psk_hint->length > 0 &&
-      session->psk_hint->length <= max_hint_len) {
-    memcpy(hint, session->psk_hint->s, session->psk_hint->length);
-    return session->psk_hint->length;
+  if (session->psk && session->psk->psk_hint &&
+      session->psk->psk_hint->s && session->psk->psk_hint->length > 0 &&
+      session->psk->psk_hint->length <= max_hint_len) {
+    memcpy(hint, session->psk->psk_hint->s, session->psk->psk_hint->length);
+    return session->psk->psk_hint->length;
   }
   psk_info = &session->context->spsk_setup_data.psk_info;
   if (psk_info->hint.s &&
@@ -468,6 +474,69 @@ coap_context_get_max_handshake_sessions(const coap_context_t *context) {
   return context->max_handshake_sessions;
 }
 
+int
+coap_context_set_hibernate_timeout(coap_context_t *context,
+                                   unsigned int hibernate_timeout) {
+  if (hibernate_timeout && !coap_dtls_can_hibernate()) {
+    coap_log(LOG_WARNING, "coap_context_set_hibernate_timeout: "
+             "not supported by the (D)TLS library\n");
+    return 0;
+  }
+  context->hibernate_timeout = hibernate_timeout;
+  return 1;
+}
+
+unsigned int
+coap_context_get_hibernate_timeout(const coap_context_t *context) {
+  return context->hibernate_timeout;
+}
+
+void
+coap_context_set_stateless_udp(coap_context_t *context, int stateless_udp) {
+  context->stateless_udp = stateless_udp ? 1 : 0;
+}
+
+int
+coap_context_get_stateless_udp(const coap_context_t *context) {
+  return context->stateless_udp;
+}
+
+void
+coap_context_set_cocoa(coap_context_t *context, int cocoa) {
+  context->cocoa = cocoa ? 1 : 0;
+}
+
+int
+coap_context_get_cocoa(const coap_context_t *context) {
+  return context->cocoa;
+}
+
+void
+coap_context_set_cork(coap_context_t *context, int cork) {
+  context->cork = cork ? 1 : 0;
+  if (!context->cork) {
+    coap_endpoint_t *ep;
+    coap_session_t *s, *rtmp;
+    coap_tick_t now;
+
+    /* Write out what has been held back */
+    coap_ticks(&now);
+    LL_FOREACH(context->endpoint, ep) {
+      SESSIONS_ITER(ep->sessions, s, rtmp) {
+        coap_session_flush(s, now);
+      }
+    }
+    SESSIONS_ITER(context->sessions, s, rtmp) {
+      coap_session_flush(s, now);
+    }
+  }
+}
+
+int
+coap_context_get_cork(const coap_context_t *context) {
+  return context->cork;
+}
+
 void
 coap_context_set_csm_timeout(coap_context_t *context,
                              unsigned int csm_timeout) {
@@ -580,6 +649,9 @@ coap_new_context(
   /* set default CSM timeout */
   c->csm_timeout = 30;
 
+  /* set default Message-ID deduplication cache size */
+  c->max_mid_cache_size = COAP_DEFAULT_MID_CACHE_SIZE;
+
   if (listen_addr) {
     coap_endpoint_t *endpoint = coap_new_endpoint(c, listen_addr, COAP_PROTO_UDP);
     if (endpoint == NULL) {
@@ -634,9 +706,13 @@ coap_free_context(coap_context_t *context) {
   if (!context)
     return;
 
+  coap_submit_free_queue(context);
+
   /* Removing a resource may cause a CON observe to be sent */
   coap_delete_all_resources(context);
 
+  coap_proxy_free_all(context);
+
   coap_delete_all(context->sendqueue);
 
 #ifdef WITH_LWIP
@@ -650,6 +726,9 @@ coap_free_context(coap_context_t *context) {
   HASH_ITER(hh, context->cache, cp, ctmp) {
     coap_delete_cache_entry(context, cp);
   }
+  HASH_ITER(hh, context->response_cache, cp, ctmp) {
+    coap_delete_cache_entry(context, cp);
+  }
   if (context->cache_ignore_count) {
     coap_free(context->cache_ignore_options);
   }
@@ -661,6 +740,9 @@ coap_free_context(coap_context_t *context) {
   SESSIONS_ITER_SAFE(context->sessions, sp, rtmp) {
     coap_session_release(sp);
   }
+  coap_context_free_tls_resume(context);
+  coap_handshake_free_pool(context);
+  coap_delete_pdu(context->rx_pdu);
 
   if (context->dtls_context)
     coap_dtls_free_context(context->dtls_context);
@@ -770,8 +852,9 @@ coap_session_send_pdu(coap_session_t *session, coap_pdu_t *pdu) {
                                         pdu->used_size + pdu->hdr_size);
       break;
     case COAP_PROTO_DTLS:
-      bytes_written = coap_dtls_send(session, pdu->token - pdu->hdr_size,
-                                     pdu->used_size + pdu->hdr_size);
+      if (coap_session_rehydrate(session))
+        bytes_written = coap_dtls_send(session, pdu->token - pdu->hdr_size,
+                                       pdu->used_size + pdu->hdr_size);
       break;
     case COAP_PROTO_TCP:
 #if !COAP_DISABLE_TCP
@@ -839,7 +922,7 @@ coap_send_pdu(coap_session_t *session, coap_pdu_t *pdu, coap_queue_t *node) {
       }
       session->last_ping = 0;
       session->last_pong = 0;
-      session->csm_tx = 0;
+      session->tcp->csm_tx = 0;
       coap_ticks( &session->last_rx_tx );
       if ((session->sock.flags & COAP_SOCKET_WANT_CONNECT) != 0) {
         session->state = COAP_SESSION_STATE_CONNECTING;
@@ -877,8 +960,10 @@ coap_send_pdu(coap_session_t *session, coap_pdu_t *pdu, coap_queue_t *node) {
     return -1;
   }
 
+  /* A retransmission (node set) already holds its place in the window */
   if (session->state != COAP_SESSION_STATE_ESTABLISHED ||
-      (pdu->type == COAP_MESSAGE_CON && session->con_active >= COAP_DEFAULT_NSTART)) {
+      (pdu->type == COAP_MESSAGE_CON && !node &&
+       COAP_SESSION_CWND_FULL(session))) {
     return coap_session_delay_pdu(session, pdu, node);
   }
 
@@ -886,6 +971,11 @@ coap_send_pdu(coap_session_t *session, coap_pdu_t *pdu, coap_queue_t *node) {
     (session->sock.flags & COAP_SOCKET_WANT_WRITE))
     return coap_session_delay_pdu(session, pdu, node);
 
+  /* Keep behind what is waiting to be written, and hold back while corked */
+  if (COAP_PROTO_RELIABLE(session->proto) &&
+      (session->delayqueue || session->context->cork))
+    return coap_session_delay_pdu(session, pdu, node);
+
   bytes_written = coap_session_send_pdu(session, pdu);
   if (bytes_written >= 0 && pdu->type == COAP_MESSAGE_CON &&
       COAP_PROTO_NOT_RELIABLE(session->proto))
@@ -927,6 +1017,124 @@ coap_send_message_type(coap_session_t *session, coap_pdu_t *request, unsigned ch
   return result;
 }
 
+/* Upper limit for any CoCoA RTO estimate */
+#define COAP_COCOA_MAX_RTO (32 * COAP_TICKS_PER_SECOND)
+
+/* Returns the current CoCoA RTO of @p session in ticks */
+static unsigned int
+coap_session_base_rto(const coap_session_t *session) {
+  if (session->cocoa->rto)
+    return session->cocoa->rto;
+  return (unsigned int)(((uint64_t)session->ack_timeout.integer_part * 1000 +
+                         session->ack_timeout.fractional_part) *
+                        COAP_TICKS_PER_SECOND / 1000);
+}
+
+/*
+ * Returns the CoCoA initial timeout, which is the RTO dithered into
+ * [RTO, 1.5 * RTO].  An RTO that has not been updated for a while is
+ * first aged towards the default of draft-ietf-core-cocoa.
+ */
+static unsigned int
+coap_cocoa_timeout(coap_session_t *session, unsigned char r) {
+  coap_session_cocoa_t *cocoa = session->cocoa;
+  unsigned int rto = coap_session_base_rto(session);
+
+  if (cocoa->rto) {
+    coap_tick_t now;
+
+    coap_ticks(&now);
+    if (rto < COAP_TICKS_PER_SECOND &&
+        now - cocoa->rto_updated > (coap_tick_t)rto * 16) {
+      rto *= 2;
+      cocoa->rto = rto;
+      cocoa->rto_updated = now;
+    } else if (rto > 3 * COAP_TICKS_PER_SECOND &&
+               now - cocoa->rto_updated > (coap_tick_t)rto * 4) {
+      rto = COAP_TICKS_PER_SECOND + rto / 2;
+      cocoa->rto = rto;
+      cocoa->rto_updated = now;
+    }
+  }
+  return rto + (unsigned int)(((uint64_t)(rto / 2) * r) >> MAX_BITS);
+}
+
+/*
+ * Returns the CoCoA variable backoff factor, in halves, for an exchange
+ * with initial timeout @p timeout.
+ */
+static uint8_t
+coap_cocoa_backoff(unsigned int timeout) {
+  if (timeout < COAP_TICKS_PER_SECOND)
+    return 6;
+  if (timeout > 3 * COAP_TICKS_PER_SECOND)
+    return 3;
+  return 4;
+}
+
+/* Returns the time to wait for the current transmission of @p node */
+static coap_tick_t
+coap_retransmit_interval(const coap_queue_t *node) {
+  coap_tick_t t = node->timeout;
+  unsigned char i;
+
+  if (!node->backoff)
+    return (coap_tick_t)(node->timeout << node->retransmit_cnt);
+  for (i = 0; i < node->retransmit_cnt; i++)
+    t = t * node->backoff / 2;
+  return t;
+}
+
+static void
+coap_rtt_estimator_update(coap_rtt_estimator_t *est, unsigned int rtt,
+                          unsigned int k) {
+  if (est->srtt == 0) {
+    est->srtt = rtt;
+    est->rttvar = rtt / 2;
+  } else {
+    unsigned int delta = est->srtt > rtt ? est->srtt - rtt : rtt - est->srtt;
+
+    est->rttvar = (3 * est->rttvar + delta) / 4;
+    est->srtt = (7 * est->srtt + rtt) / 8;
+  }
+  est->rto = est->srtt + k * est->rttvar;
+  if (est->rto > COAP_COCOA_MAX_RTO)
+    est->rto = COAP_COCOA_MAX_RTO;
+}
+
+void
+coap_update_rtt_estimate(coap_session_t *session, const coap_queue_t *node,
+                         coap_tick_t now) {
+  coap_session_cocoa_t *cocoa = session->cocoa;
+  unsigned int rtt;
+  unsigned int rto;
+
+  if (!cocoa || node->retransmit_cnt > 2 || now < node->sent)
+    return;
+
+  rtt = now - node->sent >= COAP_COCOA_MAX_RTO ?
+                   COAP_COCOA_MAX_RTO : (unsigned int)(now - node->sent);
+  if (rtt == 0)
+    rtt = 1;
+  rto = coap_session_base_rto(session);
+  if (node->retransmit_cnt == 0) {
+    /* strong estimator, K = 4, weighted 1/2 into the overall RTO */
+    coap_rtt_estimator_update(&cocoa->rtt_strong, rtt, 4);
+    rto = (rto + cocoa->rtt_strong.rto) / 2;
+  } else {
+    /* weak estimator, K = 1, weighted 1/4 into the overall RTO */
+    coap_rtt_estimator_update(&cocoa->rtt_weak, rtt, 1);
+    rto = (3 * rto + cocoa->rtt_weak.rto) / 4;
+  }
+  cocoa->rto = rto ? rto : 1;
+  cocoa->rto_updated = now;
+  coap_log(LOG_DEBUG, "***%s: mid=0x%x: RTT %ums (%s), RTO now %ums\n",
+           coap_session_str(session), node->id,
+           (unsigned)((uint64_t)rtt * 1000 / COAP_TICKS_PER_SECOND),
+           node->retransmit_cnt ? "weak" : "strong",
+           (unsigned)((uint64_t)cocoa->rto * 1000 / COAP_TICKS_PER_SECOND));
+}
+
 /**
  * Calculates the initial timeout based on the session CoAP transmission
  * parameters 'ack_timeout', 'ack_random_factor', and COAP_TICKS_PER_SECOND.
@@ -944,6 +1152,9 @@ unsigned int
 coap_calc_timeout(coap_session_t *session, unsigned char r) {
   unsigned int result;
 
+  if (session->cocoa)
+    return coap_cocoa_timeout(session, r);
+
   /* The integer 1.0 as a Qx.FRAC_BITS */
 #define FP1 Q(FRAC_BITS, ((coap_fixed_point_t){1,0}))
 
@@ -982,13 +1193,17 @@ coap_wait_ack(coap_context_t *context, coap_session_t *session,
   * an adjusted relative time.
   */
   coap_ticks(&now);
+  if (node->retransmit_cnt == 0) {
+    node->sent = now;
+    node->backoff = session->cocoa ? coap_cocoa_backoff(node->timeout) : 0;
+  }
   if (context->sendqueue == NULL) {
-    node->t = node->timeout << node->retransmit_cnt;
+    node->t = coap_retransmit_interval(node);
     context->sendqueue_basetime = now;
   } else {
     /* make node->t relative to context->sendqueue_basetime */
     node->t = (now - context->sendqueue_basetime) +
-              (node->timeout << node->retransmit_cnt);
+              coap_retransmit_interval(node);
   }
 
   coap_insert_node(&context->sendqueue, node);
@@ -1054,6 +1269,7 @@ coap_mid_t
 coap_send_large(coap_session_t *session, coap_pdu_t *pdu) {
   coap_mid_t mid = COAP_INVALID_MID;
   coap_lg_crcv_t *lg_crcv = NULL;
+  coap_lg_crcv_t *ltmp;
   coap_opt_iterator_t opt_iter;
   int observe_action = -1;
   int have_block1 = 0;
@@ -1091,7 +1307,7 @@ coap_send_large(coap_session_t *session, coap_pdu_t *pdu) {
       ((pdu->type == COAP_MESSAGE_NON || COAP_PROTO_RELIABLE(session->proto)) &&
        COAP_PDU_IS_REQUEST(pdu) && pdu->code != COAP_REQUEST_CODE_DELETE)) {
     /* See if this token is already in use for large body responses */
-    LL_FOREACH(session->lg_crcv, lg_crcv) {
+    LG_CRCV_ITER(session->lg_crcv, lg_crcv, ltmp) {
       if (token_match(pdu->token, pdu->token_length,
                       lg_crcv->app_token->s, lg_crcv->app_token->length)) {
 
@@ -1099,18 +1315,18 @@ coap_send_large(coap_session_t *session, coap_pdu_t *pdu) {
           /* Need to update token to server's version */
           coap_update_token(pdu, lg_crcv->base_token_length,
                             lg_crcv->base_token);
+          /* de-reference lg_crcv as potentially linking in later */
+          LG_CRCV_DELETE(session->lg_crcv, lg_crcv);
           memcpy(lg_crcv->token, lg_crcv->base_token,
                  lg_crcv->base_token_length);
           lg_crcv->token_length = lg_crcv->base_token_length;
           lg_crcv->initial = 1;
           lg_crcv->observe_set = 0;
-          /* de-reference lg_crcv as potentially linking in later */
-          LL_DELETE(session->lg_crcv, lg_crcv);
           goto send_it;
         }
 
         /* Need to terminate and clean up previous response setup */
-        LL_DELETE(session->lg_crcv, lg_crcv);
+        LG_CRCV_DELETE(session->lg_crcv, lg_crcv);
         coap_block_delete_lg_crcv(session, lg_crcv);
         break;
       }
@@ -1121,16 +1337,17 @@ coap_send_large(coap_session_t *session, coap_pdu_t *pdu) {
       return COAP_INVALID_MID;
     if (have_block1 && session->lg_xmit) {
       coap_lg_xmit_t *lg_xmit;
+      coap_lg_xmit_t *q;
 
-      LL_FOREACH(session->lg_xmit, lg_xmit) {
+      LG_XMIT_ITER(session->lg_xmit, lg_xmit, q) {
         if (COAP_PDU_IS_REQUEST(&lg_xmit->pdu) &&
             lg_xmit->b.b1.app_token &&
             token_match(pdu->token, pdu->token_length,
                         lg_xmit->b.b1.app_token->s,
                         lg_xmit->b.b1.app_token->length)) {
-          /* Need to update the token as set up in the session->lg_xmit */
-          coap_update_token(pdu, session->lg_xmit->b.b1.token_length,
-                            session->lg_xmit->b.b1.token);
+          /* Need to update the token as set up in the lg_xmit */
+          coap_update_token(pdu, lg_xmit->b.b1.token_length,
+                            lg_xmit->b.b1.token);
           break;
         }
       }
@@ -1141,7 +1358,7 @@ send_it:
   mid = coap_send(session, pdu);
   if (lg_crcv) {
     if (mid != COAP_INVALID_MID) {
-      LL_PREPEND(session->lg_crcv, lg_crcv);
+      LG_CRCV_ADD(session->lg_crcv, lg_crcv);
     }
     else {
       coap_block_delete_lg_crcv(session, lg_crcv);
@@ -1300,7 +1517,10 @@ coap_send(coap_session_t *session, coap_pdu_t *pdu) {
   if (COAP_PROTO_RELIABLE(session->proto) &&
       (size_t)bytes_written < pdu->used_size + pdu->hdr_size) {
     if (coap_session_delay_pdu(session, pdu, NULL) == COAP_PDU_DELAYED) {
-      session->partial_write = (size_t)bytes_written;
+      session->tcp->partial_write = (size_t)bytes_written;
+      /* The (D)TLS library expects the same write again */
+      session->tcp->write_retry = bytes_written == 0 &&
+                                  session->proto == COAP_PROTO_TLS;
       /* do not free pdu as it is stored with session for later use */
       return pdu->mid;
     } else {
@@ -1312,6 +1532,8 @@ coap_send(coap_session_t *session, coap_pdu_t *pdu) {
   if (pdu->type != COAP_MESSAGE_CON
       || COAP_PROTO_RELIABLE(session->proto)) {
     coap_mid_t id = pdu->mid;
+    if (pdu->type == COAP_MESSAGE_ACK && session->mid_cache)
+      coap_mid_cache_set_response(session, pdu);
     coap_delete_pdu(pdu);
     return id;
   }
@@ -1344,13 +1566,15 @@ coap_retransmit(coap_context_t *context, coap_queue_t *node) {
     coap_tick_t now;
 
     node->retransmit_cnt++;
+    if (node->retransmit_cnt == 1)
+      coap_session_cwnd_loss(node->session);
     coap_ticks(&now);
     if (context->sendqueue == NULL) {
-      node->t = node->timeout << node->retransmit_cnt;
+      node->t = coap_retransmit_interval(node);
       context->sendqueue_basetime = now;
     } else {
       /* make node->t relative to context->sendqueue_basetime */
-      node->t = (now - context->sendqueue_basetime) + (node->timeout << node->retransmit_cnt);
+      node->t = (now - context->sendqueue_basetime) + coap_retransmit_interval(node);
     }
     coap_insert_node(&context->sendqueue, node);
 #ifdef WITH_LWIP
@@ -1410,8 +1634,8 @@ coap_retransmit(coap_context_t *context, coap_queue_t *node) {
  }
 
   /* And finally delete the node */
-  if (node->pdu->type == COAP_MESSAGE_CON && context->nack_handler)
-    context->nack_handler(context, node->session, node->pdu, COAP_NACK_TOO_MANY_RETRIES, node->id);
+  if (node->pdu->type == COAP_MESSAGE_CON)
+    coap_handle_nack(node->session, node->pdu, COAP_NACK_TOO_MANY_RETRIES, node->id);
   coap_delete_node(node);
   return COAP_INVALID_MID;
 }
@@ -1435,7 +1659,8 @@ coap_handle_dgram_for_proto(coap_context_t *ctx, coap_session_t *session, coap_p
   if (session->proto == COAP_PROTO_DTLS) {
     if (session->type == COAP_SESSION_TYPE_HELLO)
       result = coap_dtls_hello(session, data, data_len);
-    else if (session->tls)
+    else if ((session->tls || coap_session_is_hibernated(session)) &&
+             coap_session_rehydrate(session))
       result = coap_dtls_receive(session, data, data_len);
   } else if (session->proto == COAP_PROTO_UDP) {
     result = coap_handle_dgram(ctx, session, data, data_len);
@@ -1484,52 +1709,74 @@ static void
 coap_write_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now) {
   (void)ctx;
   assert(session->sock.flags & COAP_SOCKET_CONNECTED);
+  if (!session->tcp)
+    /* Only reliable sessions have partially written data to complete */
+    return;
+
+  coap_session_write_delayed(session, now);
+  coap_session_idle_update(session);
+}
 
-  while (session->delayqueue) {
-    ssize_t bytes_written;
-    coap_queue_t *q = session->delayqueue;
-    coap_log(LOG_DEBUG, "** %s: mid=0x%x: transmitted after delay\n",
-             coap_session_str(session), (int)q->pdu->mid);
-    assert(session->partial_write < q->pdu->used_size + q->pdu->hdr_size);
-    switch (session->proto) {
-      case COAP_PROTO_TCP:
-#if !COAP_DISABLE_TCP
-        bytes_written = coap_session_write(
-          session,
-          q->pdu->token - q->pdu->hdr_size - session->partial_write,
-          q->pdu->used_size + q->pdu->hdr_size - session->partial_write
-        );
-#endif /* !COAP_DISABLE_TCP */
-        break;
-      case COAP_PROTO_TLS:
 #if !COAP_DISABLE_TCP
-        bytes_written = coap_tls_write(
-          session,
-          q->pdu->token - q->pdu->hdr_size - session->partial_write,
-          q->pdu->used_size + q->pdu->hdr_size - session->partial_write
-        );
-#endif /* !COAP_DISABLE_TCP */
-        break;
-      case COAP_PROTO_NONE:
-      case COAP_PROTO_UDP:
-      case COAP_PROTO_DTLS:
-      default:
-        bytes_written = -1;
-        break;
-    }
-    if (bytes_written > 0)
+/*
+ * Reads up to data_len bytes from the stream of the reliable session.
+ */
+static ssize_t
+coap_read_stream(coap_session_t *session, uint8_t *data, size_t data_len,
+                 coap_tick_t now) {
+  ssize_t bytes_read = 0;
+
+  if (session->proto == COAP_PROTO_TCP)
+    bytes_read = coap_socket_read(&session->sock, data, data_len);
+  else if (session->proto == COAP_PROTO_TLS) {
+    if (!session->tls && session->type == COAP_SESSION_TYPE_SERVER &&
+        session->state == COAP_SESSION_STATE_HANDSHAKE) {
+      /* The ClientHello is here, so the TLS session can be set up */
       session->last_rx_tx = now;
-    if (bytes_written <= 0 || (size_t)bytes_written < q->pdu->used_size + q->pdu->hdr_size - session->partial_write) {
-      if (bytes_written > 0)
-        session->partial_write += (size_t)bytes_written;
-      break;
+      coap_session_accept_tls(session);
+      return 0;
     }
-    session->delayqueue = q->next;
-    session->partial_write = 0;
-    coap_delete_node(q);
+    bytes_read = coap_tls_read(session, data, data_len);
+  }
+  if (bytes_read > 0) {
+    coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
+             coap_session_str(session), bytes_read);
+    session->last_rx_tx = now;
   }
+  return bytes_read;
 }
 
+/*
+ * Parses the complete message at data (hdr_size bytes of header followed by
+ * size bytes) received on the reliable session, and dispatches it.  The PDU
+ * it is parsed into is kept by ctx for the next message.
+ */
+static int
+coap_handle_stream_pdu(coap_context_t *ctx, coap_session_t *session,
+                       const uint8_t *data, size_t hdr_size, size_t size) {
+  size_t max_size = coap_session_max_pdu_size(session);
+  coap_pdu_t *pdu = ctx->rx_pdu;
+
+  /* Taken off ctx while in use, should coap_dispatch() come back here */
+  ctx->rx_pdu = NULL;
+  if (pdu)
+    coap_pdu_clear(pdu, max_size);
+  else
+    pdu = coap_pdu_init(0, 0, 0, max_size);
+  if (pdu == NULL || !coap_pdu_resize(pdu, size)) {
+    coap_delete_pdu(pdu);
+    return -1;
+  }
+  if (coap_pdu_parse(session->proto, data, hdr_size + size, pdu))
+    coap_dispatch(ctx, session, pdu);
+  if (ctx->rx_pdu)
+    coap_delete_pdu(pdu);
+  else
+    ctx->rx_pdu = pdu;
+  return 0;
+}
+#endif /* !COAP_DISABLE_TCP */
+
 static void
 coap_read_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now) {
 #if COAP_CONSTRAINED_STACK
@@ -1568,103 +1815,101 @@ coap_read_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now)
     }
 #if !COAP_DISABLE_TCP
   } else {
+    coap_session_tcp_t *tcp = session->tcp;
     ssize_t bytes_read = 0;
-    const uint8_t *p;
-    int retry;
     /* adjust for LWIP */
     uint8_t *buf = packet->payload;
     size_t buf_len = sizeof(packet->payload);
+    int retry;
 
     do {
-      if (session->proto == COAP_PROTO_TCP)
-        bytes_read = coap_socket_read(&session->sock, buf, buf_len);
-      else if (session->proto == COAP_PROTO_TLS)
-        bytes_read = coap_tls_read(session, buf, buf_len);
-      if (bytes_read > 0) {
-        coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
-                 coap_session_str(session), bytes_read);
-        session->last_rx_tx = now;
+      const uint8_t *p = buf;
+      size_t avail;
+
+      if (tcp->partial_pdu) {
+        /* The rest of a message that straddles reads goes straight into
+           its PDU */
+        coap_pdu_t *pdu = tcp->partial_pdu;
+        size_t len = pdu->used_size + pdu->hdr_size - tcp->partial_read;
+
+        bytes_read = coap_read_stream(session,
+                          pdu->token - pdu->hdr_size + tcp->partial_read,
+                          len, now);
+        if (bytes_read <= 0)
+          break;
+        retry = (size_t)bytes_read == len;
+        if (!retry) {
+          tcp->partial_read += (size_t)bytes_read;
+          break;
+        }
+        /* Taken off the session in case it is disconnected by dispatch */
+        tcp->partial_pdu = NULL;
+        tcp->partial_read = 0;
+        if (coap_pdu_parse_header(pdu, session->proto) &&
+            coap_pdu_parse_opt(pdu)) {
+          coap_dispatch(ctx, session, pdu);
+        }
+        coap_delete_pdu(pdu);
+        continue;
       }
-      p = buf;
-      retry = bytes_read == (ssize_t)buf_len;
-      while (bytes_read > 0) {
-        if (session->partial_pdu) {
-          size_t len = session->partial_pdu->used_size
-                     + session->partial_pdu->hdr_size
-                     - session->partial_read;
-          size_t n = min(len, (size_t)bytes_read);
-          memcpy(session->partial_pdu->token - session->partial_pdu->hdr_size
-                 + session->partial_read, p, n);
-          p += n;
-          bytes_read -= n;
-          if (n == len) {
-            if (coap_pdu_parse_header(session->partial_pdu, session->proto)
-              && coap_pdu_parse_opt(session->partial_pdu)) {
-              coap_dispatch(ctx, session, session->partial_pdu);
-            }
-            coap_delete_pdu(session->partial_pdu);
-            session->partial_pdu = NULL;
-            session->partial_read = 0;
-          } else {
-            session->partial_read += n;
-          }
-        } else if (session->partial_read > 0) {
-          size_t hdr_size = coap_pdu_parse_header_size(session->proto,
-            session->read_header);
-          size_t len = hdr_size - session->partial_read;
-          size_t n = min(len, (size_t)bytes_read);
-          memcpy(session->read_header + session->partial_read, p, n);
-          p += n;
-          bytes_read -= n;
-          if (n == len) {
-            size_t size = coap_pdu_parse_size(session->proto, session->read_header,
-              hdr_size);
-            if (size > COAP_DEFAULT_MAX_PDU_RX_SIZE) {
-              coap_log(LOG_WARNING,
-                       "** %s: incoming PDU length too large (%zu > %lu)\n",
-                       coap_session_str(session),
-                       size, COAP_DEFAULT_MAX_PDU_RX_SIZE);
-              bytes_read = -1;
-              break;
-            }
-            /* Need max space incase PDU is updated with updated token etc. */
-            session->partial_pdu = coap_pdu_init(0, 0, 0,
-                                           coap_session_max_pdu_size(session));
-            if (session->partial_pdu == NULL) {
-              bytes_read = -1;
-              break;
-            }
-            if (session->partial_pdu->alloc_size < size && !coap_pdu_resize(session->partial_pdu, size)) {
-              bytes_read = -1;
-              break;
-            }
-            session->partial_pdu->hdr_size = (uint8_t)hdr_size;
-            session->partial_pdu->used_size = size;
-            memcpy(session->partial_pdu->token - hdr_size, session->read_header, hdr_size);
-            session->partial_read = hdr_size;
-            if (size == 0) {
-              if (coap_pdu_parse_header(session->partial_pdu, session->proto)) {
-                coap_dispatch(ctx, session, session->partial_pdu);
-              }
-              coap_delete_pdu(session->partial_pdu);
-              session->partial_pdu = NULL;
-              session->partial_read = 0;
-            }
-          } else {
-            session->partial_read += bytes_read;
-          }
-        } else {
-          session->read_header[0] = *p++;
-          bytes_read -= 1;
-          if (!coap_pdu_parse_header_size(session->proto,
-                                          session->read_header)) {
+
+      /* Read as much as there is room for after the start of a header that
+         straddled the previous read */
+      memcpy(buf, tcp->read_header, tcp->partial_read);
+      bytes_read = coap_read_stream(session, buf + tcp->partial_read,
+                                    buf_len - tcp->partial_read, now);
+      if (bytes_read <= 0)
+        break;
+      retry = (size_t)bytes_read == buf_len - tcp->partial_read;
+      avail = tcp->partial_read + (size_t)bytes_read;
+      tcp->partial_read = 0;
+
+      /* Parse the complete messages in the buffer */
+      while (avail > 0 && (session->sock.flags & COAP_SOCKET_CONNECTED)) {
+        size_t hdr_size = coap_pdu_parse_header_size(session->proto, p);
+        size_t size;
+
+        if (avail < hdr_size) {
+          memcpy(tcp->read_header, p, avail);
+          tcp->partial_read = avail;
+          break;
+        }
+        size = coap_pdu_parse_size(session->proto, p, hdr_size);
+        if (size > COAP_DEFAULT_MAX_PDU_RX_SIZE) {
+          coap_log(LOG_WARNING,
+                   "** %s: incoming PDU length too large (%zu > %lu)\n",
+                   coap_session_str(session),
+                   size, COAP_DEFAULT_MAX_PDU_RX_SIZE);
+          bytes_read = -1;
+          break;
+        }
+        if (avail < hdr_size + size) {
+          /* Only a message that straddles reads gets a PDU of its own */
+          coap_pdu_t *pdu = coap_pdu_init(0, 0, 0,
+                                          coap_session_max_pdu_size(session));
+
+          if (pdu == NULL || !coap_pdu_resize(pdu, size)) {
+            coap_delete_pdu(pdu);
             bytes_read = -1;
             break;
           }
-          session->partial_read = 1;
+          pdu->hdr_size = (uint8_t)hdr_size;
+          pdu->used_size = size;
+          memcpy(pdu->token - hdr_size, p, avail);
+          tcp->partial_pdu = pdu;
+          tcp->partial_read = avail;
+          retry = 1;
+          break;
+        }
+        if (coap_handle_stream_pdu(ctx, session, p, hdr_size, size) < 0) {
+          bytes_read = -1;
+          break;
         }
+        p += hdr_size + size;
+        avail -= hdr_size + size;
       }
-    } while (bytes_read == 0 && retry);
+    } while (bytes_read > 0 && retry &&
+             (session->sock.flags & COAP_SOCKET_CONNECTED));
     if (bytes_read < 0)
       coap_session_disconnected(session, COAP_NACK_NOT_DELIVERABLE);
 #endif /* !COAP_DISABLE_TCP */
@@ -1707,8 +1952,15 @@ coap_read_endpoint(coap_context_t *ctx, coap_endpoint_t *endpoint, coap_tick_t n
       coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
                coap_session_str(session), bytes_read);
       result = coap_handle_dgram_for_proto(ctx, session, packet);
+      coap_session_cid_rebind_done(session);
       if (endpoint->proto == COAP_PROTO_DTLS && session->type == COAP_SESSION_TYPE_HELLO && result == 1)
         coap_session_new_dtls_session(session, now);
+      else if (endpoint->proto == COAP_PROTO_DTLS &&
+               session->type == COAP_SESSION_TYPE_HELLO)
+        /* Nothing needs keeping until a valid cookie comes back */
+        coap_session_free(session);
+      else if (session->transient)
+        coap_session_check_transient(session);
     }
   }
 #if COAP_CONSTRAINED_STACK
@@ -1728,10 +1980,24 @@ coap_write_endpoint(coap_context_t *ctx, coap_endpoint_t *endpoint, coap_tick_t
 static int
 coap_accept_endpoint(coap_context_t *ctx, coap_endpoint_t *endpoint,
   coap_tick_t now) {
-  coap_session_t *session = coap_new_server_session(ctx, endpoint);
-  if (session)
+  int accepted = 0;
+#if !COAP_DISABLE_TCP
+
+  /* Drain the accept queue, up to a point */
+  while (accepted < COAP_MAX_ACCEPT_BATCH) {
+    coap_session_t *session = coap_new_server_session(ctx, endpoint);
+
+    if (!session)
+      break;
     session->last_rx_tx = now;
-  return session != NULL;
+    accepted++;
+  }
+#else /* COAP_DISABLE_TCP */
+  (void)ctx;
+  (void)endpoint;
+  (void)now;
+#endif /* COAP_DISABLE_TCP */
+  return accepted;
 }
 
 void
@@ -1745,6 +2011,9 @@ coap_io_do_io(coap_context_t *ctx, coap_tick_t now) {
   coap_endpoint_t *ep, *tmp;
   coap_session_t *s, *rtmp;
 
+  coap_handshake_process(ctx);
+  coap_submit_process(ctx);
+
   LL_FOREACH_SAFE(ctx->endpoint, ep, tmp) {
     if ((ep->sock.flags & COAP_SOCKET_CAN_READ) != 0)
       coap_read_endpoint(ctx, ep, now);
@@ -1873,6 +2142,14 @@ coap_io_do_epoll(coap_context_t *ctx, struct epoll_event *events, size_t nevents
         /* Now dereference session so it can go away if needed */
         coap_session_release(session);
       }
+      else if (sock == coap_handshake_socket(ctx)) {
+        sock->flags |= COAP_SOCKET_CAN_READ;
+        coap_handshake_process(ctx);
+      }
+      else if (sock == coap_submit_socket(ctx)) {
+        sock->flags |= COAP_SOCKET_CAN_READ;
+        coap_submit_process(ctx);
+      }
     }
     else if (ctx->eptimerfd != -1) {
       /*
@@ -1909,13 +2186,43 @@ coap_handle_dgram(coap_context_t *ctx, coap_session_t *session,
   /* Need max space incase PDU is updated with updated token etc. */
   pdu = coap_pdu_init(0, 0, 0, coap_session_max_pdu_size(session));
   if (!pdu)
-    goto error;
+    return -1;
+  /* One too big is discarded by coap_handle_dgram_pdu() */
+  if (msg_len - COAP_PDU_MAX_UDP_HEADER_SIZE <= pdu->max_size) {
+    if (!coap_pdu_resize(pdu, msg_len - COAP_PDU_MAX_UDP_HEADER_SIZE)) {
+      coap_delete_pdu(pdu);
+      return -1;
+    }
+    memcpy(pdu->token - COAP_PDU_MAX_UDP_HEADER_SIZE, msg, msg_len);
+  }
+  return coap_handle_dgram_pdu(ctx, session, pdu, msg_len);
+}
+
+int
+coap_handle_dgram_pdu(coap_context_t *ctx, coap_session_t *session,
+                      coap_pdu_t *pdu, size_t msg_len) {
+  size_t max_size = coap_session_max_pdu_size(session);
+
+  assert(COAP_PROTO_NOT_RELIABLE(session->proto));
+  if (msg_len < 4) {
+    /* Minimum size of CoAP header - ignore runt */
+    coap_delete_pdu(pdu);
+    return -1;
+  }
 
-  if (!coap_pdu_parse(session->proto, msg, msg_len, pdu)) {
+  /* As if created with room for the session's largest PDU */
+  pdu->max_size = max_size;
+  if (msg_len - COAP_PDU_MAX_UDP_HEADER_SIZE > max_size ||
+      !coap_pdu_parse(session->proto,
+                      pdu->token - COAP_PDU_MAX_UDP_HEADER_SIZE, msg_len,
+                      pdu)) {
     coap_log(LOG_WARNING, "discard malformed PDU\n");
     goto error;
   }
 
+  if (session->cid)
+    /* Record with a Connection ID has been decrypted, so follow the peer */
+    coap_session_cid_rebind(session);
   coap_dispatch(ctx, session, pdu);
   coap_delete_pdu(pdu);
   return 0;
@@ -1985,8 +2292,8 @@ coap_cancel_session_messages(coap_context_t *context, coap_session_t *session,
     context->sendqueue = q->next;
     coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed\n",
              coap_session_str(session), q->id);
-    if (q->pdu->type == COAP_MESSAGE_CON && context->nack_handler)
-      context->nack_handler(context, session, q->pdu, reason, q->id);
+    if (q->pdu->type == COAP_MESSAGE_CON)
+      coap_handle_nack(session, q->pdu, reason, q->id);
     coap_delete_node(q);
   }
 
@@ -2001,8 +2308,8 @@ coap_cancel_session_messages(coap_context_t *context, coap_session_t *session,
       p->next = q->next;
       coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed\n",
                coap_session_str(session), q->id);
-      if (q->pdu->type == COAP_MESSAGE_CON && context->nack_handler)
-        context->nack_handler(context, session, q->pdu, reason, q->id);
+      if (q->pdu->type == COAP_MESSAGE_CON)
+        coap_handle_nack(session, q->pdu, reason, q->id);
       coap_delete_node(q);
       q = p->next;
     } else {
@@ -2227,6 +2534,10 @@ coap_wellknown_response(coap_context_t *context, coap_session_t *session,
   /* check whether the request contains the Block2 option */
   if (coap_get_block(request, COAP_OPTION_BLOCK2, &block)) {
     coap_log(LOG_DEBUG, "create block\n");
+    if (block.szx == COAP_BERT_SZX && COAP_PROTO_RELIABLE(session->proto)) {
+      /* BERT - respond with standard SZX 6 blocks */
+      block.szx = COAP_BERT_SZX - 1;
+    }
     offset = block.num << (block.szx + 4);
     if (block.szx > 6) {  /* invalid, MUST lead to 4.00 Bad Request */
       resp->code = COAP_RESPONSE_CODE(400);
@@ -2806,6 +3117,18 @@ handle_request(coap_context_t *context, coap_session_t *session, coap_pdu_t *pdu
         }
       }
 
+      if ((resource->flags & COAP_RESOURCE_FLAGS_CACHE_RESPONSES) &&
+          coap_cache_response_lookup(session, resource, pdu, response)) {
+        goto skip_handler;
+      }
+#ifndef WITHOUT_ASYNC
+      if ((resource->flags & COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS) &&
+          coap_async_collapse_join(context, session, resource, pdu)) {
+        /* Answered along with an identical request */
+        goto skip_handler;
+      }
+#endif /* WITHOUT_ASYNC */
+
       /*
        * Call the request handler with everything set up
        */
@@ -2814,6 +3137,13 @@ handle_request(coap_context_t *context, coap_session_t *session, coap_pdu_t *pdu
       /* Check if lg_xmit generated and update PDU code if so */
       coap_check_code_lg_xmit(session, response, resource, query);
 
+      if (resource->flags & COAP_RESOURCE_FLAGS_CACHE_RESPONSES)
+        coap_cache_response_store(session, resource, pdu, response);
+#ifndef WITHOUT_ASYNC
+      if (resource->flags & COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS)
+        coap_async_collapse_update(context, session, resource, pdu, response);
+#endif /* WITHOUT_ASYNC */
+
 skip_handler:
       respond = no_response(pdu, response, session);
       if (respond != RESPONSE_DROP) {
@@ -2912,8 +3242,15 @@ handle_response(coap_context_t *context, coap_session_t *session,
     }
   }
 
+  /* Responses to forwarded requests go back to the proxy's clients */
+  if (session->proxy && session->proxy->upstream) {
+    if (coap_proxy_handle_response(session, rcvd) == COAP_RESPONSE_FAIL)
+      coap_send_rst(session, rcvd);
+    else
+      coap_send_ack(session, rcvd);
+  }
   /* Call application-specific response handler when available. */
-  if (context->response_handler) {
+  else if (context->response_handler) {
     if (context->response_handler(context, session, sent, rcvd,
                                   rcvd->mid) == COAP_RESPONSE_FAIL)
       coap_send_rst(session, rcvd);
@@ -2944,6 +3281,13 @@ handle_signaling(coap_context_t *context, coap_session_t *session,
         session->csm_block_supported = 1;
       }
     }
+    /*
+     * BERT can only be used if the peer supports Block-Wise-Transfer and
+     * can take a message larger than a single 1024 byte block
+     * https://tools.ietf.org/html/rfc8323#section-6
+     */
+    session->csm_bert_rem_support = session->csm_block_supported &&
+                                    session->mtu > COAP_BERT_BASE;
     if (session->state == COAP_SESSION_STATE_CSM)
       coap_session_connected(session);
   } else if (pdu->code == COAP_SIGNALING_CODE_PING) {
@@ -2994,6 +3338,14 @@ coap_dispatch(coap_context_t *context, coap_session_t *session,
       /* find message id in sendqueue to stop retransmission */
       coap_remove_from_queue(&context->sendqueue, session, pdu->mid, &sent);
 
+      if (sent && session->cocoa) {
+        coap_tick_t now;
+
+        coap_ticks(&now);
+        coap_update_rtt_estimate(session, sent, now);
+      }
+      if (sent)
+        coap_session_cwnd_ack(session, sent);
       if (sent && session->con_active) {
         session->con_active--;
         if (session->state == COAP_SESSION_STATE_ESTABLISHED)
@@ -3043,12 +3395,18 @@ coap_dispatch(coap_context_t *context, coap_session_t *session,
       coap_remove_from_queue(&context->sendqueue, session, pdu->mid, &sent);
 
       if (sent) {
+        if (session->cocoa) {
+          coap_tick_t now;
+
+          coap_ticks(&now);
+          coap_update_rtt_estimate(session, sent, now);
+        }
         coap_cancel(context, sent);
 
         if (!is_ping_rst) {
-          if(sent->pdu->type==COAP_MESSAGE_CON && context->nack_handler)
-            context->nack_handler(context, sent->session, sent->pdu,
-                                  COAP_NACK_RST, sent->id);
+          if(sent->pdu->type==COAP_MESSAGE_CON)
+            coap_handle_nack(sent->session, sent->pdu, COAP_NACK_RST,
+                             sent->id);
         }
         else {
           if (context->pong_handler) {
@@ -3084,7 +3442,11 @@ coap_dispatch(coap_context_t *context, coap_session_t *session,
       }
       break;
 
-    case COAP_MESSAGE_CON:        /* check for unknown critical options */
+    case COAP_MESSAGE_CON:
+      /* answer a retransmitted request with the response already sent */
+      if (COAP_PDU_IS_REQUEST(pdu) && coap_mid_cache_check(session, pdu))
+        goto cleanup;
+      /* check for unknown critical options */
       if (coap_option_check_critical(context, pdu, opt_filter) == 0) {
 
         if (COAP_PDU_IS_REQUEST(pdu)) {
@@ -3151,10 +3513,25 @@ cleanup:
   coap_delete_node(sent);
 }
 
+void
+coap_handle_nack(coap_session_t *session, coap_pdu_t *sent,
+                 coap_nack_reason_t reason, coap_mid_t mid) {
+  coap_context_t *context = session->context;
+
+  if ((session->proxy && session->proxy->upstream) ||
+      context->proxy_upstreams)
+    coap_proxy_handle_nack(session, sent, reason);
+  if (context->nack_handler)
+    context->nack_handler(context, session, sent, reason, mid);
+}
+
 int
 coap_handle_event(coap_context_t *context, coap_event_t event, coap_session_t *session) {
   coap_log(LOG_DEBUG, "***EVENT: 0x%04x\n", event);
 
+  if (session)
+    coap_proxy_handle_event(session, event);
+
   if (context->handle_event) {
     return context->handle_event(context, event, session);
   } else {
@@ -3190,20 +3567,28 @@ coap_can_exit(coap_context_t *context) {
 coap_tick_t
 coap_check_async(coap_context_t *context, coap_tick_t now) {
   coap_tick_t next_due = 0;
-  coap_async_t *async, *tmp;
+  coap_async_t *async;
 
-  LL_FOREACH_SAFE(context->async_state, async, tmp) {
-    if (async->delay <= now) {
+  /* Handling one may free others (those of requests collapsed into it), so
+   * each search for the next one that is due starts again.  A delay of 0
+   * never triggers. */
+  do {
+    LL_FOREACH(context->async_state, async) {
+      if (async->delay && async->delay <= now)
+        break;
+    }
+    if (async) {
       /* Send off the request to the application */
       handle_request(context, async->session, async->pdu);
 
       /* Remove this async entry as it has now fired */
       coap_free_async(context, async);
     }
-    else {
-      if (next_due == 0 || next_due > async->delay - now)
-        next_due = async->delay - now;
-    }
+  } while (async);
+
+  LL_FOREACH(context->async_state, async) {
+    if (async->delay && (next_due == 0 || next_due > async->delay - now))
+      next_due = async->delay - now;
   }
   return next_due;
 }
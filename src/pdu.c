@@ -436,7 +436,8 @@ coap_insert_option(coap_pdu_t *pdu, coap_option_num_t number, size_t len,
   shift = coap_opt_encode_size(number - prev_number, len);
 
   /* size of next option (header may shrink in size as delta changes */
-  if (!coap_opt_parse(option, opt_iter.length + 5, &decode))
+  if (!coap_opt_parse(option, pdu->used_size - (option - pdu->token),
+                      &decode))
     return 0;
   opt_delta = opt_iter.number - number;
 
@@ -1114,7 +1115,9 @@ coap_pdu_parse(coap_proto_t proto,
   if (!coap_pdu_resize(pdu, length - hdr_size))
     return 0;
 #ifndef WITH_LWIP
-  memcpy(pdu->token - hdr_size, data, length);
+  /* The datagram may have been received straight into the PDU */
+  if (pdu->token - hdr_size != data)
+    memcpy(pdu->token - hdr_size, data, length);
 #endif
   pdu->hdr_size = (uint8_t)hdr_size;
   pdu->used_size = length - hdr_size;
@@ -500,6 +500,9 @@ coap_free_resource(coap_resource_t *resource) {
   if (resource->context->release_userdata && resource->user_data)
     resource->context->release_userdata(resource->user_data);
 
+  /* Shared large bodies must not be matched against a reused resource */
+  coap_block_unlink_lg_bodies(resource->context, resource);
+
   /* delete registered attributes */
   LL_FOREACH_SAFE(resource->link_attr, attr, tmp) coap_delete_attr(attr);
 
@@ -557,6 +560,10 @@ coap_add_resource(coap_context_t *context, coap_resource_t *resource) {
   }
   assert(resource->context == NULL);
   resource->context = context;
+  /* The response cache fills itself, so is bounded unless told otherwise */
+  if ((resource->flags & COAP_RESOURCE_FLAGS_CACHE_RESPONSES) &&
+      !context->cache_size_set)
+    context->max_cache_size = COAP_DEFAULT_CACHE_SIZE;
 }
 
 int
@@ -862,7 +869,7 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
         context->observe_pending = 1;
         continue;
       }
-      if (obs->session->con_active >= COAP_DEFAULT_NSTART &&
+      if (COAP_SESSION_CWND_FULL(obs->session) &&
           ((r->flags & COAP_RESOURCE_FLAGS_NOTIFY_CON) ||
            (obs->non_cnt >= COAP_OBS_MAX_NON))) {
         r->partiallydirty = 1;
@@ -958,6 +965,8 @@ coap_resource_set_dirty(coap_resource_t *r, const coap_string_t *query) {
 
 int
 coap_resource_notify_observers(coap_resource_t *r, const coap_string_t *query) {
+  if (r->flags & COAP_RESOURCE_FLAGS_CACHE_RESPONSES)
+    coap_cache_invalidate_resource(r);
   if (!r->observable)
     return 0;
   if (query) {
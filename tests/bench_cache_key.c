@@ -0,0 +1,132 @@
+/* bench_cache_key -- compare the cost of the cache-key derivation modes
+ *
+ * Copyright (C) 2021 The libcoap project
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ *
+ * Usage: bench_cache_key [iterations]
+ *
+ * For each of COAP_CACHE_KEY_DIGEST and COAP_CACHE_KEY_FAST, the time per
+ * request is reported for deriving a cache-key, and for looking up a request
+ * in a cache holding a matching cache-entry, for a typical proxied GET and a
+ * FETCH with a small body.
+ */
+
+#include <coap2/coap.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_ITERATIONS 200000
+
+static coap_pdu_t *
+make_request(coap_pdu_code_t code, size_t body_len) {
+  static const uint8_t body[256];
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, code, 0x1234, 1024);
+  uint8_t buf[4];
+
+  if (!pdu)
+    return NULL;
+  coap_add_token(pdu, 8, (const uint8_t *)"\x01\x02\x03\x04\x05\x06\x07\x08");
+  coap_add_option(pdu, COAP_OPTION_URI_HOST, 11,
+                  (const uint8_t *)"example.com");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 7, (const uint8_t *)"sensors");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 4, (const uint8_t *)"temp");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 1, (const uint8_t *)"1");
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, 6, (const uint8_t *)"unit=c");
+  coap_add_option(pdu, COAP_OPTION_ACCEPT,
+                  coap_encode_var_safe(buf, sizeof(buf),
+                                       COAP_MEDIATYPE_APPLICATION_CBOR), buf);
+  if (body_len)
+    coap_add_data(pdu, body_len, body);
+  return pdu;
+}
+
+static double
+ns_per_op(coap_tick_t start, coap_tick_t end, unsigned long iterations) {
+  return (double)(end - start) * (1000000000.0 / COAP_TICKS_PER_SECOND) /
+         (double)iterations;
+}
+
+static void
+run(coap_session_t *session, coap_pdu_t *pdu, const char *name,
+    unsigned long iterations) {
+  coap_tick_t start, end;
+  unsigned long i;
+
+  coap_ticks(&start);
+  for (i = 0; i < iterations; i++) {
+    coap_cache_key_t *cache_key =
+        coap_cache_derive_key(session, pdu, COAP_CACHE_NOT_SESSION_BASED);
+    coap_delete_cache_key(cache_key);
+  }
+  coap_ticks(&end);
+  printf("%-6s %-6s derive %8.1f ns", coap_context_get_cache_key_mode(
+           coap_session_get_context(session)) == COAP_CACHE_KEY_FAST ?
+           "fast" : "digest", name, ns_per_op(start, end, iterations));
+
+  coap_new_cache_entry(session, pdu, COAP_CACHE_RECORD_PDU,
+                       COAP_CACHE_NOT_SESSION_BASED, 0);
+  coap_ticks(&start);
+  for (i = 0; i < iterations; i++) {
+    if (!coap_cache_get_by_pdu(session, pdu, COAP_CACHE_NOT_SESSION_BASED)) {
+      printf("\nlookup failed\n");
+      exit(1);
+    }
+  }
+  coap_ticks(&end);
+  printf("   lookup %8.1f ns\n", ns_per_op(start, end, iterations));
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long iterations = DEFAULT_ITERATIONS;
+  coap_address_t dst;
+  coap_context_t *ctx;
+  coap_session_t *session;
+  coap_pdu_t *get, *fetch;
+  static const coap_cache_key_mode_t modes[] = {
+    COAP_CACHE_KEY_DIGEST, COAP_CACHE_KEY_FAST
+  };
+  size_t m;
+
+  if (argc > 1)
+    iterations = strtoul(argv[1], NULL, 10);
+  if (iterations == 0)
+    iterations = DEFAULT_ITERATIONS;
+
+  coap_startup();
+  coap_set_log_level(LOG_WARNING);
+
+  coap_address_init(&dst);
+  dst.size = sizeof(struct sockaddr_in);
+  dst.addr.sin.sin_family = AF_INET;
+  dst.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  dst.addr.sin.sin_port = htons(COAP_DEFAULT_PORT);
+
+  ctx = coap_new_context(NULL);
+  session = ctx ? coap_new_client_session(ctx, NULL, &dst, COAP_PROTO_UDP) :
+                  NULL;
+  get = make_request(COAP_REQUEST_CODE_GET, 0);
+  fetch = make_request(COAP_REQUEST_CODE_FETCH, 64);
+  if (!session || !get || !fetch) {
+    fprintf(stderr, "setup failed\n");
+    return 1;
+  }
+
+  printf("%lu iterations, time per request\n", iterations);
+  for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    coap_context_set_cache_key_mode(ctx, modes[m]);
+    run(session, get, "GET", iterations);
+    run(session, fetch, "FETCH", iterations);
+  }
+
+  coap_delete_pdu(get);
+  coap_delete_pdu(fetch);
+  coap_session_release(session);
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
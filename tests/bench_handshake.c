@@ -0,0 +1,185 @@
+/* bench_handshake -- measure the rate of DTLS handshakes
+ *
+ * Copyright (C) 2021 The libcoap project
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ *
+ * Usage: bench_handshake [handshakes [threads [port]]]
+ *
+ * Runs the given number of DTLS PSK handshakes between a client and a server
+ * context in the one process, over the loopback interface, with whichever
+ * (D)TLS library libcoap has been built with.  The handshakes per second are
+ * reported for full handshakes (a new client context each time, the time
+ * taken to create it included) and for resumed ones (the client context
+ * keeps the state of the previous session).
+ * The server context runs its handshakes on the given number of worker
+ * threads (see coap_context_set_handshake_threads()), 0 by default.
+ */
+
+#include <coap2/coap.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_HANDSHAKES 200
+#define DEFAULT_PORT 25694
+
+/* How long a handshake may take before the benchmark gives up */
+#define HANDSHAKE_TIMEOUT (5 * COAP_TICKS_PER_SECOND)
+
+static const char identity[] = "bench";
+static const uint8_t key[] = "bench-secret-key";
+
+/*
+ * Runs one handshake from client to the server at dst.  Returns 1 if it
+ * succeeded, else 0.
+ */
+static int
+handshake(coap_context_t *server, coap_context_t *client,
+          const coap_address_t *dst) {
+  coap_dtls_cpsk_t setup_data;
+  coap_session_t *session;
+  coap_tick_t start, now;
+  coap_session_state_t state;
+
+  memset(&setup_data, 0, sizeof(setup_data));
+  setup_data.version = COAP_DTLS_CPSK_SETUP_VERSION;
+  setup_data.psk_info.identity.s = (const uint8_t *)identity;
+  setup_data.psk_info.identity.length = sizeof(identity) - 1;
+  setup_data.psk_info.key.s = key;
+  setup_data.psk_info.key.length = sizeof(key) - 1;
+
+  coap_ticks(&start);
+  session = coap_new_client_session_psk2(client, NULL, dst, COAP_PROTO_DTLS,
+                                         &setup_data);
+  if (!session)
+    return 0;
+  do {
+    coap_io_process(server, COAP_IO_NO_WAIT);
+    coap_io_process(client, COAP_IO_NO_WAIT);
+    state = coap_session_get_state(session);
+    coap_ticks(&now);
+  } while (state != COAP_SESSION_STATE_ESTABLISHED &&
+           state != COAP_SESSION_STATE_NONE &&
+           now - start < HANDSHAKE_TIMEOUT);
+  coap_session_release(session);
+  /* Let the server see the close_notify, so its sessions do not pile up */
+  coap_io_process(client, COAP_IO_NO_WAIT);
+  coap_io_process(server, COAP_IO_NO_WAIT);
+  return state == COAP_SESSION_STATE_ESTABLISHED;
+}
+
+static void
+report(const char *name, unsigned long handshakes, coap_tick_t elapsed) {
+  double secs = (double)elapsed / COAP_TICKS_PER_SECOND;
+
+  printf("%-8s %6lu handshakes %8.3f s %10.1f /s %8.1f us each\n", name,
+         handshakes, secs, secs > 0 ? handshakes / secs : 0.0,
+         handshakes ? secs * 1000000.0 / handshakes : 0.0);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long handshakes = DEFAULT_HANDSHAKES;
+  unsigned int threads = 0;
+  unsigned int port = DEFAULT_PORT;
+  coap_address_t addr;
+  coap_context_t *server, *client;
+  coap_dtls_spsk_t setup_data;
+  coap_tick_t start, end;
+  unsigned long i;
+  const char *library;
+  coap_tls_version_t *version;
+
+  if (argc > 1)
+    handshakes = strtoul(argv[1], NULL, 10);
+  if (handshakes == 0)
+    handshakes = DEFAULT_HANDSHAKES;
+  if (argc > 2)
+    threads = (unsigned int)strtoul(argv[2], NULL, 10);
+  if (argc > 3)
+    port = (unsigned int)strtoul(argv[3], NULL, 10);
+
+  coap_startup();
+  coap_set_log_level(LOG_WARNING);
+  coap_dtls_set_log_level(LOG_WARNING);
+
+  if (!coap_dtls_is_supported()) {
+    printf("DTLS is not supported by this build\n");
+    coap_cleanup();
+    return 0;
+  }
+
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = htons((uint16_t)port);
+
+  memset(&setup_data, 0, sizeof(setup_data));
+  setup_data.version = COAP_DTLS_SPSK_SETUP_VERSION;
+  setup_data.psk_info.key.s = key;
+  setup_data.psk_info.key.length = sizeof(key) - 1;
+
+  server = coap_new_context(NULL);
+  if (!server || !coap_context_set_psk2(server, &setup_data) ||
+      !coap_new_endpoint(server, &addr, COAP_PROTO_DTLS)) {
+    fprintf(stderr, "server setup failed (port %u)\n", port);
+    return 1;
+  }
+  if (threads && !coap_context_set_handshake_threads(server, threads))
+    fprintf(stderr, "cannot use %u handshake threads, using none\n", threads);
+
+  version = coap_get_tls_library_version();
+  switch (version->type) {
+  case COAP_TLS_LIBRARY_TINYDTLS: library = "TinyDTLS"; break;
+  case COAP_TLS_LIBRARY_OPENSSL:  library = "OpenSSL"; break;
+  case COAP_TLS_LIBRARY_GNUTLS:   library = "GnuTLS"; break;
+  case COAP_TLS_LIBRARY_MBEDTLS:  library = "Mbed TLS"; break;
+  case COAP_TLS_LIBRARY_NOTLS:
+  default:                        library = "unknown"; break;
+  }
+  printf("%s, %u server handshake thread(s)\n", library,
+         coap_context_get_handshake_threads(server));
+
+  coap_ticks(&start);
+  for (i = 0; i < handshakes; i++) {
+    int ok;
+
+    client = coap_new_context(NULL);
+    if (!client) {
+      fprintf(stderr, "client setup failed\n");
+      return 1;
+    }
+    ok = handshake(server, client, &addr);
+    coap_free_context(client);
+    if (!ok) {
+      fprintf(stderr, "full handshake %lu failed\n", i);
+      return 1;
+    }
+  }
+  coap_ticks(&end);
+  report("full", handshakes, end - start);
+
+  client = coap_new_context(NULL);
+  if (!client) {
+    fprintf(stderr, "client setup failed\n");
+    return 1;
+  }
+  coap_ticks(&start);
+  for (i = 0; i < handshakes; i++) {
+    if (!handshake(server, client, &addr)) {
+      fprintf(stderr, "resumed handshake %lu failed\n", i);
+      return 1;
+    }
+  }
+  coap_ticks(&end);
+  report("resumed", handshakes, end - start);
+
+  coap_free_context(client);
+  coap_free_context(server);
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,151 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+#include "test_async.h"
+
+#include <stdio.h>
+
+static coap_context_t *ctx; /* Holds the coap context for the tests */
+
+static int collapse_calls;
+
+static void
+t_collapse_handler(coap_context_t *context, coap_resource_t *resource,
+                   coap_session_t *s, coap_pdu_t *request,
+                   coap_binary_t *token, coap_string_t *query,
+                   coap_pdu_t *response) {
+  (void)resource;
+  (void)query;
+  collapse_calls++;
+  if (!coap_find_async(context, s, *token)) {
+    /* Answered once the async is triggered */
+    coap_register_async(context, s, request, 0);
+    return;
+  }
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data(response, 5, (const uint8_t *)"hello");
+}
+
+/* Test 1 checks that identical requests for a resource with
+ * COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS wait for the one being handled
+ * asynchronously, and get a copy of its response. */
+static void
+t_async1(void) {
+  uint8_t request[] = { 0x41, 0x01, 0x60, 0x01, 'a',
+                        0xb8, 'c', 'o', 'l', 'l', 'a', 'p', 's', 'e' };
+  uint8_t query_request[] = { 0x41, 0x01, 0x60, 0x02, 'c',
+                              0xb8, 'c', 'o', 'l', 'l', 'a', 'p', 's', 'e',
+                              0x41, 'x' };
+  uint8_t data[sizeof(query_request)];
+  uint8_t token_value[] = { 'a' };
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s1, *s2;
+  coap_async_t *async;
+  coap_binary_t token = { sizeof(token_value), token_value };
+  coap_tick_t now;
+
+  if (!coap_async_is_supported()) {
+    CU_PASS("async not supported");
+    return;
+  }
+  r = coap_resource_init(coap_make_str_const("collapse"),
+                         COAP_RESOURCE_FLAGS_COLLAPSE_REQUESTS);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_GET, t_collapse_handler);
+  coap_add_resource(ctx, r);
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s1 = t_loopback_peer(ep, 30018);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s1);
+  s2 = t_loopback_peer(ep, 30019);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s2);
+
+  collapse_calls = 0;
+  memcpy(data, request, sizeof(request));
+  coap_handle_dgram(ctx, s1, data, sizeof(request));
+  CU_ASSERT(collapse_calls == 1);
+  async = coap_find_async(ctx, s1, token);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(async);
+  CU_ASSERT(HASH_COUNT(ctx->async_collapse) == 1);
+
+  /* The same request from another client waits for the first one */
+  memcpy(data, request, sizeof(request));
+  data[4] = 'b';
+  coap_handle_dgram(ctx, s2, data, sizeof(request));
+  CU_ASSERT(collapse_calls == 1);
+  CU_ASSERT_PTR_NOT_NULL(async->followers);
+
+  /* and a different one does not */
+  memcpy(data, query_request, sizeof(query_request));
+  coap_handle_dgram(ctx, s2, data, sizeof(query_request));
+  CU_ASSERT(collapse_calls == 2);
+  CU_ASSERT(HASH_COUNT(ctx->async_collapse) == 2);
+
+  /* Answering the first request answers the one waiting for it */
+  coap_async_set_delay(async, 1);
+  do {
+    coap_ticks(&now);
+  } while (now < async->delay);
+  coap_check_async(ctx, now);
+  CU_ASSERT(collapse_calls == 3);
+  CU_ASSERT(HASH_COUNT(ctx->async_collapse) == 1);
+  CU_ASSERT(t_queued_responses(s2, COAP_RESPONSE_CODE_CONTENT) == 1);
+  CU_ASSERT_PTR_NULL(coap_find_async(ctx, s1, token));
+  token_value[0] = 'b';
+  CU_ASSERT_PTR_NULL(coap_find_async(ctx, s2, token));
+
+  /* Asyncs with a delay of 0 are not triggered */
+  CU_ASSERT(coap_check_async(ctx, now) == 0);
+  CU_ASSERT(collapse_calls == 3);
+
+  coap_delete_all_async(ctx);
+  CU_ASSERT_PTR_NULL(ctx->async_collapse);
+  coap_cancel_session_messages(ctx, s2, COAP_NACK_RST);
+  coap_delete_resource(ctx, r);
+  coap_free_endpoint(ep);
+}
+
+static int
+t_async_tests_create(void) {
+  ctx = coap_new_context(NULL);
+  return ctx == NULL;
+}
+
+static int
+t_async_tests_remove(void) {
+  coap_free_context(ctx);
+  return 0;
+}
+
+CU_pSuite
+t_init_async_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("async",
+                       t_async_tests_create, t_async_tests_remove);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add async test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define ASYNC_TEST(s,t)                                                \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add async test (%s)\n",                \
+            CU_get_error_msg());                                      \
+  }
+
+  ASYNC_TEST(suite, t_async1);
+
+  return suite;
+}
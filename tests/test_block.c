@@ -0,0 +1,567 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_block.h"
+#include "test_loopback.h"
+
+#include <stdio.h>
+
+static uint8_t t_block_body[5000];
+static int t_block_responses;
+static coap_pdu_code_t t_block_code;
+static int t_block_whole;
+
+static coap_response_t
+t_block_response(coap_context_t *context, coap_session_t *s,
+                 coap_pdu_t *sent, coap_pdu_t *received,
+                 const coap_mid_t id) {
+  (void)context;
+  (void)s;
+  (void)sent;
+  (void)id;
+  t_block_code = received->code;
+  t_block_responses++;
+  return COAP_RESPONSE_OK;
+}
+
+static void
+t_block_put_handler(coap_context_t *context, coap_resource_t *resource,
+                    coap_session_t *s, coap_pdu_t *request,
+                    coap_binary_t *token, coap_string_t *query,
+                    coap_pdu_t *response) {
+  size_t length, offset, total;
+  const uint8_t *data;
+
+  (void)context;
+  (void)resource;
+  (void)s;
+  (void)token;
+  (void)query;
+  if (coap_get_data_large(request, &length, &data, &offset, &total) &&
+      offset == 0 && length == sizeof(t_block_body) &&
+      memcmp(data, t_block_body, length) == 0)
+    t_block_whole++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+static int t_block_get_calls;
+static int t_block_releases;
+
+static void
+t_block_release(coap_session_t *s, void *app_ptr) {
+  (void)s;
+  (void)app_ptr;
+  t_block_releases++;
+}
+
+static void
+t_block_get_handler(coap_context_t *context, coap_resource_t *resource,
+                    coap_session_t *s, coap_pdu_t *request,
+                    coap_binary_t *token, coap_string_t *query,
+                    coap_pdu_t *response) {
+  (void)context;
+  t_block_get_calls++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data_large_response(resource, s, request, response, token, query,
+                               COAP_MEDIATYPE_TEXT_PLAIN, -1, 0x1234,
+                               3000, t_block_body, t_block_release, NULL);
+}
+
+/* Sends a PUT for path with a Block1 option of value block and the first
+ * length bytes of the body, and returns the code of the response */
+static coap_pdu_code_t
+t_block_put(coap_context_t *sctx, coap_context_t *cctx, coap_session_t *s,
+            const char *path, unsigned int block, size_t length) {
+  coap_pdu_t *pdu = coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT, s);
+  uint8_t token[8];
+  uint8_t buf[4];
+  size_t len;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_session_new_token(s, &len, token);
+  CU_ASSERT_FATAL(coap_add_token(pdu, len, token));
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, strlen(path),
+                  (const uint8_t *)path);
+  coap_add_option(pdu, COAP_OPTION_BLOCK1,
+                  coap_encode_var_safe(buf, sizeof(buf), block), buf);
+  coap_add_option(pdu, COAP_OPTION_SIZE1,
+                  coap_encode_var_safe(buf, sizeof(buf),
+                                       sizeof(t_block_body)), buf);
+  CU_ASSERT_FATAL(coap_add_data(pdu, length, t_block_body));
+  t_block_code = 0;
+  t_block_responses = 0;
+  CU_ASSERT(coap_send(s, pdu) != COAP_INVALID_MID);
+  t_loopback_run(sctx, cctx, s, &t_block_responses, 1);
+  return t_block_code;
+}
+
+/* Test 1 checks that SZX 7 is taken as a BERT block of one or more 1024
+ * byte blocks on reliable sessions, and as SZX 6 on unreliable ones. */
+static void
+t_block1(void) {
+  coap_session_t s;
+  coap_block_b_t block;
+  coap_pdu_t *pdu;
+  uint8_t buf[4];
+
+  memset(&s, 0, sizeof(s));
+  pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_RESPONSE_CODE_CONTENT, 0, 4096);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_add_option(pdu, COAP_OPTION_BLOCK2,
+                  coap_encode_var_safe(buf, sizeof(buf), (2 << 4) | 0x0f),
+                  buf);
+  coap_add_data(pdu, 2048, t_block_body);
+
+  s.proto = COAP_PROTO_UDP;
+  CU_ASSERT_FATAL(coap_get_block_b(&s, pdu, COAP_OPTION_BLOCK2, &block));
+  CU_ASSERT(block.num == 2);
+  CU_ASSERT(block.m == 1);
+  CU_ASSERT(block.szx == 6);
+  CU_ASSERT(block.aszx == COAP_BERT_SZX);
+  CU_ASSERT(block.bert == 0);
+  CU_ASSERT(block.chunk_size == 1024);
+
+  s.proto = COAP_PROTO_TCP;
+  CU_ASSERT_FATAL(coap_get_block_b(&s, pdu, COAP_OPTION_BLOCK2, &block));
+  CU_ASSERT(block.num == 2);
+  CU_ASSERT(block.szx == 6);
+  CU_ASSERT(block.bert == 1);
+  CU_ASSERT(block.chunk_size == 2048);
+  coap_delete_pdu(pdu);
+}
+
+/* Test 2 checks that BERT is used once both ends of a TCP session have
+ * announced Block-Wise-Transfer, that a body is sent with several blocks
+ * in each PDU, and that a BERT block with more to follow that is not made
+ * up of whole 1024 byte blocks is rejected. */
+static void
+t_block2(void) {
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_lg_xmit_t *lg_xmit;
+  coap_pdu_t *pdu;
+  uint8_t token[8];
+  size_t len;
+  size_t i;
+
+  if (!coap_tcp_is_supported()) {
+    CU_PASS("TCP is not supported");
+    return;
+  }
+  for (i = 0; i < sizeof(t_block_body); i++)
+    t_block_body[i] = (uint8_t)(i * 7);
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  coap_context_set_block_mode(sctx,
+                              COAP_BLOCK_USE_LIBCOAP | COAP_BLOCK_SINGLE_BODY);
+  r = coap_resource_init(coap_make_str_const("bert"), 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_PUT, t_block_put_handler);
+  coap_add_resource(sctx, r);
+  r = coap_resource_init(coap_make_str_const("raw"), 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_PUT, t_block_put_handler);
+  coap_add_resource(sctx, r);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_context_set_block_mode(cctx, COAP_BLOCK_USE_LIBCOAP);
+  coap_register_response_handler(cctx, t_block_response);
+  s = coap_new_client_session(cctx, NULL, &ep->bind_addr, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  t_loopback_run(sctx, cctx, s, NULL, 0);
+  CU_ASSERT_FATAL(s->state == COAP_SESSION_STATE_ESTABLISHED);
+  CU_ASSERT(s->csm_block_supported);
+  CU_ASSERT(s->csm_bert_rem_support);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep->sessions);
+  CU_ASSERT(ep->sessions->csm_bert_rem_support);
+
+  /* More to follow, but a part of a block */
+  CU_ASSERT(t_block_put(sctx, cctx, s, "raw", 0x0f, 1500) ==
+            COAP_RESPONSE_CODE_BAD_REQUEST);
+  /* Two whole blocks */
+  CU_ASSERT(t_block_put(sctx, cctx, s, "raw", 0x0f, 2048) ==
+            COAP_RESPONSE_CODE_CONTINUE);
+
+  /* Room for two blocks in each PDU */
+  coap_session_set_mtu(s, 2600);
+  pdu = coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT, s);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_session_new_token(s, &len, token);
+  CU_ASSERT_FATAL(coap_add_token(pdu, len, token));
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 4, (const uint8_t *)"bert");
+  CU_ASSERT_FATAL(coap_add_data_large_request(s, pdu, sizeof(t_block_body),
+                                              t_block_body, NULL, NULL));
+  lg_xmit = s->lg_xmit;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(lg_xmit);
+  CU_ASSERT(lg_xmit->blk_size == COAP_BERT_SZX);
+  CU_ASSERT(lg_xmit->bert_size == 2048);
+  t_block_whole = 0;
+  t_block_responses = 0;
+  CU_ASSERT(coap_send_large(s, pdu) != COAP_INVALID_MID);
+  t_loopback_run(sctx, cctx, s, &t_block_responses, 1);
+  CU_ASSERT(t_block_responses == 1);
+  CU_ASSERT(t_block_code == COAP_RESPONSE_CODE_CHANGED);
+  CU_ASSERT(t_block_whole == 1);
+
+  coap_session_release(s);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+/* Passes a GET for block num of the large resource to s */
+static void
+t_block_get(coap_session_t *s, uint16_t mid, uint8_t num) {
+  uint8_t request[] = { 0x41, 0x01, 0x00, 0x00, 't',
+                        0xb5, 'l', 'a', 'r', 'g', 'e', 0xc1, 0x06 };
+
+  request[2] = (uint8_t)(mid >> 8);
+  request[3] = (uint8_t)mid;
+  request[12] |= (uint8_t)(num << 4);
+  coap_handle_dgram(s->context, s, request, sizeof(request));
+}
+
+/* Test 3 checks that the server side of a Block2 transfer is kept for
+ * EXCHANGE_LIFETIME seconds between block requests, and so survives a gap
+ * of more than a second. */
+static void
+t_block3(void) {
+  coap_context_t *sctx;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_lg_xmit_t *lg_xmit;
+  coap_tick_t last_used;
+
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  coap_context_set_block_mode(sctx, COAP_BLOCK_USE_LIBCOAP);
+  r = coap_resource_init(coap_make_str_const("large"), 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_GET, t_block_get_handler);
+  coap_add_resource(sctx, r);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s = t_loopback_peer(ep, 30030);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  t_block_get_calls = 0;
+  t_block_get(s, 0x7001, 0);
+  CU_ASSERT(t_block_get_calls == 1);
+  lg_xmit = s->lg_xmit;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(lg_xmit);
+  last_used = lg_xmit->last_used;
+
+  /* Two seconds later the transfer is still there */
+  CU_ASSERT(coap_block_check_lg_timeouts(s,
+                                         last_used + 2 * COAP_TICKS_PER_SECOND)
+            != (coap_tick_t)-1);
+  CU_ASSERT_PTR_EQUAL(s->lg_xmit, lg_xmit);
+  /* and the next block comes from it */
+  t_block_get(s, 0x7002, 1);
+  CU_ASSERT(t_block_get_calls == 1);
+  CU_ASSERT_PTR_EQUAL(s->lg_xmit, lg_xmit);
+
+  /* It goes once EXCHANGE_LIFETIME has passed without a request */
+  last_used = lg_xmit->last_used;
+  coap_block_check_lg_timeouts(s, last_used +
+                      (coap_tick_t)COAP_EXCHANGE_LIFETIME(s) *
+                      COAP_TICKS_PER_SECOND - 1);
+  CU_ASSERT_PTR_EQUAL(s->lg_xmit, lg_xmit);
+  coap_block_check_lg_timeouts(s, last_used +
+                      (coap_tick_t)COAP_EXCHANGE_LIFETIME(s) *
+                      COAP_TICKS_PER_SECOND);
+  CU_ASSERT_PTR_NULL(s->lg_xmit);
+
+  coap_free_context(sctx);
+}
+
+/* Test 4 checks that the body of a large response with an ETag is shared
+ * by the transfers of the same representation to different sessions, and
+ * that it is freed with the last transfer that uses it. */
+static void
+t_block4(void) {
+  coap_context_t *sctx;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s1, *s2;
+  coap_lg_body_t *body;
+  coap_tick_t later;
+
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  coap_context_set_block_mode(sctx, COAP_BLOCK_USE_LIBCOAP);
+  r = coap_resource_init(coap_make_str_const("large"), 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_GET, t_block_get_handler);
+  coap_add_resource(sctx, r);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s1 = t_loopback_peer(ep, 30031);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s1);
+  s2 = t_loopback_peer(ep, 30032);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s2);
+
+  t_block_releases = 0;
+  t_block_get(s1, 0x7101, 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s1->lg_xmit);
+  body = s1->lg_xmit->body;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(body);
+  CU_ASSERT_PTR_EQUAL(sctx->lg_body, body);
+  CU_ASSERT(body->ref == 1);
+
+  /* The second copy given by the application is not needed */
+  t_block_get(s2, 0x7102, 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s2->lg_xmit);
+  CU_ASSERT_PTR_EQUAL(s2->lg_xmit->body, body);
+  CU_ASSERT(body->ref == 2);
+  CU_ASSERT(t_block_releases == 1);
+  CU_ASSERT_PTR_EQUAL(s2->lg_xmit->data, s1->lg_xmit->data);
+
+  /* The body stays with the remaining transfer */
+  later = s1->lg_xmit->last_used +
+          (coap_tick_t)COAP_EXCHANGE_LIFETIME(s1) * COAP_TICKS_PER_SECOND;
+  coap_block_check_lg_timeouts(s1, later);
+  CU_ASSERT_PTR_NULL(s1->lg_xmit);
+  CU_ASSERT(body->ref == 1);
+  CU_ASSERT_PTR_EQUAL(sctx->lg_body, body);
+  CU_ASSERT(t_block_releases == 1);
+
+  /* and is released with it, which may have been sent a tick later */
+  later = s2->lg_xmit->last_used +
+          (coap_tick_t)COAP_EXCHANGE_LIFETIME(s2) * COAP_TICKS_PER_SECOND;
+  coap_block_check_lg_timeouts(s2, later);
+  CU_ASSERT_PTR_NULL(s2->lg_xmit);
+  CU_ASSERT_PTR_NULL(sctx->lg_body);
+  CU_ASSERT(t_block_releases == 2);
+
+  coap_free_context(sctx);
+}
+
+/* Returns the BLOCK1 lg_xmit of s that has a token with the bottom 32 bits
+ * of token */
+static coap_lg_xmit_t *
+t_block_find_b1(coap_session_t *s, uint64_t token) {
+  coap_lg_xmit_key_t key;
+  coap_lg_xmit_t *lg_xmit;
+
+  memset(&key, 0, sizeof(key));
+  key.id = (uint32_t)(token & 0xffffffff);
+  LG_XMIT_FIND(s->lg_xmit, key, lg_xmit);
+  return lg_xmit;
+}
+
+/* Adds a large PUT body to a new request with app_token and returns the
+ * request */
+static coap_pdu_t *
+t_block_large_put(coap_session_t *s, uint8_t app_token) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT,
+                                  coap_new_message_id(s),
+                                  coap_session_max_pdu_size(s));
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  CU_ASSERT_FATAL(coap_add_token(pdu, 1, &app_token));
+  CU_ASSERT_FATAL(coap_add_data_large_request(s, pdu, 3000, t_block_body,
+                                              NULL, NULL));
+  return pdu;
+}
+
+/* Test 5 checks that BLOCK1 lg_xmits are found from any of the tokens of
+ * their transfer, that a new transfer never shares the bottom 32 bits of
+ * its token with another, and that transfers are replaced and deleted. */
+static void
+t_block5(void) {
+  coap_context_t *cctx;
+  coap_address_t saddr;
+  coap_session_t *s;
+  coap_lg_xmit_t *a, *b;
+  coap_pdu_t *pdu1, *pdu2, *pdu3, *rcvd;
+  uint64_t token_a, token_b;
+  uint8_t token[8];
+  size_t len;
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_context_set_block_mode(cctx, COAP_BLOCK_USE_LIBCOAP);
+  coap_address_init(&saddr);
+  saddr.size = sizeof(struct sockaddr_in6);
+  saddr.addr.sin6.sin6_family = AF_INET6;
+  saddr.addr.sin6.sin6_addr = in6addr_loopback;
+  saddr.addr.sin6.sin6_port = htons(30033);
+  s = coap_new_client_session(cctx, NULL, &saddr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  pdu1 = t_block_large_put(s, 'a');
+  CU_ASSERT(HASH_COUNT(s->lg_xmit) == 1);
+  a = s->lg_xmit;
+  token_a = coap_decode_var_bytes8(a->b.b1.token, a->b.b1.token_length);
+  CU_ASSERT(token_a >> 32 == 1);
+  CU_ASSERT_PTR_EQUAL(t_block_find_b1(s, token_a), a);
+  /* The later PDUs of the transfer only differ in the top 32 bits */
+  CU_ASSERT_PTR_EQUAL(t_block_find_b1(s, token_a + ((uint64_t)5 << 32)), a);
+
+  /* The next session token would give the same bottom 32 bits */
+  s->tx_token = (token_a & 0xffffffff) - 1 + ((uint64_t)1 << 32);
+  pdu2 = t_block_large_put(s, 'b');
+  CU_ASSERT(HASH_COUNT(s->lg_xmit) == 2);
+  b = t_block_find_b1(s, s->tx_token);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+  CU_ASSERT(b != a);
+  token_b = coap_decode_var_bytes8(b->b.b1.token, b->b.b1.token_length);
+  CU_ASSERT((token_b & 0xffffffff) != (token_a & 0xffffffff));
+  CU_ASSERT_PTR_EQUAL(t_block_find_b1(s, token_a), a);
+
+  /* A new body for the same application token replaces the transfer */
+  pdu3 = t_block_large_put(s, 'a');
+  CU_ASSERT(HASH_COUNT(s->lg_xmit) == 2);
+  CU_ASSERT_PTR_NULL(t_block_find_b1(s, token_a));
+  CU_ASSERT_PTR_EQUAL(t_block_find_b1(s, token_b), b);
+
+  /* An error response to any PDU of a transfer ends it */
+  rcvd = coap_pdu_init(COAP_MESSAGE_ACK, COAP_RESPONSE_CODE_BAD_REQUEST, 0,
+                       64);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(rcvd);
+  len = coap_encode_var_safe8(token, sizeof(token_b),
+                              token_b + ((uint64_t)1 << 32));
+  CU_ASSERT_FATAL(coap_add_token(rcvd, len, token));
+  CU_ASSERT(coap_handle_response_send_block(s, rcvd) == 0);
+  CU_ASSERT(rcvd->token_length == 1 && rcvd->token[0] == 'b');
+  CU_ASSERT(HASH_COUNT(s->lg_xmit) == 1);
+  CU_ASSERT_PTR_NULL(t_block_find_b1(s, token_b));
+
+  coap_delete_pdu(rcvd);
+  coap_delete_pdu(pdu1);
+  coap_delete_pdu(pdu2);
+  coap_delete_pdu(pdu3);
+  coap_session_release(s);
+  coap_free_context(cctx);
+}
+
+static size_t t_block6_offset;
+static int t_block6_rekeyed;
+
+static coap_response_t
+t_block6_response(coap_context_t *context, coap_session_t *s,
+                  coap_pdu_t *sent, coap_pdu_t *received,
+                  const coap_mid_t id) {
+  coap_lg_crcv_t *lg_crcv;
+  size_t length, offset, total;
+  const uint8_t *data;
+
+  (void)context;
+  (void)sent;
+  (void)id;
+  if (coap_get_data_large(received, &length, &data, &offset, &total) &&
+      offset == t_block6_offset &&
+      memcmp(data, t_block_body + offset, length) == 0)
+    t_block6_offset += length;
+  /* Each block is asked for with a new token */
+  LG_CRCV_FIND(s->lg_crcv, (const uint8_t *)"g", 1, lg_crcv);
+  if (HASH_COUNT(s->lg_crcv) == 1 && lg_crcv == NULL)
+    t_block6_rekeyed++;
+  t_block_responses++;
+  return COAP_RESPONSE_OK;
+}
+
+/* Test 6 checks that the lg_crcv of a Block2 transfer is found by each of
+ * the tokens it uses in turn, and that it expires once the body is in. */
+static void
+t_block6(void) {
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_lg_crcv_t *lg_crcv;
+  coap_pdu_t *pdu;
+  coap_tick_t later;
+  size_t i;
+
+  for (i = 0; i < sizeof(t_block_body); i++)
+    t_block_body[i] = (uint8_t)(i * 7);
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  coap_context_set_block_mode(sctx, COAP_BLOCK_USE_LIBCOAP);
+  r = coap_resource_init(coap_make_str_const("large"), 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_GET, t_block_get_handler);
+  coap_add_resource(sctx, r);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_context_set_block_mode(cctx, COAP_BLOCK_USE_LIBCOAP);
+  coap_register_response_handler(cctx, t_block6_response);
+  s = coap_new_client_session(cctx, NULL, &ep->bind_addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  /* NON, so that the lg_crcv is set up when the request is sent */
+  pdu = coap_new_pdu(COAP_MESSAGE_NON, COAP_REQUEST_CODE_GET, s);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  CU_ASSERT_FATAL(coap_add_token(pdu, 1, (const uint8_t *)"g"));
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 5, (const uint8_t *)"large");
+  t_block_responses = 0;
+  t_block6_offset = 0;
+  t_block6_rekeyed = 0;
+  CU_ASSERT(coap_send_large(s, pdu) != COAP_INVALID_MID);
+  CU_ASSERT(HASH_COUNT(s->lg_crcv) == 1);
+  LG_CRCV_FIND(s->lg_crcv, (const uint8_t *)"g", 1, lg_crcv);
+  CU_ASSERT_PTR_NOT_NULL(lg_crcv);
+
+  t_loopback_run(sctx, cctx, s, &t_block_responses, 3);
+  CU_ASSERT(t_block_responses == 3);
+  CU_ASSERT(t_block6_offset == 3000);
+  CU_ASSERT(t_block6_rekeyed == 3);
+
+  /* Kept for the next body under the request token until it expires */
+  CU_ASSERT(HASH_COUNT(s->lg_crcv) == 1);
+  LG_CRCV_FIND(s->lg_crcv, (const uint8_t *)"g", 1, lg_crcv);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(lg_crcv);
+  CU_ASSERT(lg_crcv->last_used != 0);
+  later = lg_crcv->last_used +
+          (coap_tick_t)COAP_EXCHANGE_LIFETIME(s) * COAP_TICKS_PER_SECOND;
+  coap_block_check_lg_timeouts(s, later);
+  CU_ASSERT_PTR_NULL(s->lg_crcv);
+
+  coap_session_release(s);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+CU_pSuite
+t_init_block_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("block", NULL, NULL);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add block test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define BLOCK_TEST(s,t)                                                \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add block test (%s)\n",                \
+            CU_get_error_msg());                                      \
+  }
+
+  BLOCK_TEST(suite, t_block1);
+  BLOCK_TEST(suite, t_block2);
+  BLOCK_TEST(suite, t_block3);
+  BLOCK_TEST(suite, t_block4);
+  BLOCK_TEST(suite, t_block5);
+  BLOCK_TEST(suite, t_block6);
+
+  return suite;
+}
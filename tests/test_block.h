@@ -0,0 +1,11 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include <CUnit/CUnit.h>
+
+CU_pSuite t_init_block_tests(void);
@@ -0,0 +1,398 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+#include "test_cache.h"
+
+#include <stdio.h>
+
+static coap_context_t *ctx; /* Holds the coap context for the tests */
+
+static int dedup_calls;
+
+static void
+t_dedup_handler(coap_context_t *context, coap_resource_t *resource,
+                coap_session_t *s, coap_pdu_t *request,
+                coap_binary_t *token, coap_string_t *query,
+                coap_pdu_t *response) {
+  (void)context;
+  (void)resource;
+  (void)s;
+  (void)request;
+  (void)token;
+  (void)query;
+  dedup_calls++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+}
+
+/* Test 1 checks that a retransmitted CON request is answered from the
+ * Message-ID deduplication cache without calling the handler again, and
+ * that the cache is limited in size. */
+static void
+t_cache1(void) {
+  uint8_t request[] = { 0x40, 0x01, 0x10, 0x01,
+                        0xb5, 'd', 'e', 'd', 'u', 'p' };
+  uint8_t data[sizeof(request)];
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s;
+
+  CU_ASSERT(coap_context_get_mid_cache_size(ctx) ==
+            COAP_DEFAULT_MID_CACHE_SIZE);
+  coap_context_set_mid_cache_size(ctx, 4096);
+
+  r = coap_resource_init(coap_make_str_const("dedup"), 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_GET, t_dedup_handler);
+  coap_add_resource(ctx, r);
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s = t_loopback_peer(ep, 30010);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  dedup_calls = 0;
+  memcpy(data, request, sizeof(request));
+  coap_handle_dgram(ctx, s, data, sizeof(data));
+  CU_ASSERT(dedup_calls == 1);
+  CU_ASSERT(HASH_COUNT(s->mid_cache) == 1);
+  CU_ASSERT_PTR_NOT_NULL(s->mid_cache->response);
+  CU_ASSERT(ctx->mid_cache_size ==
+            sizeof(coap_mid_cache_t) + s->mid_cache->response->length);
+
+  /* The retransmission is answered from the cache */
+  memcpy(data, request, sizeof(request));
+  coap_handle_dgram(ctx, s, data, sizeof(data));
+  CU_ASSERT(dedup_calls == 1);
+
+  /* A new Message-ID is handled */
+  memcpy(data, request, sizeof(request));
+  data[3] = 0x02;
+  coap_handle_dgram(ctx, s, data, sizeof(data));
+  CU_ASSERT(dedup_calls == 2);
+  CU_ASSERT(HASH_COUNT(s->mid_cache) == 2);
+
+  /* Shrinking the cache evicts the least recently used request */
+  coap_context_set_mid_cache_size(ctx, ctx->mid_cache_size - 1);
+  CU_ASSERT(HASH_COUNT(s->mid_cache) == 1);
+  CU_ASSERT(s->mid_cache->mid == 0x1002);
+  memcpy(data, request, sizeof(request));
+  coap_handle_dgram(ctx, s, data, sizeof(data));
+  CU_ASSERT(dedup_calls == 3);
+
+  /* and disabling it forgets everything */
+  coap_context_set_mid_cache_size(ctx, 0);
+  CU_ASSERT_PTR_NULL(s->mid_cache);
+  CU_ASSERT_PTR_NULL(ctx->mid_cache_lru);
+  CU_ASSERT(ctx->mid_cache_size == 0);
+  memcpy(data, request, sizeof(request));
+  coap_handle_dgram(ctx, s, data, sizeof(data));
+  CU_ASSERT(dedup_calls == 4);
+
+  coap_context_set_mid_cache_size(ctx, COAP_DEFAULT_MID_CACHE_SIZE);
+  coap_delete_resource(ctx, r);
+  coap_free_endpoint(ep);
+}
+
+static int cached_calls;
+
+static void
+t_cached_handler(coap_context_t *context, coap_resource_t *resource,
+                 coap_session_t *s, coap_pdu_t *request,
+                 coap_binary_t *token, coap_string_t *query,
+                 coap_pdu_t *response) {
+  (void)context;
+  (void)resource;
+  (void)s;
+  (void)request;
+  (void)token;
+  (void)query;
+  cached_calls++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_option(response, COAP_OPTION_ETAG, 2, (const uint8_t *)"ab");
+  coap_add_data(response, 5, (const uint8_t *)"hello");
+}
+
+/* Returns the code of the response sent for mid, taken from the Message-ID
+ * deduplication cache */
+static int
+t_sent_code(coap_session_t *s, coap_mid_t mid) {
+  coap_mid_cache_t *entry;
+
+  MID_CACHE_FIND(s->mid_cache, mid, entry);
+  if (!entry || !entry->response)
+    return -1;
+  return entry->response->s[1];
+}
+
+/* Test 2 checks that the responses of a resource with
+ * COAP_RESOURCE_FLAGS_CACHE_RESPONSES are sent from the response cache,
+ * that a matching ETag gets 2.03 Valid, and that notifying invalidates. */
+static void
+t_cache2(void) {
+  uint8_t request[] = { 0x40, 0x01, 0x20, 0x01,
+                        0xb6, 'c', 'a', 'c', 'h', 'e', 'd' };
+  uint8_t etag_request[] = { 0x40, 0x01, 0x20, 0x03, 0x42, 'a', 'b',
+                             0x76, 'c', 'a', 'c', 'h', 'e', 'd' };
+  uint8_t observe_request[] = { 0x40, 0x01, 0x20, 0x05, 0x60,
+                                0x56, 'c', 'a', 'c', 'h', 'e', 'd' };
+  uint8_t data[sizeof(etag_request)];
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s;
+
+  r = coap_resource_init(coap_make_str_const("cached"),
+                         COAP_RESOURCE_FLAGS_CACHE_RESPONSES);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_register_handler(r, COAP_REQUEST_GET, t_cached_handler);
+  /* The response cache opts in to the default size limit */
+  CU_ASSERT(coap_context_get_cache_size(ctx) == 0);
+  coap_add_resource(ctx, r);
+  CU_ASSERT(coap_context_get_cache_size(ctx) == COAP_DEFAULT_CACHE_SIZE);
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s = t_loopback_peer(ep, 30012);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  cached_calls = 0;
+  memcpy(data, request, sizeof(request));
+  coap_handle_dgram(ctx, s, data, sizeof(request));
+  CU_ASSERT(cached_calls == 1);
+  CU_ASSERT(HASH_COUNT(ctx->response_cache) == 1);
+  CU_ASSERT(t_sent_code(s, 0x2001) == COAP_RESPONSE_CODE_CONTENT);
+
+  /* The next request is answered from the cache */
+  memcpy(data, request, sizeof(request));
+  data[3] = 0x02;
+  coap_handle_dgram(ctx, s, data, sizeof(request));
+  CU_ASSERT(cached_calls == 1);
+  CU_ASSERT(t_sent_code(s, 0x2002) == COAP_RESPONSE_CODE_CONTENT);
+
+  /* and one with the current ETag gets 2.03 */
+  memcpy(data, etag_request, sizeof(etag_request));
+  coap_handle_dgram(ctx, s, data, sizeof(etag_request));
+  CU_ASSERT(cached_calls == 1);
+  CU_ASSERT(t_sent_code(s, 0x2003) == COAP_RESPONSE_CODE_VALID);
+
+  /* A change of the resource invalidates the cached response */
+  coap_resource_notify_observers(r, NULL);
+  CU_ASSERT_PTR_NULL(ctx->response_cache);
+  memcpy(data, request, sizeof(request));
+  data[3] = 0x04;
+  coap_handle_dgram(ctx, s, data, sizeof(request));
+  CU_ASSERT(cached_calls == 2);
+  CU_ASSERT(HASH_COUNT(ctx->response_cache) == 1);
+
+  /* Observe requests always go to the handler */
+  memcpy(data, observe_request, sizeof(observe_request));
+  coap_handle_dgram(ctx, s, data, sizeof(observe_request));
+  CU_ASSERT(cached_calls == 3);
+
+  coap_delete_resource(ctx, r);
+  CU_ASSERT_PTR_NULL(ctx->response_cache);
+  coap_free_endpoint(ep);
+}
+
+static coap_pdu_t *
+t_cache_request(const char *path) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  0x3001, 64);
+
+  if (pdu)
+    coap_add_option(pdu, COAP_OPTION_URI_PATH, strlen(path),
+                    (const uint8_t *)path);
+  return pdu;
+}
+
+/* Test 3 checks that cache-entries are evicted least recently used first
+ * to stay within the context's limit, that they are expired in order, and
+ * that the statistics are kept. */
+static void
+t_cache3(void) {
+  coap_pdu_t *pdu_a = t_cache_request("a");
+  coap_pdu_t *pdu_b = t_cache_request("b");
+  coap_pdu_t *pdu_c = t_cache_request("c");
+  coap_cache_stats_t before, stats;
+  coap_address_t addr;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_tick_t now;
+  coap_tick_t remaining;
+  size_t entry_size;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu_a);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu_b);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu_c);
+  t_loopback_address(&addr, COAP_DEFAULT_PORT);
+  s = coap_new_client_session(ctx, NULL, &addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  coap_cache_get_stats(ctx, &before);
+  CU_ASSERT(before.entries == 0);
+  CU_ASSERT(before.bytes == 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(
+    coap_new_cache_entry(s, pdu_a, COAP_CACHE_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED, 1));
+  coap_cache_get_stats(ctx, &stats);
+  entry_size = stats.bytes;
+  CU_ASSERT(entry_size > sizeof(coap_cache_entry_t));
+
+  /* Room for two entries */
+  coap_context_set_cache_size(ctx, entry_size * 2 + entry_size / 2);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(
+    coap_new_cache_entry(s, pdu_b, COAP_CACHE_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED, 1));
+  CU_ASSERT_PTR_NOT_NULL(coap_cache_get_by_pdu(s, pdu_a,
+                                               COAP_CACHE_NOT_SESSION_BASED));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(
+    coap_new_cache_entry(s, pdu_c, COAP_CACHE_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED, 1));
+
+  /* b was the least recently used */
+  CU_ASSERT_PTR_NULL(coap_cache_get_by_pdu(s, pdu_b,
+                                           COAP_CACHE_NOT_SESSION_BASED));
+  CU_ASSERT_PTR_NOT_NULL(coap_cache_get_by_pdu(s, pdu_c,
+                                               COAP_CACHE_NOT_SESSION_BASED));
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.entries == 2);
+  CU_ASSERT(stats.bytes == entry_size * 2);
+  CU_ASSERT(stats.hits - before.hits == 2);
+  CU_ASSERT(stats.misses - before.misses == 1);
+  CU_ASSERT(stats.evictions - before.evictions == 1);
+
+  /* Expiry only looks at what is due */
+  coap_ticks(&now);
+  remaining = coap_expire_cache_entries(ctx, now);
+  CU_ASSERT(remaining > 0 && remaining <= COAP_TICKS_PER_SECOND);
+  CU_ASSERT(coap_expire_cache_entries(ctx, now + 2 * COAP_TICKS_PER_SECOND)
+            == 0);
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.entries == 0);
+  CU_ASSERT(stats.bytes == 0);
+  CU_ASSERT(stats.expiries - before.expiries == 2);
+  CU_ASSERT_PTR_NULL(ctx->cache_lru);
+  CU_ASSERT_PTR_NULL(ctx->cache_expire);
+
+  /* A limit set by the application is kept */
+  coap_context_set_cache_size(ctx, 0);
+  r = coap_resource_init(coap_make_str_const("cached3"),
+                         COAP_RESOURCE_FLAGS_CACHE_RESPONSES);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_add_resource(ctx, r);
+  CU_ASSERT(coap_context_get_cache_size(ctx) == 0);
+
+  coap_context_set_cache_size(ctx, COAP_DEFAULT_CACHE_SIZE);
+  coap_session_release(s);
+  coap_delete_pdu(pdu_a);
+  coap_delete_pdu(pdu_b);
+  coap_delete_pdu(pdu_c);
+}
+
+/* Test 4 checks the COAP_CACHE_KEY_FAST cache-keys, including that a
+ * hash match with different cache-key information is not used. */
+static void
+t_cache4(void) {
+  coap_pdu_t *pdu_a = t_cache_request("a");
+  coap_pdu_t *pdu_b = t_cache_request("b");
+  coap_cache_key_t *key1, *key2;
+  coap_cache_entry_t *entry;
+  coap_address_t addr;
+  coap_session_t *s;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu_a);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu_b);
+  t_loopback_address(&addr, COAP_DEFAULT_PORT);
+  s = coap_new_client_session(ctx, NULL, &addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  CU_ASSERT(coap_context_get_cache_key_mode(ctx) == COAP_CACHE_KEY_DIGEST);
+  CU_ASSERT_PTR_NOT_NULL(
+    coap_new_cache_entry(s, pdu_a, COAP_CACHE_NOT_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED, 0));
+  /* Changing the mode drops the existing cache-entries */
+  coap_context_set_cache_key_mode(ctx, COAP_CACHE_KEY_FAST);
+  CU_ASSERT(coap_context_get_cache_key_mode(ctx) == COAP_CACHE_KEY_FAST);
+  CU_ASSERT_PTR_NULL(ctx->cache);
+
+  key1 = coap_cache_derive_key(s, pdu_a, COAP_CACHE_NOT_SESSION_BASED);
+  key2 = coap_cache_derive_key(s, pdu_a, COAP_CACHE_NOT_SESSION_BASED);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(key1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(key2);
+  CU_ASSERT(memcmp(key1->key, key2->key, sizeof(key1->key)) == 0);
+  coap_delete_cache_key(key2);
+  key2 = coap_cache_derive_key(s, pdu_b, COAP_CACHE_NOT_SESSION_BASED);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(key2);
+  CU_ASSERT(memcmp(key1->key, key2->key, sizeof(key1->key)) != 0);
+  coap_delete_cache_key(key2);
+  key2 = coap_cache_derive_key(s, pdu_a, COAP_CACHE_IS_SESSION_BASED);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(key2);
+  CU_ASSERT(memcmp(key1->key, key2->key, sizeof(key1->key)) != 0);
+  coap_delete_cache_key(key2);
+
+  entry = coap_new_cache_entry(s, pdu_a, COAP_CACHE_NOT_RECORD_PDU,
+                               COAP_CACHE_NOT_SESSION_BASED, 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(entry);
+  CU_ASSERT(coap_cache_get_by_key(ctx, key1) == entry);
+  CU_ASSERT(coap_cache_get_by_pdu(s, pdu_a,
+                                  COAP_CACHE_NOT_SESSION_BASED) == entry);
+  CU_ASSERT_PTR_NULL(coap_cache_get_by_pdu(s, pdu_b,
+                                           COAP_CACHE_NOT_SESSION_BASED));
+
+  /* Simulate a collision: same hash, different information */
+  CU_ASSERT_PTR_NOT_NULL_FATAL(key1->data);
+  key1->data->s[key1->data->length - 1] ^= 0xff;
+  CU_ASSERT_PTR_NULL(coap_cache_get_by_key(ctx, key1));
+
+  coap_delete_cache_key(key1);
+  coap_context_set_cache_key_mode(ctx, COAP_CACHE_KEY_DIGEST);
+  CU_ASSERT_PTR_NULL(ctx->cache);
+  coap_session_release(s);
+  coap_delete_pdu(pdu_a);
+  coap_delete_pdu(pdu_b);
+}
+
+static int
+t_cache_tests_create(void) {
+  ctx = coap_new_context(NULL);
+  return ctx == NULL;
+}
+
+static int
+t_cache_tests_remove(void) {
+  coap_free_context(ctx);
+  return 0;
+}
+
+CU_pSuite
+t_init_cache_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("cache",
+                       t_cache_tests_create, t_cache_tests_remove);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add cache test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define CACHE_TEST(s,t)                                                \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add cache test (%s)\n",                \
+            CU_get_error_msg());                                      \
+  }
+
+  CACHE_TEST(suite, t_cache1);
+  CACHE_TEST(suite, t_cache2);
+  CACHE_TEST(suite, t_cache3);
+  CACHE_TEST(suite, t_cache4);
+
+  return suite;
+}
@@ -0,0 +1,10 @@
+/* libcoap unit tests common include
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "coap2/coap_internal.h"
+
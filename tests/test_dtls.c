@@ -0,0 +1,644 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+#include "test_dtls.h"
+
+#include <stdio.h>
+
+static coap_context_t *ctx; /* Holds the coap context for the tests */
+
+static uint8_t t_sent[64];
+static size_t t_sent_len;
+
+static ssize_t
+t_capture_send(coap_socket_t *sock, const coap_session_t *s,
+               const uint8_t *data, size_t datalen) {
+  (void)sock;
+  (void)s;
+  t_sent_len = datalen <= sizeof(t_sent) ? datalen : 0;
+  memcpy(t_sent, data, t_sent_len);
+  return (ssize_t)datalen;
+}
+
+/* Builds a DTLS ClientHello with the cookie into packet */
+static void
+t_client_hello(coap_packet_t *packet, const uint8_t *cookie,
+               size_t cookie_len) {
+  static const uint8_t suites[] = { 0x00, 0x02, 0x00, 0xa8, 0x01, 0x00 };
+  size_t hello_len = 2 + 32 + 1 + 1 + cookie_len + sizeof(suites);
+  uint8_t *p = packet->payload;
+
+  memset(p, 0, 13 + 12 + hello_len);
+  p[0] = 22;                     /* handshake, DTLS 1.2, epoch and seq 0 */
+  p[1] = 0xfe;
+  p[2] = 0xfd;
+  p[12] = (uint8_t)(12 + hello_len);
+  p[13] = 1;                     /* ClientHello, unfragmented */
+  p[16] = p[24] = (uint8_t)hello_len;
+  p[25] = 0xfe;
+  p[26] = 0xfd;
+  memset(&p[27], 0x5a, 32);      /* random, no session_id */
+  p[60] = (uint8_t)cookie_len;
+  if (cookie_len)
+    memcpy(&p[61], cookie, cookie_len);
+  memcpy(&p[61 + cookie_len], suites, sizeof(suites));
+  packet->length = 13 + 12 + hello_len;
+}
+
+/* Test 1 checks that a ClientHello on a DTLS endpoint is answered with
+ * a HelloVerifyRequest without a session being created, and that one is
+ * only created once the ClientHello echoes the cookie from the same
+ * address. */
+static void
+t_dtls1(void) {
+  static const uint8_t key[] = "secret";
+  coap_context_t *dctx;
+  coap_endpoint_t *ep;
+  coap_packet_t *packet;
+  coap_session_t *s;
+  uint8_t cookie[16];
+  coap_tick_t now = 1000;
+
+  if (!coap_dtls_is_supported() || !coap_dtls_hello_needs_cookie()) {
+    CU_PASS("DTLS cookies are not checked by libcoap");
+    return;
+  }
+  dctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(dctx);
+  CU_ASSERT_FATAL(coap_context_set_psk(dctx, "hint", key, sizeof(key) - 1));
+  ep = t_loopback_endpoint(dctx, COAP_PROTO_DTLS);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  dctx->network_send = t_capture_send;
+  packet = t_loopback_packet(ep, 30017);
+
+  /* No cookie: a HelloVerifyRequest, but no session */
+  t_client_hello(packet, NULL, 0);
+  t_sent_len = 0;
+  CU_ASSERT_PTR_NULL(coap_endpoint_get_session(ep, packet, now));
+  CU_ASSERT_PTR_NULL(ep->sessions);
+  CU_ASSERT(ep->num_hs == 0);
+  CU_ASSERT_FATAL(t_sent_len == 13 + 12 + 3 + sizeof(cookie));
+  CU_ASSERT(t_sent[0] == 22);
+  CU_ASSERT(t_sent[13] == 3);
+  CU_ASSERT(t_sent[27] == sizeof(cookie));
+  memcpy(cookie, &t_sent[28], sizeof(cookie));
+
+  /* A cookie that does not match the address */
+  t_client_hello(packet, cookie, sizeof(cookie));
+  packet->addr_info.remote.addr.sin6.sin6_port = htons(30018);
+  t_sent_len = 0;
+  CU_ASSERT_PTR_NULL(coap_endpoint_get_session(ep, packet, now));
+  CU_ASSERT_PTR_NULL(ep->sessions);
+  CU_ASSERT(t_sent_len == 13 + 12 + 3 + sizeof(cookie));
+
+  /* A truncated ClientHello is dropped */
+  packet->addr_info.remote.addr.sin6.sin6_port = htons(30017);
+  packet->length -= 8;
+  t_sent_len = 0;
+  CU_ASSERT_PTR_NULL(coap_endpoint_get_session(ep, packet, now));
+  CU_ASSERT(t_sent_len == 0);
+
+  /* The cookie echoed from the address it was sent to */
+  t_client_hello(packet, cookie, sizeof(cookie));
+  s = coap_endpoint_get_session(ep, packet, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  CU_ASSERT(s->type == COAP_SESSION_TYPE_HELLO);
+  CU_ASSERT(HASH_COUNT(ep->sessions) == 1);
+
+  coap_free(packet);
+  coap_free_context(dctx);
+}
+
+/* Test 2 checks that a record with the Connection ID of a session is
+ * routed to it from any address, and that the session only moves to the
+ * new address once a message from there has been handled.  The routing
+ * does not depend on the (D)TLS library, so a UDP endpoint is used. */
+static void
+t_dtls2(void) {
+  uint8_t ack[] = { 0x60, 0x00, 0x12, 0x34 };
+  coap_endpoint_t *ep;
+  coap_packet_t *packet;
+  coap_session_t *s, *other;
+  uint8_t cid[COAP_DTLS_CID_LENGTH];
+  coap_tick_t now = 1000;
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  packet = t_loopback_packet(ep, 30020);
+  memcpy(packet->payload, ack, sizeof(ack));
+  packet->length = sizeof(ack);
+  s = coap_endpoint_get_session(ep, packet, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  CU_ASSERT_FATAL(coap_session_new_cid(s, cid));
+  CU_ASSERT_PTR_NOT_NULL(s->cid);
+  CU_ASSERT(HASH_COUNT(ep->cid_sessions) == 1);
+
+  /* Left over at the address the peer moves to */
+  packet->addr_info.remote.addr.sin6.sin6_port = htons(30021);
+  other = coap_endpoint_get_session(ep, packet, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(other);
+  CU_ASSERT(other != s);
+
+  /* A record with the CID from another address */
+  memset(packet->payload, 0, 13 + COAP_DTLS_CID_LENGTH);
+  packet->payload[0] = 25;
+  packet->payload[1] = 0xfe;
+  packet->payload[2] = 0xfd;
+  memcpy(&packet->payload[11], cid, sizeof(cid));
+  packet->length = 13 + COAP_DTLS_CID_LENGTH;
+  CU_ASSERT_PTR_EQUAL(coap_endpoint_get_session(ep, packet, now), s);
+  CU_ASSERT(s->cid->rebinding);
+
+  /* Not handled (as if it did not decrypt), so the session stays put */
+  coap_session_cid_rebind_done(s);
+  CU_ASSERT(!s->cid->rebinding);
+  CU_ASSERT(ntohs(s->addr_info.remote.addr.sin6.sin6_port) == 30020);
+  memcpy(packet->payload, ack, sizeof(ack));
+  packet->length = sizeof(ack);
+  CU_ASSERT_PTR_EQUAL(coap_endpoint_get_session(ep, packet, now), other);
+
+  /* A message handled from the new address moves the session there */
+  memset(packet->payload, 0, 13 + COAP_DTLS_CID_LENGTH);
+  packet->payload[0] = 25;
+  memcpy(&packet->payload[11], cid, sizeof(cid));
+  packet->length = 13 + COAP_DTLS_CID_LENGTH;
+  CU_ASSERT_PTR_EQUAL(coap_endpoint_get_session(ep, packet, now), s);
+  coap_handle_dgram(ctx, s, ack, sizeof(ack));
+  CU_ASSERT(!s->cid->rebinding);
+  CU_ASSERT(ntohs(s->addr_info.remote.addr.sin6.sin6_port) == 30021);
+  CU_ASSERT(HASH_COUNT(ep->sessions) == 1);
+  memcpy(packet->payload, ack, sizeof(ack));
+  packet->length = sizeof(ack);
+  CU_ASSERT_PTR_EQUAL(coap_endpoint_get_session(ep, packet, now), s);
+
+  coap_free(packet);
+  coap_free_endpoint(ep);
+}
+
+/* Test 3 checks that imported client (D)TLS states are kept per server and
+ * client credentials, only for the (D)TLS library they came from, and that
+ * the oldest one is dropped once COAP_TLS_RESUME_MAX_SERVERS states are
+ * kept. */
+static void
+t_dtls3(void) {
+  /* Library, client credentials and state */
+  uint8_t state[1 + COAP_TLS_CREDENTIALS_LENGTH + 5] = { 0 };
+  coap_address_t server;
+  coap_session_t s;
+  coap_session_secure_t secure;
+  const coap_binary_t *found;
+  int i;
+
+  memset(&s, 0, sizeof(s));
+  s.context = ctx;
+  s.proto = COAP_PROTO_DTLS;
+  t_loopback_address(&server, 0);
+  memcpy(&state[1 + COAP_TLS_CREDENTIALS_LENGTH], "state", 5);
+
+  /* Only for the (D)TLS library it came from */
+  state[0] = (uint8_t)coap_get_tls_library_version()->type + 1;
+  CU_ASSERT(!coap_context_import_tls_state(ctx, &server, COAP_PROTO_DTLS,
+                                           state, sizeof(state)));
+  state[0] = (uint8_t)coap_get_tls_library_version()->type;
+  CU_ASSERT(!coap_context_import_tls_state(ctx, &server, COAP_PROTO_UDP,
+                                           state, sizeof(state)));
+  CU_ASSERT_PTR_NULL(ctx->tls_resume);
+
+  /* Port 0 is the default port for the protocol */
+  CU_ASSERT(coap_context_import_tls_state(ctx, &server, COAP_PROTO_DTLS,
+                                          state, sizeof(state)));
+  coap_address_copy(&s.addr_info.remote, &server);
+  coap_address_set_port(&s.addr_info.remote, COAPS_DEFAULT_PORT);
+  found = coap_session_tls_resume_state(&s);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(found);
+  CU_ASSERT(found->length == 5);
+  CU_ASSERT(memcmp(found->s, "state", found->length) == 0);
+  s.proto = COAP_PROTO_TLS;
+  CU_ASSERT_PTR_NULL(coap_session_tls_resume_state(&s));
+  s.proto = COAP_PROTO_DTLS;
+  /* Only for the credentials it was got with */
+  memset(&secure, 0, sizeof(secure));
+  s.secure = &secure;
+  CU_ASSERT_PTR_NOT_NULL(coap_session_tls_resume_state(&s));
+  secure.credentials[0] = 1;
+  CU_ASSERT_PTR_NULL(coap_session_tls_resume_state(&s));
+  s.secure = NULL;
+
+  /* A new state for the same server replaces the old one */
+  state[1 + COAP_TLS_CREDENTIALS_LENGTH] = 'S';
+  CU_ASSERT(coap_context_import_tls_state(ctx, &server, COAP_PROTO_DTLS,
+                                          state, sizeof(state)));
+  CU_ASSERT(HASH_COUNT(ctx->tls_resume) == 1);
+  found = coap_session_tls_resume_state(&s);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(found);
+  CU_ASSERT(found->s[0] == 'S');
+
+  /* The oldest state goes once the store is full */
+  for (i = 1; i <= COAP_TLS_RESUME_MAX_SERVERS; i++) {
+    server.addr.sin6.sin6_port = htons(40000 + i);
+    CU_ASSERT(coap_context_import_tls_state(ctx, &server, COAP_PROTO_DTLS,
+                                            state, sizeof(state)));
+  }
+  CU_ASSERT(HASH_COUNT(ctx->tls_resume) == COAP_TLS_RESUME_MAX_SERVERS);
+  CU_ASSERT_PTR_NULL(coap_session_tls_resume_state(&s));
+  coap_address_set_port(&s.addr_info.remote, 40001);
+  CU_ASSERT_PTR_NOT_NULL(coap_session_tls_resume_state(&s));
+
+  /* Sessions without a (D)TLS connection have no state to export */
+  s.type = COAP_SESSION_TYPE_CLIENT;
+  s.state = COAP_SESSION_STATE_ESTABLISHED;
+  CU_ASSERT_PTR_NULL(coap_session_export_tls_state(&s));
+
+  coap_context_free_tls_resume(ctx);
+  CU_ASSERT_PTR_NULL(ctx->tls_resume);
+}
+
+static int handshake_runs;
+static int handshake_dones;
+
+static int
+t_dtls4_run(coap_handshake_job_t *job) {
+  /* Only the record of the step is passed in */
+  CU_ASSERT_PTR_NOT_NULL(job->in);
+  if (job->in) {
+    coap_handshake_data_t *record = job->in;
+
+    CU_ASSERT_PTR_NULL(record->next);
+    CU_ASSERT(record->length == 1 && record->s[0] == 'a');
+    job->in = NULL;
+    coap_free(record);
+  }
+  coap_handshake_data_add(&job->out, (const uint8_t *)"out", 3);
+  handshake_runs++;
+  return 1;
+}
+
+static void
+t_dtls4_done(coap_handshake_job_t *job) {
+  /* The records received during the step are kept in order */
+  CU_ASSERT_PTR_NOT_NULL_FATAL(job->pending);
+  CU_ASSERT(job->pending->s[0] == 'b');
+  CU_ASSERT_PTR_NOT_NULL_FATAL(job->pending->next);
+  CU_ASSERT(job->pending->next->s[0] == 'c');
+  CU_ASSERT_PTR_NULL(job->pending->next->next);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(job->out);
+  CU_ASSERT(job->out->length == 3 && memcmp(job->out->s, "out", 3) == 0);
+  CU_ASSERT(job->result == 1);
+  handshake_dones++;
+}
+
+/* Test 4 checks that a handshake step is run by the worker threads and
+ * completed by coap_io_process(), with the records that arrive meanwhile
+ * held back. */
+static void
+t_dtls4(void) {
+  coap_session_t s;
+  int i;
+
+  memset(&s, 0, sizeof(s));
+  s.context = ctx;
+  s.proto = COAP_PROTO_DTLS;
+  s.ref = 1;
+
+  if (!coap_context_set_handshake_threads(ctx, 2)) {
+    /* Not supported by the (D)TLS library, so done inline */
+    CU_ASSERT(coap_context_get_handshake_threads(ctx) == 0);
+    CU_ASSERT(!coap_handshake_offload(&s, NULL, (const uint8_t *)"a", 1,
+                                      t_dtls4_run, t_dtls4_done));
+    CU_ASSERT_PTR_NULL(s.secure);
+    return;
+  }
+  CU_ASSERT(coap_context_get_handshake_threads(ctx) == 2);
+
+  handshake_runs = handshake_dones = 0;
+  CU_ASSERT(coap_handshake_offload(&s, NULL, (const uint8_t *)"a", 1,
+                                   t_dtls4_run, t_dtls4_done));
+  CU_ASSERT(coap_handshake_busy(&s));
+  CU_ASSERT(coap_handshake_offload(&s, NULL, (const uint8_t *)"b", 1,
+                                   t_dtls4_run, t_dtls4_done));
+  CU_ASSERT(coap_handshake_offload(&s, NULL, (const uint8_t *)"c", 1,
+                                   t_dtls4_run, t_dtls4_done));
+  /* Cannot be changed while a step is outstanding */
+  CU_ASSERT(!coap_context_set_handshake_threads(ctx, 1));
+
+  for (i = 0; i < 50 && !handshake_dones; i++)
+    coap_io_process(ctx, 100);
+  CU_ASSERT(handshake_runs == 1);
+  CU_ASSERT(handshake_dones == 1);
+  CU_ASSERT(!coap_handshake_busy(&s));
+  /* A completed handshake lets go of its job */
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s.secure);
+  CU_ASSERT_PTR_NULL(s.secure->handshake);
+  CU_ASSERT(s.ref == 1);
+
+  /* A queued step can be cancelled */
+  CU_ASSERT(coap_handshake_offload(&s, NULL, (const uint8_t *)"a", 1,
+                                   t_dtls4_run, t_dtls4_done));
+  coap_handshake_cancel(&s);
+  CU_ASSERT_PTR_NULL(s.secure->handshake);
+  CU_ASSERT(!coap_handshake_busy(&s));
+  coap_free_type(COAP_SESSION_SECURE, s.secure);
+
+  CU_ASSERT(coap_context_set_handshake_threads(ctx, 0));
+  CU_ASSERT(coap_context_get_handshake_threads(ctx) == 0);
+  CU_ASSERT_PTR_NULL(coap_handshake_socket(ctx));
+}
+
+static const uint8_t t_dtls_key[] = "secret";
+static int t_dtls_full;
+static int t_dtls_responses;
+
+static const coap_bin_const_t *
+t_dtls_identity(coap_bin_const_t *identity, coap_session_t *s, void *arg) {
+  static coap_bin_const_t key = { sizeof(t_dtls_key) - 1, t_dtls_key };
+
+  (void)identity;
+  (void)s;
+  (void)arg;
+  /* Only asked for in a full handshake */
+  t_dtls_full++;
+  return &key;
+}
+
+static coap_response_t
+t_dtls_response(coap_context_t *context, coap_session_t *s,
+                coap_pdu_t *sent, coap_pdu_t *received,
+                const coap_mid_t id) {
+  (void)context;
+  (void)s;
+  (void)sent;
+  (void)received;
+  (void)id;
+  t_dtls_responses++;
+  return COAP_RESPONSE_OK;
+}
+
+/* Returns a new context with a PSK DTLS endpoint in *ep, which counts the
+ * full handshakes in t_dtls_full */
+static coap_context_t *
+t_dtls_psk_server(coap_endpoint_t **ep) {
+  coap_context_t *sctx = coap_new_context(NULL);
+  coap_dtls_spsk_t setup_data;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  memset(&setup_data, 0, sizeof(setup_data));
+  setup_data.version = COAP_DTLS_SPSK_SETUP_VERSION;
+  setup_data.validate_id_call_back = t_dtls_identity;
+  setup_data.psk_info.key.s = t_dtls_key;
+  setup_data.psk_info.key.length = sizeof(t_dtls_key) - 1;
+  CU_ASSERT_FATAL(coap_context_set_psk2(sctx, &setup_data));
+  *ep = t_loopback_endpoint(sctx, COAP_PROTO_DTLS);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(*ep);
+  return sctx;
+}
+
+/* Returns a DTLS client session of cctx with identity and sni to ep, once
+ * it is established */
+static coap_session_t *
+t_dtls_psk_client(coap_context_t *sctx, coap_context_t *cctx,
+                  coap_endpoint_t *ep, const char *identity, char *sni) {
+  coap_dtls_cpsk_t setup_data;
+  coap_session_t *s;
+
+  memset(&setup_data, 0, sizeof(setup_data));
+  setup_data.version = COAP_DTLS_CPSK_SETUP_VERSION;
+  setup_data.client_sni = sni;
+  setup_data.psk_info.identity.s = (const uint8_t *)identity;
+  setup_data.psk_info.identity.length = strlen(identity);
+  setup_data.psk_info.key.s = t_dtls_key;
+  setup_data.psk_info.key.length = sizeof(t_dtls_key) - 1;
+  s = coap_new_client_session_psk2(cctx, NULL, &ep->bind_addr,
+                                   COAP_PROTO_DTLS, &setup_data);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  t_loopback_run(sctx, cctx, s, NULL, 0);
+  CU_ASSERT(s->state == COAP_SESSION_STATE_ESTABLISHED);
+  return s;
+}
+
+/* Test 5 checks that only established DTLS server sessions with (D)TLS
+ * objects hibernate, and that the hibernation timeout is only taken where
+ * the (D)TLS library can serialise its connections.  Where it can, a
+ * hibernated session has to exchange PDUs again without a new handshake. */
+static void
+t_dtls5(void) {
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_session_t *cs, *ss;
+  coap_pdu_t *pdu;
+  coap_session_t s;
+  int full;
+
+  memset(&s, 0, sizeof(s));
+  s.context = ctx;
+  s.proto = COAP_PROTO_DTLS;
+  s.type = COAP_SESSION_TYPE_SERVER;
+  s.state = COAP_SESSION_STATE_HANDSHAKE;
+
+  CU_ASSERT(coap_context_set_hibernate_timeout(ctx, 30) ==
+            coap_dtls_can_hibernate());
+  CU_ASSERT(coap_context_get_hibernate_timeout(ctx) ==
+            (coap_dtls_can_hibernate() ? 30U : 0U));
+
+  CU_ASSERT(!coap_session_hibernate(&s));
+  s.state = COAP_SESSION_STATE_ESTABLISHED;
+  CU_ASSERT(!coap_session_hibernate(&s));
+  s.proto = COAP_PROTO_UDP;
+  CU_ASSERT(!coap_session_hibernate(&s));
+  CU_ASSERT(!coap_session_is_hibernated(&s));
+
+  /* Nothing to restore */
+  CU_ASSERT(coap_session_rehydrate(&s));
+  CU_ASSERT_PTR_NULL(s.tls);
+
+  CU_ASSERT(coap_context_set_hibernate_timeout(ctx, 0));
+  CU_ASSERT(coap_context_get_hibernate_timeout(ctx) == 0);
+
+  /* Only mbed TLS built with MBEDTLS_SSL_CONTEXT_SERIALIZATION */
+  if (!coap_dtls_can_hibernate())
+    return;
+  sctx = t_dtls_psk_server(&ep);
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_register_response_handler(cctx, t_dtls_response);
+  cs = t_dtls_psk_client(sctx, cctx, ep, "id", NULL);
+  ss = ep->sessions;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ss);
+  full = t_dtls_full;
+
+  CU_ASSERT_FATAL(coap_session_hibernate(ss));
+  CU_ASSERT_PTR_NULL(ss->tls);
+  CU_ASSERT(coap_session_is_hibernated(ss));
+
+  /* The request rehydrates the session, which answers it */
+  pdu = coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET, cs);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 7, (const uint8_t *)"missing");
+  t_dtls_responses = 0;
+  CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+  t_loopback_run(sctx, cctx, cs, &t_dtls_responses, 1);
+  CU_ASSERT(t_dtls_responses == 1);
+  CU_ASSERT_PTR_NOT_NULL(ss->tls);
+  CU_ASSERT(!coap_session_is_hibernated(ss));
+  CU_ASSERT(ss->state == COAP_SESSION_STATE_ESTABLISHED);
+  CU_ASSERT(t_dtls_full == full);
+
+  coap_session_release(cs);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+/* Test 6 checks that a DTLS cookie is accepted until the secret after
+ * the one it was made with is replaced, even if no cookies are handed out
+ * in between. */
+static void
+t_dtls6(void) {
+  coap_addr_hash_t addr_hash;
+  uint8_t cookie[COAP_DTLS_COOKIE_LENGTH];
+
+  memset(&addr_hash, 0, sizeof(addr_hash));
+  addr_hash.lport = 5684;
+  coap_dtls_cookie_generate(ctx, &addr_hash, cookie);
+  CU_ASSERT(coap_dtls_cookie_verify(ctx, &addr_hash, cookie, sizeof(cookie)));
+  cookie[0] ^= 1;
+  CU_ASSERT(!coap_dtls_cookie_verify(ctx, &addr_hash, cookie,
+                                     sizeof(cookie)));
+  cookie[0] ^= 1;
+
+  /* Still valid under the previous secret */
+  ctx->dtls_cookie_drawn -= COAP_DTLS_COOKIE_SECRET_TICKS;
+  CU_ASSERT(coap_dtls_cookie_verify(ctx, &addr_hash, cookie, sizeof(cookie)));
+  /* but not once that has been replaced as well */
+  ctx->dtls_cookie_drawn -= COAP_DTLS_COOKIE_SECRET_TICKS;
+  CU_ASSERT(!coap_dtls_cookie_verify(ctx, &addr_hash, cookie,
+                                     sizeof(cookie)));
+
+  /* Both secrets go if neither has been replaced for that long */
+  coap_dtls_cookie_generate(ctx, &addr_hash, cookie);
+  ctx->dtls_cookie_drawn -= 2 * COAP_DTLS_COOKIE_SECRET_TICKS;
+  CU_ASSERT(!coap_dtls_cookie_verify(ctx, &addr_hash, cookie,
+                                     sizeof(cookie)));
+}
+
+/* Connects a DTLS client session of cctx with identity and sni to ep, and
+ * returns whether it did a full handshake */
+static int
+t_dtls7_connect(coap_context_t *sctx, coap_context_t *cctx,
+                coap_endpoint_t *ep, const char *identity, char *sni) {
+  int full = t_dtls_full;
+
+  coap_session_release(t_dtls_psk_client(sctx, cctx, ep, identity, sni));
+  return t_dtls_full != full;
+}
+
+/* Test 7 checks that a client session only resumes the (D)TLS state of an
+ * earlier session to the same server if it has the same PSK identity and
+ * SNI, and does a full handshake otherwise. */
+static void
+t_dtls7(void) {
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  char sni[] = "localhost";
+  /* TinyDTLS does not support session resumption */
+  int resumes = coap_get_tls_library_version()->type !=
+                COAP_TLS_LIBRARY_TINYDTLS;
+
+  if (!coap_dtls_is_supported()) {
+    CU_PASS("DTLS is not supported");
+    return;
+  }
+  sctx = t_dtls_psk_server(&ep);
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+
+  CU_ASSERT(t_dtls7_connect(sctx, cctx, ep, "id", NULL));
+  CU_ASSERT(t_dtls7_connect(sctx, cctx, ep, "id", NULL) == !resumes);
+  /* Other credentials for the same server */
+  CU_ASSERT(t_dtls7_connect(sctx, cctx, ep, "other", NULL));
+  CU_ASSERT(t_dtls7_connect(sctx, cctx, ep, "id", sni));
+  CU_ASSERT(HASH_COUNT(cctx->tls_resume) == (resumes ? 3U : 0U));
+
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+/* Test 8 checks that a datagram too short to hold a DTLS record is dropped
+ * and leaves the session as it was. */
+static void
+t_dtls8(void) {
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_session_t *cs;
+  coap_session_t *ss;
+  const uint8_t junk[] = { 0x17, 0xfe, 0xfd };
+  size_t i;
+
+  if (coap_get_tls_library_version()->type != COAP_TLS_LIBRARY_OPENSSL) {
+    CU_PASS("not OpenSSL");
+    return;
+  }
+  sctx = t_dtls_psk_server(&ep);
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  cs = t_dtls_psk_client(sctx, cctx, ep, "id", NULL);
+  ss = ep->sessions;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ss);
+
+  for (i = 1; i <= sizeof(junk); i++) {
+    CU_ASSERT(coap_dtls_receive(ss, junk, i) == 0);
+    CU_ASSERT(ss->state == COAP_SESSION_STATE_ESTABLISHED);
+  }
+
+  coap_session_release(cs);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+static int
+t_dtls_tests_create(void) {
+  ctx = coap_new_context(NULL);
+  return ctx == NULL;
+}
+
+static int
+t_dtls_tests_remove(void) {
+  coap_free_context(ctx);
+  return 0;
+}
+
+CU_pSuite
+t_init_dtls_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("dtls",
+                       t_dtls_tests_create, t_dtls_tests_remove);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add dtls test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define DTLS_TEST(s,t)                                                 \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add dtls test (%s)\n",                 \
+            CU_get_error_msg());                                      \
+  }
+
+  DTLS_TEST(suite, t_dtls1);
+  DTLS_TEST(suite, t_dtls2);
+  DTLS_TEST(suite, t_dtls3);
+  DTLS_TEST(suite, t_dtls4);
+  DTLS_TEST(suite, t_dtls5);
+  DTLS_TEST(suite, t_dtls6);
+  DTLS_TEST(suite, t_dtls7);
+  DTLS_TEST(suite, t_dtls8);
+
+  return suite;
+}
@@ -0,0 +1,83 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+
+#include <CUnit/CUnit.h>
+
+void
+t_loopback_address(coap_address_t *addr, uint16_t port) {
+  coap_address_init(addr);
+  addr->size = sizeof(struct sockaddr_in6);
+  addr->addr.sin6.sin6_family = AF_INET6;
+  addr->addr.sin6.sin6_addr = in6addr_loopback;
+  addr->addr.sin6.sin6_port = htons(port);
+}
+
+coap_endpoint_t *
+t_loopback_endpoint(coap_context_t *context, coap_proto_t proto) {
+  coap_address_t laddr;
+
+  t_loopback_address(&laddr, 0);
+  return coap_new_endpoint(context, &laddr, proto);
+}
+
+coap_packet_t *
+t_loopback_packet(coap_endpoint_t *ep, uint16_t port) {
+  coap_packet_t *packet = coap_malloc(sizeof(coap_packet_t));
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(packet);
+  memset(packet, 0, sizeof(coap_packet_t));
+  coap_address_copy(&packet->addr_info.local, &ep->bind_addr);
+  t_loopback_address(&packet->addr_info.remote, port);
+  return packet;
+}
+
+coap_session_t *
+t_loopback_peer(coap_endpoint_t *ep, uint16_t port) {
+  coap_packet_t *packet = t_loopback_packet(ep, port);
+  coap_session_t *s;
+  coap_tick_t now;
+
+  coap_ticks(&now);
+  s = coap_endpoint_get_session(ep, packet, now);
+  coap_free(packet);
+  return s;
+}
+
+void
+t_loopback_run(coap_context_t *sctx, coap_context_t *cctx,
+               coap_session_t *s, const int *count, int target) {
+  coap_tick_t start, now;
+
+  coap_ticks(&start);
+  do {
+    coap_io_process(cctx, COAP_IO_NO_WAIT);
+    coap_io_process(sctx, COAP_IO_NO_WAIT);
+    coap_ticks(&now);
+  } while ((count ? *count < target :
+            s->state != COAP_SESSION_STATE_ESTABLISHED) &&
+           now - start < 5 * COAP_TICKS_PER_SECOND);
+}
+
+int
+t_queued_responses(coap_session_t *s, coap_pdu_code_t code) {
+  coap_queue_t *node;
+  int count = 0;
+
+  for (node = s->context->sendqueue; node; node = node->next) {
+    if (node->session == s && node->pdu->code == code)
+      count++;
+  }
+  for (node = s->delayqueue; node; node = node->next) {
+    if (node->pdu->code == code)
+      count++;
+  }
+  return count;
+}
@@ -0,0 +1,36 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/* Helpers for the tests that talk to themselves over the loopback
+ * interface.  Include after test_common.h. */
+
+/* Sets addr to the IPv6 loopback address with port */
+void t_loopback_address(coap_address_t *addr, uint16_t port);
+
+/* Returns a new endpoint of context for proto on an ephemeral loopback
+ * port */
+coap_endpoint_t *t_loopback_endpoint(coap_context_t *context,
+                                     coap_proto_t proto);
+
+/* Returns a new empty packet as received by ep from port on the loopback
+ * address, which is to be released with coap_free() */
+coap_packet_t *t_loopback_packet(coap_endpoint_t *ep, uint16_t port);
+
+/* Returns the server session of ep for the peer at port on the loopback
+ * address */
+coap_session_t *t_loopback_peer(coap_endpoint_t *ep, uint16_t port);
+
+/* Runs the I/O of the client context cctx and the server context sctx until
+ * *count reaches target, or until s is established if count is NULL, for at
+ * most 5 seconds */
+void t_loopback_run(coap_context_t *sctx, coap_context_t *cctx,
+                    coap_session_t *s, const int *count, int target);
+
+/* Returns the number of responses with code that have been sent, or are
+ * waiting to be sent, as CON on s */
+int t_queued_responses(coap_session_t *s, coap_pdu_code_t code);
@@ -1197,6 +1197,35 @@ t_encode_pdu21(void) {
   CU_ASSERT(memcmp(pdu->token, data3, pdu->used_size) == 0);
 }
 
+/* Insert an option before one whose value has an extended length */
+static void
+t_encode_pdu22(void) {
+  uint8_t  hop_limit = 16;
+  uint8_t  block1 = 0x0e;
+  const char uri[] = "coap://localhost:5684/example_data1";
+  uint8_t  data1[] = { 0xd1, 0x03, 0x10, 0xdd, 0x06, 0x16 };
+  uint8_t  data2[] = { 0xd1, 0x03, 0x10, 0xb1, 0x0e, 0x8d, 0x16 };
+  coap_opt_iterator_t opt_iter;
+  size_t result;
+
+  coap_pdu_clear(pdu, pdu->max_size);        /* clear PDU */
+
+  coap_add_option(pdu, COAP_OPTION_HOP_LIMIT, 1, &hop_limit);
+  coap_add_option(pdu, COAP_OPTION_PROXY_URI, sizeof(uri) - 1,
+                  (const uint8_t *)uri);
+  CU_ASSERT(pdu->used_size == sizeof(data1) + sizeof(uri) - 1);
+  CU_ASSERT(memcmp(pdu->token, data1, sizeof(data1)) == 0);
+
+  /* The Proxy-Uri delta shrinks to fit in the first byte */
+  result = coap_insert_option(pdu, COAP_OPTION_BLOCK1, 1, &block1);
+  CU_ASSERT(result == 2);
+  CU_ASSERT(pdu->used_size == sizeof(data2) + sizeof(uri) - 1);
+  CU_ASSERT(memcmp(pdu->token, data2, sizeof(data2)) == 0);
+  CU_ASSERT(memcmp(pdu->token + sizeof(data2), uri, sizeof(uri) - 1) == 0);
+  CU_ASSERT_PTR_NOT_NULL(coap_check_option(pdu, COAP_OPTION_PROXY_URI,
+                                           &opt_iter));
+}
+
 static int
 t_pdu_tests_create(void) {
   pdu = coap_pdu_init(0, 0, 0, COAP_DEFAULT_MTU);
@@ -1274,6 +1303,7 @@ t_init_pdu_tests(void) {
     PDU_ENCODER_TEST(suite[1], t_encode_pdu19);
     PDU_ENCODER_TEST(suite[1], t_encode_pdu20);
     PDU_ENCODER_TEST(suite[1], t_encode_pdu21);
+    PDU_ENCODER_TEST(suite[1], t_encode_pdu22);
 
   } else                         /* signal error */
     fprintf(stderr, "W: cannot add pdu parser test suite (%s)\n",
@@ -0,0 +1,201 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+#include "test_proxy.h"
+
+#include <stdio.h>
+
+static coap_context_t *ctx; /* Holds the coap context for the tests */
+
+static coap_pdu_t *
+t_proxy_request(coap_mid_t mid, const char *proxy_uri) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  mid, 128);
+
+  if (pdu) {
+    coap_add_token(pdu, 2, (const uint8_t *)&mid);
+    if (proxy_uri)
+      coap_add_option(pdu, COAP_OPTION_PROXY_URI, strlen(proxy_uri),
+                      (const uint8_t *)proxy_uri);
+  }
+  return pdu;
+}
+
+/* Forwards request and returns the code the handler's response is left
+ * with, which is 0 if the request was forwarded */
+static coap_pdu_code_t
+t_proxy_forward(coap_session_t *s, coap_resource_t *r, coap_pdu_t *request) {
+  coap_pdu_t *response = coap_pdu_init(COAP_MESSAGE_ACK, 0, request->mid, 128);
+  coap_pdu_code_t code;
+  int forwarded;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(response);
+  forwarded = coap_proxy_forward_request(s, request, response, r);
+  code = response->code;
+  CU_ASSERT(forwarded == (code == 0));
+  coap_delete_pdu(response);
+  coap_delete_pdu(request);
+  return code;
+}
+
+/* Passes a response with code to the request in flight on upstream as if
+ * it had been received from the upstream server */
+static coap_response_t
+t_proxy_respond(coap_proxy_upstream_t *upstream, coap_pdu_code_t code) {
+  coap_proxy_req_t *req = upstream->reqs;
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_ACK, code, 0, 64);
+  uint8_t token[8];
+  coap_response_t ret;
+  size_t i;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(req);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  for (i = 0; i < req->token_length; i++)
+    token[req->token_length - 1 - i] = (uint8_t)(req->token >> (8 * i));
+  coap_add_token(pdu, req->token_length, token);
+  coap_add_data(pdu, 5, (const uint8_t *)"hello");
+  ret = coap_proxy_handle_response(upstream->session, pdu);
+  coap_delete_pdu(pdu);
+  return ret;
+}
+
+/* Test 1 checks the forward proxy: requests that cannot be forwarded are
+ * answered with an error, requests to the same server share one upstream
+ * session, identical requests are collapsed, and the in-flight and queue
+ * limits are applied. */
+static void
+t_proxy1(void) {
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_proxy_upstream_t *upstream;
+  const char *host_names[] = { "proxy" };
+
+  if (!coap_proxy_is_supported()) {
+    CU_PASS("forward proxy not supported");
+    return;
+  }
+  r = coap_resource_proxy_uri_init(NULL, 1, host_names);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+  coap_add_resource(ctx, r);
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s = t_loopback_peer(ep, 30015);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  /* Neither Proxy-Uri nor Proxy-Scheme */
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5001, NULL)) ==
+            COAP_RESPONSE_CODE_NOT_FOUND);
+  /* A scheme that cannot be forwarded to */
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5002,
+                                                  "http://example.com/")) ==
+            COAP_RESPONSE_CODE_PROXYING_NOT_SUPPORTED);
+  CU_ASSERT_PTR_NULL(ctx->proxy_upstreams);
+
+  coap_context_set_proxy_limits(ctx, 1, 1);
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5003,
+                                                  "coap://[::1]:30016/a")) ==
+            0);
+  CU_ASSERT(HASH_COUNT(ctx->proxy_upstreams) == 1);
+  upstream = ctx->proxy_upstreams;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(upstream->session);
+  /* Only the upstream session has proxy state */
+  CU_ASSERT_PTR_NOT_NULL_FATAL(upstream->session->proxy);
+  CU_ASSERT(upstream->session->proxy->upstream == upstream);
+  CU_ASSERT_PTR_NULL(s->proxy);
+  CU_ASSERT(upstream->inflight == 1);
+  CU_ASSERT(upstream->queued == 0);
+
+  /* An identical request is collapsed into the one in flight */
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5013,
+                                                  "coap://[::1]:30016/a")) ==
+            0);
+  CU_ASSERT(upstream->inflight == 1);
+  CU_ASSERT(upstream->queued == 0);
+  CU_ASSERT(HASH_CNT(ch, ctx->proxy_collapse) == 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(upstream->reqs);
+  CU_ASSERT_PTR_NOT_NULL(upstream->reqs->followers);
+
+  /* The same server is reached over the same upstream session, and the
+   * second request waits for the first */
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5004,
+                                                  "coap://[::1]:30016/b")) ==
+            0);
+  CU_ASSERT(HASH_COUNT(ctx->proxy_upstreams) == 1);
+  CU_ASSERT(upstream->inflight == 1);
+  CU_ASSERT(upstream->queued == 1);
+
+  /* and once the queue is full, requests are turned away */
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5005,
+                                                  "coap://[::1]:30016/c")) ==
+            COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE);
+
+  /* The response to the request in flight is passed back to both clients,
+   * and the queued request is sent */
+  CU_ASSERT(t_proxy_respond(upstream, COAP_RESPONSE_CODE_CONTENT) ==
+            COAP_RESPONSE_OK);
+  CU_ASSERT(t_queued_responses(s, COAP_RESPONSE_CODE_CONTENT) == 2);
+  CU_ASSERT(upstream->inflight == 1);
+  CU_ASSERT(upstream->queued == 0);
+  CU_ASSERT(HASH_CNT(ch, ctx->proxy_collapse) == 1);
+  CU_ASSERT_PTR_NULL(upstream->reqs->followers);
+
+  /* A different port is a different upstream */
+  CU_ASSERT(t_proxy_forward(s, r, t_proxy_request(0x5006,
+                                                  "coap://[::1]:30017/a")) ==
+            0);
+  CU_ASSERT(HASH_COUNT(ctx->proxy_upstreams) == 2);
+
+  coap_proxy_free_all(ctx);
+  CU_ASSERT_PTR_NULL(ctx->proxy_upstreams);
+  CU_ASSERT_PTR_NULL(ctx->proxy_reqs);
+  CU_ASSERT_PTR_NULL(ctx->proxy_collapse);
+  coap_cancel_session_messages(ctx, s, COAP_NACK_RST);
+  coap_context_set_proxy_limits(ctx, 0, 0);
+  coap_delete_resource(ctx, r);
+  coap_free_endpoint(ep);
+}
+
+static int
+t_proxy_tests_create(void) {
+  ctx = coap_new_context(NULL);
+  return ctx == NULL;
+}
+
+static int
+t_proxy_tests_remove(void) {
+  coap_free_context(ctx);
+  return 0;
+}
+
+CU_pSuite
+t_init_proxy_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("proxy",
+                       t_proxy_tests_create, t_proxy_tests_remove);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add proxy test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define PROXY_TEST(s,t)                                                \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add proxy test (%s)\n",                \
+            CU_get_error_msg());                                      \
+  }
+
+  PROXY_TEST(suite, t_proxy1);
+
+  return suite;
+}
@@ -7,6 +7,7 @@
  */
 
 #include "test_common.h"
+#include "test_loopback.h"
 #include "test_session.h"
 
 #include <stdio.h>
@@ -159,9 +160,299 @@ t_session6(void) {
   CU_ASSERT_PTR_NOT_NULL(session);
   CU_ASSERT_PTR_NOT_NULL(ctx->sessions);
   CU_ASSERT(session->state == COAP_SESSION_STATE_ESTABLISHED);
+  /* No reliable transport or PSK state is carried by a UDP session */
+  CU_ASSERT_PTR_NULL(session->tcp);
+  CU_ASSERT_PTR_NULL(session->psk);
   coap_session_release(session);
 }
 
+/* Test 7 checks that idle server sessions on an endpoint are counted
+ * and that the least recently used one is evicted when the limit set
+ * by coap_context_set_max_idle_sessions() is reached. */
+static void
+t_session7(void) {
+  coap_endpoint_t *ep;
+  coap_packet_t *packet;
+  coap_session_t *s[3];
+  coap_tick_t now = 1000;
+  size_t i;
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  packet = t_loopback_packet(ep, 30000);
+  coap_context_set_max_idle_sessions(ctx, 2);
+
+  for (i = 0; i < 3; i++) {
+    packet->addr_info.remote.addr.sin6.sin6_port = htons(30000 + i);
+    s[i] = coap_endpoint_get_session(ep, packet, now++);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(s[i]);
+    if (i == 1) {
+      /* Touching the first session makes the second one the oldest */
+      packet->addr_info.remote.addr.sin6.sin6_port = htons(30000);
+      CU_ASSERT_PTR_EQUAL(coap_endpoint_get_session(ep, packet, now++), s[0]);
+    }
+  }
+  /* s[1] has been evicted to make room for s[2] */
+  CU_ASSERT(ep->num_idle == 2);
+  CU_ASSERT_PTR_EQUAL(ep->idle_sessions, s[0]);
+  CU_ASSERT_PTR_EQUAL(ep->idle_sessions->idle_next, s[2]);
+  CU_ASSERT(HASH_COUNT(ep->sessions) == 2);
+
+  /* A referenced session is not idle */
+  coap_session_reference(s[0]);
+  CU_ASSERT(ep->num_idle == 1);
+  CU_ASSERT_PTR_EQUAL(ep->idle_sessions, s[2]);
+  coap_session_release(s[0]);
+  CU_ASSERT(ep->num_idle == 2);
+  CU_ASSERT_PTR_EQUAL(ep->idle_sessions, s[2]);
+
+  coap_context_set_max_idle_sessions(ctx, 0);
+  coap_free(packet);
+  coap_free_endpoint(ep);
+}
+
+/* Test 8 checks that requests from unknown peers use the endpoint's
+ * transient session when stateless UDP is enabled, and that the
+ * transient session only becomes a server session when referenced. */
+static void
+t_session8(void) {
+  coap_endpoint_t *ep;
+  coap_packet_t *packet;
+  coap_session_t *s1, *s2;
+  coap_tick_t now = 1000;
+
+  ep = t_loopback_endpoint(ctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  packet = t_loopback_packet(ep, 30000);
+  coap_context_set_stateless_udp(ctx, 1);
+  CU_ASSERT(coap_context_get_stateless_udp(ctx) == 1);
+
+  packet->addr_info.remote.addr.sin6.sin6_port = htons(30000);
+  s1 = coap_endpoint_get_session(ep, packet, now++);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s1);
+  CU_ASSERT_PTR_EQUAL(s1, ep->transient);
+  CU_ASSERT(s1->state == COAP_SESSION_STATE_ESTABLISHED);
+  coap_session_check_transient(s1);
+  CU_ASSERT_PTR_NULL(ep->sessions);
+  CU_ASSERT(ep->num_idle == 0);
+
+  /* The next unknown peer re-uses the same transient session */
+  packet->addr_info.remote.addr.sin6.sin6_port = htons(30001);
+  s2 = coap_endpoint_get_session(ep, packet, now++);
+  CU_ASSERT_PTR_EQUAL(s2, s1);
+  CU_ASSERT(coap_address_get_port(&s2->addr_info.remote) == 30001);
+
+  /* Holding a reference means that the session has to be kept */
+  coap_session_reference(s2);
+  coap_session_check_transient(s2);
+  CU_ASSERT_PTR_NULL(ep->transient);
+  CU_ASSERT(HASH_COUNT(ep->sessions) == 1);
+  CU_ASSERT(s2->transient == 0);
+  coap_session_release(s2);
+  CU_ASSERT(ep->num_idle == 1);
+
+  /* and is then found for further requests from that peer */
+  CU_ASSERT_PTR_EQUAL(coap_endpoint_get_session(ep, packet, now++), s2);
+  packet->addr_info.remote.addr.sin6.sin6_port = htons(30002);
+  s1 = coap_endpoint_get_session(ep, packet, now++);
+  CU_ASSERT_PTR_NOT_NULL(s1);
+  CU_ASSERT(s1 != s2);
+  CU_ASSERT_PTR_EQUAL(s1, ep->transient);
+
+  coap_context_set_stateless_udp(ctx, 0);
+  coap_free(packet);
+  coap_free_endpoint(ep);
+}
+
+/* Test 9 checks that CoCoA RTO estimation is disabled by default and
+ * that, once enabled, acknowledged round-trip times feed the strong and
+ * weak estimators and determine the initial timeout and backoff. */
+static void
+t_session9(void) {
+  const unsigned int tps = COAP_TICKS_PER_SECOND;
+  coap_address_t saddr;
+  coap_session_t *s;
+  coap_queue_t *node;
+  coap_tick_t now;
+  unsigned int rto;
+
+  coap_address_init(&saddr);
+  saddr.size = sizeof(struct sockaddr_in6);
+  saddr.addr.sin6.sin6_family = AF_INET6;
+  saddr.addr.sin6.sin6_addr = in6addr_loopback;
+  saddr.addr.sin6.sin6_port = htons(20001);
+
+  s = coap_new_client_session(ctx, NULL, &saddr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  CU_ASSERT(coap_context_get_cocoa(ctx) == 0);
+  CU_ASSERT(coap_session_get_cocoa(s) == 0);
+
+  node = coap_new_node();
+  CU_ASSERT_PTR_NOT_NULL_FATAL(node);
+  node->id = 0x1234;
+  node->timeout = coap_calc_timeout(s, 0);
+  coap_wait_ack(ctx, s, node);
+  CU_ASSERT(node->backoff == 0);
+
+  /* Samples are ignored unless CoCoA is enabled */
+  coap_ticks(&now);
+  coap_update_rtt_estimate(s, node, now + tps / 10);
+  CU_ASSERT_PTR_NULL(s->cocoa);
+
+  coap_session_set_cocoa(s, 1);
+  CU_ASSERT(coap_session_get_cocoa(s) == 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s->cocoa);
+  CU_ASSERT(coap_calc_timeout(s, 0) == 2 * tps);
+
+  /* A strong sample of 100ms gives an RTO of 100 + 4 * 50ms */
+  coap_update_rtt_estimate(s, node, node->sent + tps / 10);
+  CU_ASSERT(s->cocoa->rtt_strong.srtt == tps / 10);
+  CU_ASSERT(s->cocoa->rtt_strong.rto == 3 * tps / 10);
+  rto = (2 * tps + 3 * tps / 10) / 2;
+  CU_ASSERT(s->cocoa->rto == rto);
+
+  /* A weak sample of 400ms gives an RTO of 400 + 1 * 200ms */
+  node->retransmit_cnt = 1;
+  coap_update_rtt_estimate(s, node, node->sent + 2 * tps / 5);
+  CU_ASSERT(s->cocoa->rtt_weak.rto == 3 * tps / 5);
+  rto = (3 * rto + 3 * tps / 5) / 4;
+  CU_ASSERT(s->cocoa->rto == rto);
+
+  /* Samples after more than 2 retransmissions are ambiguous */
+  node->retransmit_cnt = 3;
+  coap_update_rtt_estimate(s, node, node->sent + 5 * tps);
+  CU_ASSERT(s->cocoa->rto == rto);
+
+  CU_ASSERT(coap_calc_timeout(s, 0) == rto);
+  CU_ASSERT(coap_calc_timeout(s, 255) < rto + rto / 2);
+  CU_ASSERT(coap_calc_timeout(s, 255) > rto);
+  coap_delete_node(node);
+
+  /* The variable backoff factor depends on the initial timeout */
+  node = coap_new_node();
+  CU_ASSERT_PTR_NOT_NULL_FATAL(node);
+  node->id = 0x1235;
+  node->timeout = tps / 2;
+  coap_wait_ack(ctx, s, node);
+  CU_ASSERT(node->backoff == 6);
+  coap_delete_node(node);
+
+  coap_session_set_cocoa(s, 0);
+  CU_ASSERT_PTR_NULL(s->cocoa);
+  coap_session_release(s);
+
+  /* New sessions of the context use CoCoA */
+  coap_context_set_cocoa(ctx, 1);
+  CU_ASSERT(coap_context_get_cocoa(ctx) == 1);
+  s = coap_new_client_session(ctx, NULL, &saddr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  CU_ASSERT(coap_session_get_cocoa(s) == 1);
+  coap_context_set_cocoa(ctx, 0);
+  coap_session_release(s);
+}
+
+/* Test 10 checks that the number of outstanding CON messages is limited
+ * by the congestion window, which adapts between 1 and NSTART. */
+static void
+t_session10(void) {
+  coap_address_t saddr;
+  coap_endpoint_t *ep;
+  coap_session_t *s;
+  coap_queue_t node;
+  coap_queue_t *q;
+  int i, delayed = 0;
+
+  coap_address_init(&saddr);
+  saddr.size = sizeof(struct sockaddr_in6);
+  saddr.addr.sin6.sin6_family = AF_INET6;
+  saddr.addr.sin6.sin6_addr = in6addr_loopback;
+  saddr.addr.sin6.sin6_port = htons(20002);
+
+  /* The peer needs to exist for the sends not to be refused */
+  ep = coap_new_endpoint(ctx, &saddr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  s = coap_new_client_session(ctx, NULL, &saddr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  CU_ASSERT(coap_session_get_nstart(s) == COAP_DEFAULT_NSTART);
+
+  coap_session_set_nstart(s, 0);
+  CU_ASSERT(coap_session_get_nstart(s) == COAP_DEFAULT_NSTART);
+  coap_session_set_nstart(s, 256);
+  CU_ASSERT(coap_session_get_nstart(s) == COAP_DEFAULT_NSTART);
+  coap_session_set_nstart(s, 4);
+  CU_ASSERT(coap_session_get_nstart(s) == 4);
+
+  for (i = 0; i < 6; i++) {
+    coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                    coap_new_message_id(s),
+                                    coap_session_max_pdu_size(s));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+    CU_ASSERT(coap_send(s, pdu) != COAP_INVALID_MID);
+  }
+  CU_ASSERT(s->con_active == 4);
+  LL_COUNT(s->delayqueue, q, delayed);
+  CU_ASSERT(delayed == 2);
+
+  /* Loss halves the window, clean ACKs grow it back one per window */
+  memset(&node, 0, sizeof(node));
+  coap_session_cwnd_loss(s);
+  CU_ASSERT(s->cwnd == 2);
+  coap_session_cwnd_ack(s, &node);
+  CU_ASSERT(s->cwnd == 2);
+  coap_session_cwnd_ack(s, &node);
+  CU_ASSERT(s->cwnd == 3);
+  node.retransmit_cnt = 1;
+  for (i = 0; i < 3; i++)
+    coap_session_cwnd_ack(s, &node);
+  CU_ASSERT(s->cwnd == 3);
+  node.retransmit_cnt = 0;
+  for (i = 0; i < 3; i++)
+    coap_session_cwnd_ack(s, &node);
+  CU_ASSERT(s->cwnd == 4);
+  for (i = 0; i < 4; i++)
+    coap_session_cwnd_ack(s, &node);
+  CU_ASSERT(s->cwnd == 4);
+
+  coap_cancel_session_messages(ctx, s, COAP_NACK_NOT_DELIVERABLE);
+  coap_session_disconnected(s, COAP_NACK_NOT_DELIVERABLE);
+  coap_session_release(s);
+  coap_free_endpoint(ep);
+}
+
+/* Test 11 checks that a datagram received straight into the buffer of a PDU
+ * is handled in place, as a copied one is. */
+static void
+t_session11(void) {
+  uint8_t ack[] = { 0x60, 0x00, 0x12, 0x34 };
+  coap_address_t addr;
+  coap_session_t *s;
+  coap_pdu_t *pdu;
+
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in6);
+  addr.addr.sin6.sin6_family = AF_INET6;
+  addr.addr.sin6.sin6_addr = in6addr_loopback;
+  addr.addr.sin6.sin6_port = htons(20000);
+  s = coap_new_client_session(ctx, NULL, &addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  /* An empty ACK, which does not match a sent message */
+  CU_ASSERT(coap_handle_dgram(ctx, s, ack, sizeof(ack)) == 0);
+
+  pdu = coap_pdu_init(0, 0, 0, coap_session_max_pdu_size(s));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  memcpy(pdu->token - COAP_PDU_MAX_UDP_HEADER_SIZE, ack, sizeof(ack));
+  CU_ASSERT(coap_handle_dgram_pdu(ctx, s, pdu, sizeof(ack)) == 0);
+
+  /* A runt is discarded, and the PDU freed all the same */
+  pdu = coap_pdu_init(0, 0, 0, coap_session_max_pdu_size(s));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  memcpy(pdu->token - COAP_PDU_MAX_UDP_HEADER_SIZE, ack, sizeof(ack));
+  CU_ASSERT(coap_handle_dgram_pdu(ctx, s, pdu, sizeof(ack) - 1) < 0);
+
+  coap_session_release(s);
+}
+
 /* This function creates a set of nodes for testing. These nodes
  * will exist for all tests and are modified by coap_insert_node()
  * and coap_remove_from_queue().
@@ -217,6 +508,11 @@ t_init_session_tests(void) {
   SESSION_TEST(suite, t_session4);
   SESSION_TEST(suite, t_session5);
   SESSION_TEST(suite, t_session6);
+  SESSION_TEST(suite, t_session7);
+  SESSION_TEST(suite, t_session8);
+  SESSION_TEST(suite, t_session9);
+  SESSION_TEST(suite, t_session10);
+  SESSION_TEST(suite, t_session11);
 
   return suite;
 }
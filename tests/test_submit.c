@@ -0,0 +1,156 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+#include "test_submit.h"
+
+#include <stdio.h>
+#if COAP_SUBMIT_QUEUE && defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#define T_SUBMIT_THREADS 1
+#include <pthread.h>
+#else /* ! (COAP_SUBMIT_QUEUE && HAVE_PTHREAD_H && HAVE_PTHREAD_CREATE) */
+#define T_SUBMIT_THREADS 0
+#endif /* ! (COAP_SUBMIT_QUEUE && HAVE_PTHREAD_H && HAVE_PTHREAD_CREATE) */
+
+static coap_context_t *ctx; /* Holds the coap context for the tests */
+
+#if T_SUBMIT_THREADS
+#define T_SUBMIT_REQUESTS 20
+
+static int t_submit_responses;
+
+static coap_response_t
+t_submit_response(coap_context_t *context, coap_session_t *s,
+                  coap_pdu_t *sent, coap_pdu_t *received,
+                  const coap_mid_t id) {
+  (void)context;
+  (void)s;
+  (void)sent;
+  (void)id;
+  if (COAP_RESPONSE_CLASS(received->code) == 4)
+    t_submit_responses++;
+  return COAP_RESPONSE_OK;
+}
+
+static void *
+t_submit_thread(void *arg) {
+  coap_session_t *s = (coap_session_t *)arg;
+  int i;
+
+  for (i = 0; i < T_SUBMIT_REQUESTS; i++) {
+    /* Built without touching the session, so every request has MID 0 */
+    coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                    0, 64);
+    uint8_t token = (uint8_t)i;
+
+    if (!pdu || !coap_add_token(pdu, 1, &token) ||
+        !coap_add_option(pdu, COAP_OPTION_URI_PATH, 1, (const uint8_t *)"t") ||
+        !coap_submit_send(s, pdu))
+      break;
+  }
+  coap_submit_session_release(s);
+  return NULL;
+}
+#endif /* T_SUBMIT_THREADS */
+
+/* Test 1 checks that the requests submitted by another thread are sent by
+ * the I/O thread, each with its own message ID, and that the thread's
+ * release of the session comes after them. */
+static void
+t_submit1(void) {
+#if T_SUBMIT_THREADS
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_session_t *s;
+  pthread_t thread;
+  coap_tick_t start, now;
+
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_register_response_handler(cctx, t_submit_response);
+  s = coap_new_client_session(cctx, NULL, &ep->bind_addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+
+  /* Nothing can be submitted until the context has a queue */
+  CU_ASSERT(coap_context_get_submit_queue(cctx) == 0);
+  CU_ASSERT(!coap_submit_session_release(s));
+  CU_ASSERT_FATAL(coap_context_set_submit_queue(cctx, 1));
+  CU_ASSERT(coap_context_get_submit_queue(cctx) == 1);
+  CU_ASSERT_PTR_NOT_NULL(coap_submit_socket(cctx));
+
+  /* The thread's own reference, which it gives up when done */
+  coap_session_reference(s);
+  t_submit_responses = 0;
+  CU_ASSERT_FATAL(pthread_create(&thread, NULL, t_submit_thread, s) == 0);
+  coap_ticks(&start);
+  do {
+    /* Woken up by the submissions rather than waiting the full time */
+    coap_io_process(cctx, 1000);
+    coap_io_process(sctx, COAP_IO_NO_WAIT);
+    coap_ticks(&now);
+  } while (t_submit_responses < T_SUBMIT_REQUESTS &&
+           now - start < 5 * COAP_TICKS_PER_SECOND);
+  pthread_join(thread, NULL);
+  coap_io_process(cctx, COAP_IO_NO_WAIT);
+  CU_ASSERT(t_submit_responses == T_SUBMIT_REQUESTS);
+  CU_ASSERT(s->ref == 1);
+
+  CU_ASSERT(coap_context_set_submit_queue(cctx, 0));
+  CU_ASSERT_PTR_NULL(coap_submit_socket(cctx));
+  coap_session_release(s);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+#elif !COAP_SUBMIT_QUEUE
+  CU_ASSERT(!coap_context_set_submit_queue(ctx, 1));
+  CU_ASSERT(coap_context_get_submit_queue(ctx) == 0);
+#else /* COAP_SUBMIT_QUEUE && ! T_SUBMIT_THREADS */
+  CU_PASS("No threads to submit from");
+#endif /* COAP_SUBMIT_QUEUE && ! T_SUBMIT_THREADS */
+}
+
+static int
+t_submit_tests_create(void) {
+  ctx = coap_new_context(NULL);
+  return ctx == NULL;
+}
+
+static int
+t_submit_tests_remove(void) {
+  coap_free_context(ctx);
+  return 0;
+}
+
+CU_pSuite
+t_init_submit_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("submit",
+                       t_submit_tests_create, t_submit_tests_remove);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add submit test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define SUBMIT_TEST(s,t)                                               \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add submit test (%s)\n",               \
+            CU_get_error_msg());                                      \
+  }
+
+  SUBMIT_TEST(suite, t_submit1);
+
+  return suite;
+}
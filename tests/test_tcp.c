@@ -0,0 +1,246 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2021 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_loopback.h"
+#include "test_tcp.h"
+
+#include <stdio.h>
+
+static int t_tcp_responses;
+
+static coap_response_t
+t_tcp_response(coap_context_t *context, coap_session_t *s,
+               coap_pdu_t *sent, coap_pdu_t *received,
+               const coap_mid_t id) {
+  (void)context;
+  (void)s;
+  (void)sent;
+  (void)id;
+  if (COAP_RESPONSE_CLASS(received->code) == 4)
+    t_tcp_responses++;
+  return COAP_RESPONSE_OK;
+}
+
+/* Test 1 checks that what is sent on a TCP session while its context is
+ * corked is held back until the I/O is next waited for, and that it is then
+ * written out in order, on the client as well as on the server. */
+static void
+t_tcp1(void) {
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_session_t *s;
+  coap_queue_t *q;
+  int count;
+  int i;
+
+  if (!coap_tcp_is_supported()) {
+    CU_PASS("TCP is not supported");
+    return;
+  }
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_register_response_handler(cctx, t_tcp_response);
+  s = coap_new_client_session(cctx, NULL, &ep->bind_addr, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  t_tcp_responses = 0;
+  t_loopback_run(sctx, cctx, s, NULL, 0);
+  CU_ASSERT_FATAL(s->state == COAP_SESSION_STATE_ESTABLISHED);
+
+  coap_context_set_cork(cctx, 1);
+  CU_ASSERT(coap_context_get_cork(cctx) == 1);
+  for (i = 0; i < 3; i++) {
+    coap_pdu_t *pdu = coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET, s);
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+    CU_ASSERT(coap_send(s, pdu) != COAP_INVALID_MID);
+  }
+  LL_COUNT(s->delayqueue, q, count);
+  CU_ASSERT(count == 3);
+
+  /* Written out before the client waits, and answered in full */
+  t_loopback_run(sctx, cctx, s, &t_tcp_responses, 3);
+  CU_ASSERT(t_tcp_responses == 3);
+  CU_ASSERT_PTR_NULL(s->delayqueue);
+  CU_ASSERT(s->tcp->partial_write == 0);
+
+  /* Uncorked, a request is written as it is sent */
+  coap_context_set_cork(cctx, 0);
+  CU_ASSERT(coap_context_get_cork(cctx) == 0);
+  CU_ASSERT(coap_send(s, coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                      s)) != COAP_INVALID_MID);
+  CU_ASSERT_PTR_NULL(s->delayqueue);
+  t_loopback_run(sctx, cctx, s, &t_tcp_responses, 4);
+  CU_ASSERT(t_tcp_responses == 4);
+
+  /* With the server corked, its pipelined responses (which all have mid 0)
+   * are held back together and all get written out */
+  coap_context_set_cork(sctx, 1);
+  for (i = 0; i < 3; i++) {
+    coap_pdu_t *pdu = coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET, s);
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+    CU_ASSERT(coap_send(s, pdu) != COAP_INVALID_MID);
+  }
+  t_loopback_run(sctx, cctx, s, &t_tcp_responses, 7);
+  CU_ASSERT(t_tcp_responses == 7);
+  coap_context_set_cork(sctx, 0);
+
+  coap_session_release(s);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+/* Test 2 checks that pipelined TCP messages are all parsed, including
+ * one that is larger than a read and so straddles reads. */
+static void
+t_tcp2(void) {
+  static uint8_t payload[3 * COAP_RXBUFFER_SIZE];
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_session_t *s;
+  int i;
+
+  if (!coap_tcp_is_supported()) {
+    CU_PASS("TCP is not supported");
+    return;
+  }
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  coap_register_response_handler(cctx, t_tcp_response);
+  s = coap_new_client_session(cctx, NULL, &ep->bind_addr, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  t_tcp_responses = 0;
+  t_loopback_run(sctx, cctx, s, NULL, 0);
+  CU_ASSERT_FATAL(s->state == COAP_SESSION_STATE_ESTABLISHED);
+
+  /* Small requests either side of a large one, written together */
+  coap_context_set_cork(cctx, 1);
+  memset(payload, 'x', sizeof(payload));
+  for (i = 0; i < 9; i++) {
+    coap_pdu_t *pdu = coap_new_pdu(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT, s);
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+    CU_ASSERT_FATAL(coap_add_data(pdu, i == 4 ? sizeof(payload) : (size_t)i,
+                                  payload));
+    CU_ASSERT(coap_send(s, pdu) != COAP_INVALID_MID);
+  }
+  t_loopback_run(sctx, cctx, s, &t_tcp_responses, 9);
+  CU_ASSERT(t_tcp_responses == 9);
+  CU_ASSERT(s->state == COAP_SESSION_STATE_ESTABLISHED);
+
+  coap_session_release(s);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+/* Test 3 checks that a burst of new TCP connections is accepted in one
+ * go, and that a TLS session is set up once its ClientHello arrives. */
+static void
+t_tcp3(void) {
+  static const uint8_t key[] = "secret";
+  coap_context_t *sctx, *cctx;
+  coap_endpoint_t *ep;
+  coap_session_t *cs[5];
+  coap_session_t *s, *rtmp;
+  coap_dtls_cpsk_t setup_data;
+  int count = 0;
+  int i;
+
+  if (!coap_tcp_is_supported()) {
+    CU_PASS("TCP is not supported");
+    return;
+  }
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  for (i = 0; i < 5; i++) {
+    cs[i] = coap_new_client_session(cctx, NULL, &ep->bind_addr,
+                                    COAP_PROTO_TCP);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cs[i]);
+  }
+  /* Loopback connections are all queued by the time the server looks */
+  coap_io_process(sctx, COAP_IO_NO_WAIT);
+  SESSIONS_ITER(ep->sessions, s, rtmp) {
+    CU_ASSERT(coap_address_equals(&s->addr_info.local, &ep->bind_addr));
+    count++;
+  }
+  CU_ASSERT(count == 5);
+  t_loopback_run(sctx, cctx, cs[4], NULL, 0);
+  CU_ASSERT(cs[4]->state == COAP_SESSION_STATE_ESTABLISHED);
+  for (i = 0; i < 5; i++)
+    coap_session_release(cs[i]);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+
+  if (!coap_tls_is_supported())
+    return;
+  sctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(sctx);
+  CU_ASSERT_FATAL(coap_context_set_psk(sctx, "hint", key, sizeof(key) - 1));
+  ep = t_loopback_endpoint(sctx, COAP_PROTO_TLS);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  cctx = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cctx);
+  memset(&setup_data, 0, sizeof(setup_data));
+  setup_data.version = COAP_DTLS_CPSK_SETUP_VERSION;
+  setup_data.psk_info.identity.s = (const uint8_t *)"id";
+  setup_data.psk_info.identity.length = 2;
+  setup_data.psk_info.key.s = key;
+  setup_data.psk_info.key.length = sizeof(key) - 1;
+  cs[0] = coap_new_client_session_psk2(cctx, NULL, &ep->bind_addr,
+                                       COAP_PROTO_TLS, &setup_data);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cs[0]);
+  t_loopback_run(sctx, cctx, cs[0], NULL, 0);
+  CU_ASSERT(cs[0]->state == COAP_SESSION_STATE_ESTABLISHED);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep->sessions);
+  CU_ASSERT_PTR_NOT_NULL(ep->sessions->tls);
+  coap_session_release(cs[0]);
+  coap_free_context(cctx);
+  coap_free_context(sctx);
+}
+
+CU_pSuite
+t_init_tcp_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("tcp", NULL, NULL);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add tcp test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define TCP_TEST(s,t)                                                  \
+  if (!CU_ADD_TEST(s,t)) {                                              \
+    fprintf(stderr, "W: cannot add tcp test (%s)\n",                  \
+            CU_get_error_msg());                                      \
+  }
+
+  TCP_TEST(suite, t_tcp1);
+  TCP_TEST(suite, t_tcp2);
+  TCP_TEST(suite, t_tcp3);
+
+  return suite;
+}
@@ -10,6 +10,13 @@
 #include "test_pdu.h"
 #include "test_error_response.h"
 #include "test_session.h"
+#include "test_block.h"
+#include "test_cache.h"
+#include "test_proxy.h"
+#include "test_async.h"
+#include "test_dtls.h"
+#include "test_tcp.h"
+#include "test_submit.h"
 #include "test_sendqueue.h"
 #include "test_wellknown.h"
 #include "test_tls.h"
@@ -31,6 +38,13 @@ main(int argc COAP_UNUSED, char **argv COAP_UNUSED) {
   t_init_pdu_tests();
   t_init_error_response_tests();
   t_init_session_tests();
+  t_init_block_tests();
+  t_init_cache_tests();
+  t_init_proxy_tests();
+  t_init_async_tests();
+  t_init_dtls_tests();
+  t_init_tcp_tests();
+  t_init_submit_tests();
   t_init_sendqueue_tests();
   t_init_wellknown_tests();
   t_init_tls_tests();